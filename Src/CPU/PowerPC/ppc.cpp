@@ -287,6 +287,18 @@ typedef struct {
 static PPC_REGS ppc;
 static UINT32 ppc_rotate_mask[32][32];
 
+// Non-zero for each 4 KB page that holds translated or pre-decoded code (see ppc_jit.c and ppc_cached.c).
+// Stores only look it up while a core that keeps such code is selected.
+static UINT8 ppc_code_page[0x100000];
+static bool ppc_code_tracked = false;
+static void ppc_invalidate_code_page(UINT32 address, UINT32 length);
+
+// Page table for direct memory accesses. Points to an empty table when none is
+// set so that the load/store ops need no extra test.
+static PPC_PAGE_TABLE ppc_no_pages;
+static PPC_PAGE_TABLE *ppc_pages = &ppc_no_pages;
+static PPC_PAGE_TABLE *ppc_user_pages = NULL;	// table set by ppc_set_page_table()
+
 static void ppc_change_pc(UINT32 newpc)
 {
 	UINT i;
@@ -317,43 +329,127 @@ static void ppc_change_pc(UINT32 newpc)
 	ppc.fatalError = true;
 }
 
+#define PPC_PAGE_OFFSET(address)	((address) & ((1 << PPC_PAGE_SHIFT) - 1))
+
 inline UINT8 READ8(UINT32 address)
 {
+	const UINT8 *page = ppc_pages->read[address >> PPC_PAGE_SHIFT];
+	if (page != NULL)
+		return page[PPC_PAGE_OFFSET(address) ^ 3];
+
 	return Bus->Read8(address);
 }
 
 inline UINT16 READ16(UINT32 address)
 {
+	const UINT8 *page = ppc_pages->read[address >> PPC_PAGE_SHIFT];
+	if (page != NULL && !(address & 1))
+		return *(const UINT16 *) &page[PPC_PAGE_OFFSET(address) ^ 2];
+
 	return Bus->Read16(address);
 }
 
 inline UINT32 READ32(UINT32 address)
 {
+	const UINT8 *page = ppc_pages->read[address >> PPC_PAGE_SHIFT];
+	if (page != NULL && !(address & 3))
+		return *(const UINT32 *) &page[PPC_PAGE_OFFSET(address)];
+
 	return Bus->Read32(address);
 }
 
 inline UINT64 READ64(UINT32 address)
 {
+	const UINT8 *page = ppc_pages->read[address >> PPC_PAGE_SHIFT];
+	if (page != NULL && !(address & 7))
+	{
+		const UINT32 *p = (const UINT32 *) &page[PPC_PAGE_OFFSET(address)];
+		return ((UINT64) p[0] << 32) | p[1];
+	}
+
 	return Bus->Read64(address);
 }
 
 inline void WRITE8(UINT32 address, UINT8 data)
 {
+	if (ppc_code_tracked && ppc_code_page[address >> 12])
+		ppc_invalidate_code_page(address, 1);
+
+	UINT8 *page = ppc_pages->write[address >> PPC_PAGE_SHIFT];
+	if (page != NULL)
+	{
+		page[PPC_PAGE_OFFSET(address) ^ 3] = data;
+		return;
+	}
+
 	Bus->Write8(address,data);
 }
 
 inline void WRITE16(UINT32 address, UINT16 data)
 {
+	if (ppc_code_tracked && ppc_code_page[address >> 12])
+		ppc_invalidate_code_page(address, 2);
+
+	UINT8 *page = ppc_pages->write[address >> PPC_PAGE_SHIFT];
+	if (page != NULL && !(address & 1))
+	{
+		*(UINT16 *) &page[PPC_PAGE_OFFSET(address) ^ 2] = data;
+		return;
+	}
+
 	Bus->Write16(address,data);
 }
 
 inline void WRITE32(UINT32 address, UINT32 data)
 {
+	if (ppc_code_tracked && ppc_code_page[address >> 12])
+		ppc_invalidate_code_page(address, 4);
+
+	if (!(address & 3))
+	{
+		UINT8 *page = ppc_pages->write[address >> PPC_PAGE_SHIFT];
+		if (page != NULL)
+		{
+			*(UINT32 *) &page[PPC_PAGE_OFFSET(address)] = data;
+			return;
+		}
+
+		PPC_WRITE32_HANDLER handler = ppc_pages->write32[address >> PPC_PAGE_SHIFT];
+		if (handler != NULL)
+		{
+			handler(ppc_pages->context, address, data);
+			return;
+		}
+	}
+
 	Bus->Write32(address,data);
 }
 
 inline void WRITE64(UINT32 address, UINT64 data)
 {
+	if (ppc_code_tracked && ppc_code_page[address >> 12])
+		ppc_invalidate_code_page(address, 8);
+
+	if (!(address & 7))
+	{
+		UINT8 *page = ppc_pages->write[address >> PPC_PAGE_SHIFT];
+		if (page != NULL)
+		{
+			UINT32 *p = (UINT32 *) &page[PPC_PAGE_OFFSET(address)];
+			p[0] = (UINT32) (data >> 32);
+			p[1] = (UINT32) data;
+			return;
+		}
+
+		PPC_WRITE32_HANDLER handler = ppc_pages->write32[address >> PPC_PAGE_SHIFT];
+		if (handler != NULL)
+		{
+			handler(ppc_pages->context, address + 0, (UINT32) (data >> 32));
+			handler(ppc_pages->context, address + 4, (UINT32) data);
+			return;
+		}
+	}
+
 	Bus->Write64(address,data);
 }
 
@@ -667,6 +763,30 @@ static void (* optable59[1024])(UINT32);
 static void (* optable63[1024])(UINT32);
 static void (* optable[64])(UINT32);
 
+#include "ppc_idle.c"
+#include "ppc_jit.c"
+#include "ppc_cached.c"
+
+/*
+ * Called on writes to pages flagged in ppc_code_page, with the written range
+ * kept within the page. Dispatches to whichever execution core owns the code.
+ */
+static void ppc_invalidate_code_page(UINT32 address, UINT32 length)
+{
+	if (ppc_core == PPC_CORE_CACHED)
+		ppc_cached_invalidate(address, length);
+	else
+		ppc_jit_invalidate_page(address);
+}
+
+// Discards all translated and pre-decoded code
+static void ppc_flush_code_cache(void)
+{
+	ppc_jit_flush();
+	ppc_cached_flush();
+	ppc_idle_flush();
+}
+
 #include "ppc603.c"
 
 /********************************************************************/
@@ -863,7 +983,8 @@ void ppc_init(const PPC_CONFIG *config)
 
 void ppc_shutdown(void)
 {
-
+	ppc_jit_shutdown();
+	ppc_cached_shutdown();
 }
 
 void ppc_set_irq_line(int irqline)
@@ -889,11 +1010,45 @@ void ppc_set_fetch(PPC_FETCH_REGION * fetch)
 	ppc.fetch = fetch;
 }
 
+void ppc_set_page_table(PPC_PAGE_TABLE * table)
+{
+	ppc_user_pages = table;
+#ifdef SUPERMODEL_DEBUGGER
+	if (PPCDebug != NULL)	// debugger must see every access
+		return;
+#endif
+	ppc_pages = (table != NULL) ? table : &ppc_no_pages;
+}
+
 UINT64 ppc_total_cycles(void)
 {
 	return ppc.total_cycles + (UINT64)(ppc.cur_cycles - ppc.icount);
 }
 
+/*
+ * Shortens the time slice being run by ppc_execute() so that it returns at the
+ * given cycle count (or right away if that has passed). Everything counted
+ * relative to icount moves with it, so timers are unaffected. Does nothing
+ * outside of ppc_execute().
+ */
+void ppc_end_timeslice_at(UINT64 cycle)
+{
+	UINT64 now = ppc_total_cycles();
+	int keep = 0;
+	if (cycle > now)
+		keep = (cycle - now < (UINT64) ppc.icount) ? (int) (cycle - now) : ppc.icount;
+	int cut = ppc.icount - keep;
+	if (cut <= 0)
+		return;
+
+	ppc.icount -= cut;
+	ppc.cur_cycles -= cut;
+	ppc.tb_base_icount -= cut;
+	ppc.dec_base_icount -= cut;
+	if (ppc.dec_trigger_cycle != 0x7fffffff)
+		ppc.dec_trigger_cycle -= cut;
+}
+
 int ppc_get_cycles_per_sec()
 {
 	return ppc.cycles_per_second;
@@ -914,6 +1069,46 @@ int ppc_get_timer_ratio()
 	return ppc.timer_ratio;
 }
 
+void ppc_set_idle_skip(bool enable)
+{
+	ppc_idle_enabled = enable;
+	ppc_idle_flush();
+}
+
+bool ppc_set_core(PPC_CORE core)
+{
+	if (core == PPC_CORE_DYNAREC && !ppc_jit_init())
+		return false;
+	if (core == PPC_CORE_CACHED && !ppc_cached_init())
+		return false;
+
+	ppc_flush_code_cache();
+	ppc_core = core;
+	ppc_code_tracked = (core != PPC_CORE_INTERPRETER);
+	return true;
+}
+
+/*
+ * Called for writes to PowerPC memory that don't come from the PowerPC itself,
+ * such as DMA through the bus, so that translated and pre-decoded code doesn't
+ * go stale.
+ */
+void ppc_invalidate_code(UINT32 address, UINT32 length)
+{
+	if (!ppc_code_tracked || length == 0)
+		return;
+
+	UINT32 end = address + length;
+	while (address < end)
+	{
+		UINT32 next = (address | 0xFFF) + 1;
+		UINT32 stop = (next == 0 || next > end) ? end : next;
+		if (ppc_code_page[address >> 12])
+			ppc_invalidate_code_page(address, stop - address);
+		address = stop;
+	}
+}
+
 /******************************************************************************
  Supermodel Interface
 ******************************************************************************/
@@ -1075,6 +1270,9 @@ void ppc_load_state(CBlockFile *SaveState)
 	
 	SaveState->Read(ppc.fpr, sizeof(ppc.fpr));
 	SaveState->Read(ppc.sr, sizeof(ppc.sr));
+
+	// Memory has been replaced, so any translated code is stale
+	ppc_flush_code_cache();
 }
 
 UINT32 ppc_get_gpr(unsigned num)
@@ -1113,6 +1311,7 @@ void ppc_attach_debugger(Debugger::CPPCDebug *PPCDebugPtr)
 		ppc_detach_debugger();
 	PPCDebug = PPCDebugPtr;
 	Bus = PPCDebug->AttachBus(Bus);
+	ppc_pages = &ppc_no_pages;
 }
 
 void ppc_detach_debugger()
@@ -1121,6 +1320,7 @@ void ppc_detach_debugger()
 		return;
 	Bus = PPCDebug->DetachBus(); 
 	PPCDebug = NULL;
+	ppc_set_page_table(ppc_user_pages);
 }
 
 void ppc_break()
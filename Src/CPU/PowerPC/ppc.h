@@ -343,6 +343,39 @@ typedef struct
 
 } PPC_FETCH_REGION;
 
+/*
+ * Optional map of the address space in 64 KB pages, checked by the load and
+ * store ops before going through the bus. Page data uses the same layout as
+ * the fetch regions (each aligned 32-bit word byte reversed). Only aligned
+ * accesses are handled; everything else, and any page without an entry, goes
+ * to the bus.
+ */
+#define PPC_PAGE_SHIFT	16
+#define PPC_NUM_PAGES	(1 << (32 - PPC_PAGE_SHIFT))
+
+typedef void (*PPC_WRITE32_HANDLER)(void *context, UINT32 address, UINT32 data);
+
+// Returns the value of ppc_total_cycles() up to which reads of address return
+// the same value without side effects, ~0 if it stays fixed for the rest of the
+// time slice, or 0 if it may change at any time (used for idle loop detection)
+typedef UINT64 (*PPC_POLL_HANDLER)(void *context, UINT32 address);
+
+typedef struct
+{
+	UINT8				* read[PPC_NUM_PAGES];		// readable page data or NULL
+	UINT8				* write[PPC_NUM_PAGES];		// writable page data or NULL
+	PPC_WRITE32_HANDLER	write32[PPC_NUM_PAGES];		// 32/64-bit write handler for pages without write data
+	PPC_POLL_HANDLER	poll[PPC_NUM_PAGES];		// stability of reads from pages without read data, or NULL
+	void				* context;					// passed to write handlers
+
+} PPC_PAGE_TABLE;
+
+typedef enum {
+	PPC_CORE_INTERPRETER = 0,	// decode and dispatch every instruction
+	PPC_CORE_DYNAREC,			// translate basic blocks to host code (x86-64 only)
+	PPC_CORE_CACHED				// decode each instruction once and cache the result
+} PPC_CORE;
+
 
 /******************************************************************************
  Functions
@@ -355,11 +388,16 @@ extern void ppc_reset(void);
 extern void ppc_shutdown(void);
 extern void ppc_init(const PPC_CONFIG *config);		// must be called second!
 extern void ppc_set_fetch(PPC_FETCH_REGION * fetch);
+extern void ppc_set_page_table(PPC_PAGE_TABLE * table);	// NULL to send all accesses to the bus
 extern UINT64 ppc_total_cycles(void);
+extern void ppc_end_timeslice_at(UINT64 cycle);		// return from ppc_execute() early (devices scheduling events)
 extern int ppc_get_cycles_per_sec(void);
 extern int ppc_get_bus_freq_multipler(void);
 extern int ppc_get_timer_ratio(void);
 extern void ppc_set_timer_ratio(int ratio);
+extern bool ppc_set_core(PPC_CORE core);			// returns false if core is not available on this host
+extern void ppc_set_idle_skip(bool enable);			// fast-forward through idle polling loops
+extern void ppc_invalidate_code(UINT32 address, UINT32 length);	// memory written behind the PowerPC's back (DMA)
 
 // These have been added to support the new Supermodel
 extern void ppc_attach_bus(class IBus *BusPtr);		// must be called first!
@@ -214,6 +214,8 @@ static void ppc603_set_smi_line(int state)
 
 static void ppc603_check_interrupts(void)
 {
+	ppc_idle_epoch++;	// interrupt state may have changed
+
 	if (MSR & MSR_EE)
 	{
 		if (ppc.interrupt_pending != 0)
@@ -253,6 +255,8 @@ void ppc_reset(void)
 	ppc.total_cycles = 0;
 	ppc.cur_cycles = 0;
 	ppc.icount = 0;
+
+	ppc_flush_code_cache();
 }
 
 int ppc_execute(int cycles)
@@ -288,6 +292,11 @@ int ppc_execute(int cycles)
 		PPCDebug->CPUActive();
 #endif // SUPERMODEL_DEBUGGER
 
+	if (ppc_jit_active())
+		ppc_jit_execute();
+	else if (ppc_cached_active())
+		ppc_cached_execute();
+
 	while( ppc.icount > 0 && !ppc.fatalError)
 	{
 		ppc.pc = ppc.npc;
@@ -352,7 +361,7 @@ int ppc_execute(int cycles)
 	}
 	*/
 
-	int executed = cycles - ppc.icount;
+	int executed = ppc.cur_cycles - ppc.icount;	// slice may have been shortened by ppc_end_timeslice_at()
 	ppc.total_cycles += executed;
 	ppc.cur_cycles = 0;
 	ppc.icount = 0;
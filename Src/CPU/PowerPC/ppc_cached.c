@@ -0,0 +1,426 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_cached.c
+ *
+ * Cached interpreter for the PowerPC 603e. Included from ppc.cpp; do not
+ * compile separately.
+ *
+ * Each aligned word of the fetch regions is decoded once, the first time it
+ * is executed, into a PPC_DECODED entry holding an executor and its operands
+ * already extracted. Common instructions get dedicated executors; everything
+ * else goes through the regular opcode handler. Entries are kept in lazily
+ * allocated per-page tables and a store to a decoded word simply clears that
+ * entry so it is decoded again on its next execution.
+ */
+
+typedef struct PPC_DECODED
+{
+	void		(*exec)(const struct PPC_DECODED *d);	// NULL if not yet decoded
+	PPC_HANDLER	handler;	// interpreter handler
+	UINT32		op;			// raw opcode
+	UINT32		imm;		// immediate, mask, or branch target
+	UINT8		rd;			// RD/RS/CRFD field
+	UINT8		ra;
+	UINT8		rb;			// RB or shift amount
+} PPC_DECODED;
+
+#define PPC_CACHED_PAGE_SHIFT		12
+#define PPC_CACHED_NUM_PAGES		(1 << (32 - PPC_CACHED_PAGE_SHIFT))
+#define PPC_CACHED_PAGE_INSTRS		(1 << (PPC_CACHED_PAGE_SHIFT - 2))
+
+static PPC_DECODED	**decoded_pages = NULL;		// per-page decode tables, indexed by address >> 12
+
+static void ppc_cached_flush(void)
+{
+	memset(ppc_code_page, 0, sizeof(ppc_code_page));
+
+	if (decoded_pages == NULL)
+		return;
+
+	for (int i = 0; i < PPC_CACHED_NUM_PAGES; i++)
+	{
+		if (decoded_pages[i] != NULL)
+			memset(decoded_pages[i], 0, PPC_CACHED_PAGE_INSTRS * sizeof(PPC_DECODED));
+	}
+}
+
+static void ppc_cached_shutdown(void)
+{
+	if (decoded_pages == NULL)
+		return;
+
+	for (int i = 0; i < PPC_CACHED_NUM_PAGES; i++)
+		free(decoded_pages[i]);
+	free(decoded_pages);
+	decoded_pages = NULL;
+}
+
+static bool ppc_cached_init(void)
+{
+	if (decoded_pages == NULL)
+		decoded_pages = (PPC_DECODED **) calloc(PPC_CACHED_NUM_PAGES, sizeof(PPC_DECODED *));
+	return decoded_pages != NULL;
+}
+
+/*
+ * ppc_cached_invalidate():
+ *
+ * Discards the decoded entries overlapping a write of length bytes within one
+ * page, whether it is a store or a DMA transfer. Unlike translated blocks,
+ * entries are independent of each other, so only the written words need to be
+ * decoded again.
+ */
+static void ppc_cached_invalidate(UINT32 address, UINT32 length)
+{
+	PPC_DECODED *page = decoded_pages[address >> PPC_CACHED_PAGE_SHIFT];
+	UINT32 first = (address >> 2) & (PPC_CACHED_PAGE_INSTRS - 1);
+	UINT32 last = first + (((address & 3) + length - 1) >> 2);
+
+	if (page == NULL)
+		return;
+
+	if (last >= PPC_CACHED_PAGE_INSTRS)
+		last = PPC_CACHED_PAGE_INSTRS - 1;
+	for (UINT32 idx = first; idx <= last; idx++)
+		page[idx].exec = NULL;
+}
+
+
+/******************************************************************************
+ Executors
+******************************************************************************/
+
+static void ppc_exec_generic(const PPC_DECODED *d)
+{
+	d->handler(d->op);
+}
+
+static void ppc_exec_li(const PPC_DECODED *d)
+{
+	REG(d->rd) = d->imm;
+}
+
+static void ppc_exec_addi(const PPC_DECODED *d)
+{
+	REG(d->rd) = REG(d->ra) + d->imm;
+}
+
+static void ppc_exec_ori(const PPC_DECODED *d)
+{
+	REG(d->ra) = REG(d->rd) | d->imm;
+}
+
+static void ppc_exec_xori(const PPC_DECODED *d)
+{
+	REG(d->ra) = REG(d->rd) ^ d->imm;
+}
+
+static void ppc_exec_rlwinm(const PPC_DECODED *d)
+{
+	UINT32 rs = REG(d->rd);
+	REG(d->ra) = ((rs << d->rb) | (rs >> ((32 - d->rb) & 31))) & d->imm;
+}
+
+static void ppc_exec_add(const PPC_DECODED *d)
+{
+	REG(d->rd) = REG(d->ra) + REG(d->rb);
+}
+
+static void ppc_exec_subf(const PPC_DECODED *d)
+{
+	REG(d->rd) = REG(d->rb) - REG(d->ra);
+}
+
+static void ppc_exec_and(const PPC_DECODED *d)
+{
+	REG(d->ra) = REG(d->rd) & REG(d->rb);
+}
+
+static void ppc_exec_or(const PPC_DECODED *d)
+{
+	REG(d->ra) = REG(d->rd) | REG(d->rb);
+}
+
+static void ppc_exec_xor(const PPC_DECODED *d)
+{
+	REG(d->ra) = REG(d->rd) ^ REG(d->rb);
+}
+
+static inline void ppc_set_cr_compare(int n, int lt, int gt)
+{
+	CR(n) = lt ? 0x8 : (gt ? 0x4 : 0x2);
+	if (XER & XER_SO)
+		CR(n) |= 0x1;
+}
+
+static void ppc_exec_cmpi(const PPC_DECODED *d)
+{
+	INT32 a = (INT32) REG(d->ra);
+	INT32 b = (INT32) d->imm;
+	ppc_set_cr_compare(d->rd, a < b, a > b);
+}
+
+static void ppc_exec_cmpli(const PPC_DECODED *d)
+{
+	UINT32 a = REG(d->ra);
+	ppc_set_cr_compare(d->rd, a < d->imm, a > d->imm);
+}
+
+static void ppc_exec_cmp(const PPC_DECODED *d)
+{
+	INT32 a = (INT32) REG(d->ra);
+	INT32 b = (INT32) REG(d->rb);
+	ppc_set_cr_compare(d->rd, a < b, a > b);
+}
+
+static void ppc_exec_cmpl(const PPC_DECODED *d)
+{
+	UINT32 a = REG(d->ra);
+	UINT32 b = REG(d->rb);
+	ppc_set_cr_compare(d->rd, a < b, a > b);
+}
+
+static void ppc_exec_lwz(const PPC_DECODED *d)
+{
+	REG(d->rd) = READ32(REG(d->ra) + d->imm);
+}
+
+static void ppc_exec_lhz(const PPC_DECODED *d)
+{
+	REG(d->rd) = (UINT32) READ16(REG(d->ra) + d->imm);
+}
+
+static void ppc_exec_lbz(const PPC_DECODED *d)
+{
+	REG(d->rd) = (UINT32) READ8(REG(d->ra) + d->imm);
+}
+
+static void ppc_exec_stw(const PPC_DECODED *d)
+{
+	WRITE32(REG(d->ra) + d->imm, REG(d->rd));
+}
+
+static void ppc_exec_sth(const PPC_DECODED *d)
+{
+	WRITE16(REG(d->ra) + d->imm, (UINT16) REG(d->rd));
+}
+
+static void ppc_exec_stb(const PPC_DECODED *d)
+{
+	WRITE8(REG(d->ra) + d->imm, (UINT8) REG(d->rd));
+}
+
+static void ppc_exec_b(const PPC_DECODED *d)
+{
+	ppc.npc = d->imm;
+	ppc_idle_check(d->imm);
+}
+
+static void ppc_exec_bl(const PPC_DECODED *d)
+{
+	LR = ppc.pc + 4;
+	ppc.npc = d->imm;
+}
+
+
+/******************************************************************************
+ Decoder
+******************************************************************************/
+
+static void ppc_cached_decode(PPC_DECODED *d, UINT32 pc, UINT32 op)
+{
+	d->handler = ppc_get_handler(op);
+	d->op = op;
+	d->imm = 0;
+	d->rd = RD;
+	d->ra = RA;
+	d->rb = RB;
+	d->exec = ppc_exec_generic;
+
+	switch (op >> 26)
+	{
+		case 10:	// cmpli
+			d->rd = CRFD;
+			d->imm = UIMM16;
+			d->exec = ppc_exec_cmpli;
+			break;
+		case 11:	// cmpi
+			d->rd = CRFD;
+			d->imm = SIMM16;
+			d->exec = ppc_exec_cmpi;
+			break;
+		case 14:	// addi
+			d->imm = SIMM16;
+			d->exec = RA ? ppc_exec_addi : ppc_exec_li;
+			break;
+		case 15:	// addis
+			d->imm = UIMM16 << 16;
+			d->exec = RA ? ppc_exec_addi : ppc_exec_li;
+			break;
+		case 18:	// bx
+		{
+			INT32 li = op & 0x3fffffc;
+			if (li & 0x2000000)
+				li |= 0xfc000000;
+			d->imm = AABIT ? li : pc + li;
+			d->exec = LKBIT ? ppc_exec_bl : ppc_exec_b;
+			break;
+		}
+		case 21:	// rlwinmx
+			if (!RCBIT)
+			{
+				d->imm = GET_ROTATE_MASK(MB, ME);
+				d->rb = SH;
+				d->exec = ppc_exec_rlwinm;
+			}
+			break;
+		case 24:	// ori
+		case 25:	// oris
+			d->imm = (op >> 26) == 25 ? (UIMM16 << 16) : UIMM16;
+			d->exec = ppc_exec_ori;
+			break;
+		case 26:	// xori
+		case 27:	// xoris
+			d->imm = (op >> 26) == 27 ? (UIMM16 << 16) : UIMM16;
+			d->exec = ppc_exec_xori;
+			break;
+		case 31:
+			if (RCBIT)
+				break;
+			switch ((op >> 1) & 0x3ff)
+			{
+				case 0:		d->rd = CRFD; d->exec = ppc_exec_cmp; break;
+				case 32:	d->rd = CRFD; d->exec = ppc_exec_cmpl; break;
+				case 266:	d->exec = ppc_exec_add; break;
+				case 40:	d->exec = ppc_exec_subf; break;
+				case 28:	d->exec = ppc_exec_and; break;
+				case 444:	d->exec = ppc_exec_or; break;
+				case 316:	d->exec = ppc_exec_xor; break;
+			}
+			break;
+		case 32:	// lwz
+		case 34:	// lbz
+		case 40:	// lhz
+		case 36:	// stw
+		case 38:	// stb
+		case 44:	// sth
+			if (RA == 0)	// absolute addressing is rare; leave it to the handler
+				break;
+			d->imm = SIMM16;
+			switch (op >> 26)
+			{
+				case 32:	d->exec = ppc_exec_lwz; break;
+				case 34:	d->exec = ppc_exec_lbz; break;
+				case 40:	d->exec = ppc_exec_lhz; break;
+				case 36:	d->exec = ppc_exec_stw; break;
+				case 38:	d->exec = ppc_exec_stb; break;
+				case 44:	d->exec = ppc_exec_sth; break;
+			}
+			break;
+	}
+}
+
+/*
+ * Returns the decode table for the page containing pc, allocating it if
+ * needed, and the fetch region pointer for the start of the page. Returns NULL
+ * if pc lies outside of the fetch regions.
+ */
+static PPC_DECODED *ppc_cached_get_page(UINT32 pc, const UINT32 **src)
+{
+	UINT32 base = pc & ~((1 << PPC_CACHED_PAGE_SHIFT) - 1);
+
+	*src = NULL;
+	for (int i = 0; ppc.fetch[i].ptr != NULL; i++)
+	{
+		if (ppc.fetch[i].start <= base && (base + (1 << PPC_CACHED_PAGE_SHIFT) - 1) <= ppc.fetch[i].end)
+		{
+			*src = &ppc.fetch[i].ptr[(base - ppc.fetch[i].start) / 4];
+			break;
+		}
+	}
+
+	if (*src == NULL)
+		return NULL;
+
+	PPC_DECODED **page = &decoded_pages[pc >> PPC_CACHED_PAGE_SHIFT];
+	if (*page == NULL)
+		*page = (PPC_DECODED *) calloc(PPC_CACHED_PAGE_INSTRS, sizeof(PPC_DECODED));
+	ppc_code_page[pc >> PPC_CACHED_PAGE_SHIFT] = 1;
+	return *page;
+}
+
+/*
+ * ppc_cached_execute():
+ *
+ * Runs the cached interpreter until the time slice is used up. Called from
+ * ppc_execute() with the slice already set up.
+ */
+static void ppc_cached_execute(void)
+{
+	PPC_DECODED		*page = NULL;
+	const UINT32	*src = NULL;
+	UINT32			page_base = 1;	// never matches an aligned pc
+
+	while (ppc.icount > 0 && !ppc.fatalError)
+	{
+		ppc.pc = ppc.npc;
+
+		if ((ppc.pc & ~((1 << PPC_CACHED_PAGE_SHIFT) - 1)) != page_base)
+		{
+			page = ppc_cached_get_page(ppc.pc, &src);
+			if (page == NULL)
+			{
+				// Not entirely inside a fetch region: let the interpreter loop
+				// in ppc_execute() finish the slice (or report the bad address)
+				ppc_change_pc(ppc.pc);
+				break;
+			}
+			page_base = ppc.pc & ~((1 << PPC_CACHED_PAGE_SHIFT) - 1);
+		}
+
+		UINT32 idx = (ppc.pc >> 2) & (PPC_CACHED_PAGE_INSTRS - 1);
+		PPC_DECODED *d = &page[idx];
+		if (d->exec == NULL)
+			ppc_cached_decode(d, ppc.pc, src[idx]);
+
+		ppc.npc = ppc.pc + 4;
+		d->exec(d);
+
+		ppc.icount--;
+
+		if (ppc.icount == ppc.dec_trigger_cycle)
+		{
+			ppc.interrupt_pending |= 0x2;
+			ppc603_check_interrupts();
+		}
+	}
+}
+
+static inline bool ppc_cached_active(void)
+{
+#ifdef SUPERMODEL_DEBUGGER
+	if (PPCDebug != NULL)
+		return false;
+#endif
+	return ppc_core == PPC_CORE_CACHED;
+}
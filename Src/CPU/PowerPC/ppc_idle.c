@@ -0,0 +1,336 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_idle.c
+ *
+ * Idle loop detection for the PowerPC 603e. Included from ppc.cpp; do not
+ * compile separately.
+ *
+ * Games spend much of each frame polling a status register or a flag in RAM
+ * until an interrupt arrives. Whenever a short backward branch is taken, the
+ * loop it closes is checked once for instructions with side effects: only
+ * loads, compares, simple integer operations and non-counting branches are
+ * allowed. If such a loop completes an iteration leaving every register it
+ * writes unchanged and all of its loads come from memory that cannot change
+ * before a known point in time (see PPC_POLL_HANDLER), further iterations
+ * would do exactly the same thing. The remaining cycles are then consumed at
+ * once, up to the decrementer trigger point, the time at which a polled
+ * register changes, or the end of the time slice, whichever comes first.
+ * External interrupts are only raised between time slices.
+ */
+
+#define PPC_IDLE_MAX_LOOP		8		// longest loop considered (instructions)
+#define PPC_IDLE_CACHE_SIZE		64		// number of loops remembered
+
+typedef struct
+{
+	bool	analyzed;
+	UINT32	branch;						// address of the backward branch
+	UINT32	target;						// first instruction of the loop
+	int		length;						// instructions in the loop, 0 if not idle-able
+	UINT32	op[PPC_IDLE_MAX_LOOP];
+	UINT32	gpr_mask;					// GPRs written by the loop
+	UINT8	cr_mask;					// CR fields written by the loop
+
+	// State the last time the branch was taken
+	UINT32	epoch;
+	UINT64	time;
+	UINT32	gpr[32];
+	UINT8	cr[8];
+} PPC_IDLE_LOOP;
+
+static bool				ppc_idle_enabled = false;
+static UINT32			ppc_idle_epoch = 0;		// bumped whenever interrupts are checked
+static PPC_IDLE_LOOP	ppc_idle_loops[PPC_IDLE_CACHE_SIZE];
+
+static void ppc_idle_flush(void)
+{
+	memset(ppc_idle_loops, 0, sizeof(ppc_idle_loops));
+}
+
+static inline UINT64 ppc_idle_time(void)
+{
+	return ppc.total_cycles + (UINT64)(ppc.cur_cycles - ppc.icount);
+}
+
+// Returns true if the instruction is a load; base registers are returned in ra/rb (0 for none)
+static bool ppc_idle_is_load(UINT32 op, int *ra, int *rb)
+{
+	switch (op >> 26)
+	{
+		case 32:	// lwz
+		case 34:	// lbz
+		case 40:	// lhz
+		case 42:	// lha
+			*ra = RA;
+			*rb = 0;
+			return true;
+		case 31:
+			switch ((op >> 1) & 0x3ff)
+			{
+				case 23:	// lwzx
+				case 87:	// lbzx
+				case 279:	// lhzx
+					*ra = RA;
+					*rb = RB;
+					return true;
+			}
+			break;
+	}
+	return false;
+}
+
+/*
+ * Determines which registers an instruction writes. Returns false if the
+ * instruction may have any other effect, in which case the loop is not idle.
+ */
+static bool ppc_idle_decode(UINT32 op, UINT32 *gpr_mask, UINT8 *cr_mask)
+{
+	switch (op >> 26)
+	{
+		case 10:	// cmpli
+		case 11:	// cmpi
+			*cr_mask |= 0x80 >> CRFD;
+			return true;
+		case 14:	// addi
+		case 15:	// addis
+		case 32:	// lwz
+		case 34:	// lbz
+		case 40:	// lhz
+		case 42:	// lha
+			*gpr_mask |= 1u << RD;
+			return true;
+		case 21:	// rlwinmx
+		case 24:	// ori
+		case 25:	// oris
+		case 26:	// xori
+		case 27:	// xoris
+			*gpr_mask |= 1u << RA;
+			if ((op >> 26) == 21 && RCBIT)
+				*cr_mask |= 0x80;
+			return true;
+		case 28:	// andi.
+		case 29:	// andis.
+			*gpr_mask |= 1u << RA;
+			*cr_mask |= 0x80;
+			return true;
+		case 16:	// bcx: must not decrement CTR or set LR
+			return (BO & 0x4) && !LKBIT;
+		case 18:	// bx
+			return !LKBIT;
+		case 31:
+			switch ((op >> 1) & 0x3ff)
+			{
+				case 0:		// cmp
+				case 32:	// cmpl
+					*cr_mask |= 0x80 >> CRFD;
+					return true;
+				case 23:	// lwzx
+				case 87:	// lbzx
+				case 279:	// lhzx
+				case 40:	// subf
+				case 104:	// neg
+				case 266:	// add
+					*gpr_mask |= 1u << RD;
+					break;
+				case 26:	// cntlzw
+				case 28:	// and
+				case 60:	// andc
+				case 124:	// nor
+				case 316:	// xor
+				case 444:	// or
+				case 922:	// extsh
+				case 954:	// extsb
+					*gpr_mask |= 1u << RA;
+					break;
+				default:
+					return false;
+			}
+			if (RCBIT)
+				*cr_mask |= 0x80;
+			return true;
+	}
+	return false;
+}
+
+static const UINT32 *ppc_idle_fetch(UINT32 start, UINT32 end)
+{
+	for (int i = 0; ppc.fetch[i].ptr != NULL; i++)
+	{
+		if (ppc.fetch[i].start <= start && end <= ppc.fetch[i].end)
+			return &ppc.fetch[i].ptr[(start - ppc.fetch[i].start) / 4];
+	}
+	return NULL;
+}
+
+static void ppc_idle_analyze(PPC_IDLE_LOOP *loop, UINT32 branch, UINT32 target)
+{
+	const UINT32 *src = ppc_idle_fetch(target, branch + 3);
+	int length = (int) ((branch - target) / 4) + 1;
+
+	memset(loop, 0, sizeof(PPC_IDLE_LOOP));
+	loop->analyzed = true;
+	loop->branch = branch;
+	loop->target = target;
+
+	if (src == NULL)
+		return;
+
+	for (int i = 0; i < length; i++)
+	{
+		loop->op[i] = src[i];
+		if (!ppc_idle_decode(src[i], &loop->gpr_mask, &loop->cr_mask))
+			return;
+	}
+
+	// Load addresses must be loop-invariant: base registers may not be written
+	// by the load itself or anything after it
+	for (int i = 0; i < length; i++)
+	{
+		int ra, rb;
+		if (!ppc_idle_is_load(loop->op[i], &ra, &rb))
+			continue;
+
+		UINT32 written_after = 0;
+		UINT8 unused = 0;
+		for (int j = i; j < length; j++)
+			ppc_idle_decode(loop->op[j], &written_after, &unused);
+		if ((ra != 0 && (written_after & (1u << ra))) || (rb != 0 && (written_after & (1u << rb))))
+			return;
+	}
+
+	loop->length = length;
+}
+
+/*
+ * Returns the time until which the loop's loads keep returning the same
+ * values, or 0 if any of them may change at any time.
+ */
+static UINT64 ppc_idle_stable_until(const PPC_IDLE_LOOP *loop)
+{
+	UINT64 until = ~(UINT64) 0;
+
+	for (int i = 0; i < loop->length; i++)
+	{
+		UINT32 op = loop->op[i];
+		int ra, rb;
+		if (!ppc_idle_is_load(op, &ra, &rb))
+			continue;
+
+		UINT32 address = (ra != 0) ? REG(ra) : 0;
+		address += ((op >> 26) == 31) ? REG(rb) : (UINT32) SIMM16;
+
+		UINT32 page = address >> PPC_PAGE_SHIFT;
+		if (ppc_pages->read[page] != NULL)
+			continue;
+		if (ppc_pages->poll[page] == NULL)
+			return 0;
+
+		UINT64 t = ppc_pages->poll[page](ppc_pages->context, address);
+		if (t < until)
+			until = t;
+	}
+
+	return until;
+}
+
+/*
+ * ppc_idle_detect():
+ *
+ * Called when a backward branch to target is taken. Fast-forwards icount if
+ * the loop is idle.
+ */
+static void ppc_idle_detect(UINT32 target)
+{
+	PPC_IDLE_LOOP	*loop = &ppc_idle_loops[(ppc.pc >> 2) & (PPC_IDLE_CACHE_SIZE - 1)];
+	UINT64			now = ppc_idle_time();
+	bool			same = false;
+
+	if (!loop->analyzed || loop->branch != ppc.pc || loop->target != target)
+		ppc_idle_analyze(loop, ppc.pc, target);
+	if (loop->length == 0)
+		return;
+
+	// Compare against the previous iteration, which must have run in full
+	// since interrupts were last checked
+	if (loop->epoch == ppc_idle_epoch && now > loop->time && now - loop->time <= (UINT64) loop->length)
+	{
+		same = true;
+		for (int i = 0; i < 32 && same; i++)
+		{
+			if ((loop->gpr_mask & (1u << i)) && loop->gpr[i] != REG(i))
+				same = false;
+		}
+		for (int i = 0; i < 8 && same; i++)
+		{
+			if ((loop->cr_mask & (0x80 >> i)) && loop->cr[i] != CR(i))
+				same = false;
+		}
+	}
+
+	loop->epoch = ppc_idle_epoch;
+	loop->time = now;
+	memcpy(loop->gpr, ppc.r, sizeof(loop->gpr));
+	memcpy(loop->cr, ppc.cr, sizeof(loop->cr));
+
+	if (!same)
+		return;
+
+	// Make sure the code has not been rewritten since it was analyzed
+	const UINT32 *src = ppc_idle_fetch(loop->target, loop->branch + 3);
+	if (src == NULL || memcmp(src, loop->op, loop->length * sizeof(UINT32)) != 0)
+	{
+		loop->analyzed = false;
+		return;
+	}
+
+	UINT64 until = ppc_idle_stable_until(loop);
+	if (until <= now + 1)
+		return;
+
+	// Leave one cycle for the branch itself. Stop short of the decrementer
+	// trigger so that it fires normally.
+	int stop = (ppc.dec_trigger_cycle >= 0 && ppc.dec_trigger_cycle < ppc.icount) ? ppc.dec_trigger_cycle : 0;
+	int icount = stop + 1;
+	if (until - now - 1 < (UINT64) (ppc.icount - icount))
+		icount = ppc.icount - (int) (until - now - 1);
+
+	if (icount < ppc.icount)
+		ppc.icount = icount;
+}
+
+/*
+ * ppc_idle_check():
+ *
+ * Called by the branch handlers after a taken branch.
+ */
+static inline void ppc_idle_check(UINT32 target)
+{
+	if (ppc_idle_enabled && (ppc.pc - target) < PPC_IDLE_MAX_LOOP * 4)
+	{
+#ifdef SUPERMODEL_DEBUGGER
+		if (PPCDebug != NULL)
+			return;
+#endif
+		ppc_idle_detect(target);
+	}
+}
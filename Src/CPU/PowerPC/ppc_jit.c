@@ -0,0 +1,745 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_jit.c
+ *
+ * x86-64 dynamic recompiler for the PowerPC 603e. Included from ppc.cpp; do
+ * not compile separately.
+ *
+ * Basic blocks within the fetch regions are translated into host code that
+ * calls the interpreter's opcode handlers directly, so the opcode table lookup
+ * and dispatch in ppc_execute() are paid once per translation rather than once
+ * per executed instruction. A handful of simple integer instructions are
+ * emitted natively. Anything the translator does not know how to handle is
+ * left to the interpreter.
+ *
+ * Blocks never span a 4 KB page. A store into a page holding translated code
+ * discards every block on that page (see ppc_jit_invalidate_page()). If that
+ * includes the running block, it is left right after the store. Pages
+ * that are rewritten over and over (code and data sharing a page) are
+ * eventually left to the interpreter.
+ *
+ * Timing is identical to the interpreter: a block is only entered when it can
+ * run to completion without passing the end of the time slice or the
+ * decrementer trigger point. Otherwise, instructions are stepped one at a
+ * time.
+ */
+
+#include <cstddef>	// offsetof()
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PPC_JIT_SUPPORTED	1
+#else
+#define PPC_JIT_SUPPORTED	0
+#endif
+
+#if PPC_JIT_SUPPORTED
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+typedef void (*PPC_HANDLER)(UINT32);
+
+static void ppc_invalid(UINT32 op);
+
+static PPC_CORE ppc_core = PPC_CORE_INTERPRETER;
+
+/*
+ * ppc_get_handler():
+ *
+ * Returns the interpreter handler for an opcode.
+ */
+static inline PPC_HANDLER ppc_get_handler(UINT32 opcode)
+{
+	switch(opcode >> 26)
+	{
+		case 19:	return optable19[(opcode >> 1) & 0x3ff];
+		case 31:	return optable31[(opcode >> 1) & 0x3ff];
+		case 59:	return optable59[(opcode >> 1) & 0x3ff];
+		case 63:	return optable63[(opcode >> 1) & 0x3ff];
+		default:	return optable[opcode >> 26];
+	}
+}
+
+/*
+ * ppc_step():
+ *
+ * Interprets a single instruction at ppc.npc. ppc.op must point to it.
+ */
+static void ppc_step(void)
+{
+	UINT32 opcode;
+
+	ppc.pc = ppc.npc;
+	opcode = *ppc.op++;
+	ppc.npc = ppc.pc + 4;
+
+	ppc_get_handler(opcode)(opcode);
+
+	ppc.icount--;
+
+	if (ppc.icount == ppc.dec_trigger_cycle)
+	{
+		ppc.interrupt_pending |= 0x2;
+		ppc603_check_interrupts();
+	}
+}
+
+#if PPC_JIT_SUPPORTED
+
+/******************************************************************************
+ Translation Cache
+******************************************************************************/
+
+#define PPC_JIT_PAGE_SHIFT			12
+#define PPC_JIT_NUM_PAGES			(1 << (32 - PPC_JIT_PAGE_SHIFT))
+#define PPC_JIT_PAGE_INSTRS			(1 << (PPC_JIT_PAGE_SHIFT - 2))
+#define PPC_JIT_MAX_BLOCK			64					// maximum instructions per block
+#define PPC_JIT_MAX_INSTR_SIZE		96					// worst case host code bytes per instruction
+#define PPC_JIT_CACHE_SIZE			(16*1024*1024)		// executable memory for translated code
+#define PPC_JIT_MAX_INVALIDATIONS	64					// pages invalidated this often are interpreted
+
+typedef struct
+{
+	UINT8	*code;		// host code (NULL if not translated)
+	int		length;		// number of PowerPC instructions in block (-1 if untranslatable)
+} PPC_JIT_BLOCK;
+
+typedef int (*PPC_JIT_CODE)(void);
+
+static UINT8			*jit_cache = NULL;			// executable memory
+static UINT8			*jit_ptr = NULL;			// next free byte in jit_cache
+static PPC_JIT_BLOCK	**jit_pages = NULL;			// per-page block tables, indexed by address >> 12
+static UINT8			*jit_invalidations = NULL;	// per-page invalidation counts
+static UINT32			jit_block_page = ~0U;		// page of the block being run (~0 if none)
+static UINT8			jit_block_invalidated = 0;	// set when the running block's page is invalidated
+
+/*
+ * ppc_jit_flush():
+ *
+ * Discards all translated code.
+ */
+static void ppc_jit_flush(void)
+{
+	memset(ppc_code_page, 0, sizeof(ppc_code_page));
+
+	if (jit_pages == NULL)
+		return;
+
+	for (int i = 0; i < PPC_JIT_NUM_PAGES; i++)
+	{
+		if (jit_pages[i] != NULL)
+			memset(jit_pages[i], 0, PPC_JIT_PAGE_INSTRS * sizeof(PPC_JIT_BLOCK));
+	}
+
+	memset(jit_invalidations, 0, PPC_JIT_NUM_PAGES);
+	jit_ptr = jit_cache;
+}
+
+static void ppc_jit_shutdown(void)
+{
+	if (jit_pages != NULL)
+	{
+		for (int i = 0; i < PPC_JIT_NUM_PAGES; i++)
+			free(jit_pages[i]);
+		free(jit_pages);
+		jit_pages = NULL;
+	}
+
+	free(jit_invalidations);
+	jit_invalidations = NULL;
+
+	if (jit_cache != NULL)
+	{
+#ifdef _WIN32
+		VirtualFree(jit_cache, 0, MEM_RELEASE);
+#else
+		munmap(jit_cache, PPC_JIT_CACHE_SIZE);
+#endif
+		jit_cache = NULL;
+	}
+
+	jit_ptr = NULL;
+	memset(ppc_code_page, 0, sizeof(ppc_code_page));
+}
+
+static bool ppc_jit_init(void)
+{
+	if (jit_cache != NULL)
+		return true;
+
+#ifdef _WIN32
+	jit_cache = (UINT8 *) VirtualAlloc(NULL, PPC_JIT_CACHE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	void *mem = mmap(NULL, PPC_JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	jit_cache = (mem == MAP_FAILED) ? NULL : (UINT8 *) mem;
+#endif
+	jit_pages = (PPC_JIT_BLOCK **) calloc(PPC_JIT_NUM_PAGES, sizeof(PPC_JIT_BLOCK *));
+	jit_invalidations = (UINT8 *) calloc(PPC_JIT_NUM_PAGES, sizeof(UINT8));
+
+	if ((jit_cache == NULL) || (jit_pages == NULL) || (jit_invalidations == NULL))
+	{
+		ppc_jit_shutdown();
+		return false;
+	}
+
+	jit_ptr = jit_cache;
+	return true;
+}
+
+static void ppc_jit_invalidate_page(UINT32 address)
+{
+	UINT32 page = address >> PPC_JIT_PAGE_SHIFT;
+
+	ppc_code_page[page] = 0;
+
+	if ((jit_pages == NULL) || (jit_pages[page] == NULL))
+		return;
+
+	if (page == jit_block_page)
+		jit_block_invalidated = 1;
+
+	memset(jit_pages[page], 0, PPC_JIT_PAGE_INSTRS * sizeof(PPC_JIT_BLOCK));
+	if (jit_invalidations[page] < 255)
+		jit_invalidations[page]++;
+}
+
+
+/******************************************************************************
+ x86-64 Code Emitter
+
+ The generated code keeps a pointer to the register file in RBX and calls the
+ interpreter handlers with the opcode as their only argument. Each block
+ returns the number of PowerPC instructions it executed in EAX.
+******************************************************************************/
+
+#define PPC_OFFSET(field)	((UINT32) offsetof(PPC_REGS, field))
+#define GPR_OFFSET(n)		(PPC_OFFSET(r) + 4 * (n))
+
+static inline void jit_emit8(UINT8 data)
+{
+	*jit_ptr++ = data;
+}
+
+static inline void jit_emit32(UINT32 data)
+{
+	memcpy(jit_ptr, &data, sizeof(data));
+	jit_ptr += sizeof(data);
+}
+
+static inline void jit_emit64(UINT64 data)
+{
+	memcpy(jit_ptr, &data, sizeof(data));
+	jit_ptr += sizeof(data);
+}
+
+// mov dword [rbx+offset], imm32
+static void jit_store_imm(UINT32 offset, UINT32 data)
+{
+	jit_emit8(0xC7); jit_emit8(0x83); jit_emit32(offset); jit_emit32(data);
+}
+
+// mov eax, [rbx+offset]
+static void jit_load_eax(UINT32 offset)
+{
+	jit_emit8(0x8B); jit_emit8(0x83); jit_emit32(offset);
+}
+
+// mov [rbx+offset], eax
+static void jit_store_eax(UINT32 offset)
+{
+	jit_emit8(0x89); jit_emit8(0x83); jit_emit32(offset);
+}
+
+// sub dword [rbx+offset], imm8
+static void jit_sub_imm8(UINT32 offset, UINT8 data)
+{
+	jit_emit8(0x83); jit_emit8(0xAB); jit_emit32(offset); jit_emit8(data);
+}
+
+// <op> eax, imm32 (0x05 = add, 0x0D = or, 0x25 = and, 0x35 = xor, 0x3D = cmp)
+static void jit_alu_eax_imm(UINT8 opcode, UINT32 data)
+{
+	jit_emit8(opcode); jit_emit32(data);
+}
+
+// <op> eax, [rbx+offset] (0x03 = add, 0x0B = or, 0x23 = and, 0x2B = sub, 0x33 = xor, 0x3B = cmp)
+static void jit_alu_eax_mem(UINT8 opcode, UINT32 offset)
+{
+	jit_emit8(opcode); jit_emit8(0x83); jit_emit32(offset);
+}
+
+// not eax
+static void jit_not_eax(void)
+{
+	jit_emit8(0xF7); jit_emit8(0xD0);
+}
+
+// rol eax, imm8
+static void jit_rol_eax(UINT8 shift)
+{
+	jit_emit8(0xC1); jit_emit8(0xC0); jit_emit8(shift);
+}
+
+/*
+ * Sets CR field n from a comparison whose flags are already set, as done by
+ * the cmp family of handlers: LT/GT/EQ, plus SO copied from XER.
+ */
+static void jit_set_cr_from_flags(int n, bool is_signed)
+{
+	jit_emit8(0xB9); jit_emit32(0x4);						// mov ecx, 4 (GT)
+	jit_emit8(0xBA); jit_emit32(0x8);						// mov edx, 8 (LT)
+	jit_emit8(0x0F); jit_emit8(is_signed ? 0x4C : 0x42); jit_emit8(0xCA);	// cmovl/cmovb ecx, edx
+	jit_emit8(0xBA); jit_emit32(0x2);						// mov edx, 2 (EQ)
+	jit_emit8(0x0F); jit_emit8(0x44); jit_emit8(0xCA);		// cmove ecx, edx
+	jit_load_eax(PPC_OFFSET(xer));
+	jit_emit8(0xC1); jit_emit8(0xE8); jit_emit8(31);		// shr eax, 31 (SO)
+	jit_emit8(0x09); jit_emit8(0xC1);						// or ecx, eax
+	jit_emit8(0x88); jit_emit8(0x8B); jit_emit32(PPC_OFFSET(cr) + n);	// mov [rbx+cr+n], cl
+}
+
+// Call a handler with the opcode as its argument
+static void jit_call(PPC_HANDLER handler, UINT32 opcode)
+{
+#ifdef _WIN32
+	jit_emit8(0xB9); jit_emit32(opcode);					// mov ecx, opcode
+#else
+	jit_emit8(0xBF); jit_emit32(opcode);					// mov edi, opcode
+#endif
+	jit_emit8(0x48); jit_emit8(0xB8); jit_emit64((UINT64) handler);	// mov rax, handler
+	jit_emit8(0xFF); jit_emit8(0xD0);						// call rax
+}
+
+static void jit_prologue(void)
+{
+	jit_emit8(0x53);										// push rbx
+#ifdef _WIN32
+	jit_emit8(0x48); jit_emit8(0x83); jit_emit8(0xEC); jit_emit8(0x20);	// sub rsp, 32 (shadow space)
+#endif
+	jit_emit8(0x48); jit_emit8(0xBB); jit_emit64((UINT64) &ppc);	// mov rbx, &ppc
+}
+
+// Return the number of instructions executed
+static void jit_exit(int count)
+{
+	jit_emit8(0xB8); jit_emit32(count);						// mov eax, count
+#ifdef _WIN32
+	jit_emit8(0x48); jit_emit8(0x83); jit_emit8(0xC4); jit_emit8(0x20);	// add rsp, 32
+#endif
+	jit_emit8(0x5B);										// pop rbx
+	jit_emit8(0xC3);										// ret
+}
+
+// Leave the block if ppc.npc no longer points to the next instruction or the
+// block itself was invalidated (self-modifying code)
+static void jit_check_npc(UINT32 expected, int count)
+{
+	jit_emit8(0x81); jit_emit8(0xBB); jit_emit32(PPC_OFFSET(npc)); jit_emit32(expected);	// cmp dword [rbx+npc], expected
+	jit_emit8(0x75);										// jne exit
+	UINT8 *exit = jit_ptr++;
+	jit_emit8(0x48); jit_emit8(0xB8); jit_emit64((UINT64) &jit_block_invalidated);	// mov rax, &jit_block_invalidated
+	jit_emit8(0x80); jit_emit8(0x38); jit_emit8(0x00);		// cmp byte [rax], 0
+	jit_emit8(0x74);										// je skip
+	UINT8 *skip = jit_ptr++;
+	*exit = (UINT8) (jit_ptr - exit - 1);
+	jit_exit(count);
+	*skip = (UINT8) (jit_ptr - skip - 1);
+}
+
+
+/******************************************************************************
+ Translator
+******************************************************************************/
+
+/*
+ * Returns true if the instruction always transfers control or may change the
+ * decrementer trigger point or interrupt state, in which case it must be the
+ * last one in its block.
+ */
+static bool ppc_jit_ends_block(UINT32 opcode)
+{
+	switch (opcode >> 26)
+	{
+		case 16:	// bcx
+		case 17:	// sc
+		case 18:	// bx
+			return true;
+		case 19:
+			switch ((opcode >> 1) & 0x3ff)
+			{
+				case 16:	// bclrx
+				case 50:	// rfi
+				case 528:	// bcctrx
+					return true;
+			}
+			break;
+		case 31:
+			switch ((opcode >> 1) & 0x3ff)
+			{
+				case 146:	// mtmsr
+				case 467:	// mtspr
+					return true;
+			}
+			break;
+	}
+	return false;
+}
+
+/*
+ * Returns true if the handler only operates on registers: it does not read
+ * the program counter or cycle count and cannot raise an exception.
+ */
+static bool ppc_jit_is_pure(UINT32 opcode)
+{
+	switch (opcode >> 26)
+	{
+		case 7:		// mulli
+		case 8:		// subfic
+		case 10:	// cmpli
+		case 11:	// cmpi
+		case 12:	// addic
+		case 13:	// addic.
+		case 14:	// addi
+		case 15:	// addis
+		case 20:	// rlwimix
+		case 21:	// rlwinmx
+		case 23:	// rlwnmx
+		case 24:	// ori
+		case 25:	// oris
+		case 26:	// xori
+		case 27:	// xoris
+		case 28:	// andi.
+		case 29:	// andis.
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Emits native code for the simplest integer instructions. Returns false if
+ * the instruction must go through its handler.
+ */
+static bool ppc_jit_emit_native(UINT32 op)
+{
+	switch (op >> 26)
+	{
+		case 14:	// addi
+		case 15:	// addis
+		{
+			UINT32 imm = (op >> 26) == 14 ? (UINT32) SIMM16 : (UINT32) (op << 16);
+			if (RA == 0)
+				jit_store_imm(GPR_OFFSET(RT), imm);
+			else
+			{
+				jit_load_eax(GPR_OFFSET(RA));
+				jit_alu_eax_imm(0x05, imm);
+				jit_store_eax(GPR_OFFSET(RT));
+			}
+			return true;
+		}
+		case 24:	// ori
+		case 25:	// oris
+		case 26:	// xori
+		case 27:	// xoris
+		{
+			UINT32 imm = (op >> 26) & 1 ? (UIMM16 << 16) : UIMM16;
+			if (imm == 0 && RA == RS)	// nop
+				return true;
+			jit_load_eax(GPR_OFFSET(RS));
+			if (imm != 0)
+				jit_alu_eax_imm((op >> 26) < 26 ? 0x0D : 0x35, imm);
+			jit_store_eax(GPR_OFFSET(RA));
+			return true;
+		}
+		case 10:	// cmpli
+		case 11:	// cmpi
+		{
+			jit_load_eax(GPR_OFFSET(RA));
+			jit_alu_eax_imm(0x3D, (op >> 26) == 11 ? (UINT32) SIMM16 : UIMM16);	// cmp eax, imm32
+			jit_set_cr_from_flags(CRFD, (op >> 26) == 11);
+			return true;
+		}
+		case 31:
+		{
+			if (RCBIT)
+				return false;
+			switch ((op >> 1) & 0x3ff)
+			{
+				case 0:		// cmp
+				case 32:	// cmpl
+					jit_load_eax(GPR_OFFSET(RA));
+					jit_alu_eax_mem(0x3B, GPR_OFFSET(RB));	// cmp eax, [rb]
+					jit_set_cr_from_flags(CRFD, ((op >> 1) & 0x3ff) == 0);
+					return true;
+				case 266:	// add
+					jit_load_eax(GPR_OFFSET(RA));
+					jit_alu_eax_mem(0x03, GPR_OFFSET(RB));
+					jit_store_eax(GPR_OFFSET(RT));
+					return true;
+				case 40:	// subf
+					jit_load_eax(GPR_OFFSET(RB));
+					jit_alu_eax_mem(0x2B, GPR_OFFSET(RA));
+					jit_store_eax(GPR_OFFSET(RT));
+					return true;
+				case 28:	// and
+				case 444:	// or
+				case 316:	// xor
+				{
+					UINT32 xo = (op >> 1) & 0x3ff;
+					jit_load_eax(GPR_OFFSET(RS));
+					if (RB != RS || xo == 316)
+						jit_alu_eax_mem(xo == 28 ? 0x23 : (xo == 444 ? 0x0B : 0x33), GPR_OFFSET(RB));
+					jit_store_eax(GPR_OFFSET(RA));
+					return true;
+				}
+				case 60:	// andc
+					jit_load_eax(GPR_OFFSET(RB));
+					jit_not_eax();
+					jit_alu_eax_mem(0x23, GPR_OFFSET(RS));
+					jit_store_eax(GPR_OFFSET(RA));
+					return true;
+				case 124:	// nor
+					jit_load_eax(GPR_OFFSET(RS));
+					jit_alu_eax_mem(0x0B, GPR_OFFSET(RB));
+					jit_not_eax();
+					jit_store_eax(GPR_OFFSET(RA));
+					return true;
+			}
+			return false;
+		}
+		case 21:	// rlwinm
+		{
+			if (RCBIT)
+				return false;
+			jit_load_eax(GPR_OFFSET(RS));
+			if (SH != 0)
+				jit_rol_eax(SH);
+			jit_alu_eax_imm(0x25, GET_ROTATE_MASK(MB, ME));
+			jit_store_eax(GPR_OFFSET(RA));
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ppc_jit_translate(UINT32 pc, PPC_JIT_BLOCK *block)
+{
+	const UINT32	*src = NULL;
+	UINT32			end = 0;
+
+	// Instructions are fetched directly from the fetch regions
+	for (int i = 0; ppc.fetch[i].ptr != NULL; i++)
+	{
+		if (ppc.fetch[i].start <= pc && pc <= ppc.fetch[i].end)
+		{
+			src = &ppc.fetch[i].ptr[(pc - ppc.fetch[i].start) / 4];
+			end = ppc.fetch[i].end;
+			break;
+		}
+	}
+
+	if (src == NULL)
+		return false;
+
+	if (end > (pc | ((1 << PPC_JIT_PAGE_SHIFT) - 1)))
+		end = pc | ((1 << PPC_JIT_PAGE_SHIFT) - 1);
+
+	int max_length = (int) ((end - pc) / 4) + 1;
+	if (max_length > PPC_JIT_MAX_BLOCK)
+		max_length = PPC_JIT_MAX_BLOCK;
+
+	// Out of space: start over
+	if ((jit_ptr + PPC_JIT_MAX_BLOCK * PPC_JIT_MAX_INSTR_SIZE + 64) > (jit_cache + PPC_JIT_CACHE_SIZE))
+		ppc_jit_flush();
+
+	UINT8	*code = jit_ptr;
+	int		length = 0;
+	int		synced = 0;		// instructions already subtracted from ppc.icount
+	bool	terminated = false;
+
+	jit_prologue();
+
+	while (length < max_length && !terminated)
+	{
+		UINT32		opcode = src[length];
+		UINT32		addr = pc + length * 4;
+		PPC_HANDLER	handler = ppc_get_handler(opcode);
+
+		if (handler == ppc_invalid)
+			break;
+
+		if (ppc_jit_emit_native(opcode))
+		{
+			length++;
+			continue;
+		}
+
+		terminated = ppc_jit_ends_block(opcode);
+
+		if (ppc_jit_is_pure(opcode))
+			jit_call(handler, opcode);
+		else
+		{
+			jit_store_imm(PPC_OFFSET(pc), addr);
+			jit_store_imm(PPC_OFFSET(npc), addr + 4);
+			if (length > synced)
+			{
+				jit_sub_imm8(PPC_OFFSET(icount), (UINT8) (length - synced));
+				synced = length;
+			}
+			jit_call(handler, opcode);
+			if (!terminated)
+				jit_check_npc(addr + 4, length + 1 - synced);
+		}
+
+		length++;
+	}
+
+	if (length == 0)
+	{
+		jit_ptr = code;
+		block->length = -1;
+		return false;
+	}
+
+	if (!terminated)
+	{
+		jit_store_imm(PPC_OFFSET(pc), pc + (length - 1) * 4);
+		jit_store_imm(PPC_OFFSET(npc), pc + length * 4);
+	}
+	jit_exit(length - synced);
+
+	block->code = code;
+	block->length = length;
+	ppc_code_page[pc >> PPC_JIT_PAGE_SHIFT] = 1;
+	return true;
+}
+
+static PPC_JIT_BLOCK *ppc_jit_lookup(UINT32 pc)
+{
+	UINT32 page = pc >> PPC_JIT_PAGE_SHIFT;
+
+	if (jit_invalidations[page] >= PPC_JIT_MAX_INVALIDATIONS)
+		return NULL;
+
+	if (jit_pages[page] == NULL)
+	{
+		jit_pages[page] = (PPC_JIT_BLOCK *) calloc(PPC_JIT_PAGE_INSTRS, sizeof(PPC_JIT_BLOCK));
+		if (jit_pages[page] == NULL)
+			return NULL;
+	}
+
+	PPC_JIT_BLOCK *block = &jit_pages[page][(pc >> 2) & (PPC_JIT_PAGE_INSTRS - 1)];
+
+	if (block->code == NULL)
+	{
+		if (block->length < 0 || !ppc_jit_translate(pc, block))
+			return NULL;
+	}
+
+	return block;
+}
+
+/*
+ * ppc_jit_execute():
+ *
+ * Runs translated blocks until the time slice is used up. Called from
+ * ppc_execute() with the slice already set up.
+ */
+static void ppc_jit_execute(void)
+{
+	while (ppc.icount > 0 && !ppc.fatalError)
+	{
+		PPC_JIT_BLOCK	*block = ppc_jit_lookup(ppc.npc);
+		int				start = ppc.icount;
+
+		// Blocks must not overrun the slice or step over the decrementer trigger
+		if ((block == NULL) || (block->length > start) ||
+			((ppc.dec_trigger_cycle < start) && (ppc.dec_trigger_cycle >= start - block->length)))
+		{
+			ppc_change_pc(ppc.npc);
+			if (!ppc.fatalError)
+				ppc_step();
+			continue;
+		}
+
+		// Blocks return the number of instructions not yet accounted for.
+		// Handlers may have adjusted icount themselves (idle loop skipping).
+		jit_block_page = ppc.npc >> PPC_JIT_PAGE_SHIFT;
+		jit_block_invalidated = 0;
+		ppc.icount -= ((PPC_JIT_CODE) block->code)();
+		jit_block_page = ~0U;
+
+		if (ppc.icount == ppc.dec_trigger_cycle)
+		{
+			ppc.interrupt_pending |= 0x2;
+			ppc603_check_interrupts();
+		}
+	}
+}
+
+#else	// !PPC_JIT_SUPPORTED
+
+static void ppc_jit_flush(void)
+{
+}
+
+static void ppc_jit_shutdown(void)
+{
+}
+
+static bool ppc_jit_init(void)
+{
+	return false;
+}
+
+static void ppc_jit_invalidate_page(UINT32 address)
+{
+	ppc_code_page[address >> 12] = 0;
+}
+
+static void ppc_jit_execute(void)
+{
+	while (ppc.icount > 0 && !ppc.fatalError)
+		ppc_step();
+}
+
+#endif	// PPC_JIT_SUPPORTED
+
+/*
+ * ppc_jit_active():
+ *
+ * Returns true if ppc_execute() should run translated code. The debugger
+ * needs to see every instruction, so the interpreter is always used while it
+ * is attached.
+ */
+static inline bool ppc_jit_active(void)
+{
+#ifdef SUPERMODEL_DEBUGGER
+	if (PPCDebug != NULL)
+		return false;
+#endif
+	return ppc_core == PPC_CORE_DYNAREC;
+}
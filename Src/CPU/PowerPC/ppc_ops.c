@@ -241,6 +241,7 @@ static void ppc_bx(UINT32 op)
 	}
 	
 	ppc_change_pc(ppc.npc);
+	ppc_idle_check(ppc.npc);
 }
 
 static void ppc_bcx(UINT32 op)
@@ -255,6 +256,7 @@ static void ppc_bcx(UINT32 op)
 		}
 
 		ppc_change_pc(ppc.npc);
+		ppc_idle_check(ppc.npc);
 	}
 
 	if( LKBIT ) {
@@ -31,6 +31,7 @@ struct Game
   float real3d_status_bit_set_percent_of_frame = 0; // overrides default status bit timing (0 for default)
   uint32_t encryption_key = 0;
   bool netboard_present;
+  bool idle_skip = false;               // PowerPC idle loop skipping has been checked with this game and is enabled by default
 
   enum Inputs
   {
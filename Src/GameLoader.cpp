@@ -5,8 +5,10 @@
 #include "Util/ByteSwap.h"
 #include "Util/Format.h"
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 bool GameLoader::LoadZipArchive(ZipArchive *zip, const std::string &zipfilename) const
 {
@@ -28,7 +30,9 @@ bool GameLoader::LoadZipArchive(ZipArchive *zip, const std::string &zipfilename)
     if (UNZ_OK != unzGetCurrentFileInfo(zf, &file_info, filename_buffer, sizeof(filename_buffer), NULL, 0, NULL, 0))
       continue;
     zip->files_by_crc[file_info.crc].zf = zf;
-    zip->files_by_crc[file_info.crc].zipfilename = filename_buffer;
+    zip->files_by_crc[file_info.crc].archive = zip->zfs.size() - 1;
+    unzGetFilePos(zf, &zip->files_by_crc[file_info.crc].pos);
+    zip->files_by_crc[file_info.crc].zipfilename = zipfilename;
     zip->files_by_crc[file_info.crc].filename = filename_buffer;
     zip->files_by_crc[file_info.crc].uncompressed_size = file_info.uncompressed_size;
     zip->files_by_crc[file_info.crc].crc32 = file_info.crc;
@@ -89,40 +93,132 @@ const GameLoader::ZippedFile *GameLoader::LookupFile(const File::ptr_t &file, co
   return nullptr;
 }
 
-bool GameLoader::LoadZippedFile(std::shared_ptr<uint8_t> *buffer, size_t *file_size, const GameLoader::File::ptr_t &file, const ZipArchive &zip) const
+// We need to preserve the absolute offsets in order for byte swapping to work
+// properly when chunk size is 1
+static inline void CopyBytes(uint8_t *dest_base, uint32_t dest_offset, const uint8_t *src_base, uint32_t src_offset, uint32_t size, uint32_t byte_swap)
 {
-  // Locate file
-  const ZippedFile *zipped_file = LookupFile(file, zip);
-  if (!zipped_file)
-    return true;
-  if (UNZ_OK != unzLocateFile(zipped_file->zf, zipped_file->filename.c_str(), 2))
+  for (uint32_t i = 0; i < size; i++)
+  {
+    dest_base[(dest_offset + i) ^ byte_swap] = src_base[src_offset + i];
+  }
+}
+
+bool GameLoader::LoadZippedFile(const FileLoad &load, unzFile zf) const
+{
+  const ZippedFile *zipped_file = load.zipped_file;
+  const Region &region = *load.region;
+
+  // Locate file. The position is valid for any handle to the same archive.
+  unz_file_pos pos = zipped_file->pos;
+  if (UNZ_OK != unzGoToFilePos(zf, &pos))
   {
     ErrorLog("Unable to locate '%s' in '%s'. Is zip file corrupt?", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
     return true;
   }
 
-  // Read it in
-  if (UNZ_OK != unzOpenCurrentFile(zipped_file->zf))
+  // Inflate it straight into the region
+  if (UNZ_OK != unzOpenCurrentFile(zf))
   {
     ErrorLog("Unable to read '%s' from '%s'. Is zip file corrupt?", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
     return true;
   }
-  *file_size = zipped_file->uncompressed_size;
-  buffer->reset(new uint8_t[*file_size], std::default_delete<uint8_t[]>());
-  size_t bytes_read = (size_t) unzReadCurrentFile(zipped_file->zf, buffer->get(), *file_size);
-  if (bytes_read != *file_size)
+  size_t file_size = zipped_file->uncompressed_size;
+  uint8_t *dest = load.dest;
+  bool error = false;
+  if (region.chunk_size == region.stride)
+  {
+    error = (size_t) unzReadCurrentFile(zf, dest + load.file->offset, (unsigned) file_size) != file_size;
+    if (!error && region.byte_swap)
+      Util::FlipEndian16(dest + load.file->offset, file_size);
+  }
+  else
+  {
+    // Interleaved files are inflated a block of whole chunks at a time
+    uint32_t chunk_size = (uint32_t)region.chunk_size;   // cache these as pointer dereferencing cripples performance in a tight loop
+    uint32_t stride = (uint32_t)region.stride;
+    uint32_t byte_swap = region.byte_swap;
+    uint32_t block_size = std::max<uint32_t>(1, 0x10000 / chunk_size) * chunk_size;
+    std::unique_ptr<uint8_t[]> block(new uint8_t[block_size]);
+    uint32_t dest_offset = load.file->offset;
+    for (size_t done = 0; done < file_size && !error; )
+    {
+      uint32_t size = (uint32_t) std::min<size_t>(block_size, file_size - done);
+      if ((uint32_t) unzReadCurrentFile(zf, block.get(), size) != size)
+      {
+        error = true;
+        break;
+      }
+      for (uint32_t src_offset = 0; src_offset < size; src_offset += chunk_size)
+      {
+        CopyBytes(dest, dest_offset, block.get(), src_offset, chunk_size, byte_swap);
+        dest_offset += stride;
+      }
+      done += size;
+    }
+  }
+  if (error)
   {
     ErrorLog("Unable to read '%s' from '%s'. Is zip file corrupt?", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
-    unzCloseCurrentFile(zipped_file->zf);
+    unzCloseCurrentFile(zf);
     return true;
   }
 
   // And close it
-  if (UNZ_CRCERROR == unzCloseCurrentFile(zipped_file->zf))
+  if (UNZ_CRCERROR == unzCloseCurrentFile(zf))
     ErrorLog("CRC error reading '%s' from '%s'. File may be corrupt.", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
   return false;
 }
 
+void GameLoader::LoadFiles(std::vector<FileLoad> *loads, const ZipArchive &zip) const
+{
+  // Largest files first, so that the last ones to finish are short
+  std::vector<FileLoad *> queue;
+  for (auto &load: *loads)
+    queue.push_back(&load);
+  if (queue.empty())
+    return; // everything came from the ROM cache
+  std::sort(queue.begin(), queue.end(), [](const FileLoad *a, const FileLoad *b) { return a->zipped_file->uncompressed_size > b->zipped_file->uncompressed_size; });
+
+  // Files are shared out between this thread and some workers. minizip handles
+  // cannot be shared, so each worker opens the archives itself.
+  std::atomic<size_t> next(0);
+  auto do_loads = [&](bool own_handles)
+  {
+    std::vector<unzFile> zfs(zip.zfs.size(), nullptr);
+    size_t i;
+    while ((i = next++) < queue.size())
+    {
+      FileLoad *load = queue[i];
+      unzFile &zf = zfs[load->zipped_file->archive];
+      if (!own_handles)
+        zf = load->zipped_file->zf;
+      else if (zf == nullptr && (zf = unzOpen(zip.zipfilenames[load->zipped_file->archive].c_str())) == nullptr)
+      {
+        ErrorLog("Could not open '%s'.", zip.zipfilenames[load->zipped_file->archive].c_str());
+        load->error = true;
+        continue;
+      }
+      load->error = LoadZippedFile(*load, zf);
+    }
+    if (own_handles)
+    {
+      for (auto &zf: zfs)
+      {
+        if (zf != nullptr)
+          unzClose(zf);
+      }
+    }
+  };
+
+  size_t num_workers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), queue.size()) - 1;
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < num_workers; i++)
+    workers.emplace_back(do_loads, true);
+  do_loads(false);
+  for (auto &worker: workers)
+    worker.join();
+}
+
 bool GameLoader::MissingAttrib(const GameLoader &loader, const Util::Config::Node &node, const std::string &attribute)
 {
   if (node[attribute].Empty())
@@ -217,6 +313,7 @@ static void PopulateGameInfo(Game *game, const Util::Config::Node &game_node)
   game->real3d_status_bit_set_percent_of_frame = game_node["hardware/real3d_status_bit_set_percent_of_frame"].ValueAsDefault<float>(0);
   game->encryption_key = game_node["hardware/encryption_key"].ValueAsDefault<uint32_t>(0);
   game->netboard_present = game_node["hardware/netboard"].ValueAsDefault<bool>(false);
+  game->idle_skip = game_node["hardware/idle_skip"].ValueAsDefault<bool>(false);
 
   std::map<std::string, uint32_t> input_flags
   {
@@ -727,52 +824,19 @@ bool GameLoader::ComputeRegionSize(uint32_t *region_size, const GameLoader::Regi
   return error;
 }
 
-// We need to preserve the absolute offsets in order for byte swapping to work
-// properly when chunk size is 1
-static inline void CopyBytes(uint8_t *dest_base, uint32_t dest_offset, const uint8_t *src_base, uint32_t src_offset, uint32_t size, uint32_t byte_swap)
+uint32_t GameLoader::ComputeCacheKey(const Region::ptr_t &region, uint32_t region_size, const ZipArchive &zip) const
 {
-  for (uint32_t i = 0; i < size; i++)
-  {
-    dest_base[(dest_offset + i) ^ byte_swap] = src_base[src_offset + i];
-  }
-}
-
-bool GameLoader::LoadRegion(ROM *rom, const GameLoader::Region::ptr_t &region, const ZipArchive &zip) const
-{
-  bool error = false;
+  // Everything that determines the contents of the region: its layout in the
+  // XML and the CRC and size of each file found in the zip archives
+  Util::Format desc;
+  desc << region->region_name << ',' << region->stride << ',' << region->chunk_size << ',' << region->byte_swap << ',' << region_size;
   for (auto &file: region->files)
   {
-    std::shared_ptr<uint8_t> tmp;
-    size_t file_size;
-    error |= LoadZippedFile(&tmp, &file_size, file, zip);
-    if (!error)
-    {
-      uint8_t *dest = rom->data.get();
-      uint8_t *src = tmp.get();
-      if (region->chunk_size == region->stride)
-      {
-        memcpy(dest + file->offset, src, file_size);
-        if (region->byte_swap)
-          Util::FlipEndian16(dest + file->offset, file_size);
-      }
-      else
-      {
-        uint32_t num_chunks = (uint32_t)file_size / region->chunk_size;
-        uint32_t dest_offset = file->offset;
-        uint32_t src_offset = 0;
-        uint32_t chunk_size = (uint32_t)region->chunk_size;		// cache these as pointer dereferencing cripples performance in a tight loop
-        uint32_t stride = (uint32_t)region->stride;
-        uint32_t byte_swap = region->byte_swap;
-        for (uint32_t i = 0; i < num_chunks; i++)
-        {
-          CopyBytes(dest, dest_offset, src, src_offset, chunk_size, byte_swap);
-          dest_offset += stride;
-          src_offset += chunk_size;
-        }
-      }
-    }
+    const ZippedFile *zipped_file = LookupFile(file, zip);
+    desc << ';' << file->offset << ',' << zipped_file->crc32 << ',' << zipped_file->uncompressed_size;
   }
-  return error;
+  std::string str = desc.str();
+  return crc32(0, (const Bytef *) str.data(), uInt(str.size()));
 }
 
 bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const ZipArchive &zip) const
@@ -787,24 +851,54 @@ bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const Z
   // Load up the ROMs
   auto &regions_by_name = IsChildSet(it->second) ? m_regions_by_merged_game.find(game_name)->second : m_regions_by_game.find(game_name)->second;
   LogROMDefinition(game_name, regions_by_name);
-  bool error = false;
+
+  // Allocate all the regions, then inflate every file into place at once.
+  // Cached regions are mapped from disk instead.
+  std::map<std::string, bool> error_by_region;
+  std::map<std::string, uint32_t> cache_key_by_region;
+  std::vector<FileLoad> loads;
   for (auto &v: regions_by_name)
   {
     auto &region = v.second;
     uint32_t region_size = 0;
-    bool error_loading_region = false;
-
-    // Attempt to load the region
-    if (ComputeRegionSize(&region_size, region, zip))
-      error_loading_region = true;
-    else
+    error_by_region[region->region_name] = ComputeRegionSize(&region_size, region, zip);
+    if (error_by_region[region->region_name])
+      continue;
+    auto &rom = rom_set->rom_by_region[region->region_name];
+    uint32_t key = ComputeCacheKey(region, region_size, zip);
+    rom.key = key;
+    if (m_rom_cache)
+    {
+      if (m_rom_cache->Map(&rom, game_name, region->region_name, key, region_size))
+        continue;
+      cache_key_by_region[region->region_name] = key;
+    }
+    rom.data.reset(new uint8_t[region_size], std::default_delete<uint8_t[]>());
+    rom.size = region_size;
+    for (auto &file: region->files)
     {
-      // Load up the ROM region
-      auto &rom = rom_set->rom_by_region[region->region_name];
-      rom.data.reset(new uint8_t[region_size], std::default_delete<uint8_t[]>());
-      rom.size = region_size;
-      error_loading_region = LoadRegion(&rom, region, zip);
+      FileLoad load;
+      load.region = region;
+      load.file = file;
+      load.zipped_file = LookupFile(file, zip);
+      load.dest = rom.data.get();
+      loads.push_back(load);
     }
+  }
+  LoadFiles(&loads, zip);
+  for (auto &load: loads)
+    error_by_region[load.region->region_name] |= load.error;
+  for (auto &v: cache_key_by_region)
+  {
+    if (!error_by_region[v.first])
+      m_rom_cache->Save(rom_set->rom_by_region[v.first], game_name, v.first, v.second);
+  }
+
+  bool error = false;
+  for (auto &v: regions_by_name)
+  {
+    auto &region = v.second;
+    bool error_loading_region = error_by_region[region->region_name];
 
     if (error_loading_region && !region->required)
     {
@@ -829,7 +923,15 @@ bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const Z
     if (regions_by_name.find(region_name) == regions_by_name.end())
       ErrorLog("%s: Ignoring ROM patch for undefined region '%s' in '%s'.", m_xml_filename.c_str(), region_name.c_str(), game_name.c_str());
     else if (rom_set->rom_by_region.find(region_name) != rom_set->rom_by_region.end())
-      rom_set->rom_by_region[region_name].patches = patches;
+    {
+      auto &rom = rom_set->rom_by_region[region_name];
+      rom.patches = patches;
+      Util::Format desc;
+      for (auto &patch: patches)
+        desc << ';' << patch.offset << ',' << patch.value << ',' << patch.bits;
+      std::string str = desc.str();
+      rom.key = crc32(rom.key, (const Bytef *) str.data(), uInt(str.size()));
+    }
   }
   return error;
 }
@@ -892,6 +994,11 @@ bool GameLoader::Load(Game *game, ROMSet *rom_set, const std::string &zipfilenam
   return error;
 }
 
+void GameLoader::EnableROMCache(const std::string &directory)
+{
+  m_rom_cache = std::make_shared<ROMCache>(directory);
+}
+
 GameLoader::GameLoader(const std::string &xml_file)
 {
   LoadDefinitionXML(xml_file);
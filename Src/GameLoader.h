@@ -5,6 +5,7 @@
 #include "Pkgs/unzip.h"
 #include "Game.h"
 #include "ROMSet.h"
+#include "ROMCache.h"
 #include <map>
 #include <set>
 
@@ -53,16 +54,31 @@ private:
   std::map<std::string, RegionsByName_t> m_regions_by_merged_game;  // only child sets merged w/ parents
   std::string m_xml_filename;
 
+  // Optional on-disk cache of loaded regions
+  std::shared_ptr<ROMCache> m_rom_cache;
+
   // Single compressed file inside of a zip archive
   struct ZippedFile
   {
     unzFile zf = nullptr;
+    size_t archive = 0;       // index of zip archive in ZipArchive
+    unz_file_pos pos;         // position in archive directory, valid for any handle to the archive
     std::string zipfilename;  // zip archive
     std::string filename;     // file inside the zip archive
     size_t uncompressed_size = 0;
     uint32_t crc32 = 0;
   };
 
+  // One file to be inflated into its place in a ROM region
+  struct FileLoad
+  {
+    Region::ptr_t region;
+    File::ptr_t file;
+    const ZippedFile *zipped_file;
+    uint8_t *dest;            // base of ROM region
+    bool error = false;
+  };
+
   // Multiple zip archives
   struct ZipArchive
   {
@@ -82,7 +98,8 @@ private:
   bool LoadZipArchive(ZipArchive *zip, const std::string &zipfilename) const;
   const ZippedFile *LookupFile(const File::ptr_t &file, const ZipArchive &zip) const;
   bool FileExistsInZipArchive(const File::ptr_t &file, const ZipArchive &zip) const;
-  bool LoadZippedFile(std::shared_ptr<uint8_t> *buffer, size_t *file_size, const GameLoader::File::ptr_t &file, const ZipArchive &zip) const;
+  bool LoadZippedFile(const FileLoad &load, unzFile zf) const;
+  void LoadFiles(std::vector<FileLoad> *loads, const ZipArchive &zip) const;
   static bool MissingAttrib(const GameLoader &loader, const Util::Config::Node &node, const std::string &attribute);
   bool LoadGamesFromXML(const Util::Config::Node &xml);
   bool MergeChildrenWithParents();
@@ -96,8 +113,8 @@ private:
     const ZipArchive &zip,
     const std::map<std::string, RegionsByName_t> &regions_by_game) const;
   bool ComputeRegionSize(uint32_t *region_size, const Region::ptr_t &region, const ZipArchive &zip) const;
+  uint32_t ComputeCacheKey(const Region::ptr_t &region, uint32_t region_size, const ZipArchive &zip) const;
   void ChooseGameInZipArchive(std::string *chosen_game, bool *missing_parent_roms, const ZipArchive &zip, const std::string &zipfilename) const;
-  bool LoadRegion(ROM *buffer, const GameLoader::Region::ptr_t &region, const ZipArchive &zip) const;
   bool LoadROMs(ROMSet *rom_set, const std::string &game_name, const ZipArchive &zip) const;
   std::string ChooseGame(const std::set<std::string> &games_found, const std::string &zipfilename) const;
   static bool CompareFilesByName(const File::ptr_t &a,const File::ptr_t &b);
@@ -105,6 +122,7 @@ private:
 public:
   GameLoader(const std::string &xml_file);
   bool Load(Game *game, ROMSet *rom_set, const std::string &zipfilename) const;
+  void EnableROMCache(const std::string &directory);
   const std::map<std::string, Game> &GetGames() const
   {
     return m_game_info_by_game;
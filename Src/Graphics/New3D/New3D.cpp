@@ -5,19 +5,27 @@
 #include <algorithm>
 #include <limits>
 #include <string.h>
+#include <type_traits>
 #include "R3DFloat.h"
+#include "Supermodel.h"
 
 #define MAX_RAM_VERTS 300000	
 #define MAX_ROM_VERTS 1500000
+#define RAM_FRAMES 3				// frames of dynamic polys in a mapped vbo
+
+#define MESH_CACHE_MAGIC	0x4853454D	// "MESH"
+#define MESH_CACHE_VERSION	2
 
 #define BYTE_TO_FLOAT(B)	((2.0f * (B) + 1.0f) * (1.0F/255.0f))
 
 namespace New3D {
 
-CNew3D::CNew3D(const Util::Config::Node &config, std::string gameName)
+CNew3D::CNew3D(const Util::Config::Node &config, std::string gameName, UINT32 vromKey)
 	: m_r3dShader(config),
 	  m_r3dScrollFog(config),
-	  m_gameName(gameName)
+	  m_gameName(gameName),
+	  m_modelThreads(config["New3DThreads"].ValueAsDefault<unsigned>(0)),
+	  m_modelWorkers("New3DModels", m_modelThreads)
 {
 	m_cullingRAMLo	= nullptr;
 	m_cullingRAMHi	= nullptr;
@@ -28,6 +36,8 @@ CNew3D::CNew3D(const Util::Config::Node &config, std::string gameName)
 	m_shadeIsSigned = true;
 	m_numPolyVerts	= 3;			
 	m_primType		= GL_TRIANGLES;
+	m_meshCache		= config["MeshCache"].ValueAsDefault<bool>(false);
+	m_vromKey		= vromKey;
 
 	if (config["QuadRendering"].ValueAs<bool>()) {
 		m_numPolyVerts	= 4;
@@ -37,6 +47,19 @@ CNew3D::CNew3D(const Util::Config::Node &config, std::string gameName)
 
 CNew3D::~CNew3D()
 {
+	if (m_meshCacheLoaded && m_romMap.size() > m_meshCacheModels) {
+		SaveMeshCache();
+	}
+
+	DestroyBatchBuffers();
+	m_textureRAMCopy.Destroy();
+
+	for (auto fence : m_polyRamFences) {
+		if (fence) {
+			glDeleteSync(fence);
+		}
+	}
+
 	m_vbo.Destroy();
 }
 
@@ -66,7 +89,13 @@ void CNew3D::SetStepping(int stepping)
 		m_vertexFactor = (1.0f / 128.0f);		// 17.7
 	}
 
+	// a mapped vbo saves copying the dynamic polys again for glBufferSubData, and stalling if the gpu is still drawing from them
+	if ((GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) && m_vbo.CreateMapped(GL_ARRAY_BUFFER, sizeof(FVertex) * (MAX_RAM_VERTS * RAM_FRAMES + MAX_ROM_VERTS))) {
+		return;
+	}
+
 	m_vbo.Create(GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, sizeof(FVertex) * (MAX_RAM_VERTS + MAX_ROM_VERTS));
+	m_polyBufferRam.resize(MAX_RAM_VERTS);
 }
 
 bool CNew3D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yRes, unsigned totalXResParam, unsigned totalYResParam)
@@ -83,6 +112,14 @@ bool CNew3D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yR
 
 	m_r3dShader.LoadShader();
 
+	if (m_r3dShader.IsBatching()) {
+		CreateBatchBuffers();
+	}
+
+	if (m_r3dShader.DecodesTextures()) {
+		m_textureRAMCopy.Create();
+	}
+
 	m_r3dFrameBuffers.CreateFBO(totalXResParam, totalYResParam);
 
 	glUseProgram(0);
@@ -92,6 +129,14 @@ bool CNew3D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yR
 
 void CNew3D::UploadTextures(unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
 {
+	if (m_r3dShader.DecodesTextures()) {
+		// mipmaps are just more texture RAM, so every level is a straight copy
+		if (m_textureRAMCopyValid) {
+			m_textureRAMCopy.Upload(m_textureRAM, x, y, width, height);
+		}
+		return;
+	}
+
 	if (level == 0) {
 		m_texSheet.Invalidate(x, y, width, height);		// base textures only
 	} 
@@ -166,93 +211,342 @@ CheckScroll:
 	}
 }
 
-bool CNew3D::RenderScene(int priority, bool renderOverlay, Layer layer)
+void CNew3D::BuildDrawLists()
 {
-	bool hasOverlay = false;		// (high priority polys)
+	static const Layer layers[3] = { Layer::colour, Layer::trans1, Layer::trans2 };
+
+	for (auto &lists : m_drawLists) {
+		for (auto &overlay : lists.commands) {
+			for (auto &commands : overlay) {
+				commands.clear();		// keeps capacity between frames
+			}
+		}
+		lists.hasModels		= false;
+		lists.hasOverlay	= false;
+	}
+
+	bool batching = m_r3dShader.IsBatching();
+	bool decodeTextures = m_r3dShader.DecodesTextures();
+
+	m_drawData.clear();
+	m_drawIndirect.clear();
 
 	for (auto &n : m_nodes) {
 
-		if (n.viewport.priority != priority || n.models.empty()) {
+		if (n.models.empty()) {
 			continue;
 		}
 
-		std::shared_ptr<Texture> tex1;
+		int priority = n.viewport.priority;
+		DrawLists& lists = m_drawLists[priority];
+		lists.hasModels = true;
 
 		CalcViewport(&n.viewport, std::abs(m_nfPairs[priority].zNear*0.96f), std::abs(m_nfPairs[priority].zFar*1.05f));	// make planes 5% bigger
-		glViewport(n.viewport.x, n.viewport.y, n.viewport.width, n.viewport.height);
-
-		m_r3dShader.SetViewportUniforms(&n.viewport);
 
 		for (auto &m : n.models) {
+			for (auto &mesh : *m.meshes) {
 
-			bool matrixLoaded = false;
+				DrawCommand cmd;
+				cmd.node		= &n;
+				cmd.model		= &m;
+				cmd.mesh		= &mesh;
+				cmd.texX		= 0;
+				cmd.texY		= 0;
+				cmd.microX		= 0;
+				cmd.microY		= 0;
+				cmd.drawIndex	= 0;
+				cmd.indirect	= 0;
 
-			if (m.meshes->empty()) {
-				continue;
-			}
-
-			for (auto &mesh : *m.meshes) {
+				if (mesh.textured) {
+					CalcTexOffset(m.textureOffsetX, m.textureOffsetY, m.page, mesh.x, mesh.y, cmd.texX, cmd.texY);
 
-				if (mesh.highPriority) {
-					hasOverlay = true;
+					if (mesh.microTexture && decodeTextures) {
+						m_texSheet.GetMicrotexPos(cmd.texY / 1024, mesh.microTextureID, cmd.microX, cmd.microY);
+					}
 				}
 
-				if (!mesh.Render(layer)) continue;
-				if (mesh.highPriority != renderOverlay) continue;
+				if (batching) {
 
-				if (!matrixLoaded) {
-					m_r3dShader.SetModelStates(&m);
-					matrixLoaded = true;		// do this here to stop loading matrices we don't need. Ie when rendering non transparent etc
+					cmd.drawIndex = (int)(m_drawData.size() / (R3DShader::DRAW_DATA_TEXELS * 4));
+					m_drawData.resize(m_drawData.size() + R3DShader::DRAW_DATA_TEXELS * 4);
+					R3DShader::GetDrawData(&m, &mesh, cmd.texX, cmd.texY, cmd.microX, cmd.microY, &m_drawData[cmd.drawIndex * R3DShader::DRAW_DATA_TEXELS * 4]);
 				}
-				
-				if (mesh.textured) {
 
-					int x, y;
-					CalcTexOffset(m.textureOffsetX, m.textureOffsetY, m.page, mesh.x, mesh.y, x, y);
+				if (mesh.highPriority) {
+					lists.hasOverlay = true;
+				}
 
-					if (tex1 && tex1->Compare(x, y, mesh.width, mesh.height, mesh.format)) {
-						// texture already bound
-					}
-					else {
-						tex1 = m_texSheet.BindTexture(m_textureRAM, mesh.format, x, y, mesh.width, mesh.height);
-						if (tex1) {
-							tex1->BindTexture();
-						}
+				for (int i = 0; i < 3; i++) {
+					if (mesh.Render(layers[i])) {
+						lists.commands[mesh.highPriority][i].push_back(cmd);
 					}
+				}
+			}
+		}
+	}
 
-					if (mesh.microTexture) {
+	if (!batching) {
+		return;
+	}
 
-						int mX, mY;
-						glActiveTexture(GL_TEXTURE1);
-						m_texSheet.GetMicrotexPos(y / 1024, mesh.microTextureID, mX, mY);
-						auto tex2 = m_texSheet.BindTexture(m_textureRAM, 0, mX, mY, 128, 128);
-						if (tex2) {
-							tex2->BindTexture();
-						}
-						glActiveTexture(GL_TEXTURE0);
-					}
+	// the indirect commands follow the draw lists, so each batch is a contiguous range of them
+	for (auto &lists : m_drawLists) {
+		for (auto &overlay : lists.commands) {
+			for (auto &commands : overlay) {
+				for (auto &cmd : commands) {
+
+					DrawArraysIndirect indirect;
+					indirect.count			= cmd.mesh->vertexCount;
+					indirect.instanceCount	= 1;
+					indirect.first			= cmd.mesh->vboOffset;
+					indirect.baseInstance	= cmd.drawIndex % m_rangeDraws;		// index within its range of the draw data
+
+					cmd.indirect = (int)m_drawIndirect.size();
+					m_drawIndirect.push_back(indirect);
 				}
-				
-				m_r3dShader.SetMeshUniforms(&mesh);
-				glDrawArrays(m_primType, mesh.vboOffset, mesh.vertexCount);
 			}
 		}
 	}
+}
+
+void CNew3D::RenderDrawList(const std::vector<DrawCommand>& commands)
+{
+	if (m_r3dShader.IsBatching()) {
+		RenderDrawBatches(commands);
+		return;
+	}
+
+	const Node* node = nullptr;
+	const Model* model = nullptr;
+	std::shared_ptr<Texture> tex1;
+
+	for (const auto &cmd : commands) {
 
-	return hasOverlay;
+		if (cmd.node != node) {
+			node	= cmd.node;
+			model	= nullptr;
+			tex1	= nullptr;
+			glViewport(node->viewport.x, node->viewport.y, node->viewport.width, node->viewport.height);
+			m_r3dShader.SetViewportUniforms(&node->viewport);
+		}
+
+		if (cmd.model != model) {
+			model = cmd.model;
+			m_r3dShader.SetModelStates(model);
+		}
+
+		const Mesh& mesh = *cmd.mesh;
+
+		if (m_r3dShader.DecodesTextures()) {
+			m_r3dShader.SetTexturePos(cmd.texX, cmd.texY, cmd.microX, cmd.microY);
+		}
+		else if (mesh.textured) {
+
+			BindBaseTexture(cmd, tex1);
+
+			if (mesh.microTexture) {
+				BindMicroTexture(cmd);
+			}
+		}
+
+		m_r3dShader.SetMeshUniforms(&mesh);
+		glDrawArrays(m_primType, mesh.vboOffset, mesh.vertexCount);
+	}
 }
 
-bool CNew3D::SkipLayer(int layer)
+void CNew3D::RenderDrawBatches(const std::vector<DrawCommand>& commands)
 {
-	for (const auto &n : m_nodes) {
-		if (n.viewport.priority == layer) {
-			if (n.models.size()) {
-				return false;
+	const Node* node = nullptr;
+	std::shared_ptr<Texture> tex1;
+	bool decodeTextures = m_r3dShader.DecodesTextures();
+	int layered = -1;
+	size_t i = 0;
+
+	while (i < commands.size()) {
+
+		// a batch is a run of meshes that share the viewport, stencil state and bound textures
+		const DrawCommand& first = commands[i];
+		const DrawCommand* texCmd = nullptr;		// first textured mesh in the batch
+		const DrawCommand* microCmd = nullptr;		// first micro textured mesh in the batch
+		size_t end = i;
+
+		for (; end < commands.size(); end++) {
+
+			const DrawCommand& cmd = commands[end];
+			const Mesh& mesh = *cmd.mesh;
+
+			if (cmd.node != first.node || mesh.layered != first.mesh->layered || cmd.drawIndex / m_rangeDraws != first.drawIndex / m_rangeDraws) {
+				break;
+			}
+
+			if (!mesh.textured || decodeTextures) {
+				continue;		// texture positions are in the draw data when the shader decodes textures
+			}
+
+			if (texCmd && (cmd.texX != texCmd->texX || cmd.texY != texCmd->texY || mesh.width != texCmd->mesh->width || mesh.height != texCmd->mesh->height || mesh.format != texCmd->mesh->format)) {
+				break;
+			}
+
+			if (mesh.microTexture && microCmd && (cmd.texY / 1024 != microCmd->texY / 1024 || mesh.microTextureID != microCmd->mesh->microTextureID)) {
+				break;
+			}
+
+			if (!texCmd) {
+				texCmd = &cmd;
+			}
+
+			if (mesh.microTexture && !microCmd) {
+				microCmd = &cmd;
 			}
 		}
+
+		if (first.node != node) {
+			node	= first.node;
+			tex1	= nullptr;
+			glViewport(node->viewport.x, node->viewport.y, node->viewport.width, node->viewport.height);
+			m_r3dShader.SetViewportUniforms(&node->viewport);
+		}
+
+		BindDrawRange(first.drawIndex / m_rangeDraws);
+
+		if (texCmd) {
+			BindBaseTexture(*texCmd, tex1);
+		}
+
+		if (microCmd) {
+			BindMicroTexture(*microCmd);
+		}
+
+		if (first.mesh->layered != (layered == 1)) {
+			layered = first.mesh->layered;
+			if (layered) {
+				glEnable(GL_STENCIL_TEST);
+			}
+			else {
+				glDisable(GL_STENCIL_TEST);
+			}
+		}
+
+		glMultiDrawArraysIndirect(m_primType, (const void*)(first.indirect * sizeof(DrawArraysIndirect)), (GLsizei)(end - i), 0);
+
+		i = end;
 	}
+}
 
-	return true;
+void CNew3D::BindBaseTexture(const DrawCommand& cmd, std::shared_ptr<Texture>& tex1)
+{
+	const Mesh& mesh = *cmd.mesh;
+
+	if (tex1 && tex1->Compare(cmd.texX, cmd.texY, mesh.width, mesh.height, mesh.format)) {
+		return;		// texture already bound
+	}
+
+	tex1 = m_texSheet.BindTexture(m_textureRAM, mesh.format, cmd.texX, cmd.texY, mesh.width, mesh.height);
+	if (tex1) {
+		tex1->BindTexture();
+	}
+}
+
+void CNew3D::BindMicroTexture(const DrawCommand& cmd)
+{
+	int mX, mY;
+	glActiveTexture(GL_TEXTURE1);
+	m_texSheet.GetMicrotexPos(cmd.texY / 1024, cmd.mesh->microTextureID, mX, mY);
+	auto tex2 = m_texSheet.BindTexture(m_textureRAM, 0, mX, mY, 128, 128);
+	if (tex2) {
+		tex2->BindTexture();
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void CNew3D::CreateBatchBuffers()
+{
+	GLint maxTexels = 0;
+	GLint alignment = 1;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	// big scenes can have more draws than the buffer texture can address (65536 texels is all GL promises),
+	// so the draw data is split into ranges that each start on an offset the buffer texture can be bound at
+	m_rangeDraws = maxTexels / R3DShader::DRAW_DATA_TEXELS;
+	m_rangeDraws -= m_rangeDraws % std::max(alignment, 1);
+	m_rangeDraws = std::max(m_rangeDraws, 1);
+
+	glGenBuffers(1, &m_drawDataBuffer);
+	glGenBuffers(1, &m_drawIndexBuffer);
+	glGenBuffers(1, &m_indirectBuffer);
+
+	// the buffer texture follows the buffer when its storage is respecified each frame
+	glBindBuffer(GL_TEXTURE_BUFFER, m_drawDataBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, R3DShader::DRAW_DATA_TEXELS * 4 * sizeof(GLfloat), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glGenTextures(1, &m_drawDataTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, m_drawDataTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_drawDataBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void CNew3D::DestroyBatchBuffers()
+{
+	if (m_drawDataTexture) {
+		glDeleteTextures(1, &m_drawDataTexture);
+		glDeleteBuffers(1, &m_drawDataBuffer);
+		glDeleteBuffers(1, &m_drawIndexBuffer);
+		glDeleteBuffers(1, &m_indirectBuffer);
+		m_drawDataTexture	= 0;
+		m_drawDataBuffer	= 0;
+		m_drawIndexBuffer	= 0;
+		m_indirectBuffer	= 0;
+		m_drawIndexCount	= 0;
+	}
+}
+
+void CNew3D::UploadBatchBuffers()
+{
+	int draws = std::min((int)(m_drawData.size() / (R3DShader::DRAW_DATA_TEXELS * 4)), m_rangeDraws);
+
+	if (draws > m_drawIndexCount) {
+
+		m_drawIndexCount = std::max(draws, m_drawIndexCount * 2);
+
+		std::vector<GLint> indexes(m_drawIndexCount);
+		for (int i = 0; i < m_drawIndexCount; i++) {
+			indexes[i] = i;
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_drawIndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, indexes.size() * sizeof(GLint), indexes.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// respecifying the storage lets the driver hand us a new buffer while last frame's is still in use
+	glBindBuffer(GL_TEXTURE_BUFFER, m_drawDataBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, m_drawData.size() * sizeof(GLfloat), m_drawData.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	m_drawRange = -1;		// the buffer texture has to be pointed at the new storage
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, m_drawIndirect.size() * sizeof(DrawArraysIndirect), m_drawIndirect.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void CNew3D::BindDrawRange(int range)
+{
+	if (range == m_drawRange) {
+		return;
+	}
+
+	GLsizeiptr rangeSize	= (GLsizeiptr)m_rangeDraws * R3DShader::DRAW_DATA_TEXELS * 4 * sizeof(GLfloat);
+	GLintptr offset			= range * rangeSize;
+	GLsizeiptr size			= std::min<GLsizeiptr>(rangeSize, m_drawData.size() * sizeof(GLfloat) - offset);
+
+	glActiveTexture(GL_TEXTURE2);
+	glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, m_drawDataBuffer, offset, size);
+	glActiveTexture(GL_TEXTURE0);
+
+	m_drawRange = range;
 }
 
 void CNew3D::SetRenderStates()
@@ -275,10 +569,28 @@ void CNew3D::SetRenderStates()
 	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inFaceNormal"), 3, GL_FLOAT, GL_FALSE, sizeof(FVertex), (void*)offsetof(FVertex, faceNormal));
 	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inFixedShade"), 1, GL_FLOAT, GL_FALSE, sizeof(FVertex), (void*)offsetof(FVertex, fixedShade));
 
+	if (m_r3dShader.IsBatching()) {
+		GLint drawIndex = m_r3dShader.GetVertexAttribPos("inDrawIndex");
+		glBindBuffer(GL_ARRAY_BUFFER, m_drawIndexBuffer);
+		glEnableVertexAttribArray(drawIndex);
+		glVertexAttribIPointer(drawIndex, 1, GL_INT, sizeof(GLint), 0);
+		glVertexAttribDivisor(drawIndex, 1);						// one value per draw, starting at the base instance
+		m_vbo.Bind(true);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_BUFFER, m_drawDataTexture);
+	}
+
 	glDepthFunc		(GL_LEQUAL);
 	glEnable		(GL_DEPTH_TEST);
 	glDepthMask		(GL_TRUE);
 	glActiveTexture	(GL_TEXTURE0);
+
+	if (m_r3dShader.DecodesTextures()) {
+		m_textureRAMCopy.Bind();
+	}
+
 	glDisable		(GL_CULL_FACE);					// we'll emulate this in the shader		
 	glDisable		(GL_BLEND);
 
@@ -300,6 +612,17 @@ void CNew3D::DisableRenderStates()
 	glDisableVertexAttribArray(3);
 	glDisableVertexAttribArray(4);
 	glDisableVertexAttribArray(5);
+
+	if (m_r3dShader.IsBatching()) {
+		GLint drawIndex = m_r3dShader.GetVertexAttribPos("inDrawIndex");
+		glVertexAttribDivisor(drawIndex, 0);
+		glDisableVertexAttribArray(drawIndex);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
 }
 
 void CNew3D::RenderFrame(void)
@@ -317,17 +640,37 @@ void CNew3D::RenderFrame(void)
 		}
 	}
 
+	// ROM models from a previous run are uploaded by the rom memory sync below, in one go
+	if (m_meshCache && !m_meshCacheLoaded) {
+		LoadMeshCache();
+	}
+
+	// texture RAM is copied whole once, after that only the rectangles the game uploads
+	if (m_r3dShader.DecodesTextures() && !m_textureRAMCopyValid && m_textureRAM) {
+		m_textureRAMCopy.Upload(m_textureRAM, 0, 0, 2048, 2048);
+		m_textureRAMCopyValid = true;
+	}
+
 	// release any resources from last frame
-	m_polyBufferRam.clear();		// clear dyanmic model memory buffer
-	m_nodes.clear();				// memory will grow during the object life time, that's fine, no need to shrink to fit
+	BeginPolyRam();					// start this frame's dynamic model memory
+	RecycleNodes();					// memory will grow during the object life time, that's fine, no need to shrink to fit
 	m_modelMat.Release();			// would hope we wouldn't need this but no harm in checking
 	m_nodeAttribs.Reset();
 
 	RenderViewport(0x800000);						// build model structure
+	FinishModels();									// build any models deferred to the worker threads
 	DrawScrollFog();								// fog layer if applicable must be drawn here
+	BuildDrawLists();								// meshes to draw in each pass
+
+	if (m_r3dShader.IsBatching()) {
+		UploadBatchBuffers();
+	}
 	
 	m_vbo.Bind(true);
-	m_vbo.BufferSubData(MAX_ROM_VERTS*sizeof(FVertex), m_polyBufferRam.size()*sizeof(FVertex), m_polyBufferRam.data());	// upload all the dynamic data to GPU in one go
+
+	if (!m_vbo.GetMapping()) {
+		m_vbo.BufferSubData(MAX_ROM_VERTS*sizeof(FVertex), m_polyRamSize*sizeof(FVertex), m_polyBufferRam.data());	// upload all the dynamic data to GPU in one go
+	}
 
 	if (m_polyBufferRom.size()) {
 
@@ -342,6 +685,7 @@ void CNew3D::RenderFrame(void)
 			if (m_polyBufferRom.size() >= MAX_ROM_VERTS) {
 				m_polyBufferRom.clear();
 				m_romMap.clear();
+				WaitPolyRamFences();		// rom data is about to be written over, mapped memory isn't synchronised for us
 				m_vbo.Reset();
 			}
 			else {
@@ -355,11 +699,9 @@ void CNew3D::RenderFrame(void)
 
 	for (int pri = 0; pri <= 3; pri++) {
 
-		//==============
-		bool hasOverlay;
-		//==============
+		const DrawLists& lists = m_drawLists[pri];
 
-		if (SkipLayer(pri)) continue;
+		if (!lists.hasModels) continue;
 
 		for (int i = 0; i < 2; i++) {
 
@@ -372,7 +714,7 @@ void CNew3D::RenderFrame(void)
 
 			m_r3dShader.DiscardAlpha(true);						// discard all translucent pixels in opaque pass
 			m_r3dFrameBuffers.SetFBO(Layer::colour);
-			hasOverlay = RenderScene(pri, renderOverlay, Layer::colour);
+			RenderDrawList(lists.commands[i][0]);
 
 			if (!renderOverlay && ProcessLos(pri)) {
 				ProcessLos(pri);
@@ -390,19 +732,21 @@ void CNew3D::RenderFrame(void)
 			m_r3dShader.DiscardAlpha		(false);			// render only translucent pixels
 			m_r3dFrameBuffers.StoreDepth	();					// save depth buffer for 1st trans pass
 			m_r3dFrameBuffers.SetFBO		(Layer::trans1);
-			RenderScene						(pri, renderOverlay, Layer::trans1);
+			RenderDrawList					(lists.commands[i][1]);
 
 			m_r3dFrameBuffers.RestoreDepth	();					// restore depth buffer, trans layers don't seem to depth test against each other
 			m_r3dFrameBuffers.SetFBO		(Layer::trans2);
-			RenderScene						(pri, renderOverlay, Layer::trans2);
+			RenderDrawList					(lists.commands[i][2]);
 
 			DisableRenderStates();
 
-			if (!hasOverlay) break;								// no high priority polys						
+			if (!lists.hasOverlay) break;								// no high priority polys						
 		}
 	}
 
 	m_r3dFrameBuffers.CompositeAlphaLayer();
+
+	EndPolyRam();
 }
 
 void CNew3D::BeginFrame(void)
@@ -478,7 +822,7 @@ bool CNew3D::DrawModel(UINT32 modelAddr)
 		m->dynamic = false;
 	}
 	else {
-		m->meshes = std::make_shared<std::vector<Mesh>>();
+		m->meshes = AllocMeshes();
 	}
 
 	// copy current model matrix
@@ -492,17 +836,218 @@ bool CNew3D::DrawModel(UINT32 modelAddr)
 	m->page = m_nodeAttribs.currentPage;
 	m->scale = m_nodeAttribs.currentModelScale;
 
-	if (!cached) {
-		CacheModel(m, modelAddress);
+	bool clip = m_nodeAttribs.currentClipStatus != Clip::INSIDE;
+
+	if (m_modelThreads) {
+
+		if (m->dynamic) {
+			DeferModel(modelAddress, clip);		// built and clipped by FinishModels()
+			return true;
+		}
+
+		if (!cached) {
+			if (m_chainOpen && SharesPrevVertices(modelAddress)) {
+				BuildChain(m_modelChains.back());	// need the vertices the last deferred model finishes with
+				CopyPrevVertices(m_modelChains.back().prev, m_modelChains.back().prevTexCoords, m_prev, m_prevTexCoords);
+			}
+			m_chainOpen = false;
+			CacheModel(m, modelAddress, m_builtMeshes);
+		}
+
+		if (clip) {
+			DeferModel(nullptr, true);
+		}
+
+		return true;
 	}
 
-	if (m_nodeAttribs.currentClipStatus != Clip::INSIDE) {
-		ClipModel(m);	// not storing clipped values, only working out the Z range
+	if (cached) {
+		if (clip) {
+			ClipModel(m, m_planes, m_nfPairs[m_currentPriority]);	// not storing clipped values, only working out the Z range
+		}
+		return true;
+	}
+
+	CacheModel(m, modelAddress, m_builtMeshes);
+
+	if (clip) {
+		ClipModel(m, m_builtMeshes, m_planes, m_nfPairs[m_currentPriority]);
 	}
 
 	return true;
 }
 
+/*
+ * Parallel model building
+ *
+ * When worker threads are enabled, the scene graph is still walked in order
+ * by the render thread since the matrix stack and node attributes depend on
+ * it, but decoding dynamic models and working out the Z range of clipped
+ * models is deferred to FinishModels(). Models are decoded into their own
+ * vertex arrays in parallel and then merged into m_polyBufferRam in traversal
+ * order, so the vertex buffer ends up exactly as the single threaded path
+ * would have built it.
+ *
+ * Decoding a model can pick up the last vertices of the model decoded before
+ * it (see m_prev), so models starting with shared vertices are chained to the
+ * previous deferred model and built by the same thread in order.
+ */
+
+bool CNew3D::SharesPrevVertices(const UINT32 *data)
+{
+	if (data == NULL) {
+		return false;
+	}
+
+	PolyHeader ph;
+	ph = data;
+
+	if (ph.header[6] == 0) {
+		return false;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		if (ph.SharedVertex(i)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CNew3D::CopyPrevVertices(const Vertex src[4], const UINT16 srcTexCoords[4][2], Vertex dst[4], UINT16 dstTexCoords[4][2])
+{
+	for (int i = 0; i < 4; i++) {
+		dst[i] = src[i];
+		dstTexCoords[i][0] = srcTexCoords[i][0];
+		dstTexCoords[i][1] = srcTexCoords[i][1];
+	}
+}
+
+void CNew3D::DeferModel(const UINT32 *data, bool clip)
+{
+	if (m_numDeferred == m_deferredModels.size()) {
+		m_deferredModels.emplace_back();
+	}
+
+	DeferredModel& d = m_deferredModels[m_numDeferred++];
+
+	d.node	= m_nodes.size() - 1;
+	d.model	= m_nodes.back().models.size() - 1;
+	d.data	= data;
+	d.clip	= clip;
+
+	d.colorTableAddr = m_colorTableAddr;	// later culling nodes can change it before the model is built
+
+	d.meshes.count = 0;		// still holds last frame's meshes until it is built
+
+	for (int i = 0; i < 5; i++) {
+		d.planes[i] = m_planes[i];
+	}
+
+	if (data == NULL) {
+		return;
+	}
+
+	if (!m_chainOpen || !SharesPrevVertices(data)) {
+		m_modelChains.emplace_back();
+		CopyPrevVertices(m_prev, m_prevTexCoords, m_modelChains.back().prev, m_modelChains.back().prevTexCoords);
+	}
+
+	m_modelChains.back().models.push_back(m_numDeferred - 1);
+	m_chainOpen = true;
+}
+
+void CNew3D::BuildChain(ModelChain& chain)
+{
+	if (chain.built) {
+		return;
+	}
+
+	for (auto i : chain.models) {
+		DeferredModel& d = m_deferredModels[i];
+		BuildMeshes(d.data, d.colorTableAddr, chain.prev, chain.prevTexCoords, d.meshes);
+	}
+
+	chain.built = true;
+}
+
+void CNew3D::MergeModel(DeferredModel& d, NFPair nfPairs[4])
+{
+	const Model& m = m_nodes[d.node].models[d.model];
+
+	for (const auto& mesh : d.meshes) {
+		std::copy(mesh.verts.begin(), mesh.verts.end(), m_polyRam + (mesh.vboOffset - m_polyRamBase));
+	}
+
+	if (!d.clip) {
+		return;
+	}
+
+	if (d.data) {
+		ClipModel(&m, d.meshes, d.planes, nfPairs[m_nodes[d.node].viewport.priority]);
+	}
+	else {
+		ClipModel(&m, d.planes, nfPairs[m_nodes[d.node].viewport.priority]);
+	}
+}
+
+void CNew3D::FinishModels()
+{
+	if (m_numDeferred == 0) {
+		return;
+	}
+
+	m_threadNFPairs.resize((m_modelWorkers.NumWorkers() + 1) * 4);
+
+	for (auto& nf : m_threadNFPairs) {
+		nf.zNear = -std::numeric_limits<float>::max();
+		nf.zFar  =  std::numeric_limits<float>::max();
+	}
+
+	m_modelWorkers.Run(m_modelChains.size(), [this](size_t i, unsigned) { BuildChain(m_modelChains[i]); });
+
+	// lay out the vertices in traversal order
+	for (size_t i = 0; i < m_numDeferred; i++) {
+
+		DeferredModel& d = m_deferredModels[i];
+
+		if (d.data == NULL) {
+			continue;
+		}
+
+		auto& meshes = *m_nodes[d.node].models[d.model].meshes;
+
+		meshes.reserve(d.meshes.size());
+
+		for (auto& mesh : d.meshes) {
+			if (AllocPolyRam(mesh)) {
+				meshes.push_back(mesh);
+			}
+			else {
+				mesh.verts.clear();		// out of room, nothing to copy or clip
+			}
+		}
+	}
+
+	// copy the vertices into place and work out the Z ranges, min/max don't care about the order
+	m_modelWorkers.Run(m_numDeferred, [this](size_t i, unsigned slot) { MergeModel(m_deferredModels[i], &m_threadNFPairs[slot * 4]); });
+
+	for (size_t i = 0; i < m_threadNFPairs.size(); i++) {
+		m_nfPairs[i % 4].zNear = std::max(m_threadNFPairs[i].zNear, m_nfPairs[i % 4].zNear);
+		m_nfPairs[i % 4].zFar  = std::min(m_threadNFPairs[i].zFar, m_nfPairs[i % 4].zFar);
+	}
+
+	// carry the shared vertices over as if the models had been built in order
+	if (m_chainOpen) {
+		CopyPrevVertices(m_modelChains.back().prev, m_modelChains.back().prevTexCoords, m_prev, m_prevTexCoords);
+	}
+
+	m_numDeferred = 0;
+	m_modelChains.clear();
+	m_chainOpen = false;
+}
+
 // Descends into a 10-word culling node
 void CNew3D::DescendCullingNode(UINT32 addr)
 {
@@ -813,7 +1358,14 @@ void CNew3D::RenderViewport(UINT32 addr)
 
 		// create node object 
 		m_nodes.emplace_back(Node());
-		m_nodes.back().models.reserve(2048);				// create space for models
+
+		if (m_spareModels.size()) {
+			m_nodes.back().models.swap(m_spareModels.back());	// space for models, from last frame's nodes
+			m_spareModels.pop_back();
+		}
+		else {
+			m_nodes.back().models.reserve(2048);				// create space for models
+		}
 
 		// get pointer to its viewport
 		Viewport *vp = &m_nodes.back().viewport;
@@ -1066,14 +1618,145 @@ void CNew3D::SetMeshValues(SortingMesh *currentMesh, PolyHeader &ph)
 	}
 }
 
-void CNew3D::CacheModel(Model *m, const UINT32 *data)
+void CNew3D::CacheModel(Model *m, const UINT32 *data, BuiltMeshes& meshes)
+{
+	BuildMeshes(data, m_colorTableAddr, m_prev, m_prevTexCoords, meshes);
+
+	// we know how many meshes we have so reserve appropriate space
+	m->meshes->reserve(meshes.size());
+
+	for (auto& mesh : meshes) {
+
+		if (m->dynamic) {
+
+			// calculate VBO values for current mesh
+			if (!AllocPolyRam(mesh)) {
+				mesh.verts.clear();		// out of room, lose the mesh for this frame
+				continue;
+			}
+
+			// copy poly data straight to this frame's part of the VBO, or the buffer that is uploaded in one go
+			std::copy(mesh.verts.begin(), mesh.verts.end(), m_polyRam + (mesh.vboOffset - m_polyRamBase));
+		}
+		else {
+			// calculate VBO values for current mesh
+			mesh.vboOffset		= (int)m_polyBufferRom.size();
+			mesh.vertexCount	= (int)mesh.verts.size();
+
+			// copy poly data to main buffer
+			m_polyBufferRom.insert(m_polyBufferRom.end(), mesh.verts.begin(), mesh.verts.end());
+		}
+
+		//copy the temp mesh into the model structure
+		//this will lose the associated vertex data, which is now copied to the main buffer anyway
+		m->meshes->push_back(mesh);
+	}
+}
+
+std::shared_ptr<std::vector<Mesh>> CNew3D::AllocMeshes()
+{
+	// dynamic models are rebuilt every frame, so their mesh arrays are handed out again each frame instead of being freed
+	// an array can only be reused once no model holds on to it
+	while (m_meshPoolUsed < m_meshPool.size()) {
+
+		auto& meshes = m_meshPool[m_meshPoolUsed++];
+
+		if (meshes.use_count() == 1) {
+			meshes->clear();		// keeps capacity
+			return meshes;
+		}
+	}
+
+	m_meshPool.push_back(std::make_shared<std::vector<Mesh>>());
+	m_meshPoolUsed = m_meshPool.size();
+
+	return m_meshPool.back();
+}
+
+void CNew3D::RecycleNodes()
+{
+	// last frame's models must be released before their mesh arrays can be handed out again
+	for (auto& n : m_nodes) {
+		n.models.clear();
+		m_spareModels.emplace_back();
+		m_spareModels.back().swap(n.models);
+	}
+
+	m_nodes.clear();
+	m_meshPoolUsed = 0;
+}
+
+bool CNew3D::AllocPolyRam(SortingMesh& mesh)
+{
+	int numVerts = (int)mesh.verts.size();
+
+	if (m_polyRamSize + numVerts > MAX_RAM_VERTS) {
+		return false;
+	}
+
+	mesh.vboOffset		= m_polyRamBase + m_polyRamSize;
+	mesh.vertexCount	= numVerts;
+	m_polyRamSize		+= numVerts;
+
+	return true;
+}
+
+void CNew3D::BeginPolyRam()
+{
+	m_polyRamSize = 0;
+
+	if (!m_vbo.GetMapping()) {
+		m_polyRam		= m_polyBufferRam.data();
+		m_polyRamBase	= MAX_ROM_VERTS;
+		return;
+	}
+
+	m_polyRamFrame = (m_polyRamFrame + 1) % RAM_FRAMES;
+
+	// wait for the gpu to finish with this part of the vbo, it was last drawn from RAM_FRAMES - 1 frames ago so this shouldn't block
+	GLsync& fence = m_polyRamFences[m_polyRamFrame];
+
+	if (fence) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	m_polyRamBase	= MAX_ROM_VERTS + m_polyRamFrame * MAX_RAM_VERTS;
+	m_polyRam		= (FVertex*)m_vbo.GetMapping() + m_polyRamBase;
+}
+
+void CNew3D::WaitPolyRamFences()
+{
+	// the gpu may still be drawing from any part of the vbo for the frames in flight
+	for (auto& fence : m_polyRamFences) {
+		if (fence) {
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+			glDeleteSync(fence);
+			fence = 0;
+		}
+	}
+}
+
+void CNew3D::EndPolyRam()
+{
+	if (m_vbo.GetMapping()) {
+		m_polyRamFences[m_polyRamFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+void CNew3D::BuildMeshes(const UINT32 *data, UINT32 colorTableAddr, Vertex prev[4], UINT16 prevTexCoords[4][2], BuiltMeshes& meshes)
 {
 	UINT16			texCoords[4][2];
 	PolyHeader		ph;
 	UINT64			lastHash	= -1;
 	SortingMesh*	currentMesh = nullptr;
-	
-	std::map<UINT64, SortingMesh> sMap;
+
+	// meshes are handed back in hash order, there are only ever a handful per model so they are kept sorted in place
+	std::vector<UINT64>& hashes = meshes.hashes;
+
+	hashes.clear();
+	meshes.count = 0;
 
 	if (data == NULL)
 		return;
@@ -1097,11 +1780,26 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 
 		if (hash != lastHash) {
 
-			if (sMap.count(hash) == 0) {
+			auto it = std::lower_bound(hashes.begin(), hashes.end(), hash);
+			auto index = it - hashes.begin();
+
+			if (it == hashes.end() || *it != hash) {
+
+				hashes.insert(it, hash);
+
+				// reuse the first spare mesh, rotating it into place only swaps vertex arrays around
+				if (meshes.count == meshes.meshes.size()) {
+					meshes.meshes.emplace_back();
+				}
+
+				SortingMesh& spare = meshes.meshes[meshes.count];
+				static_cast<Mesh&>(spare) = Mesh();
+				spare.verts.clear();
 
-				sMap[hash] = SortingMesh();
+				std::rotate(meshes.meshes.begin() + index, meshes.meshes.begin() + meshes.count, meshes.meshes.begin() + meshes.count + 1);
+				meshes.count++;
 
-				currentMesh = &sMap[hash];
+				currentMesh = &meshes.meshes[index];
 
 				//make space for our vertices
 				currentMesh->verts.reserve(numTriangles * 3);
@@ -1110,7 +1808,7 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 				SetMeshValues(currentMesh, ph);
 			}
 
-			currentMesh = &sMap[hash];
+			currentMesh = &meshes.meshes[index];
 		}
 
 		// Obtain basic polygon parameters
@@ -1126,10 +1824,10 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 		{
 			if (ph.SharedVertex(i))
 			{
-				p.v[j] = m_prev[i];
+				p.v[j] = prev[i];
 
-				texCoords[j][0] = m_prevTexCoords[i][0];
-				texCoords[j][1] = m_prevTexCoords[i][1];
+				texCoords[j][0] = prevTexCoords[i][0];
+				texCoords[j][1] = prevTexCoords[i][1];
 
 				//check if we need to recalc tex coords - will only happen if tex tiles are different + sharing vertices
 				if (hash != lastHash) {
@@ -1148,9 +1846,9 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 
 		if (!ph.PolyColor()) {
 			int colorIdx = ph.ColorIndex();
-			p.faceColour[2] = (m_polyRAM[m_colorTableAddr + colorIdx] & 0xFF);
-			p.faceColour[1] = ((m_polyRAM[m_colorTableAddr + colorIdx] >> 8) & 0xFF);
-			p.faceColour[0] = ((m_polyRAM[m_colorTableAddr + colorIdx] >> 16) & 0xFF);
+			p.faceColour[2] = (m_polyRAM[colorTableAddr + colorIdx] & 0xFF);
+			p.faceColour[1] = ((m_polyRAM[colorTableAddr + colorIdx] >> 8) & 0xFF);
+			p.faceColour[0] = ((m_polyRAM[colorTableAddr + colorIdx] >> 16) & 0xFF);
 		}
 		else {
 			p.faceColour[0] = ((ph.header[4] >> 24));
@@ -1251,42 +1949,12 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 		
 		// Copy current vertices into previous vertex array
 		for (i = 0; i < 4; i++) {
-			m_prev[i] = p.v[i];
-			m_prevTexCoords[i][0] = texCoords[i][0];
-			m_prevTexCoords[i][1] = texCoords[i][1];
+			prev[i] = p.v[i];
+			prevTexCoords[i][0] = texCoords[i][0];
+			prevTexCoords[i][1] = texCoords[i][1];
 		}
 
 	} while (ph.NextPoly());
-
-	//sorted the data, now copy to main data structures
-
-	// we know how many meshes we have so reserve appropriate space
-	m->meshes->reserve(sMap.size());
-
-	for (auto& it : sMap) {
-
-		if (m->dynamic) {
-
-			// calculate VBO values for current mesh
-			it.second.vboOffset		= (int)m_polyBufferRam.size() + MAX_ROM_VERTS;
-			it.second.vertexCount	= (int)it.second.verts.size();
-
-			// copy poly data to main buffer
-			m_polyBufferRam.insert(m_polyBufferRam.end(), it.second.verts.begin(), it.second.verts.end());
-		}
-		else {
-			// calculate VBO values for current mesh
-			it.second.vboOffset		= (int)m_polyBufferRom.size();
-			it.second.vertexCount	= (int)it.second.verts.size();
-
-			// copy poly data to main buffer
-			m_polyBufferRom.insert(m_polyBufferRom.end(), it.second.verts.begin(), it.second.verts.end());
-		}
-
-		//copy the temp mesh into the model structure
-		//this will lose the associated vertex data, which is now copied to the main buffer anyway
-		m->meshes->push_back(it.second);
-	}
 }
 
 bool CNew3D::IsDynamicModel(UINT32 *data)
@@ -1558,42 +2226,41 @@ void CNew3D::ClipPolygon(ClipPoly& clipPoly, Plane planes[5])
 	}
 }
 
-void CNew3D::ClipModel(const Model *m)
+void CNew3D::ClipModel(const Model *m, Plane planes[5], NFPair& nfPair)
 {
-	//===============================
-	ClipPoly				clipPoly;
-	std::vector<FVertex>*	vertices;
-	int						offset;
-	//===============================
-
-	if (m->dynamic) {
-		vertices = &m_polyBufferRam;
-		offset = MAX_ROM_VERTS;
+	for (const auto &mesh : *m->meshes) {
+		ClipVertices(m->modelMat, m_polyBufferRom.data() + mesh.vboOffset, mesh.vertexCount, planes, nfPair);
 	}
-	else {
-		vertices = &m_polyBufferRom;
-		offset = 0;
+}
+
+void CNew3D::ClipModel(const Model *m, const BuiltMeshes& meshes, Plane planes[5], NFPair& nfPair)
+{
+	// dynamic polys may only be in write only vbo memory by now, so clip the copies the meshes were built in
+	for (const auto &mesh : meshes) {
+		ClipVertices(m->modelMat, mesh.verts.data(), (int)mesh.verts.size(), planes, nfPair);
 	}
+}
 
-	for (const auto &mesh : *m->meshes) {
+void CNew3D::ClipVertices(const float *modelMat, const FVertex *verts, int count, Plane planes[5], NFPair& nfPair)
+{
+	//===============================
+	ClipPoly				clipPoly;
+	//===============================
 
-		int start = mesh.vboOffset - offset;
-		
-		for (int i = 0; i < mesh.vertexCount; i += m_numPolyVerts) {							// inc to next poly
+	for (int i = 0; i < count; i += m_numPolyVerts) {									// inc to next poly
 
-			for (int j = 0; j < m_numPolyVerts; j++) {
-				MultVec(m->modelMat, (*vertices)[start + i + j].pos, clipPoly.list[j].pos);		// copy all 3 of 4  our transformed vertices into our clip poly struct
-			}
+		for (int j = 0; j < m_numPolyVerts; j++) {
+			MultVec(modelMat, verts[i + j].pos, clipPoly.list[j].pos);				// copy all 3 of 4  our transformed vertices into our clip poly struct
+		}
 
-			clipPoly.count = m_numPolyVerts;
+		clipPoly.count = m_numPolyVerts;
 
-			ClipPolygon(clipPoly, m_planes);
+		ClipPolygon(clipPoly, planes);
 
-			for (int j = 0; j < clipPoly.count; j++) {
-				if (clipPoly.list[j].pos[2] < 0) {
-					m_nfPairs[m_currentPriority].zNear = std::max(clipPoly.list[j].pos[2], m_nfPairs[m_currentPriority].zNear);
-					m_nfPairs[m_currentPriority].zFar  = std::min(clipPoly.list[j].pos[2], m_nfPairs[m_currentPriority].zFar);
-				}
+		for (int j = 0; j < clipPoly.count; j++) {
+			if (clipPoly.list[j].pos[2] < 0) {
+				nfPair.zNear = std::max(clipPoly.list[j].pos[2], nfPair.zNear);
+				nfPair.zFar  = std::min(clipPoly.list[j].pos[2], nfPair.zFar);
 			}
 		}
 	}
@@ -1721,4 +2388,171 @@ bool CNew3D::ProcessLos(int priority)
 	return false;
 }
 
+/*
+ * On-disk cache of ROM models
+ *
+ * Building ROM models is the most expensive part of the first frames a model
+ * appears in. The cache stores m_polyBufferRom and m_romMap exactly as they are
+ * in memory, so it's only valid for the same ROM set, stepping and build.
+ */
+
+namespace {
+
+struct MeshCacheHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 vertexSize;
+	UINT32 meshSize;
+	UINT32 vromKey;
+	UINT32 step;
+	UINT32 numPolyVerts;
+	UINT32 shadeIsSigned;
+	UINT32 numVerts;
+	UINT32 numModels;
+};
+
+struct MeshCacheModel
+{
+	UINT32 addr;
+	UINT32 numMeshes;
+};
+
+static_assert(std::is_trivially_copyable<FVertex>::value && std::is_trivially_copyable<Mesh>::value, "mesh cache writes vertices and meshes as raw memory");
+
+}
+
+std::string CNew3D::GetMeshCachePath() const
+{
+	return "MeshCache/" + m_gameName + ".mc";
+}
+
+void CNew3D::LoadMeshCache()
+{
+	m_meshCacheLoaded = true;
+
+	std::string path = GetMeshCachePath();
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (!fp) {
+		return;		// nothing cached yet
+	}
+
+	MeshCacheHeader header;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1;
+
+	if (ok) {
+		if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION ||
+			header.vertexSize != sizeof(FVertex) || header.meshSize != sizeof(Mesh) ||
+			header.vromKey != m_vromKey || header.step != (UINT32)m_step ||
+			header.numPolyVerts != (UINT32)m_numPolyVerts || header.shadeIsSigned != (UINT32)m_shadeIsSigned) {
+			InfoLog("Mesh cache '%s' does not match this ROM set or configuration and will be rebuilt.\n", path.c_str());
+			fclose(fp);
+			return;
+		}
+		ok = header.numVerts < MAX_ROM_VERTS;
+	}
+
+	std::vector<FVertex> verts;
+	std::unordered_map<UINT32, std::shared_ptr<std::vector<Mesh>>> romMap;
+
+	if (ok) {
+		verts.resize(header.numVerts);
+		ok = fread(verts.data(), sizeof(FVertex), header.numVerts, fp) == header.numVerts;
+	}
+
+	for (UINT32 i = 0; ok && i < header.numModels; i++) {
+
+		MeshCacheModel model;
+		ok = fread(&model, sizeof(model), 1, fp) == 1 && model.numMeshes <= header.numVerts;
+		if (!ok) {
+			break;
+		}
+
+		auto meshes = std::make_shared<std::vector<Mesh>>(model.numMeshes);
+		ok = fread(meshes->data(), sizeof(Mesh), model.numMeshes, fp) == model.numMeshes;
+
+		for (auto& mesh : *meshes) {
+			if (mesh.vboOffset < 0 || mesh.vertexCount < 0 || (UINT32)(mesh.vboOffset + mesh.vertexCount) > header.numVerts) {
+				ok = false;
+			}
+		}
+
+		romMap[model.addr] = meshes;
+	}
+
+	fclose(fp);
+
+	if (!ok) {
+		ErrorLog("Mesh cache '%s' is corrupt and will be rebuilt.\n", path.c_str());
+		return;
+	}
+
+	m_polyBufferRom.swap(verts);
+	m_romMap.swap(romMap);
+	m_meshCacheModels = m_romMap.size();
+	WaitPolyRamFences();
+	m_vbo.Reset();
+
+	InfoLog("Loaded %u cached models (%u vertices) from '%s'.\n", header.numModels, header.numVerts, path.c_str());
+}
+
+void CNew3D::SaveMeshCache()
+{
+	std::string path = GetMeshCachePath();
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		ErrorLog("Unable to save mesh cache to '%s'.\n", path.c_str());
+		return;
+	}
+
+	MeshCacheHeader header;
+	header.magic			= MESH_CACHE_MAGIC;
+	header.version			= MESH_CACHE_VERSION;
+	header.vertexSize		= sizeof(FVertex);
+	header.meshSize			= sizeof(Mesh);
+	header.vromKey			= m_vromKey;
+	header.step				= m_step;
+	header.numPolyVerts		= m_numPolyVerts;
+	header.shadeIsSigned	= m_shadeIsSigned;
+	header.numVerts			= (UINT32)m_polyBufferRom.size();
+	header.numModels		= 0;
+
+	for (auto& it : m_romMap) {
+		if (it.second) {
+			header.numModels++;
+		}
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(m_polyBufferRom.data(), sizeof(FVertex), m_polyBufferRom.size(), fp) == m_polyBufferRom.size();
+
+	for (auto& it : m_romMap) {
+
+		if (!ok) {
+			break;
+		}
+
+		if (!it.second) {
+			continue;
+		}
+
+		MeshCacheModel model;
+		model.addr		= it.first;
+		model.numMeshes	= (UINT32)it.second->size();
+
+		ok = fwrite(&model, sizeof(model), 1, fp) == 1;
+		ok = ok && fwrite(it.second->data(), sizeof(Mesh), it.second->size(), fp) == it.second->size();
+	}
+
+	fclose(fp);
+
+	if (!ok) {
+		ErrorLog("Unable to save mesh cache to '%s'.\n", path.c_str());
+		remove(path.c_str());
+		return;
+	}
+
+	InfoLog("Saved %u models (%u vertices) to mesh cache '%s'.\n", header.numModels, header.numVerts, path.c_str());
+}
+
 } // New3D
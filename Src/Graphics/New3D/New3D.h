@@ -43,6 +43,8 @@
 #include "R3DScrollFog.h"
 #include "PolyHeader.h"
 #include "R3DFrameBuffers.h"
+#include "TextureRAM.h"
+#include "Util/WorkerPool.h"
 #include <mutex>
 
 namespace New3D {
@@ -181,9 +183,12 @@ public:
 	* Constructor and destructor.
 	*
 	* Parameters:
-	*   config  Run-time configuration.
+	*   config    Run-time configuration.
+	*   gameName  Name of the game, used to name its mesh cache.
+	*   vromKey   Identifies the VROM contents (ROM::key), checked against the
+	*             mesh cache instead of reading the whole VROM.
 	*/
-	CNew3D(const Util::Config::Node &config, std::string gameName);
+	CNew3D(const Util::Config::Node &config, std::string gameName, UINT32 vromKey);
 	~CNew3D(void);
 
 private:
@@ -191,6 +196,51 @@ private:
 	* Private Members
 	*/
 
+	// A mesh to draw, in scene order. The draw lists are built once per frame
+	// after the scene has been traversed, so that each pass only visits the
+	// meshes it actually draws.
+	struct DrawCommand
+	{
+		Node*	node;
+		Model*	model;
+		Mesh*	mesh;
+		int		texX, texY;			// texture position with the model's texture offset applied
+		int		microX, microY;		// micro texture position (only when the shader decodes textures)
+		int		drawIndex;			// model and mesh state in m_drawData (batched mode)
+		int		indirect;			// draw command in m_drawIndirect (batched mode)
+	};
+
+	// Same layout as the GL indirect draw arrays command
+	struct DrawArraysIndirect
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;		// read by the shader as the draw data index
+	};
+
+	struct DrawLists
+	{
+		std::vector<DrawCommand> commands[2][3];	// [overlay][colour, trans1, trans2]
+		bool hasModels	= false;
+		bool hasOverlay	= false;						// has high priority polys
+	};
+
+	// Meshes decoded from one model, in hash order. The meshes are handed out again for
+	// the next model rather than freed, so their vertex arrays keep their capacity.
+	struct BuiltMeshes
+	{
+		std::vector<SortingMesh>	meshes;			// only the first count are in use
+		std::vector<UINT64>			hashes;			// hash of each mesh in use, sorted
+		size_t						count = 0;
+
+		SortingMesh*		begin()			{ return meshes.data(); }
+		SortingMesh*		end()			{ return meshes.data() + count; }
+		const SortingMesh*	begin() const	{ return meshes.data(); }
+		const SortingMesh*	end() const		{ return meshes.data() + count; }
+		size_t				size() const	{ return count; }
+	};
+
 	// Real3D address translation
 	const UINT32 *TranslateCullingAddress(UINT32 addr);
 	const UINT32 *TranslateModelAddress(UINT32 addr);
@@ -208,14 +258,28 @@ private:
 
 	// building the scene
 	void SetMeshValues(SortingMesh *currentMesh, PolyHeader &ph);
-	void CacheModel(Model *m, const UINT32 *data);
+	void CacheModel(Model *m, const UINT32 *data, BuiltMeshes& meshes);
+	bool AllocPolyRam(SortingMesh& mesh);			// place a dynamic mesh in this frame's vertex memory
+	std::shared_ptr<std::vector<Mesh>> AllocMeshes();	// mesh array for a dynamic model, reused from frame to frame
+	void RecycleNodes();
+	void BeginPolyRam();
+	void EndPolyRam();
+	void WaitPolyRamFences();		// before the rom part of a mapped vbo is rewritten
+	void BuildMeshes(const UINT32 *data, UINT32 colorTableAddr, Vertex prev[4], UINT16 prevTexCoords[4][2], BuiltMeshes& meshes);
 	void CopyVertexData(const R3DPoly& r3dPoly, std::vector<FVertex>& vertexArray);
 
-	bool RenderScene(int priority, bool renderOverlay, Layer layer);		// returns if has overlay plane
+	void BuildDrawLists();
+	void RenderDrawList(const std::vector<DrawCommand>& commands);
+	void RenderDrawBatches(const std::vector<DrawCommand>& commands);
+	void BindBaseTexture(const DrawCommand& cmd, std::shared_ptr<Texture>& tex1);
+	void BindMicroTexture(const DrawCommand& cmd);
+	void CreateBatchBuffers();
+	void DestroyBatchBuffers();
+	void UploadBatchBuffers();
+	void BindDrawRange(int range);
 	bool IsDynamicModel(UINT32 *data);				// check if the model has a colour palette
 	bool IsVROMModel(UINT32 modelAddr);
 	void DrawScrollFog();
-	bool SkipLayer(int layer);
 	void SetRenderStates();
 	void DisableRenderStates();
 	void TranslateLosPosition(int inX, int inY, int& outX, int& outY);
@@ -223,6 +287,11 @@ private:
 
 	void CalcTexOffset(int offX, int offY, int page, int x, int y, int& newX, int& newY);	
 
+	// on-disk cache of ROM models
+	std::string GetMeshCachePath() const;
+	void LoadMeshCache();
+	void SaveMeshCache();
+
 	/*
 	* Data
 	*/
@@ -276,12 +345,47 @@ private:
 	UINT16			m_prevTexCoords[4][2];	// basically relying on undefined behavour
 
 	std::vector<Node>	 m_nodes;				// this represents the entire render frame
-	std::vector<FVertex> m_polyBufferRam;		// dynamic polys
+	DrawLists			 m_drawLists[4];		// meshes to draw from m_nodes, by priority
+	std::vector<FVertex> m_polyBufferRam;		// dynamic polys, only used if the vbo can't stay mapped
+	BuiltMeshes			 m_builtMeshes;			// meshes of the model just built, kept for clipping
+
+	// per frame structures are kept from frame to frame rather than freed and allocated again
+	std::vector<std::vector<Model>>					m_spareModels;		// model arrays of last frame's nodes
+	std::vector<std::shared_ptr<std::vector<Mesh>>>	m_meshPool;			// mesh arrays for dynamic models
+	size_t											m_meshPoolUsed = 0;
 	std::vector<FVertex> m_polyBufferRom;		// rom polys
 	std::unordered_map<UINT32, std::shared_ptr<std::vector<Mesh>>> m_romMap;	// a hash table for all the ROM models. The meshes don't have model matrices or tex offsets yet
 
+	bool	m_meshCache;					// load ROM models from disk on the first frame and save them on exit
+	bool	m_meshCacheLoaded	= false;	// first frame has been rendered
+	UINT32	m_vromKey;						// identifies the ROM set the cached models were built from
+	size_t	m_meshCacheModels	= 0;		// number of models read from the cache, it is only rewritten if more were built
+
 	VBO m_vbo;								// large VBO to hold our poly data, start of VBO is ROM data, ram polys follow
+
+	// if the vbo stays mapped, dynamic polys are written straight into it, each frame into the next of 3 parts so the gpu can still draw the previous ones
+	FVertex*	m_polyRam			= nullptr;	// this frame's dynamic polys, the mapped vbo or m_polyBufferRam
+	int			m_polyRamBase		= 0;		// vbo offset of m_polyRam in vertices
+	int			m_polyRamSize		= 0;		// vertices used this frame
+	int			m_polyRamFrame		= 0;
+	GLsync		m_polyRamFences[3]	= {};		// signalled when the gpu has finished with each part
 	R3DShader m_r3dShader;
+
+	// batched mode, each draw list is submitted as a few multi-draws with the mesh state read from a buffer texture
+	std::vector<GLfloat>			m_drawData;				// R3DShader::DRAW_DATA_TEXELS texels per model mesh
+	std::vector<DrawArraysIndirect>	m_drawIndirect;			// one per draw list entry, each list is contiguous
+	GLuint	m_drawDataBuffer	= 0;
+	GLuint	m_drawDataTexture	= 0;
+	GLuint	m_drawIndexBuffer	= 0;						// 0, 1, 2 .. as a per instance attribute, offset by the base instance
+	GLuint	m_indirectBuffer	= 0;
+	int		m_drawIndexCount	= 0;
+	int		m_rangeDraws		= 0;						// draws the shader can see at once, limited by the buffer texture size
+	int		m_drawRange			= -1;						// part of m_drawData the buffer texture currently covers
+
+	// gpu texture decoding, the shader reads textures straight out of this copy of texture RAM
+	TextureRAM	m_textureRAMCopy;
+	bool		m_textureRAMCopyValid = false;		// the whole of texture RAM has been copied at least once
+
 	R3DScrollFog m_r3dScrollFog;
 	R3DFrameBuffers m_r3dFrameBuffers;
 
@@ -306,10 +410,47 @@ private:
 	void TransformBox		(const float *m, BBox& box);
 	void MultVec			(const float matrix[16], const float in[4], float out[4]);
 	Clip ClipBox			(BBox& box, Plane planes[5]);
-	void ClipModel			(const Model *m);
+	void ClipModel			(const Model *m, Plane planes[5], NFPair& nfPair);									// cached rom model
+	void ClipModel			(const Model *m, const BuiltMeshes& meshes, Plane planes[5], NFPair& nfPair);				// model that has just been built
+	void ClipVertices		(const float *modelMat, const FVertex *verts, int count, Plane planes[5], NFPair& nfPair);
 	void ClipPolygon		(ClipPoly& clipPoly, Plane planes[5]);
 	void CalcBoxExtents		(const BBox& box);
 	void CalcViewport		(Viewport* vp, float near, float far);
+
+	// Parallel model building
+	struct DeferredModel
+	{
+		size_t			node;				// index into m_nodes
+		size_t			model;				// index into the node's models
+		const UINT32*	data;				// model to decode, or NULL if it only needs clipping
+		UINT32			colorTableAddr;		// color table of the culling node the model was found under
+		bool			clip;				// work out the Z range
+		Plane			planes[5];			// frustum planes of the model's viewport
+		BuiltMeshes		meshes;				// decoded meshes, not yet merged into m_polyBufferRam
+	};
+
+	struct ModelChain						// deferred models that must be decoded in order, since they share vertices
+	{
+		std::vector<size_t>	models;			// indices into m_deferredModels
+		Vertex				prev[4];		// shared vertices going into the chain, and coming out once built
+		UINT16				prevTexCoords[4][2];
+		bool				built = false;
+	};
+
+	bool SharesPrevVertices	(const UINT32 *data);
+	void CopyPrevVertices	(const Vertex src[4], const UINT16 srcTexCoords[4][2], Vertex dst[4], UINT16 dstTexCoords[4][2]);
+	void DeferModel			(const UINT32 *data, bool clip);
+	void BuildChain			(ModelChain& chain);
+	void MergeModel			(DeferredModel& d, NFPair nfPairs[4]);
+	void FinishModels		();
+
+	unsigned					m_modelThreads;				// worker threads helping the render thread, 0 builds everything in order as we go
+	Util::WorkerPool			m_modelWorkers;
+	std::vector<DeferredModel>	m_deferredModels;			// kept from frame to frame along with their meshes, only the first m_numDeferred are in use
+	size_t						m_numDeferred = 0;
+	std::vector<ModelChain>		m_modelChains;
+	bool						m_chainOpen = false;		// the last model decoded was deferred, so m_prev is out of date
+	std::vector<NFPair>			m_threadNFPairs;			// Z ranges per thread, 4 priorities each
 };
 
 } // New3D
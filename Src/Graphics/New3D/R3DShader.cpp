@@ -1,6 +1,9 @@
 #include "R3DShader.h"
 #include "R3DShaderQuads.h"
 #include "R3DShaderTriangles.h"
+#include "R3DShaderTextureRAM.h"
+#include "Supermodel.h"
+#include <string.h>
 
 // having 2 sets of shaders to maintain is really less than ideal
 // but hopefully not too many breaking changes at this point
@@ -10,6 +13,8 @@ namespace New3D {
 R3DShader::R3DShader(const Util::Config::Node &config)
 	: m_config(config)
 {
+	m_batching			= config["New3DBatching"].ValueAsDefault<bool>(false);
+	m_textureRAM		= config["GPUTextures"].ValueAsDefault<bool>(false);
 	m_shaderProgram		= 0;
 	m_vertexShader		= 0;
 	m_geoShader			= 0;
@@ -41,6 +46,12 @@ void R3DShader::Start()
 	m_texWrapMode[0]	= 0;
 	m_texWrapMode[1]	= 0;
 
+	m_textureFormat		= 0;
+
+	for (int i = 0; i < 4; i++) {
+		m_texturePos[i] = 0;
+	}
+
 	m_dirtyMesh			= true;			// dirty means all the above are dirty, ie first run
 	m_dirtyModel		= true;
 }
@@ -59,6 +70,23 @@ bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
 		fShader = fragmentShaderR3DQuads;
 	}
 
+	if (m_batching && (quads || !GLEW_VERSION_4_3)) {
+		ErrorLog("New3D batching requires OpenGL 4.3 and triangle rendering. Drawing meshes individually instead.\n");
+		m_batching = false;
+	}
+
+	if (m_textureRAM && !GLEW_VERSION_3_2) {
+		ErrorLog("Decoding textures on the GPU requires OpenGL 3.2. Decoding them on the CPU instead.\n");
+		m_textureRAM = false;
+	}
+
+	// batching and texture decoding are switched on in the same shader sources with defines
+	std::string vSource = ShaderSource(vShader, false);
+	std::string fSource = ShaderSource(fShader, true);
+
+	vShader = vSource.c_str();
+	fShader = fSource.c_str();
+
 	m_shaderProgram		= glCreateProgram();
 	m_vertexShader		= glCreateShader(GL_VERTEX_SHADER);
 	m_fragmentShader	= glCreateShader(GL_FRAGMENT_SHADER);
@@ -82,10 +110,42 @@ bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
 
 	glAttachShader(m_shaderProgram, m_vertexShader);
 	glAttachShader(m_shaderProgram, m_fragmentShader);
+
+	if (m_batching) {
+		glBindAttribLocation(m_shaderProgram, 6, "inDrawIndex");	// after the 6 vertex attributes
+	}
+
 	glLinkProgram(m_shaderProgram);
 
 	PrintProgramResult(m_shaderProgram);
 
+	if (m_batching || m_textureRAM) {
+
+		GLint linked;
+		glGetProgramiv(m_shaderProgram, GL_LINK_STATUS, &linked);
+
+		if (linked == GL_FALSE) {
+			ErrorLog("Unable to build the New3D shader with batching or GPU texture decoding. Using the default shader instead.\n");
+			glDeleteProgram(m_shaderProgram);
+			glDeleteShader(m_vertexShader);
+			glDeleteShader(m_fragmentShader);
+			if (m_geoShader) {
+				glDeleteShader(m_geoShader);
+				m_geoShader = 0;
+			}
+			m_batching		= false;
+			m_textureRAM	= false;
+			return LoadShader();
+		}
+
+		// samplers don't change, tex1 and tex2 are otherwise set by SetMeshUniforms
+		glUseProgram(m_shaderProgram);
+		glUniform1i(glGetUniformLocation(m_shaderProgram, "tex1"), 0);
+		glUniform1i(glGetUniformLocation(m_shaderProgram, "tex2"), 1);
+		glUniform1i(glGetUniformLocation(m_shaderProgram, "drawData"), 2);
+		glUniform1i(glGetUniformLocation(m_shaderProgram, "textureRAM"), 0);
+	}
+
 	m_locTexture1			= glGetUniformLocation(m_shaderProgram, "tex1");
 	m_locTexture2			= glGetUniformLocation(m_shaderProgram, "tex2");
 	m_locTexture1Enabled	= glGetUniformLocation(m_shaderProgram, "textureEnabled");
@@ -96,6 +156,9 @@ bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
 	m_locBaseTexSize		= glGetUniformLocation(m_shaderProgram, "baseTexSize");
 	m_locTextureInverted	= glGetUniformLocation(m_shaderProgram, "textureInverted");
 	m_locTexWrapMode		= glGetUniformLocation(m_shaderProgram, "textureWrapMode");
+	m_locTextureFormat		= glGetUniformLocation(m_shaderProgram, "textureFormat");
+	m_locTexturePos			= glGetUniformLocation(m_shaderProgram, "texturePos");
+	m_locMicroTexturePos	= glGetUniformLocation(m_shaderProgram, "microTexturePos");
 
 	m_locFogIntensity		= glGetUniformLocation(m_shaderProgram, "fogIntensity");
 	m_locFogDensity			= glGetUniformLocation(m_shaderProgram, "fogDensity");
@@ -129,6 +192,47 @@ bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
 	return true;
 }
 
+bool R3DShader::IsBatching() const
+{
+	return m_batching;
+}
+
+bool R3DShader::DecodesTextures() const
+{
+	return m_textureRAM;
+}
+
+std::string R3DShader::ShaderSource(const char* source, bool fragment) const
+{
+	std::string s = source;
+	std::string header;
+
+	if (m_batching) {
+		header += "#define BATCHED\n";
+	}
+
+	if (m_textureRAM && fragment) {
+		header += fragmentShaderTextureRAM;
+	}
+
+	if (header.empty()) {
+		return s;
+	}
+
+	// texelFetch, integer textures and flat varyings need glsl 1.50 in the triangle shaders, the rest of the shader is left as it is
+	// except texture2DLod, which strict compilers only allow in vertex shaders at this version
+	std::string version = "#version 120";
+	size_t pos = s.find(version);
+
+	if (pos != std::string::npos) {
+		s.replace(pos, version.size(), "#version 150 compatibility\n#define texture2DLod textureLod");
+	}
+
+	s.insert(s.find('\n', s.find("#version")) + 1, header);
+
+	return s;
+}
+
 GLint R3DShader::GetVertexAttribPos(const std::string& attrib)
 {
 	if (m_vertexLocCache.count(attrib)==0) {
@@ -233,6 +337,11 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 		m_translatorMap = m->translatorMap;
 	}
 
+	if (m_textureRAM && (m_dirtyMesh || m->format != m_textureFormat)) {
+		glUniform1i(m_locTextureFormat, m->format);
+		m_textureFormat = m->format;
+	}
+
 	if (m_dirtyMesh || m->wrapModeU != m_texWrapMode[0] || m->wrapModeV != m_texWrapMode[1]) {
 		m_texWrapMode[0] = m->wrapModeU;
 		m_texWrapMode[1] = m->wrapModeV;
@@ -286,6 +395,57 @@ void R3DShader::SetModelStates(const Model* model)
 	m_dirtyModel = false;
 }
 
+void R3DShader::GetDrawData(const Model* model, const Mesh* m, int texX, int texY, int microX, int microY, GLfloat* data)
+{
+	// must match FetchDrawData() and the BATCHED defines in the triangle shaders
+	memcpy(data, model->modelMat, sizeof(model->modelMat));
+
+	data[16] = model->scale;
+	data[17] = m->translatorMap;
+	data[18] = m->textured;
+	data[19] = m->microTexture;
+
+	data[20] = m->microTextureScale;
+	data[21] = (float)m->width;
+	data[22] = (float)m->height;
+	data[23] = m->inverted;
+
+	data[24] = m->textureAlpha;
+	data[25] = m->alphaTest;
+	data[26] = (float)m->wrapModeU;
+	data[27] = (float)m->wrapModeV;
+
+	data[28] = m->lighting;
+	data[29] = m->specular;
+	data[30] = m->specularValue;
+	data[31] = m->shininess;
+
+	data[32] = m->fogIntensity;
+	data[33] = m->fixedShading;
+	data[34] = (float)m->format;
+	data[35] = 0;
+
+	data[36] = (float)texX;
+	data[37] = (float)texY;
+	data[38] = (float)microX;
+	data[39] = (float)microY;
+}
+
+void R3DShader::SetTexturePos(int texX, int texY, int microX, int microY)
+{
+	if (m_dirtyMesh || texX != m_texturePos[0] || texY != m_texturePos[1]) {
+		m_texturePos[0] = texX;
+		m_texturePos[1] = texY;
+		glUniform2i(m_locTexturePos, texX, texY);
+	}
+
+	if (m_dirtyMesh || microX != m_texturePos[2] || microY != m_texturePos[3]) {
+		m_texturePos[2] = microX;
+		m_texturePos[3] = microY;
+		glUniform2i(m_locMicroTexturePos, microX, microY);
+	}
+}
+
 void R3DShader::DiscardAlpha(bool discard)
 {
 	glUniform1i(m_locDiscardAlpha, discard);
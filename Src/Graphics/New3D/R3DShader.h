@@ -12,9 +12,15 @@ namespace New3D {
 class R3DShader
 {
 public:
+	static const int DRAW_DATA_TEXELS = 10;				// RGBA32F texels of model and mesh state per draw in batched mode
+
 	R3DShader(const Util::Config::Node &config);
 
 	bool	LoadShader			(const char* vertexShader = nullptr, const char* fragmentShader = nullptr);
+	bool	IsBatching			() const;				// mesh state comes from the draw data buffer instead of uniforms
+	bool	DecodesTextures		() const;				// textures are decoded by the shader from a copy of texture RAM
+	static void GetDrawData		(const Model* model, const Mesh* m, int texX, int texY, int microX, int microY, GLfloat* data);
+	void	SetTexturePos		(int texX, int texY, int microX, int microY);	// texture RAM positions, call before SetMeshUniforms
 	void	SetMeshUniforms		(const Mesh* m);
 	void	SetModelStates		(const Model* model);
 	void	SetViewportUniforms	(const Viewport *vp);
@@ -25,11 +31,15 @@ public:
 
 private:
 
+	std::string ShaderSource(const char* source, bool fragment) const;
+
 	void PrintShaderResult(GLuint shader);
 	void PrintProgramResult(GLuint program);
 
 	// run-time config
 	const Util::Config::Node &m_config;
+	bool m_batching;
+	bool m_textureRAM;
 
 	// shader IDs
 	GLuint m_shaderProgram;
@@ -49,6 +59,9 @@ private:
 	GLint m_locTextureInverted;
 	GLint m_locTexWrapMode;
 	GLint m_locTranslatorMap;
+	GLint m_locTextureFormat;
+	GLint m_locTexturePos;
+	GLint m_locMicroTexturePos;
 
 	// cached mesh values
 	bool	m_textured1;
@@ -68,6 +81,8 @@ private:
 	float	m_baseTexSize[2];
 	int		m_texWrapMode[2];
 	bool	m_textureInverted;
+	int		m_textureFormat;
+	int		m_texturePos[4];		// base and micro texture positions
 
 	// cached model values
 	float	m_modelScale;
@@ -159,9 +159,14 @@ static const char *fragmentShaderR3DQuads = R"glsl(
 
 #version 450 core
 
+#ifndef TEXTURE_RAM
 uniform sampler2D tex1;			// base tex
 uniform sampler2D tex2;			// micro tex (optional)
 
+#define TexSampler	sampler2D
+#define SampleR3D	textureLod
+#endif
+
 // texturing
 uniform bool	textureEnabled;
 uniform bool	microTexture;
@@ -194,6 +199,11 @@ uniform float	fogAmbient;
 uniform bool	fixedShading;
 uniform int		hardwareStep;
 
+// texture RAM positions, only used when decoding textures in the shader
+uniform int		textureFormat;
+uniform ivec2	texturePos;
+uniform ivec2	microTexturePos;
+
 // test
 uniform mat4	projMat;
 
@@ -394,16 +404,16 @@ float LinearTexLocations(int wrapMode, float size, float u, out float u0, out fl
 	}
 }
 
-vec4 texBiLinear(sampler2D texSampler, float level, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
+vec4 texBiLinear(TexSampler texSampler, float level, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
 {
 	float tx[2], ty[2];
 	float a = LinearTexLocations(wrapMode.s, texSize.x, texCoord.x, tx[0], tx[1]);
 	float b = LinearTexLocations(wrapMode.t, texSize.y, texCoord.y, ty[0], ty[1]);
 	
-	vec4 p0q0 = textureLod(texSampler, vec2(tx[0],ty[0]), level);
-    vec4 p1q0 = textureLod(texSampler, vec2(tx[1],ty[0]), level);
-    vec4 p0q1 = textureLod(texSampler, vec2(tx[0],ty[1]), level);
-    vec4 p1q1 = textureLod(texSampler, vec2(tx[1],ty[1]), level);
+	vec4 p0q0 = SampleR3D(texSampler, vec2(tx[0],ty[0]), level);
+    vec4 p1q0 = SampleR3D(texSampler, vec2(tx[1],ty[0]), level);
+    vec4 p0q1 = SampleR3D(texSampler, vec2(tx[0],ty[1]), level);
+    vec4 p1q1 = SampleR3D(texSampler, vec2(tx[1],ty[1]), level);
 
 	if(alphaTest) {
 		if(p0q0.a > p1q0.a)		{ p1q0.rgb = p0q0.rgb; }
@@ -426,7 +436,7 @@ vec4 texBiLinear(sampler2D texSampler, float level, ivec2 wrapMode, vec2 texSize
     return mix( pInterp_q0, pInterp_q1, b ); // Interpolate in Y direction.
 }
 
-vec4 textureR3D(sampler2D texSampler, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
+vec4 textureR3D(TexSampler texSampler, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
 {
 	float numLevels = floor(log2(min(texSize.x, texSize.y)));				// r3d only generates down to 1:1 for square textures, otherwise its the min dimension
 	float fLevel	= min(mip_map_level(texCoord * texSize), numLevels);
@@ -0,0 +1,86 @@
+#ifndef _R3DSHADERTEXTURERAM_H_
+#define _R3DSHADERTEXTURERAM_H_
+
+// inserted at the top of the fragment shaders when textures are decoded on the gpu
+// the shaders then sample through SampleR3D() from a copy of texture RAM instead of a texture object per texture
+
+static const char *fragmentShaderTextureRAM = R"glsl(
+
+#define TEXTURE_RAM
+
+uniform usampler2D textureRAM;		// 2048x2048 16 bit texels, page 1 starts at y = 1024
+
+struct TexSampler
+{
+	ivec2	pos;		// position of the base level in texture RAM
+	ivec2	size;
+	int		format;
+};
+
+#define tex1	TexSampler(texturePos, ivec2(baseTexSize), textureFormat)
+#define tex2	TexSampler(microTexturePos, ivec2(128), 0)
+
+// same conversions as Texture::UploadTextureMip()
+vec4 DecodeTexel(uint t, int format)
+{
+	uint lo = t & 0xFFu;
+	uint hi = t >> 8;
+	uvec4 c;
+
+	if (format == 0) {						// T1RGB5
+		c = uvec4(((t >> 10) & 0x1Fu) * 255u / 31u, ((t >> 5) & 0x1Fu) * 255u / 31u, (t & 0x1Fu) * 255u / 31u, (t & 0x8000u) != 0u ? 0u : 255u);
+	}
+	else if (format == 1) {					// A4L4 low byte
+		c = uvec4(uvec3((lo & 0xFu) * 17u), (lo >> 4) * 17u);
+	}
+	else if (format == 2) {					// L4A4 low byte
+		c = uvec4(uvec3((lo >> 4) * 17u), (lo & 0xFu) * 17u);
+	}
+	else if (format == 3) {					// A4L4 high byte
+		c = uvec4(uvec3((hi & 0xFu) * 17u), (hi >> 4) * 17u);
+	}
+	else if (format == 4) {					// L4A4 high byte
+		c = uvec4(uvec3((hi >> 4) * 17u), (hi & 0xFu) * 17u);
+	}
+	else if (format == 5) {					// 8 bit grayscale low byte
+		c = uvec4(uvec3(lo), lo == 255u ? 0u : 255u);
+	}
+	else if (format == 6) {					// 8 bit grayscale high byte
+		c = uvec4(uvec3(hi), hi == 255u ? 0u : 255u);
+	}
+	else if (format == 7) {					// RGBA4
+		c = uvec4((t >> 12) & 0xFu, (t >> 8) & 0xFu, (t >> 4) & 0xFu, t & 0xFu) * 17u;
+	}
+	else if (format <= 11) {				// 4 bit luminance, 8-9 low byte, 10-11 high byte, odd formats use the high nibble
+		uint b = (format < 10) ? lo : hi;
+		uint l = (((format & 1) == 0) ? (b & 0xFu) : (b >> 4)) * 17u;
+		c = uvec4(uvec3(l), l == 255u ? 0u : 255u);
+	}
+	else {									// debug texture
+		c = uvec4(255u, 0u, 0u, 255u);
+	}
+
+	return vec4(c) / 255.0;
+}
+
+// nearest texel of a mipmap level with repeat wrapping, like the texture objects this replaces
+vec4 SampleR3D(TexSampler tex, vec2 texCoord, float level)
+{
+	const int mipXBase[11] = int[11](0, 1024, 1536, 1792, 1920, 1984, 2016, 2032, 2040, 2044, 2046);
+	const int mipYBase[11] = int[11](0, 512, 768, 896, 960, 992, 1008, 1016, 1020, 1022, 1023);
+
+	int maxLevel	= int(log2(float(min(tex.size.x, tex.size.y))) + 0.5);
+	int lvl			= min(int(level), maxLevel);
+	ivec2 size		= max(tex.size >> lvl, ivec2(1));
+	ivec2 texel		= ivec2(floor(texCoord * vec2(size))) & (size - 1);		// sizes are powers of 2
+
+	// each page has its mipmaps in the same place, scaled down from the base level position
+	ivec2 pos;
+	pos.x = mipXBase[lvl] + (tex.pos.x >> lvl);
+	pos.y = mipYBase[lvl] + ((tex.pos.y & 1023) >> lvl) + (tex.pos.y & 1024);
+
+	return DecodeTexel(texelFetch(textureRAM, (pos + texel) & 2047, 0).r, tex.format);
+}
+)glsl";
+
+#endif
@@ -6,10 +6,23 @@ static const char *vertexShaderR3D = R"glsl(
 #version 120
 
 // uniforms
+uniform mat4	projMat;
+
+#ifdef BATCHED
+// model and mesh state for each draw, R3DShader::DRAW_DATA_TEXELS texels per draw
+uniform samplerBuffer drawData;
+in int			inDrawIndex;
+
+mat4	modelMat;
+float	modelScale;
+bool	translatorMap;
+
+flat out vec4	fsDrawData[6];		// mesh state for the fragment shader
+#else
 uniform float	modelScale;
 uniform mat4	modelMat;
-uniform mat4	projMat;
 uniform bool	translatorMap;
+#endif
 
 // attributes
 attribute vec4	inVertex;
@@ -47,8 +60,31 @@ float CalcBackFace(in vec3 viewVertex)
 	return dot(vt, vn);
 }
 
+#ifdef BATCHED
+void FetchDrawData()
+{
+	int base = inDrawIndex * 10;
+
+	modelMat = mat4(texelFetch(drawData, base + 0),
+					texelFetch(drawData, base + 1),
+					texelFetch(drawData, base + 2),
+					texelFetch(drawData, base + 3));
+
+	for (int i = 0; i < 6; i++) {
+		fsDrawData[i] = texelFetch(drawData, base + 4 + i);
+	}
+
+	modelScale		= fsDrawData[0].x;
+	translatorMap	= fsDrawData[0].y != 0.0;
+}
+#endif
+
 void main(void)
 {
+#ifdef BATCHED
+	FetchDrawData();
+#endif
+
 	fsViewVertex	= vec3(modelMat * inVertex);
 	fsViewNormal	= (mat3(modelMat) * inNormal) / modelScale;
 	fsDiscard		= CalcBackFace(fsViewVertex);
@@ -63,9 +99,36 @@ static const char *fragmentShaderR3D = R"glsl(
 
 #version 120
 
+#ifndef TEXTURE_RAM
 uniform sampler2D tex1;			// base tex
 uniform sampler2D tex2;			// micro tex (optional)
 
+#define TexSampler	sampler2D
+#define SampleR3D	texture2DLod
+#endif
+
+#ifdef BATCHED
+// mesh state for this draw, see R3DShader::GetDrawData()
+flat in vec4	fsDrawData[6];
+
+#define textureEnabled		(fsDrawData[0].z != 0.0)
+#define microTexture		(fsDrawData[0].w != 0.0)
+#define microTextureScale	fsDrawData[1].x
+#define baseTexSize			fsDrawData[1].yz
+#define textureInverted		(fsDrawData[1].w != 0.0)
+#define textureAlpha		(fsDrawData[2].x != 0.0)
+#define alphaTest			(fsDrawData[2].y != 0.0)
+#define textureWrapMode		ivec2(fsDrawData[2].zw)
+#define lightEnabled		(fsDrawData[3].x != 0.0)
+#define specularEnabled		(fsDrawData[3].y != 0.0)
+#define specularValue		fsDrawData[3].z
+#define shininess			fsDrawData[3].w
+#define fogIntensity		fsDrawData[4].x
+#define fixedShading		(fsDrawData[4].y != 0.0)
+#define textureFormat		int(fsDrawData[4].z)
+#define texturePos			ivec2(fsDrawData[5].xy)
+#define microTexturePos		ivec2(fsDrawData[5].zw)
+#else
 // texturing
 uniform bool	textureEnabled;
 uniform bool	microTexture;
@@ -74,9 +137,24 @@ uniform vec2	baseTexSize;
 uniform bool	textureInverted;
 uniform bool	textureAlpha;
 uniform bool	alphaTest;
-uniform bool	discardAlpha;
 uniform ivec2	textureWrapMode;
 
+// lighting
+uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
+uniform bool	specularEnabled;	// specular enabled
+uniform float	specularValue;		// specular coefficient
+uniform float	shininess;			// specular shininess
+uniform float	fogIntensity;
+uniform bool	fixedShading;
+
+// texture RAM positions, only used when decoding textures in the shader
+uniform int		textureFormat;
+uniform ivec2	texturePos;
+uniform ivec2	microTexturePos;
+#endif
+
+uniform bool	discardAlpha;
+
 // general
 uniform vec3	fogColour;
 uniform vec4	spotEllipse;		// spotlight ellipse position: .x=X position (screen coordinates), .y=Y position, .z=half-width, .w=half-height)
@@ -84,18 +162,12 @@ uniform vec2	spotRange;			// spotlight Z range: .x=start (viewspace coordinates)
 uniform vec3	spotColor;			// spotlight RGB color
 uniform vec3	spotFogColor;		// spotlight RGB color on fog
 uniform vec3	lighting[2];		// lighting state (lighting[0] = sun direction, lighting[1].x,y = diffuse, ambient intensities from 0-1.0)
-uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
 uniform bool	sunClamp;			// not used by daytona and la machine guns
 uniform bool	intensityClamp;		// some games such as daytona and 
-uniform bool	specularEnabled;	// specular enabled
-uniform float	specularValue;		// specular coefficient
-uniform float	shininess;			// specular shininess
-uniform float	fogIntensity;
 uniform float	fogDensity;
 uniform float	fogStart;
 uniform float	fogAttenuation;
 uniform float	fogAmbient;
-uniform bool	fixedShading;
 uniform int		hardwareStep;
 
 //interpolated inputs from vertex shader
@@ -162,16 +234,16 @@ float LinearTexLocations(int wrapMode, float size, float u, out float u0, out fl
 	}
 }
 
-vec4 texBiLinear(sampler2D texSampler, float level, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
+vec4 texBiLinear(TexSampler texSampler, float level, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
 {
 	float tx[2], ty[2];
 	float a = LinearTexLocations(wrapMode.s, texSize.x, texCoord.x, tx[0], tx[1]);
 	float b = LinearTexLocations(wrapMode.t, texSize.y, texCoord.y, ty[0], ty[1]);
 	
-	vec4 p0q0 = texture2DLod(texSampler, vec2(tx[0],ty[0]), level);
-    vec4 p1q0 = texture2DLod(texSampler, vec2(tx[1],ty[0]), level);
-    vec4 p0q1 = texture2DLod(texSampler, vec2(tx[0],ty[1]), level);
-    vec4 p1q1 = texture2DLod(texSampler, vec2(tx[1],ty[1]), level);
+	vec4 p0q0 = SampleR3D(texSampler, vec2(tx[0],ty[0]), level);
+    vec4 p1q0 = SampleR3D(texSampler, vec2(tx[1],ty[0]), level);
+    vec4 p0q1 = SampleR3D(texSampler, vec2(tx[0],ty[1]), level);
+    vec4 p1q1 = SampleR3D(texSampler, vec2(tx[1],ty[1]), level);
 
 	if(alphaTest) {
 		if(p0q0.a > p1q0.a)		{ p1q0.rgb = p0q0.rgb; }
@@ -194,7 +266,7 @@ vec4 texBiLinear(sampler2D texSampler, float level, ivec2 wrapMode, vec2 texSize
     return mix( pInterp_q0, pInterp_q1, b ); // Interpolate in Y direction.
 }
 
-vec4 textureR3D(sampler2D texSampler, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
+vec4 textureR3D(TexSampler texSampler, ivec2 wrapMode, vec2 texSize, vec2 texCoord)
 {
 	float numLevels = floor(log2(min(texSize.x, texSize.y)));				// r3d only generates down to 1:1 for square textures, otherwise its the min dimension
 	float fLevel	= min(mip_map_level(texCoord * texSize), numLevels);
@@ -0,0 +1,69 @@
+#include "TextureRAM.h"
+
+namespace New3D {
+
+TextureRAM::TextureRAM()
+{
+	m_textureID = 0;
+}
+
+TextureRAM::~TextureRAM()
+{
+	Destroy();		// make sure to have valid context before destroying
+}
+
+void TextureRAM::Create()
+{
+	Destroy();
+
+	glGenTextures(1, &m_textureID);
+	glBindTexture(GL_TEXTURE_2D, m_textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);		// integer textures can't be filtered, the shader does it
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, 2048, 2048, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void TextureRAM::Destroy()
+{
+	if (m_textureID) {
+		glDeleteTextures(1, &m_textureID);
+		m_textureID = 0;
+	}
+}
+
+void TextureRAM::Upload(const UINT16* src, int x, int y, int width, int height)
+{
+	if (!src || !m_textureID) {
+		return;		// sanity checking
+	}
+
+	if (x + width > 2048) {
+		width = 2048 - x;
+	}
+
+	if (y + height > 2048) {
+		height = 2048 - y;
+	}
+
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, m_textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 2048);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, src + (y * 2048) + x);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void TextureRAM::Bind()
+{
+	glBindTexture(GL_TEXTURE_2D, m_textureID);
+}
+
+} // New3D
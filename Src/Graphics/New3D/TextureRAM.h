@@ -0,0 +1,29 @@
+#ifndef _TEXTURE_RAM_H_
+#define _TEXTURE_RAM_H_
+
+#include "Types.h"
+#include <GL/glew.h>
+
+namespace New3D {
+
+// A copy of the whole of texture RAM on the gpu, for shaders that decode textures themselves.
+// Written to as the game uploads textures, so there are no texture objects to create or invalidate.
+
+class TextureRAM
+{
+public:
+	TextureRAM();
+	~TextureRAM();
+
+	void	Create		();
+	void	Destroy		();
+	void	Upload		(const UINT16* src, int x, int y, int width, int height);	// copy a rectangle of texture RAM
+	void	Bind		();
+
+private:
+	GLuint m_textureID;
+};
+
+} // New3D
+
+#endif
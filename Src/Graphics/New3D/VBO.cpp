@@ -1,4 +1,5 @@
 #include "VBO.h"
+#include <string.h>
 
 namespace New3D {
 
@@ -8,6 +9,7 @@ VBO::VBO()
 	m_target	= 0;
 	m_capacity	= 0;
 	m_size		= 0;
+	m_mapping	= nullptr;
 }
 
 void VBO::Create(GLenum target, GLenum usage, GLsizeiptr size, const void* data)
@@ -23,8 +25,40 @@ void VBO::Create(GLenum target, GLenum usage, GLsizeiptr size, const void* data)
 	Bind(false);		// unbind
 }
 
+bool VBO::CreateMapped(GLenum target, GLsizeiptr size)
+{
+	// coherent, so writes are seen by the gpu without flushing, it's up to the caller not to write to memory that is still being drawn from
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glGenBuffers(1, &m_id);
+	glBindBuffer(target, m_id);
+	glBufferStorage(target, size, nullptr, flags);
+
+	m_mapping = glMapBufferRange(target, 0, size, flags);
+
+	if (!m_mapping) {
+		glBindBuffer(target, 0);
+		glDeleteBuffers(1, &m_id);
+		m_id = 0;
+		return false;
+	}
+
+	m_target	= target;
+	m_capacity	= size;
+	m_size		= 0;
+
+	Bind(false);
+
+	return true;
+}
+
 void VBO::BufferSubData(GLintptr offset, GLsizeiptr size, const GLvoid* data)
 {
+	if (m_mapping) {
+		memcpy((char*)m_mapping + offset, data, size);
+		return;
+	}
+
 	glBufferSubData(m_target, offset, size, data);
 }
 
@@ -53,11 +87,12 @@ void VBO::Reset()
 void VBO::Destroy()
 {
 	if (m_id) {
-		glDeleteBuffers(1, &m_id);
+		glDeleteBuffers(1, &m_id);		// also unmaps a mapped buffer
 		m_id		= 0;
 		m_target	= 0;
 		m_capacity	= 0;
 		m_size		= 0;
+		m_mapping	= nullptr;
 	}
 }
 
@@ -81,4 +116,9 @@ int VBO::GetCapacity()
 	return m_capacity;
 }
 
+void* VBO::GetMapping()
+{
+	return m_mapping;
+}
+
 } // New3D
@@ -11,6 +11,7 @@ public:
 	VBO();
 
 	void Create			(GLenum target, GLenum usage, GLsizeiptr size, const void* data=nullptr);
+	bool CreateMapped	(GLenum target, GLsizeiptr size);		// immutable storage that stays mapped until destroyed, needs GL 4.4 or ARB_buffer_storage
 	void BufferSubData	(GLintptr offset, GLsizeiptr size, const GLvoid* data);
 	bool AppendData		(GLsizeiptr size, const GLvoid* data);
 	void Reset			();		// don't delete data, just go back to start
@@ -18,12 +19,14 @@ public:
 	void Bind			(bool enable);
 	int  GetSize		();
 	int  GetCapacity	();
+	void* GetMapping	();		// null unless created with CreateMapped
 
 private:
 	GLuint	m_id;
 	GLenum	m_target;
 	int		m_capacity;
 	int		m_size;
+	void*	m_mapping;
 };
 
 } // New3D
@@ -270,8 +270,11 @@
  * they exceed the color resolution of the palette, they must be scaled
  * appropriately.
  *
- * Color offset registers are handled in TileGen.cpp. Two palettes are computed
- * -- one for A/A' and another for B/B'. These are passed to the renderer.
+ * TileGen.cpp decodes the palette and color offsets are applied here. Two
+ * offset palettes are kept -- one for A/A' and another for B/B' -- and only
+ * recomputed in full when an offset register changes, and otherwise only where
+ * palette RAM changed. When drawing on the GPU, the offsets are passed to the
+ * shader instead.
  */
 
 #include "Render2D.h"
@@ -280,6 +283,11 @@
 #include "Shader.h"
 #include "Shaders2D.h" // fragment and vertex shaders
 
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RENDER2D_SSE2
+#endif
 #include <cstring>
 #include <GL/glew.h>
 
@@ -296,105 +304,224 @@
 /******************************************************************************
  Layer Rendering
 
- This code is quite slow and badly needs to be optimized. Dirty rectangles
- should be implemented first and tile pre-decoding second.
+ Each layer is drawn into its own surface and kept from frame to frame. Only
+ lines that may have changed are redrawn: those whose scroll table entry, mask,
+ name table row, tile patterns or colors were written since the last frame, or
+ all of them if the layer's registers changed. The top and bottom surfaces are
+ then composited from the layers, again line by line, and only the lines that
+ changed are uploaded.
+
+ Tile patterns are decoded a VRAM page at a time into caches holding one color
+ index per byte, in screen order, so that a tile line is just 8 palette
+ lookups. Pages are decoded on first use and invalidated by MarkVRAMDirty().
+ Mask bits cover 32 pixels, so most tiles are either entirely visible or
+ entirely hidden and are drawn without testing each pixel.
 ******************************************************************************/
 
-template <int bits, bool alphaTest, bool clip>
-static inline void DrawTileLine(uint32_t *line, int pixelOffset, uint16_t tile, int patternLine, const uint32_t *vram, const uint32_t *palette, uint16_t mask)
+// VRAM pages passed to MarkVRAMDirty() are 1 KB, the same as CTileGen's dirty pages
+#define VRAM_PAGE_WIDTH 10
+
+static inline bool IsPageDirty(const uint8_t *dirtyPages, unsigned addr)
 {
-  static_assert(bits == 4 || bits == 8, "Tiles are either 4- or 8-bit");
+  unsigned page = addr >> VRAM_PAGE_WIDTH;
+  return (dirtyPages[page >> 3] >> (page & 7)) & 1;
+}
 
-  // For 8-bit pixels, each line of tile pattern is two words
-  if (bits == 8)
-    patternLine *= 2;
+template <int bits>
+static inline int GetPatternOffset(uint16_t tile)
+{
+  static_assert(bits == 4 || bits == 8, "Tiles are either 4- or 8-bit");
 
-  // Compute offset of pattern for this line
-  int patternOffset;
+  // Returns the offset of the tile pattern in words
   if (bits == 4)
   {
-    patternOffset = ((tile & 0x3FFF) << 1) | ((tile >> 15) & 1);
-    patternOffset *= 32;
-    patternOffset /= 4;
+    int patternOffset = ((tile & 0x3FFF) << 1) | ((tile >> 15) & 1);
+    return patternOffset * 32 / 4;
   }
   else
+    return (tile & 0x3FFF) * 64 / 4;
+}
+
+template <int bits>
+static inline uint32_t GetColorHi(uint16_t tile)
+{
+  // Name table entry provides high color bits
+  return tile & ((bits == 4) ? 0x7FF0 : 0x7F00);
+}
+
+#ifdef RENDER2D_SSE2
+// Reverses the bytes of each word, putting the pixels they hold in screen order
+static inline __m128i SwapWordBytes(__m128i x)
+{
+  x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+  x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+#endif
+
+// Decodes a page of VRAM (256 words) as 4-bit (2048 indices) or 8-bit (1024) pixels
+template <int bits>
+static void DecodePatternPage(uint8_t *dest, const uint32_t *src)
+{
+  const int numWords = 1 << (VRAM_PAGE_WIDTH - 2);
+#ifdef RENDER2D_SSE2
+  const __m128i lowNibbles = _mm_set1_epi8(0x0F);
+  for (int i = 0; i < numWords; i += 4)
+  {
+    __m128i pixels = SwapWordBytes(_mm_loadu_si128((const __m128i *) &src[i]));
+    if (bits == 4)
+    {
+      __m128i hi = _mm_and_si128(_mm_srli_epi16(pixels, 4), lowNibbles);
+      __m128i lo = _mm_and_si128(pixels, lowNibbles);
+      _mm_storeu_si128((__m128i *) &dest[i * 8 + 0], _mm_unpacklo_epi8(hi, lo));
+      _mm_storeu_si128((__m128i *) &dest[i * 8 + 16], _mm_unpackhi_epi8(hi, lo));
+    }
+    else
+      _mm_storeu_si128((__m128i *) &dest[i * 4], pixels);
+  }
+#else
+  for (int i = 0; i < numWords; i++)
   {
-    patternOffset = tile & 0x3FFF;
-    patternOffset *= 64;
-    patternOffset /= 4;
+    uint32_t pattern = src[i];
+    for (int p = 32 / bits - 1; p >= 0; p--)
+      *dest++ = (pattern >> (p * bits)) & ((1 << bits) - 1);
   }
+#endif
+}
 
-  // Name table entry provides high color bits
-  uint32_t colorHi = tile & ((bits == 4) ? 0x7FF0 : 0x7F00);
+// Draws 8 pixels from a decoded tile line
+static inline void DrawPixels(uint32_t *dest, const uint8_t *indices, const uint32_t *palette)
+{
+#ifdef RENDER2D_SSE2
+  __m128i lo = _mm_setr_epi32(palette[indices[0]], palette[indices[1]], palette[indices[2]], palette[indices[3]]);
+  __m128i hi = _mm_setr_epi32(palette[indices[4]], palette[indices[5]], palette[indices[6]], palette[indices[7]]);
+  _mm_storeu_si128((__m128i *) &dest[0], lo);
+  _mm_storeu_si128((__m128i *) &dest[4], hi);
+#else
+  for (int p = 0; p < 8; p++)
+    dest[p] = palette[indices[p]];
+#endif
+}
 
-  // Draw
-  if (bits == 4)
+static inline void ClearPixels(uint32_t *dest)
+{
+#ifdef RENDER2D_SSE2
+  _mm_storeu_si128((__m128i *) &dest[0], _mm_setzero_si128());
+  _mm_storeu_si128((__m128i *) &dest[4], _mm_setzero_si128());
+#else
+  memset(dest, 0, 8 * sizeof(uint32_t));
+#endif
+}
+
+template <bool clip>
+static inline void DrawTileLine(uint32_t *line, int pixelOffset, const uint8_t *indices, const uint32_t *palette, uint16_t mask)
+{
+  // Pixels hidden by the mask are transparent, so that layers can be
+  // composited later on without knowing their order here. Unclipped tiles
+  // that do not straddle a change in the mask are drawn all at once.
+  if (!clip)
   {
-    uint32_t pattern = vram[patternOffset + patternLine];
-    for (int p = 7; p >= 0; p--)
+    bool firstVisible = (mask & (1 << (15 - pixelOffset / 32))) != 0;
+    bool lastVisible = (mask & (1 << (15 - (pixelOffset + 7) / 32))) != 0;
+    if (firstVisible && lastVisible)
     {
-      if (!clip || (clip && pixelOffset >= 0 && pixelOffset < 496))
-      {
-        uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
-        bool visible = (mask & maskTest) != 0;
-        uint32_t pixel = palette[((pattern >> (p*4)) & 0xF) | colorHi];
-        if (alphaTest)
-        {
-          if (visible && (pixel >> 24) != 0)  // only draw opaque pixels
-            line[pixelOffset] = pixel;
-        }
-        else
-        {
-          if (visible)
-            line[pixelOffset] = pixel;
-          else
-            line[pixelOffset] = 0;
-        }
-      }
-      ++pixelOffset;
+      DrawPixels(&line[pixelOffset], indices, palette);
+      return;
+    }
+    if (!firstVisible && !lastVisible)
+    {
+      ClearPixels(&line[pixelOffset]);
+      return;
     }
   }
-  else
+
+  for (int p = 0; p < 8; p++)
   {
-    for (int i = 0; i < 2; i++) // 4 pixels per word
+    if (!clip || (pixelOffset >= 0 && pixelOffset < 496))
     {
-      uint32_t pattern = vram[patternOffset + patternLine + i];
-      for (int p = 3; p >= 0; p--)
-      {
-        if (!clip || (clip && pixelOffset >= 0 && pixelOffset < 496))
-        {
-          uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
-          bool visible = (mask & maskTest) != 0;
-          uint32_t pixel = palette[((pattern >> (p*8)) & 0xFF) | colorHi];
-          if (alphaTest)
-          {
-            if (visible && (pixel >> 24) != 0)
-              line[pixelOffset] = pixel;
-          }
-          else
-          {
-            if (visible)
-              line[pixelOffset] = pixel;
-            else
-              line[pixelOffset] = 0;  // transparent
-          }
-        }
-        ++pixelOffset;
-      }
+      uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
+      bool visible = (mask & maskTest) != 0;
+      line[pixelOffset] = visible ? palette[indices[p]] : 0;
     }
+    ++pixelOffset;
+  }
+}
+
+/*
+ * Color offsets are signed but I'm not sure whether or not their range is
+ * merely [-128,+127], which would mean adding to a 0 component would not
+ * result full intensity (only +127 at most). Alternatively, the signed value
+ * might have to be multiplied by 2. That is assumed here. In either case, the
+ * signed addition should be saturated. Alpha is left alone.
+ */
+static void AddColorOffset(uint32_t *dest, const uint32_t *src, unsigned numColors, uint32_t offsetReg)
+{
+  // Split into amounts to add and subtract from each of R, G, B
+  uint8_t add[4] = { 0, 0, 0, 0 };
+  uint8_t sub[4] = { 0, 0, 0, 0 };
+  for (int i = 0; i < 3; i++)
+  {
+    int offset = 2 * (int8_t) (offsetReg >> (i * 8));
+    add[i] = (uint8_t) std::max(offset, 0);
+    sub[i] = (uint8_t) std::min(std::max(-offset, 0), 0xFF);  // colors cannot go below 0 anyway
+  }
+
+  unsigned i = 0;
+#ifdef RENDER2D_SSE2
+  uint32_t add32, sub32;
+  memcpy(&add32, add, 4);
+  memcpy(&sub32, sub, 4);
+  const __m128i addVec = _mm_set1_epi32(add32);
+  const __m128i subVec = _mm_set1_epi32(sub32);
+  for (; i + 4 <= numColors; i += 4)
+  {
+    __m128i colors = _mm_loadu_si128((const __m128i *) &src[i]);
+    colors = _mm_subs_epu8(_mm_adds_epu8(colors, addVec), subVec);
+    _mm_storeu_si128((__m128i *) &dest[i], colors);
+  }
+#endif
+  for (; i < numColors; i++)
+  {
+    uint32_t color = src[i];
+    for (int c = 0; c < 3; c++)
+    {
+      int value = (int) ((color >> (c * 8)) & 0xFF) + add[c] - sub[c];
+      value = std::min(std::max(value, 0), 0xFF);
+      color = (color & ~(0xFF << (c * 8))) | ((uint32_t) value << (c * 8));
+    }
+    dest[i] = color;
+  }
+}
+
+// Returns the 8 color indices of a tile line, decoding its VRAM page if needed
+template <int bits>
+const uint8_t *CRender2D::GetPatternLine(uint16_t tile, int patternLine)
+{
+  // For 8-bit pixels, each line of tile pattern is two words
+  unsigned addr = (GetPatternOffset<bits>(tile) + ((bits == 8) ? patternLine * 2 : patternLine)) * 4;
+  unsigned page = addr >> VRAM_PAGE_WIDTH;
+  uint8_t *cache = m_patternCache[(bits == 8) ? 1 : 0];
+  uint8_t &valid = m_patternCacheValid[(bits == 8) ? 1 : 0][page >> 3];
+  if ((valid & (1 << (page & 7))) == 0)
+  {
+    DecodePatternPage<bits>(&cache[(page << VRAM_PAGE_WIDTH) * 8 / bits], &m_vram[page << (VRAM_PAGE_WIDTH - 2)]);
+    valid |= 1 << (page & 7);
   }
+  return &cache[addr * 8 / bits];
 }
 
-template <int bits, bool alphaTest>
-static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, const uint32_t *regs, const uint32_t *palette)
+template <int bits>
+void CRender2D::DrawLayerLine(uint32_t *line, int layerNum, int y, const uint32_t *palette)
 {
+  const uint32_t *vram = m_vram;
+  const uint32_t *regs = m_regs;
   const uint16_t *nameTableBase = (const uint16_t *) &vram[(0xF8000 + layerNum * 0x2000) / 4];
   const uint16_t *hScrollTable = (const uint16_t *) &vram[(0xF6000 + layerNum * 0x400) / 4];
   bool lineScrollMode = (regs[0x60/4 + layerNum] & 0x8000) != 0;
   int hFullScroll = regs[0x60/4 + layerNum] & 0x3FF;
   int vScroll = (regs[0x60/4 + layerNum] >> 16) & 0x1FF;
 
-  const uint16_t  *maskTable = (const uint16_t *) &vram[0xF7000 / 4];
+  const uint16_t  *maskTable = (const uint16_t *) &vram[0xF7000 / 4 + y];
   if (layerNum < 2) // little endian: layers A and A' use second word in each pair
     maskTable += 1;
 
@@ -402,110 +529,431 @@ static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, cons
   // zero, so we flip the mask when drawing alternate layers (layers 1 and 3).
   const uint16_t maskPolarity = (layerNum & 1) ? 0xFFFF : 0x0000;
 
-  uint32_t *line = pixels;
-
-  for (int y = 0; y < 384; y++)
-  {
-    int hScroll = (lineScrollMode ? hScrollTable[y] : hFullScroll) & 0x1FF;
-    int hTile = hScroll / 8;
-    int hFine = hScroll & 7;        // horizontal pixel offset within tile line
-    int vFine = (y + vScroll) & 7;  // vertical pixel offset within 8x8 tile
-    const uint16_t *nameTable = &nameTableBase[(64 * ((y + vScroll) / 8)) & 0xFFF]; // clamp to 64x64 = 0x1000
-    uint16_t mask = *maskTable ^ maskPolarity;  // each bit covers 32 pixels
+  int hScroll = (lineScrollMode ? hScrollTable[y] : hFullScroll) & 0x1FF;
+  int hTile = hScroll / 8;
+  int hFine = hScroll & 7;        // horizontal pixel offset within tile line
+  int vFine = (y + vScroll) & 7;  // vertical pixel offset within 8x8 tile
+  const uint16_t *nameTable = &nameTableBase[(64 * ((y + vScroll) / 8)) & 0xFFF]; // clamp to 64x64 = 0x1000
+  uint16_t mask = *maskTable ^ maskPolarity;  // each bit covers 32 pixels
 
-    int pixelOffset = -hFine;
-    int extraTile = (hFine != 0) ? 1 : 0; // h-scrolling requires part of 63rd tile
+  int pixelOffset = -hFine;
+  int extraTile = (hFine != 0) ? 1 : 0; // h-scrolling requires part of 63rd tile
 
-    // First tile may be clipped
-    int tx = 0;
-    DrawTileLine<bits, alphaTest, true>(line, pixelOffset, nameTable[(hTile ^ 1) & 63], vFine, vram, palette, mask);
-    ++hTile;
-    pixelOffset += 8;
-    // Middle tiles will not be clipped
-    for (tx = 1; tx < (62 - 1 + extraTile); tx++)
-    {
-      DrawTileLine<bits, alphaTest, false>(line, pixelOffset, nameTable[(hTile ^ 1) & 63], vFine, vram, palette, mask);
-      ++hTile;
-      pixelOffset += 8;
-    }
-    // Last tile may be clipped
-    DrawTileLine<bits, alphaTest, true>(line, pixelOffset, nameTable[(hTile ^ 1) & 63], vFine, vram, palette, mask);
+  // First tile may be clipped
+  int tx = 0;
+  uint16_t tile = nameTable[(hTile ^ 1) & 63];
+  DrawTileLine<true>(line, pixelOffset, GetPatternLine<bits>(tile, vFine), &palette[GetColorHi<bits>(tile)], mask);
+  ++hTile;
+  pixelOffset += 8;
+  // Middle tiles will not be clipped
+  for (tx = 1; tx < (62 - 1 + extraTile); tx++)
+  {
+    tile = nameTable[(hTile ^ 1) & 63];
+    DrawTileLine<false>(line, pixelOffset, GetPatternLine<bits>(tile, vFine), &palette[GetColorHi<bits>(tile)], mask);
     ++hTile;
     pixelOffset += 8;
+  }
+  // Last tile may be clipped
+  tile = nameTable[(hTile ^ 1) & 63];
+  DrawTileLine<true>(line, pixelOffset, GetPatternLine<bits>(tile, vFine), &palette[GetColorHi<bits>(tile)], mask);
+}
 
-    // Advance one line
-    maskTable += 2;
-    line += 496;
+// Returns true if anything a line of a layer is drawn from lies in a dirty page
+template <int bits>
+static bool IsLayerLineDirty(int layerNum, int y, const uint32_t *vram, const uint32_t *regs, const uint8_t *dirtyPages, bool checkTiles)
+{
+  bool lineScrollMode = (regs[0x60/4 + layerNum] & 0x8000) != 0;
+  int vScroll = (regs[0x60/4 + layerNum] >> 16) & 0x1FF;
+  int vFine = (y + vScroll) & 7;
+  unsigned nameTableAddr = 0xF8000 + layerNum * 0x2000 + ((128 * ((y + vScroll) / 8)) & 0x1FFF);
+
+  if (IsPageDirty(dirtyPages, 0xF7000 + y * 4) ||
+      (lineScrollMode && IsPageDirty(dirtyPages, 0xF6000 + layerNum * 0x400 + y * 2)) ||
+      IsPageDirty(dirtyPages, nameTableAddr))
+    return true;
+
+  if (!checkTiles)
+    return false;
+
+  // Any tile in the row could be visible, depending on horizontal scroll
+  const uint16_t *nameTable = (const uint16_t *) &vram[nameTableAddr / 4];
+  int patternLine = (bits == 8) ? vFine * 2 : vFine;
+  for (int tx = 0; tx < 64; tx++)
+  {
+    uint16_t tile = nameTable[tx];
+    unsigned patternAddr = (GetPatternOffset<bits>(tile) + patternLine) * 4;
+    unsigned colorAddr = 0x100000 + GetColorHi<bits>(tile) * 4;
+    if (IsPageDirty(dirtyPages, patternAddr) || IsPageDirty(dirtyPages, colorAddr))
+      return true;
   }
+  return false;
 }
 
-std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *pixelsTop)
+bool CRender2D::UpdateLayer(int layerNum, bool dirtyLines[384])
 {
-  unsigned priority = (m_regs[0x20/4] >> 8) & 0xF;
+  uint32_t scrollReg = m_regs[0x60/4 + layerNum];
+  uint32_t colorOffset = m_regs[0x40/4 + layerNum / 2];
+  bool is4Bit = (m_regs[0x20/4] & (1 << (12 + layerNum))) != 0;
+  const uint32_t *palette = m_offsetPalette[layerNum / 2];
+  uint32_t *line = m_layerSurface[layerNum];
 
-  // Render bottom layers
-  bool noBottomSurface = true;
-  static const int bottomOrder[4] = { 3, 2, 1, 0 };
-  for (int i = 0; i < 4; i++)
+  // Scroll or color depth changes move everything around, color offsets change every pixel
+  bool redrawAll = !m_layerValid[layerNum] || scrollReg != m_layerScroll[layerNum] || is4Bit != m_layerIs4Bit[layerNum] ||
+                   colorOffset != m_layerColorOffset[layerNum];
+  bool checkTiles = m_patternsDirty || m_paletteDirty;
+  if (!redrawAll && !m_anyDirty)
+    return false;
+
+  bool updated = false;
+  for (int y = 0; y < 384; y++)
   {
-    int layerNum = bottomOrder[i];
-    bool is4Bit = (m_regs[0x20/4] & (1 << (12 + layerNum))) != 0;
-    bool enabled = (m_regs[0x60/4 + layerNum] & 0x80000000) != 0;
-    bool selected = (priority & (1 << layerNum)) == 0;
-    if (enabled && selected)
+    bool dirty = redrawAll;
+    if (!dirty)
+      dirty = is4Bit ? IsLayerLineDirty<4>(layerNum, y, m_vram, m_regs, m_dirtyPages, checkTiles) : IsLayerLineDirty<8>(layerNum, y, m_vram, m_regs, m_dirtyPages, checkTiles);
+    if (dirty)
     {
-      if (noBottomSurface)
-      {
-        if (is4Bit)
-          DrawLayer<4, false>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
-        else
-          DrawLayer<8, false>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
-      }
+      if (is4Bit)
+        DrawLayerLine<4>(line, layerNum, y, palette);
       else
-      {
-        if (is4Bit)
-          DrawLayer<4, true>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
-        else
-          DrawLayer<8, true>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
-      }
-      noBottomSurface = false;
+        DrawLayerLine<8>(line, layerNum, y, palette);
+      dirtyLines[y] = true;
+      updated = true;
     }
+    line += 496;
   }
 
-  // Render top layers
+  m_layerValid[layerNum] = true;
+  m_layerScroll[layerNum] = scrollReg;
+  m_layerColorOffset[layerNum] = colorOffset;
+  m_layerIs4Bit[layerNum] = is4Bit;
+  return updated;
+}
+
+void CRender2D::ComposeLine(uint32_t *dest, unsigned layers, int y)
+{
+  // Layers are ordered from bottom to top: B', B, A', A. The bottom-most layer
+  // is copied as is and the others only where they are opaque.
   // NOTE: layer ordering is different according to MAME (which has 3, 2, 0, 1
   // for top layer). Until I see evidence that this is correct and not a typo,
   // I will assume consistent layer ordering.
-  bool noTopSurface = true;
-  static const int topOrder[4] = { 3, 2, 1, 0 };
-  for (int i = 0; i < 4; i++)
+  bool first = true;
+  for (int layerNum = 3; layerNum >= 0; layerNum--)
   {
-    int layerNum = topOrder[i];
-    bool is4Bit = (m_regs[0x20/4] & (1 << (12 + layerNum))) != 0;
-    bool enabled = (m_regs[0x60/4 + layerNum] & 0x80000000) != 0;
-    bool selected = (priority & (1 << layerNum)) != 0;
-    if (enabled && selected)
+    if ((layers & (1 << layerNum)) == 0)
+      continue;
+    const uint32_t *src = &m_layerSurface[layerNum][y * 496];
+    if (first)
+      memcpy(dest, src, 496 * sizeof(uint32_t));
+    else
     {
-      if (noTopSurface)
+      for (int x = 0; x < 496; x++)
       {
-        if (is4Bit)
-          DrawLayer<4, false>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
-        else
-          DrawLayer<8, false>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+        if ((src[x] >> 24) != 0)  // only draw opaque pixels
+          dest[x] = src[x];
       }
-      else
+    }
+    first = false;
+  }
+}
+
+void CRender2D::UploadLines(GLuint texID, const uint32_t *pixels, const bool dirtyLines[384])
+{
+  // Upload each run of changed lines as a sub-rectangle
+  glBindTexture(GL_TEXTURE_2D, texID);
+  int y = 0;
+  while (y < 384)
+  {
+    if (!dirtyLines[y])
+    {
+      y++;
+      continue;
+    }
+    int first = y;
+    while (y < 384 && dirtyLines[y])
+      y++;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 496, y - first, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[first * 496]);
+  }
+}
+
+// Sorts enabled layers into top and bottom (below 3D graphics) surfaces
+void CRender2D::GetSurfaceLayers(unsigned surfaceLayers[2]) const
+{
+  unsigned priority = (m_regs[0x20/4] >> 8) & 0xF;
+  surfaceLayers[0] = 0;
+  surfaceLayers[1] = 0;
+  for (int layerNum = 0; layerNum < 4; layerNum++)
+  {
+    bool enabled = (m_regs[0x60/4 + layerNum] & 0x80000000) != 0;
+    if (enabled)
+      surfaceLayers[(priority & (1 << layerNum)) ? 0 : 1] |= 1 << layerNum;
+  }
+}
+
+void CRender2D::ClearDirtyPages(void)
+{
+  memset(m_dirtyPages, 0, sizeof(m_dirtyPages));
+  m_anyDirty = false;
+  m_patternsDirty = false;
+  m_paletteDirty = false;
+}
+
+void CRender2D::UpdateOffsetPalettes(void)
+{
+  const unsigned colorsPerPage = 1 << (VRAM_PAGE_WIDTH - 2);
+  for (int i = 0; i < 2; i++)
+  {
+    uint32_t offsetReg = m_regs[0x40/4 + i];
+    if (!m_offsetPalettesValid || offsetReg != m_paletteOffset[i])
+      AddColorOffset(m_offsetPalette[i], m_palette, 32768, offsetReg);
+    else if (m_paletteDirty)
+    {
+      for (unsigned color = 0; color < 32768; color += colorsPerPage)
       {
-        if (is4Bit)
-          DrawLayer<4, true>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
-        else
-          DrawLayer<8, true>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+        if (IsPageDirty(m_dirtyPages, 0x100000 + color * 4))
+          AddColorOffset(&m_offsetPalette[i][color], &m_palette[color], colorsPerPage, offsetReg);
       }
-      noTopSurface = false;
     }
+    m_paletteOffset[i] = offsetReg;
   }
+  m_offsetPalettesValid = true;
+}
+
+std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *pixelsTop)
+{
+  unsigned surfaceLayers[2];  // top, bottom
+  GetSurfaceLayers(surfaceLayers);
+
+  // Colors must be up to date before any layer is drawn
+  UpdateOffsetPalettes();
+
+  // Bring layer surfaces up to date, noting which lines changed in each
+  // surface. A different set of layers means the whole surface changes.
+  uint32_t *pixels[2] = { pixelsTop, pixelsBottom };
+  bool dirtyLines[2][384];
+  for (int s = 0; s < 2; s++)
+    std::fill(dirtyLines[s], dirtyLines[s] + 384, surfaceLayers[s] != m_surfaceLayers[s]);
+  for (int layerNum = 0; layerNum < 4; layerNum++)
+  {
+    int s = (surfaceLayers[0] & (1 << layerNum)) ? 0 : 1;
+    if (surfaceLayers[s] & (1 << layerNum))
+      UpdateLayer(layerNum, dirtyLines[s]);
+    else
+      m_layerValid[layerNum] = false; // not drawn, so will fall out of date
+  }
+
+  for (int s = 0; s < 2; s++)
+  {
+    m_surfaceLayers[s] = surfaceLayers[s];
+    if (surfaceLayers[s] == 0)
+      continue;
+    for (int y = 0; y < 384; y++)
+    {
+      if (dirtyLines[s][y])
+        ComposeLine(&pixels[s][y * 496], surfaceLayers[s], y);
+    }
+    UploadLines(m_texID[s], pixels[s], dirtyLines[s]);
+  }
+
+  // Everything marked dirty has now been dealt with
+  ClearDirtyPages();
 
   // Indicate whether top and bottom surfaces have to be rendered
-  return std::pair<bool, bool>(!noTopSurface, !noBottomSurface);
+  return std::pair<bool, bool>(surfaceLayers[0] != 0, surfaceLayers[1] != 0);
+}
+
+
+/******************************************************************************
+ GPU Layer Rendering
+
+ Alternatively, the layers are drawn by a fragment shader that decodes tiles
+ straight from a copy of VRAM and the palettes kept in textures. Only changed
+ VRAM pages and palette lines are uploaded, and the surfaces are only redrawn
+ when something changed. The shader composites the layers exactly as the CPU
+ code above does, into the same surface textures.
+******************************************************************************/
+
+void CRender2D::UploadVRAMWords(unsigned first, unsigned end)
+{
+  // Whole lines of the texture are uploaded together, partial ones on their own
+  while (first < end)
+  {
+    unsigned x = first & 1023;
+    unsigned y = first >> 10;
+    if (x == 0 && end - first >= 1024)
+    {
+      unsigned lines = (end - first) / 1024;
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, 1024, lines, GL_RED_INTEGER, GL_UNSIGNED_INT, &m_vram[first]);
+      first += lines * 1024;
+    }
+    else
+    {
+      unsigned width = std::min(1024 - x, end - first);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, &m_vram[first]);
+      first += width;
+    }
+  }
+}
+
+void CRender2D::UploadTilemapData(void)
+{
+  const unsigned vramPages = 0x100000 >> VRAM_PAGE_WIDTH;   // 256 words each
+  const unsigned palettePages = 0x20000 >> VRAM_PAGE_WIDTH; // 256 colors each
+
+  glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+  // Tile RAM, in runs of dirty pages
+  glBindTexture(GL_TEXTURE_2D, m_vramTexID);
+  unsigned page = 0;
+  while (page < vramPages)
+  {
+    if (m_tilemapDataValid && !IsPageDirty(m_dirtyPages, page << VRAM_PAGE_WIDTH))
+    {
+      page++;
+      continue;
+    }
+    unsigned first = page;
+    while (page < vramPages && (!m_tilemapDataValid || IsPageDirty(m_dirtyPages, page << VRAM_PAGE_WIDTH)))
+      page++;
+    UploadVRAMWords(first * 256, page * 256);
+  }
+
+  // Palette, one texture line per page of palette RAM
+  glBindTexture(GL_TEXTURE_2D, m_paletteTexID);
+  page = 0;
+  while (page < palettePages)
+  {
+    if (m_tilemapDataValid && !IsPageDirty(m_dirtyPages, 0x100000 + (page << VRAM_PAGE_WIDTH)))
+    {
+      page++;
+      continue;
+    }
+    unsigned first = page;
+    while (page < palettePages && (!m_tilemapDataValid || IsPageDirty(m_dirtyPages, 0x100000 + (page << VRAM_PAGE_WIDTH))))
+      page++;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 256, page - first, GL_RGBA, GL_UNSIGNED_BYTE, &m_palette[first * 256]);
+  }
+
+  glPopClientAttrib();
+  m_tilemapDataValid = true;
+}
+
+std::pair<bool, bool> CRender2D::DrawTilemapsGPU(void)
+{
+  unsigned surfaceLayers[2];  // top, bottom
+  GetSurfaceLayers(surfaceLayers);
+
+  // Surfaces only have to be redrawn if anything they depend on changed
+  uint32_t regs[7] = { m_regs[0x20/4], m_regs[0x60/4], m_regs[0x64/4], m_regs[0x68/4], m_regs[0x6C/4], m_regs[0x40/4], m_regs[0x44/4] };
+  bool changed = m_anyDirty || !m_tilemapDataValid || memcmp(regs, m_drawnRegs, sizeof(regs)) != 0 ||
+                 surfaceLayers[0] != m_surfaceLayers[0] || surfaceLayers[1] != m_surfaceLayers[1];
+
+  if (changed && (surfaceLayers[0] | surfaceLayers[1]))
+  {
+    // The 3D renderer's state is left as it was found
+    GLint drawFramebuffer, readFramebuffer, program;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT | GL_TEXTURE_BIT);
+
+    glActiveTexture(GL_TEXTURE1);
+    UploadTilemapData();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_vramTexID);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, 496, 384);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    glUseProgram(m_tilemapProgram);
+    glUniform1i(m_layerConfigLoc, regs[0]);
+    glUniform4i(m_scrollLoc, regs[1], regs[2], regs[3], regs[4]);
+    glUniform2i(m_colorOffsetLoc, regs[5], regs[6]);
+
+    for (int s = 0; s < 2; s++)
+    {
+      if (surfaceLayers[s] == 0)
+        continue;
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texID[s], 0);
+      glUniform1i(m_layersLoc, surfaceLayers[s]);
+      glBegin(GL_QUADS);
+      glVertex2f(-1.0f, -1.0f);
+      glVertex2f(1.0f, -1.0f);
+      glVertex2f(1.0f, 1.0f);
+      glVertex2f(-1.0f, 1.0f);
+      glEnd();
+    }
+
+    glPopAttrib();
+    glUseProgram(program);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+
+    memcpy(m_drawnRegs, regs, sizeof(regs));
+    m_surfaceLayers[0] = surfaceLayers[0];
+    m_surfaceLayers[1] = surfaceLayers[1];
+    ClearDirtyPages();
+  }
+
+  // Indicate whether top and bottom surfaces have to be rendered
+  return std::pair<bool, bool>(surfaceLayers[0] != 0, surfaceLayers[1] != 0);
+}
+
+bool CRender2D::InitTilemapRendering(void)
+{
+  // Needs integer textures, texelFetch() and framebuffer objects
+  if (!GLEW_VERSION_3_0)
+  {
+    ErrorLog("GPU tilemap rendering requires OpenGL 3.0. Tilemaps will be drawn on the CPU.");
+    return false;
+  }
+
+  if (OKAY != LoadShaderProgram(&m_tilemapProgram, &m_tilemapVertexShader, &m_tilemapFragmentShader, "", "", s_tilemapVertexShaderSource, s_tilemapFragmentShaderSource))
+  {
+    ErrorLog("Tilemaps will be drawn on the CPU.");
+    return false;
+  }
+
+  glUseProgram(m_tilemapProgram);
+  glUniform1i(glGetUniformLocation(m_tilemapProgram, "vram"), 0);    // texture unit 0
+  glUniform1i(glGetUniformLocation(m_tilemapProgram, "palette"), 1); // texture unit 1
+  m_layersLoc = glGetUniformLocation(m_tilemapProgram, "layers");
+  m_layerConfigLoc = glGetUniformLocation(m_tilemapProgram, "layerConfig");
+  m_scrollLoc = glGetUniformLocation(m_tilemapProgram, "scroll");
+  m_colorOffsetLoc = glGetUniformLocation(m_tilemapProgram, "colorOffset");
+
+  GLuint texIDs[2];
+  glGenTextures(2, texIDs);
+  m_vramTexID = texIDs[0];
+  m_paletteTexID = texIDs[1];
+  for (int i = 0; i < 2; i++)
+  {
+    glBindTexture(GL_TEXTURE_2D, texIDs[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  }
+  glBindTexture(GL_TEXTURE_2D, m_vramTexID);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, 1024, 256, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+  glBindTexture(GL_TEXTURE_2D, m_paletteTexID);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 128, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  glGenFramebuffers(1, &m_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texID[0], 0);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    ErrorLog("Unable to draw into tilemap surfaces (framebuffer status %X). Tilemaps will be drawn on the CPU.", status);
+    return false;
+  }
+
+  return true;
 }
 
 
@@ -568,19 +1016,12 @@ void CRender2D::BeginFrame(void)
 
 void CRender2D::PreRenderFrame(void)
 {
-  // Update all layers
-  m_surfaces_present = DrawTilemaps(m_bottomSurface, m_topSurface);
+  // Update the layers and upload whatever changed
   glActiveTexture(GL_TEXTURE0); // texture unit 0
-  if (m_surfaces_present.first)
-  {
-    glBindTexture(GL_TEXTURE_2D, m_texID[0]);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 496, 384, GL_RGBA, GL_UNSIGNED_BYTE, m_topSurface);
-  }
-  if (m_surfaces_present.second)
-  {
-    glBindTexture(GL_TEXTURE_2D, m_texID[1]);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 496, 384, GL_RGBA, GL_UNSIGNED_BYTE, m_bottomSurface);
-  }
+  if (m_gpuTilemaps)
+    m_surfaces_present = DrawTilemapsGPU();
+  else
+    m_surfaces_present = DrawTilemaps(m_bottomSurface, m_topSurface);
 }
 
 void CRender2D::RenderFrameBottom(void)
@@ -616,6 +1057,29 @@ void CRender2D::WriteVRAM(unsigned addr, uint32_t data)
 {
 }
 
+void CRender2D::MarkVRAMDirty(const uint8_t *dirtyPages)
+{
+  bool any = false;
+  for (size_t i = 0; i < sizeof(m_dirtyPages); i++)
+  {
+    m_dirtyPages[i] |= dirtyPages[i];
+    any |= dirtyPages[i] != 0;
+  }
+  if (!any)
+    return;
+
+  // Palette RAM starts at 0x100000, everything below may hold tile patterns
+  const size_t paletteStart = 0x100000 >> (VRAM_PAGE_WIDTH + 3);
+  for (size_t i = 0; i < paletteStart; i++)
+  {
+    m_patternCacheValid[0][i] &= ~dirtyPages[i];
+    m_patternCacheValid[1][i] &= ~dirtyPages[i];
+  }
+  m_anyDirty = true;
+  m_patternsDirty |= std::any_of(dirtyPages, dirtyPages + paletteStart, [](uint8_t b) { return b != 0; });
+  m_paletteDirty |= std::any_of(dirtyPages + paletteStart, dirtyPages + sizeof(m_dirtyPages), [](uint8_t b) { return b != 0; });
+}
+
 
 /******************************************************************************
  Configuration, Initialization, and Shutdown
@@ -627,10 +1091,9 @@ void CRender2D::AttachRegisters(const uint32_t *regPtr)
   DebugLog("Render2D attached registers\n");
 }
 
-void CRender2D::AttachPalette(const uint32_t *palPtr[2])
+void CRender2D::AttachPalette(const uint32_t *palPtr)
 {
-  m_palette[0] = palPtr[0];
-  m_palette[1] = palPtr[1];
+  m_palette = palPtr;
   DebugLog("Render2D attached palette\n");
 }
 
@@ -641,9 +1104,13 @@ void CRender2D::AttachVRAM(const uint8_t *vramPtr)
 }
 
 // Memory pool and offsets within it
-#define MEMORY_POOL_SIZE      (2*512*384*4)
-#define OFFSET_TOP_SURFACE    0             // 512*384*4 bytes
-#define OFFSET_BOTTOM_SURFACE (512*384*4)   // 512*384*4
+#define MEMORY_POOL_SIZE        (6*512*384*4 + 0x340000)
+#define OFFSET_TOP_SURFACE      0             // 512*384*4 bytes
+#define OFFSET_BOTTOM_SURFACE   (512*384*4)   // 512*384*4
+#define OFFSET_LAYER_SURFACES   (2*512*384*4) // 4*512*384*4
+#define OFFSET_PATTERN_CACHE_4  (6*512*384*4) // 0x200000 (2 indices per VRAM byte)
+#define OFFSET_PATTERN_CACHE_8  (6*512*384*4 + 0x200000)  // 0x100000
+#define OFFSET_OFFSET_PALETTES  (6*512*384*4 + 0x300000)  // 2*0x20000
 
 bool CRender2D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yRes, unsigned totalXRes, unsigned totalYRes)
 {
@@ -665,6 +1132,12 @@ bool CRender2D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned
   // Set up pointers to memory regions
   m_topSurface    = (uint32_t *) &m_memoryPool[OFFSET_TOP_SURFACE];
   m_bottomSurface = (uint32_t *) &m_memoryPool[OFFSET_BOTTOM_SURFACE];
+  for (int i = 0; i < 4; i++)
+    m_layerSurface[i] = (uint32_t *) &m_memoryPool[OFFSET_LAYER_SURFACES + i*512*384*4];
+  m_patternCache[0] = &m_memoryPool[OFFSET_PATTERN_CACHE_4];
+  m_patternCache[1] = &m_memoryPool[OFFSET_PATTERN_CACHE_8];
+  m_offsetPalette[0] = (uint32_t *) &m_memoryPool[OFFSET_OFFSET_PALETTES];
+  m_offsetPalette[1] = (uint32_t *) &m_memoryPool[OFFSET_OFFSET_PALETTES + 0x20000];
 
   // Resolution
   m_xPixels = xRes;
@@ -689,6 +1162,10 @@ bool CRender2D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 496, 384, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
   }
 
+  // Optionally draw the layers with a shader rather than on the CPU
+  if (m_config["GPUTilemaps"].ValueAsDefault<bool>(false))
+    m_gpuTilemaps = InitTilemapRendering();
+
   DebugLog("Render2D initialized (allocated %1.1f MB)\n", float(MEMORY_POOL_SIZE) / 0x100000);
   return OKAY;
 }
@@ -703,6 +1180,15 @@ CRender2D::~CRender2D(void)
 {
   DestroyShaderProgram(m_shaderProgram, m_vertexShader, m_fragmentShader);
   glDeleteTextures(2, m_texID);
+  if (m_tilemapProgram)
+    DestroyShaderProgram(m_tilemapProgram, m_tilemapVertexShader, m_tilemapFragmentShader);
+  if (m_vramTexID)
+  {
+    glDeleteTextures(1, &m_vramTexID);
+    glDeleteTextures(1, &m_paletteTexID);
+  }
+  if (m_fbo)
+    glDeleteFramebuffers(1, &m_fbo);
 
   if (m_memoryPool)
   {
@@ -713,6 +1199,8 @@ CRender2D::~CRender2D(void)
   m_vram = 0;
   m_topSurface = 0;
   m_bottomSurface = 0;
+  for (int i = 0; i < 4; i++)
+    m_layerSurface[i] = 0;
 
   DebugLog("Destroyed Render2D\n");
 }
@@ -100,6 +100,20 @@ public:
    *    data  The data to write.
    */
   void WriteVRAM(unsigned addr, uint32_t data);
+
+  /*
+   * MarkVRAMDirty(dirtyPages):
+   *
+   * Indicates which parts of VRAM changed since the last call. Only the
+   * lines of each layer that are drawn from changed pages are redrawn by
+   * PreRenderFrame(), so every change must be reported here. Register
+   * changes are detected by the renderer itself.
+   *
+   * Parameters:
+   *    dirtyPages  One bit per 1 KB page of VRAM and palette RAM (0x120000
+   *                bytes in all). Bit n of byte i covers page i*8+n.
+   */
+  void MarkVRAMDirty(const uint8_t *dirtyPages);
   
   /*
    * AttachRegisters(regPtr):
@@ -116,14 +130,16 @@ public:
   /*
    * AttachPalette(palPtr):
    *
-   * Attaches tile generator palettes. This must be done prior to any
-   * rendering.
+   * Attaches the tile generator palette. This must be done prior to any
+   * rendering. Changes to it must be reported with MarkVRAMDirty() as
+   * changes to the corresponding palette RAM pages.
    *
    * Parameters:
-   *    palPtr  Pointer to two palettes. The first is for layers A/A' and
-   *        the second is for B/B'.
+   *    palPtr  Pointer to 32768 decoded RGBA colors, without color offsets.
+   *        The offsets for layers A/A' and B/B' are applied by the
+   *        renderer from registers 0x40 and 0x44.
    */
-  void AttachPalette(const uint32_t *palPtr[2]);
+  void AttachPalette(const uint32_t *palPtr);
 
   /*
    * AttachVRAM(vramPtr):
@@ -173,7 +189,19 @@ public:
   
 private:
   // Private member functions
+  void GetSurfaceLayers(unsigned surfaceLayers[2]) const;
+  void ClearDirtyPages(void);
+  void UpdateOffsetPalettes(void);
   std::pair<bool, bool> DrawTilemaps(uint32_t *destBottom, uint32_t *destTop);
+  std::pair<bool, bool> DrawTilemapsGPU(void);
+  bool InitTilemapRendering(void);
+  void UploadTilemapData(void);
+  void UploadVRAMWords(unsigned first, unsigned end);
+  template <int bits> const uint8_t *GetPatternLine(uint16_t tile, int patternLine);
+  template <int bits> void DrawLayerLine(uint32_t *line, int layerNum, int y, const uint32_t *palette);
+  bool UpdateLayer(int layerNum, bool dirtyLines[384]);
+  void ComposeLine(uint32_t *dest, unsigned layers, int y);
+  void UploadLines(GLuint texID, const uint32_t *pixels, const bool dirtyLines[384]);
   void DisplaySurface(int surface);
   void Setup2D(bool isBottom);
       
@@ -182,7 +210,7 @@ private:
 
   // Data received from tile generator device object
   const uint32_t *m_vram;
-  const uint32_t *m_palette[2]; // palettes for A/A' and B/B'
+  const uint32_t *m_palette;    // decoded palette, without color offsets
   const uint32_t *m_regs;
   
   // OpenGL data
@@ -201,6 +229,22 @@ private:
   GLuint m_fragmentShader;  // fragment shader
   GLuint m_textureMapLoc;   // location of "textureMap" uniform
 
+  // GPU tilemap rendering: layers are drawn into the surface textures by a
+  // shader that reads VRAM and the palettes from textures of their own
+  bool   m_gpuTilemaps = false;
+  GLuint m_tilemapProgram = 0;
+  GLuint m_tilemapVertexShader = 0;
+  GLuint m_tilemapFragmentShader = 0;
+  GLint  m_layersLoc;             // location of "layers" uniform
+  GLint  m_layerConfigLoc;        // location of "layerConfig" uniform
+  GLint  m_scrollLoc;             // location of "scroll" uniform
+  GLint  m_colorOffsetLoc;        // location of "colorOffset" uniform
+  GLuint m_vramTexID = 0;         // 1 MB of tile RAM as 1024x256 32-bit words
+  GLuint m_paletteTexID = 0;      // palette as 256x128 colors
+  GLuint m_fbo = 0;               // for drawing into the surface textures
+  bool   m_tilemapDataValid = false;  // whether VRAM and palette textures have been filled in
+  uint32_t m_drawnRegs[7];        // layer configuration, scroll and color offset registers last drawn with
+
   // PreRenderFrame() tracks which surfaces exist in current frame
   std::pair<bool, bool> m_surfaces_present = std::pair<bool, bool>(false, false);
 
@@ -208,6 +252,23 @@ private:
   uint8_t   *m_memoryPool = 0;    // all memory is allocated here
   uint32_t  *m_topSurface = 0;    // 512x384x32bpp pixel surface for top layers
   uint32_t  *m_bottomSurface = 0; // bottom layers
+  uint32_t  *m_layerSurface[4] = { 0, 0, 0, 0 };  // each layer on its own, kept between frames
+  uint8_t   *m_patternCache[2] = { 0, 0 };        // VRAM decoded to one color index per byte, as 4- and 8-bit patterns
+  uint32_t  *m_offsetPalette[2] = { 0, 0 };       // palette with the A/A' and B/B' color offsets applied
+
+  // Change tracking, so layers are only redrawn where they may have changed
+  uint8_t   m_dirtyPages[0x120000/0x2000] = {};   // VRAM pages changed since the last frame
+  bool      m_anyDirty = false;
+  bool      m_patternsDirty = false;              // any page below palette RAM
+  bool      m_paletteDirty = false;
+  bool      m_layerValid[4] = { false, false, false, false };
+  uint32_t  m_layerScroll[4];                     // scroll registers the layers were drawn with
+  uint32_t  m_layerColorOffset[4];                // color offset registers the layers were drawn with
+  bool      m_layerIs4Bit[4];
+  unsigned  m_surfaceLayers[2] = { ~0u, ~0u };    // layers composited into top and bottom surfaces
+  uint8_t   m_patternCacheValid[2][0x100000/0x2000] = {};  // VRAM pages decoded into each pattern cache
+  bool      m_offsetPalettesValid = false;
+  uint32_t  m_paletteOffset[2];                   // color offset registers the offset palettes were computed with
 };
 
 
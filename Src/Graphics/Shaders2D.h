@@ -114,4 +114,177 @@ static const char s_fragmentShaderSource[] =
 "}\n"
 };
 
+// Tilemap vertex shader
+static const char s_tilemapVertexShaderSource[] =
+{
+"/**\n"
+" ** Supermodel\n"
+" ** A Sega Model 3 Arcade Emulator.\n"
+" ** Copyright 2011-2012 Bart Trzynadlowski, Nik Henson \n"
+" **\n"
+" ** This file is part of Supermodel.\n"
+" **\n"
+" ** Supermodel is free software: you can redistribute it and/or modify it under\n"
+" ** the terms of the GNU General Public License as published by the Free \n"
+" ** Software Foundation, either version 3 of the License, or (at your option)\n"
+" ** any later version.\n"
+" **\n"
+" ** Supermodel is distributed in the hope that it will be useful, but WITHOUT\n"
+" ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or\n"
+" ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for\n"
+" ** more details.\n"
+" **\n"
+" ** You should have received a copy of the GNU General Public License along\n"
+" ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.\n"
+" **/\n"
+"\n"
+"/*\n"
+" * Vertex2DTilemap.glsl\n"
+" *\n"
+" * Vertex shader for drawing 2D tilemap layers on the GPU.\n"
+" */\n"
+" \n"
+"#version 130\n"
+"\n"
+"void main(void)\n"
+"{\n"
+"\tgl_Position = gl_Vertex;\t// quad already covers the whole surface\n"
+"}\n"
+};
+
+// Tilemap fragment shader
+static const char s_tilemapFragmentShaderSource[] = 
+{
+"/**\n"
+" ** Supermodel\n"
+" ** A Sega Model 3 Arcade Emulator.\n"
+" ** Copyright 2011-2012 Bart Trzynadlowski, Nik Henson \n"
+" **\n"
+" ** This file is part of Supermodel.\n"
+" **\n"
+" ** Supermodel is free software: you can redistribute it and/or modify it under\n"
+" ** the terms of the GNU General Public License as published by the Free \n"
+" ** Software Foundation, either version 3 of the License, or (at your option)\n"
+" ** any later version.\n"
+" **\n"
+" ** Supermodel is distributed in the hope that it will be useful, but WITHOUT\n"
+" ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or\n"
+" ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for\n"
+" ** more details.\n"
+" **\n"
+" ** You should have received a copy of the GNU General Public License along\n"
+" ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.\n"
+" **/\n"
+"\n"
+"/*\n"
+" * Fragment2DTilemap.glsl\n"
+" *\n"
+" * Fragment shader for drawing 2D tilemap layers on the GPU. Each fragment is\n"
+" * one pixel of a 496x384 layer surface, composited from the selected layers\n"
+" * in the same way as CRender2D does on the CPU. See Render2D.cpp for the\n"
+" * VRAM layout.\n"
+" */\n"
+"\n"
+"#version 130\n"
+"\n"
+"// Global uniforms\n"
+"uniform usampler2D\tvram;\t\t\t// 1 MB of tile RAM, one 32-bit word per texel, 1024 per line\n"
+"uniform sampler2D\tpalette;\t\t// decoded palette, 256 colors per line\n"
+"uniform int\t\t\tlayers;\t\t\t// layers composited into this surface, bit n = layer n\n"
+"uniform int\t\t\tlayerConfig;\t// layer configuration register (0x20)\n"
+"uniform ivec4\t\tscroll;\t\t\t// layer scroll registers (0x60-0x6C)\n"
+"uniform ivec2\t\tcolorOffset;\t// color offset registers for A/A' and B/B' (0x40-0x44)\n"
+"\n"
+"// Reads a 32-bit word at a byte address\n"
+"uint ReadWord(int addr)\n"
+"{\n"
+"\tint i = addr >> 2;\n"
+"\treturn texelFetch(vram, ivec2(i & 1023, i >> 10), 0).r;\n"
+"}\n"
+"\n"
+"// Reads a little endian 16-bit word at a byte address\n"
+"int ReadHalf(int addr)\n"
+"{\n"
+"\treturn int((ReadWord(addr) >> uint((addr & 2) * 8)) & 0xFFFFu);\n"
+"}\n"
+"\n"
+"// Adds a color offset register: signed R, G, B offsets, doubled, with saturation\n"
+"vec4 AddColorOffset(vec4 color, int offsetReg)\n"
+"{\n"
+"\tivec3 offset = ivec3(offsetReg << 24, offsetReg << 16, offsetReg << 8) >> 24;\n"
+"\tivec3 rgb = clamp(ivec3(color.rgb * 255.0 + 0.5) + offset * 2, 0, 255);\n"
+"\treturn vec4(vec3(rgb) / 255.0, color.a);\n"
+"}\n"
+"\n"
+"// Returns a pixel of one layer, transparent where hidden by the mask\n"
+"vec4 LayerPixel(int layer, ivec2 pos)\n"
+"{\n"
+"\tint scrollReg = scroll[layer];\n"
+"\tbool lineScrollMode = (scrollReg & 0x8000) != 0;\n"
+"\tint hScroll = (lineScrollMode ? ReadHalf(0xF6000 + layer * 0x400 + pos.y * 2) : scrollReg) & 0x1FF;\n"
+"\tint vScroll = (scrollReg >> 16) & 0x1FF;\n"
+"\n"
+"\t// If mask bit is clear, alternate layer is shown (layers A and A' use the upper half)\n"
+"\tuint maskWord = ReadWord(0xF7000 + pos.y * 4);\n"
+"\tint mask = int((layer < 2) ? (maskWord >> 16) : (maskWord & 0xFFFFu));\n"
+"\tif ((layer & 1) != 0)\n"
+"\t\tmask ^= 0xFFFF;\n"
+"\tif ((mask & (1 << (15 - (pos.x >> 5)))) == 0)\n"
+"\t\treturn vec4(0.0);\n"
+"\n"
+"\t// Name table entry, stored in pairs with the left tile in the upper half\n"
+"\tint x = pos.x + hScroll;\n"
+"\tint y = pos.y + vScroll;\n"
+"\tint nameIndex = ((y >> 3) & 63) * 64 + (((x >> 3) & 63) ^ 1);\n"
+"\tint tile = ReadHalf(0xF8000 + layer * 0x2000 + nameIndex * 2);\n"
+"\tint fineX = x & 7;\n"
+"\tint fineY = y & 7;\n"
+"\n"
+"\tint color;\n"
+"\tif ((layerConfig & (1 << (12 + layer))) != 0)\n"
+"\t{\n"
+"\t\t// 4-bit pattern, 1 word per line\n"
+"\t\tint patternAddr = (((tile & 0x3FFF) << 1) | ((tile >> 15) & 1)) * 32;\n"
+"\t\tuint pattern = ReadWord(patternAddr + fineY * 4);\n"
+"\t\tcolor = int((pattern >> uint((7 - fineX) * 4)) & 0xFu) | (tile & 0x7FF0);\n"
+"\t}\n"
+"\telse\n"
+"\t{\n"
+"\t\t// 8-bit pattern, 2 words per line\n"
+"\t\tint patternAddr = (tile & 0x3FFF) * 64;\n"
+"\t\tuint pattern = ReadWord(patternAddr + fineY * 8 + (fineX >> 2) * 4);\n"
+"\t\tcolor = int((pattern >> uint((3 - (fineX & 3)) * 8)) & 0xFFu) | (tile & 0x7F00);\n"
+"\t}\n"
+"\n"
+"\treturn AddColorOffset(texelFetch(palette, ivec2(color & 255, color >> 8), 0), colorOffset[layer >> 1]);\n"
+"}\n"
+"\n"
+"/*\n"
+" * main():\n"
+" *\n"
+" * Fragment shader entry point.\n"
+" */\n"
+"\n"
+"void main(void)\n"
+"{\n"
+"\tivec2 pos = ivec2(gl_FragCoord.xy);\n"
+"\tvec4 color = vec4(0.0);\n"
+"\tbool first = true;\n"
+"\n"
+"\t// Layers from bottom to top: B', B, A', A. The bottom-most layer is drawn\n"
+"\t// as is and the others only where they are opaque.\n"
+"\tfor (int layer = 3; layer >= 0; layer--)\n"
+"\t{\n"
+"\t\tif ((layers & (1 << layer)) == 0)\n"
+"\t\t\tcontinue;\n"
+"\t\tvec4 pixel = LayerPixel(layer, pos);\n"
+"\t\tif (first || pixel.a != 0.0)\n"
+"\t\t\tcolor = pixel;\n"
+"\t\tfirst = false;\n"
+"\t}\n"
+"\n"
+"\tgl_FragColor = color;\n"
+"}\n"
+};
+
 #endif	// INCLUDED_SHADERS2D_H
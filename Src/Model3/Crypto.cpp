@@ -92,7 +92,9 @@ enum {
 };
 
 CCrypto::CCrypto()
-  : key(0)
+  : key(0),
+    scheduled_subkey(0),
+    schedule_valid(false)
 {
 }
 
@@ -165,6 +167,7 @@ void CCrypto::Init(uint32_t encryptionKey, std::function<uint16_t(uint32_t)> Rea
 */
 
   key = encryptionKey;
+  game_key_schedule(key);
 }
 
 void CCrypto::Reset()
@@ -648,54 +651,84 @@ const int CCrypto::fn2_sequence_key_scheduling[16] = {77,34,8,42,36,27,69,66,13,
 
 const int CCrypto::fn2_middle_result_scheduling[16] = {1,10,44,68,74,78,81,95,2,4,30,40,41,51,53,58};
 
-int CCrypto::feistel_function(int input, const struct sbox *sboxes, UINT32 subkeys)
+/**************************
+The key scheduling below is done once per game and once per sequence key rather than for every word, and the
+Feistel networks are evaluated with lookup tables: the sbox inputs of each round are gathered from the 8-bit half
+and the sbox outputs scattered into the result with one table lookup each. The first network only depends on the
+counter once the sequence key is known, so each of its rounds is reduced to a single 256-entry table.
+**************************/
+
+void CCrypto::build_feistel_tables(feistel_tables *tables, const struct sbox *sboxes)
 {
 	int k,m;
-	int aux;
-	int result=0;
 
 	for (m=0; m<4; ++m) { // 4 sboxes
-		for (k=0, aux=0; k<6; ++k)
-			if (sboxes[m].inputs[k]!=-1)
-				aux |= BIT(input, sboxes[m].inputs[k]) << k;
-
-		aux = sboxes[m].table[(aux^subkeys)&0x3f];
-
-		for (k=0; k<2; ++k)
-			result |= BIT(aux,k) << sboxes[m].outputs[k];
+		for (int input=0; input<256; ++input) {
+			int aux=0;
+			for (k=0; k<6; ++k)
+				if (sboxes[m].inputs[k]!=-1)
+					aux |= BIT(input, sboxes[m].inputs[k]) << k;
+			tables->inputs[m][input] = aux;
+		}
 
-		subkeys >>=6;
+		for (int x=0; x<64; ++x) {
+			int aux = sboxes[m].table[x];
+			int result = 0;
+			for (k=0; k<2; ++k)
+				result |= BIT(aux,k) << sboxes[m].outputs[k];
+			tables->outputs[m][x] = result;
+		}
 	}
-
-	return result;
 }
 
-/**************************
-This implementation is an "educational" version. It must be noted that it can be speed-optimized in a number of ways.
-The most evident one is to factor out the parts of the key-scheduling that must only be done once (like the game-key &
-sequence-key parts) as noted in the comments inlined in the function. More sophisticated speed-ups can be gained by
-noticing that the weak key-scheduling would allow to create some pregenerated look-up tables for doing most of the work
-of the function. Even so, it would still be pretty slow, so caching techniques could be a wiser option here.
-**************************/
+inline int CCrypto::fast_feistel_function(int input, const feistel_tables &tables, UINT32 subkeys)
+{
+	return tables.outputs[0][tables.inputs[0][input] ^ ((subkeys >>  0) & 0x3f)] |
+		tables.outputs[1][tables.inputs[1][input] ^ ((subkeys >>  6) & 0x3f)] |
+		tables.outputs[2][tables.inputs[2][input] ^ ((subkeys >> 12) & 0x3f)] |
+		tables.outputs[3][tables.inputs[3][input] ^ ((subkeys >> 18) & 0x3f)];
+}
 
-UINT16 CCrypto::block_decrypt(UINT32 game_key, UINT16 sequence_key, UINT16 counter, UINT16 data)
+void CCrypto::game_key_schedule(UINT32 game_key)
 {
-	int j;
+	int i,j;
 	int aux, aux2;
-	int A, B;
-	int middle_result;
-	UINT32 fn1_subkeys[4];
-	UINT32 fn2_subkeys[4];
 
-	/* Game-key scheduling; this could be done just once per game at initialization time */
-	memset(fn1_subkeys, 0, sizeof(UINT32) * 4);
-	memset(fn2_subkeys, 0, sizeof(UINT32) * 4);
+	for (j = 0; j < 4; ++j) {
+		build_feistel_tables(&fn1_tables[j], fn1_sboxes[j]);
+		build_feistel_tables(&fn2_tables[j], fn2_sboxes[j]);
+	}
+
+	for (i = 0; i < 256; ++i) {
+		bitswap_tables[0][0][i] = BITSWAP16(i, 5, 12, 14, 13, 9, 3, 6, 4, 8, 1, 15, 11, 0, 7, 10, 2);
+		bitswap_tables[0][1][i] = BITSWAP16(i << 8, 5, 12, 14, 13, 9, 3, 6, 4, 8, 1, 15, 11, 0, 7, 10, 2);
+		bitswap_tables[1][0][i] = BITSWAP16(i, 14, 3, 8, 12, 13, 7, 15, 4, 6, 2, 9, 5, 11, 0, 1, 10);
+		bitswap_tables[1][1][i] = BITSWAP16(i << 8, 14, 3, 8, 12, 13, 7, 15, 4, 6, 2, 9, 5, 11, 0, 1, 10);
+		bitswap_tables[2][0][i] = BITSWAP16(i, 15, 7, 6, 14, 13, 12, 5, 4, 3, 2, 11, 10, 9, 1, 0, 8);
+		bitswap_tables[2][1][i] = BITSWAP16(i << 8, 15, 7, 6, 14, 13, 12, 5, 4, 3, 2, 11, 10, 9, 1, 0, 8);
+	}
+
+	/* Middle-result-key sheduling, by byte */
+	memset(fn2_middle_subkeys, 0, sizeof(fn2_middle_subkeys));
+	for (i = 0; i < 256; ++i) {
+		for (j = 0; j < 16; ++j) {
+			if (BIT(i, j & 7) != 0) {
+				aux = fn2_middle_result_scheduling[j] % 24;
+				aux2 = fn2_middle_result_scheduling[j] / 24;
+				fn2_middle_subkeys[j >> 3][i][aux2] ^= (1 << aux);
+			}
+		}
+	}
+
+	/* Game-key scheduling */
+	memset(fn1_game_subkeys, 0, sizeof(UINT32) * 4);
+	memset(fn2_game_subkeys, 0, sizeof(UINT32) * 4);
 
 	for (j = 0; j < FN1GK; ++j) {
 		if (BIT(game_key, fn1_game_key_scheduling[j][0]) != 0) {
 			aux = fn1_game_key_scheduling[j][1] % 24;
 			aux2 = fn1_game_key_scheduling[j][1] / 24;
-			fn1_subkeys[aux2] ^= (1 << aux);
+			fn1_game_subkeys[aux2] ^= (1 << aux);
 		}
 	}
 
@@ -703,12 +736,22 @@ UINT16 CCrypto::block_decrypt(UINT32 game_key, UINT16 sequence_key, UINT16 count
 		if (BIT(game_key, fn2_game_key_scheduling[j][0]) != 0) {
 			aux = fn2_game_key_scheduling[j][1] % 24;
 			aux2 = fn2_game_key_scheduling[j][1] / 24;
-			fn2_subkeys[aux2] ^= (1 << aux);
+			fn2_game_subkeys[aux2] ^= (1 << aux);
 		}
 	}
-	/********************************************************/
 
-	/* Sequence-key scheduling; this could be done just once per decryption run */
+	schedule_valid = false;
+}
+
+void CCrypto::sequence_key_schedule(UINT16 sequence_key)
+{
+	int i,j;
+	int aux, aux2;
+	UINT32 fn1_subkeys[4];
+
+	memcpy(fn1_subkeys, fn1_game_subkeys, sizeof(UINT32) * 4);
+	memcpy(fn2_sequence_subkeys, fn2_game_subkeys, sizeof(UINT32) * 4);
+
 	for (j = 0; j < 20; ++j) {
 		if (BIT(sequence_key, fn1_sequence_key_scheduling[j][0]) != 0) {
 			aux = fn1_sequence_key_scheduling[j][1] % 24;
@@ -721,64 +764,57 @@ UINT16 CCrypto::block_decrypt(UINT32 game_key, UINT16 sequence_key, UINT16 count
 		if (BIT(sequence_key, j) != 0) {
 			aux = fn2_sequence_key_scheduling[j] % 24;
 			aux2 = fn2_sequence_key_scheduling[j] / 24;
-			fn2_subkeys[aux2] ^= (1 << aux);
+			fn2_sequence_subkeys[aux2] ^= (1 << aux);
 		}
 	}
 
-	/**************************************************************/
-
-	// First Feistel Network
-
-	aux = BITSWAP16(counter, 5, 12, 14, 13, 9, 3, 6, 4, 8, 1, 15, 11, 0, 7, 10, 2);
-
-	// 1st round
-	B = aux >> 8;
-	A = (aux & 0xff) ^ feistel_function(B, fn1_sboxes[0], fn1_subkeys[0]);
+	// The first Feistel network's subkeys are now fixed
+	for (j = 0; j < 4; ++j)
+		for (i = 0; i < 256; ++i)
+			fn1_rounds[j][i] = fast_feistel_function(i, fn1_tables[j], fn1_subkeys[j]);
 
-	// 2nd round
-	B ^= feistel_function(A, fn1_sboxes[1], fn1_subkeys[1]);
+	scheduled_subkey = sequence_key;
+	schedule_valid = true;
+}
 
-	// 3rd round
-	A ^= feistel_function(B, fn1_sboxes[2], fn1_subkeys[2]);
+UINT16 CCrypto::block_decrypt(UINT16 counter, UINT16 data)
+{
+	int aux;
+	int A, B;
+	UINT32 fn2_subkeys[4];
 
-	// 4th round
-	B ^= feistel_function(A, fn1_sboxes[3], fn1_subkeys[3]);
+	// First Feistel Network
 
-	middle_result = (B << 8) | A;
+	aux = bitswap_tables[0][0][counter & 0xff] | bitswap_tables[0][1][counter >> 8];
 
+	B = aux >> 8;
+	A = (aux & 0xff) ^ fn1_rounds[0][B];
+	B ^= fn1_rounds[1][A];
+	A ^= fn1_rounds[2][B];
+	B ^= fn1_rounds[3][A];
 
-	/* Middle-result-key sheduling */
-	for (j = 0; j < 16; ++j) {
-		if (BIT(middle_result, j) != 0) {
-			aux = fn2_middle_result_scheduling[j] % 24;
-			aux2 = fn2_middle_result_scheduling[j] / 24;
-			fn2_subkeys[aux2] ^= (1 << aux);
-		}
-	}
-	/*********************/
+	/* Middle-result-key sheduling (middle result is B:A) */
+	for (int j = 0; j < 4; ++j)
+		fn2_subkeys[j] = fn2_sequence_subkeys[j] ^ fn2_middle_subkeys[0][A][j] ^ fn2_middle_subkeys[1][B][j];
 
 	// Second Feistel Network
 
-	aux = BITSWAP16(data, 14, 3, 8, 12, 13, 7, 15, 4, 6, 2, 9, 5, 11, 0, 1, 10);
+	aux = bitswap_tables[1][0][data & 0xff] | bitswap_tables[1][1][data >> 8];
 
 	// 1st round
 	B = aux >> 8;
-	A = (aux & 0xff) ^ feistel_function(B, fn2_sboxes[0], fn2_subkeys[0]);
+	A = (aux & 0xff) ^ fast_feistel_function(B, fn2_tables[0], fn2_subkeys[0]);
 
 	// 2nd round
-	B ^= feistel_function(A, fn2_sboxes[1], fn2_subkeys[1]);
+	B ^= fast_feistel_function(A, fn2_tables[1], fn2_subkeys[1]);
 
 	// 3rd round
-	A ^= feistel_function(B, fn2_sboxes[2], fn2_subkeys[2]);
+	A ^= fast_feistel_function(B, fn2_tables[2], fn2_subkeys[2]);
 
 	// 4th round
-	B ^= feistel_function(A, fn2_sboxes[3], fn2_subkeys[3]);
+	B ^= fast_feistel_function(A, fn2_tables[3], fn2_subkeys[3]);
 
-	aux = (B << 8) | A;
-
-	aux = BITSWAP16(aux, 15, 7, 6, 14, 13, 12, 5, 4, 3, 2, 11, 10, 9, 1, 0, 8);
-
-	return aux;
+	return bitswap_tables[2][0][A] | bitswap_tables[2][1][B];
 }
 
 
@@ -788,7 +824,10 @@ UINT16 CCrypto::get_decrypted_16()
 
 	enc = m_read(prot_cur_address);
 
-	UINT16 dec = block_decrypt(key, subkey, prot_cur_address, enc);
+	if (!schedule_valid || subkey != scheduled_subkey)
+		sequence_key_schedule(subkey);
+
+	UINT16 dec = block_decrypt(prot_cur_address, enc);
 	UINT16 res = (dec & 3) | (dec_hist & 0xfffc);
 	dec_hist = dec;
 
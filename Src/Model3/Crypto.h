@@ -108,8 +108,32 @@ private:
 
 	static const uint8_t trees[9][2][32];
 
-	int feistel_function(int input, const struct sbox *sboxes, uint32_t subkeys);
-	uint16_t block_decrypt(uint32_t game_key, uint16_t sequence_key, uint16_t counter, uint16_t data);
+	// Lookup tables for one round of a Feistel network: the 6 inputs of each
+	// sbox taken from the 8-bit half, and the result bits of each sbox entry
+	struct feistel_tables {
+		uint8_t inputs[4][256];
+		uint8_t outputs[4][64];
+	};
+
+	feistel_tables fn1_tables[4];
+	feistel_tables fn2_tables[4];
+	uint16_t bitswap_tables[3][2][256];         // counter, data and result bit swaps, by byte
+	uint32_t fn2_middle_subkeys[2][256][4];     // FN2 subkey bits from each byte of the middle result
+
+	// Key scheduling, done once per game and again whenever the sequence key
+	// changes
+	uint32_t fn1_game_subkeys[4];
+	uint32_t fn2_game_subkeys[4];
+	uint8_t fn1_rounds[4][256];                 // FN1 round functions for the current sequence key
+	uint32_t fn2_sequence_subkeys[4];
+	uint16_t scheduled_subkey;
+	bool schedule_valid;
+
+	static void build_feistel_tables(feistel_tables *tables, const struct sbox *sboxes);
+	static int fast_feistel_function(int input, const feistel_tables &tables, uint32_t subkeys);
+	void game_key_schedule(uint32_t game_key);
+	void sequence_key_schedule(uint16_t sequence_key);
+	uint16_t block_decrypt(uint16_t counter, uint16_t data);
 
 	uint16_t get_decrypted_16();
 	int get_compressed_bit();
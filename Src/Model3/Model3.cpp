@@ -859,6 +859,89 @@ void CModel3::SetCROMBank(unsigned idx)
   idx = (~idx) & 0xF;
   cromBank = &crom[0x800000 + (idx*0x800000)];
   DebugLog("CROM bank setting: %d (%02X), PC=%08X, LR=%08X\n", idx, cromBankReg, ppc_get_pc(), ppc_get_lr());
+
+  // Remap FF000000-FF7FFFFF
+  if (PPCPageTable != NULL)
+  {
+    for (UINT32 offset = 0; offset < 0x800000; offset += 1 << PPC_PAGE_SHIFT)
+      PPCPageTable->read[(0xFF000000 + offset) >> PPC_PAGE_SHIFT] = &cromBank[offset];
+  }
+}
+
+/*
+ * CModel3::MapPPCPages():
+ *
+ * Fills in the PowerPC page table so that the most heavily used regions are
+ * accessed directly instead of through Read*() and Write*(). Everything not
+ * mapped here (I/O registers, Real3D ports, etc.) still goes through the bus.
+ * Must be kept in sync with the handlers below.
+ */
+void CModel3::MapPPCPages(void)
+{
+  const UINT32 pageSize = 1 << PPC_PAGE_SHIFT;
+
+  memset(PPCPageTable, 0, sizeof(PPC_PAGE_TABLE));
+  PPCPageTable->context = this;
+
+  // RAM
+  for (UINT32 offset = 0; offset < 0x800000; offset += pageSize)
+  {
+    PPCPageTable->read[offset >> PPC_PAGE_SHIFT] = &ram[offset];
+    PPCPageTable->write[offset >> PPC_PAGE_SHIFT] = &ram[offset];
+  }
+
+  // Fixed CROM (banked CROM is mapped by SetCROMBank())
+  for (UINT32 offset = 0; offset < 0x800000; offset += pageSize)
+    PPCPageTable->read[(0xFF800000 + offset) >> PPC_PAGE_SHIFT] = &crom[offset];
+  SetCROMBank(cromBankReg);
+
+  // Backup RAM (write only: Read8() does not decode it)
+  for (UINT32 offset = 0; offset < 0x20000; offset += pageSize)
+  {
+    PPCPageTable->write[(0xF00C0000 + offset) >> PPC_PAGE_SHIFT] = &backupRAM[offset];
+    PPCPageTable->write[(0xFE0C0000 + offset) >> PPC_PAGE_SHIFT] = &backupRAM[offset];
+  }
+
+  // Real3D culling and polygon RAM (stored little endian and dirty tracked)
+  for (UINT32 offset = 0; offset < 0x400000; offset += pageSize)
+  {
+    PPCPageTable->write32[(0x8C000000 + offset) >> PPC_PAGE_SHIFT] = WriteLowCullingRAMPage;
+    PPCPageTable->write32[(0x98000000 + offset) >> PPC_PAGE_SHIFT] = WritePolygonRAMPage;
+  }
+  for (UINT32 offset = 0; offset < 0x100000; offset += pageSize)
+    PPCPageTable->write32[(0x8E000000 + offset) >> PPC_PAGE_SHIFT] = WriteHighCullingRAMPage;
+
+  // Registers commonly polled in idle loops
+  PPCPageTable->poll[0x84000000 >> PPC_PAGE_SHIFT] = PollReal3DRegisterPage;
+  PPCPageTable->poll[0xF0100000 >> PPC_PAGE_SHIFT] = PollSystemRegisterPage;
+  PPCPageTable->poll[0xFE100000 >> PPC_PAGE_SHIFT] = PollSystemRegisterPage;
+}
+
+void CModel3::WriteLowCullingRAMPage(void *context, UINT32 addr, UINT32 data)
+{
+  static_cast<CModel3 *>(context)->GPU.WriteLowCullingRAM(addr&0x3FFFFF,FLIPENDIAN32(data));
+}
+
+void CModel3::WriteHighCullingRAMPage(void *context, UINT32 addr, UINT32 data)
+{
+  static_cast<CModel3 *>(context)->GPU.WriteHighCullingRAM(addr&0xFFFFF,FLIPENDIAN32(data));
+}
+
+void CModel3::WritePolygonRAMPage(void *context, UINT32 addr, UINT32 data)
+{
+  static_cast<CModel3 *>(context)->GPU.WritePolygonRAM(addr&0x3FFFFF,FLIPENDIAN32(data));
+}
+
+UINT64 CModel3::PollReal3DRegisterPage(void *context, UINT32 addr)
+{
+  return static_cast<CModel3 *>(context)->GPU.GetRegisterStableUntil(addr&0x3F);
+}
+
+UINT64 CModel3::PollSystemRegisterPage(void *context, UINT32 addr)
+{
+  // IRQ enable and pending registers only change between PowerPC time slices
+  unsigned reg = addr&0x3F;
+  return (reg >= 0x14 && reg < 0x1C) ? ~UINT64(0) : 0;
 }
 
 UINT8 CModel3::ReadSystemRegister(unsigned reg)
@@ -897,6 +980,11 @@ void CModel3::WriteSystemRegister(unsigned reg, UINT8 data)
     break;
   case 0x18:  // IRQ acknowledge
     IRQ.Deassert(data);
+    if ((data & 0x40) && midiIRQPending)  // MIDI handshake continues as soon as the game is done
+    {
+      Scheduler.Cancel(MIDIIRQAckEvent, this);
+      MIDIIRQDone();
+    }
     DebugLog("IRQ ACK? %02X=%02X\n", reg, data);
     break;
   case 0x0C:  // JTAG Test Access Port
@@ -1378,7 +1466,8 @@ UINT64 CModel3::Read64(UINT32 addr)
  * CModel3::Write32(addr, data):
  * CModel3::Write64(addr, data):
  *
- * Write handlers.
+ * Write handlers. RAM writes arriving here come from DMA (Real3D, SCSI) or
+ * unaligned PowerPC stores, and drop any PowerPC code translated from them.
  */
 void CModel3::Write8(UINT32 addr, UINT8 data)
 {
@@ -1386,6 +1475,7 @@ void CModel3::Write8(UINT32 addr, UINT8 data)
   if (addr < 0x00800000)
   {
     ram[addr^3] = data;
+    ppc_invalidate_code(addr, 1);
     return;
   }
 
@@ -1527,6 +1617,7 @@ void CModel3::Write16(UINT32 addr, UINT16 data)
   if (addr < 0x00800000)
   {
     *(UINT16 *) &ram[addr^2] = data;
+    ppc_invalidate_code(addr, 2);
     return;
   }
 
@@ -1620,6 +1711,7 @@ void CModel3::Write32(UINT32 addr, UINT32 data)
   if (addr<0x00800000)
   {
     *(UINT32 *) &ram[addr] = data;
+    ppc_invalidate_code(addr, 4);
     return;
   }
 
@@ -1900,6 +1992,9 @@ void CModel3::LoadState(CBlockFile *SaveState)
   SaveState->Read(&adcChannel, sizeof(adcChannel));
   SaveState->Read(&cromBankReg, sizeof(cromBankReg));
   SetCROMBank(cromBankReg); // update CROM bank
+  Scheduler.Clear();        // events are not saved, state is always saved between frames
+  inVBlank = false;
+  midiIRQPending = false;
   SaveState->Read(&securityPtr, sizeof(securityPtr));
   SaveState->Read(ram, 0x800000);
   SaveState->Read(backupRAM, 0x20000);
@@ -2038,6 +2133,11 @@ void CModel3::RunMainBoardFrame(void)
 {
 	UINT32 start = CThread::GetTicks();
 
+	// If the GPU buffers were swapped rather than copied, bring the write side up to date first
+	// (when multi-threaded, this overlaps with rendering of the previous frame)
+	TileGen.ReplaySnapshots();
+	GPU.ReplaySnapshots();
+
 	// Compute display and VBlank timings
 	unsigned ppcCycles		= m_config["PowerPCFrequency"].ValueAs<unsigned>() * 1000000;
 	unsigned frameCycles	= (unsigned)((float)ppcCycles / 57.524160f);
@@ -2062,66 +2162,110 @@ void CModel3::RunMainBoardFrame(void)
 	ppc_set_timer_ratio(ppc_get_bus_freq_multipler() * 2 * ppcCycles / ppc_get_cycles_per_sec());
 
 	// VBlank
+	UINT64 frameStart = Scheduler.Now();
+	UINT64 frameEnd = frameStart + dispCycles;
 	if (gpusReady)
 	{
 		TileGen.BeginVBlank();
 		GPU.BeginVBlank(statusCycles);	// Games poll the ping_pong at startup. Values aren't 100% accurate so we stretch the frame a bit to ensure writes happen in the correct frame
 
-		ppc_execute(offsetCycles);
-		IRQ.Assert(0x02);								// start at 33% of the frame
-		ppc_execute(gapCycles);					// need a gap between asserting irqs
-
-		/*
-		* Sound:
-		*
-		* Bit 0x20 of the MIDI control port appears to enable periodic interrupts,
-		* which are used to send MIDI commands. Often games will write 0x27, send
-		* a series of commands, and write 0x06 to stop. Other games, like Star
-		* Wars Trilogy and Sega Rally 2, will enable interrupts at the beginning
-		* by writing 0x37 and will disable/enable interrupts to control command
-		* output.
-		*/
-		//printf("\t-- BEGIN (Ctrl=%02X, IRQEn=%02X, IRQPend=%02X) --\n", midiCtrlPort, IRQ.ReadIRQEnable()&0x40, IRQ.ReadIRQState());
-		int irqCount = 0;
-		while ((midiCtrlPort & 0x20))
-			//while (midiCtrlPort == 0x27)  // 27 triggers IRQ sequence, 06 stops it
-		{
-			// Don't waste time firing MIDI interrupts if game has disabled them
-			if ((IRQ.ReadIRQEnable() & 0x40) == 0)
-				break;
-
-			// Process MIDI interrupt
-			IRQ.Assert(0x40);
-			ppc_execute(200); // give PowerPC time to acknowledge IR
-			IRQ.Deassert(0x40);
-			ppc_execute(200); // acknowledge that IRQ was deasserted (TODO: is this really needed?)
-			dispCycles -= 400;
-
-			++irqCount;
-			if (irqCount > 128)
-			{
-				break;
-			}
-		}
-
-		IRQ.Assert(0x0D);
-
-		// End VBlank
-		GPU.EndVBlank();
-		TileGen.EndVBlank();
+		Scheduler.ScheduleAt(frameStart + offsetCycles, VBlankIRQEvent, this);				// start at 33% of the frame
+		Scheduler.ScheduleAt(frameStart + offsetCycles + gapCycles, MIDIIRQEvent, this);	// need a gap between asserting irqs
+		midiIRQCount = 0;
+		inVBlank = true;
+		frameEnd = frameStart + frameCycles;	// MIDI interrupts and active display share the rest of the frame
 	}
 
-	// Run the PowerPC for the active display part of the frame
-	ppc_execute(dispCycles);
+	// Run the PowerPC for the whole frame, dispatching events as they come due
+	Scheduler.RunUntil(frameEnd);
+	if (inVBlank)	// only if MIDI interrupts ran past the end of the frame
+		EndVBlank();
 
 	timings.ppcTicks = CThread::GetTicks() - start;
 }
 
+void CModel3::VBlankIRQEvent(void *context)
+{
+	static_cast<CModel3 *>(context)->IRQ.Assert(0x02);
+}
+
+/*
+ * Sound:
+ *
+ * Bit 0x20 of the MIDI control port appears to enable periodic interrupts,
+ * which are used to send MIDI commands. Often games will write 0x27, send
+ * a series of commands, and write 0x06 to stop. Other games, like Star
+ * Wars Trilogy and Sega Rally 2, will enable interrupts at the beginning
+ * by writing 0x37 and will disable/enable interrupts to control command
+ * output.
+ *
+ * MIDI interrupts are fired back to back after the VBlank gap, until the game
+ * stops them. Each one is held until the game acknowledges it (or for at most
+ * 200 cycles) and followed by 200 cycles with the line deasserted. VBlank ends
+ * once they are done.
+ */
+void CModel3::MIDIIRQEvent(void *context)
+{
+	CModel3 *self = static_cast<CModel3 *>(context);
+
+	// Don't waste time firing MIDI interrupts if game has disabled them
+	if (!self->inVBlank)
+		return;
+	if ((self->midiCtrlPort & 0x20) == 0 || (self->IRQ.ReadIRQEnable() & 0x40) == 0 || self->midiIRQCount > 128)
+	{
+		self->EndVBlank();
+		return;
+	}
+
+	// Process MIDI interrupt
+	self->IRQ.Assert(0x40);
+	self->midiIRQPending = true;
+	self->Scheduler.ScheduleIn(200, MIDIIRQAckEvent, self);	// give PowerPC time to acknowledge IRQ, otherwise deassert it ourselves
+}
+
+void CModel3::MIDIIRQAckEvent(void *context)
+{
+	CModel3 *self = static_cast<CModel3 *>(context);
+
+	self->IRQ.Deassert(0x40);
+	self->MIDIIRQDone();
+}
+
+void CModel3::MIDIIRQDone(void)
+{
+	midiIRQPending = false;
+	++midiIRQCount;
+	Scheduler.ScheduleIn(200, MIDIIRQEvent, this);	// acknowledge that IRQ was deasserted (TODO: is this really needed?)
+}
+
+void CModel3::EndVBlank(void)
+{
+	// Stop MIDI interrupts still in flight at the end of the frame
+	Scheduler.Cancel(MIDIIRQEvent, this);
+	Scheduler.Cancel(MIDIIRQAckEvent, this);
+	if (midiIRQPending)
+	{
+		IRQ.Deassert(0x40);
+		midiIRQPending = false;
+	}
+
+	inVBlank = false;
+	IRQ.Assert(0x0D);
+
+	// End VBlank
+	GPU.EndVBlank();
+	TileGen.EndVBlank();
+}
+
 void CModel3::SyncGPUs(void)
 {
   UINT32 start = CThread::GetTicks();
 
-  timings.syncSize = GPU.SyncSnapshots() + TileGen.SyncSnapshots();
+  // Each GPU queues its dirty regions, which are then copied together
+  UINT32 copied = GPU.SyncSnapshots();
+  copied += TileGen.SyncSnapshots();
+  copied += SnapshotSync.Run();
+  timings.syncSize = copied;
   gpusReady = true;
 
   timings.syncTicks = CThread::GetTicks() - start;
@@ -2787,6 +2931,12 @@ void CModel3::Reset(void)
 
   // MIDI
   midiCtrlPort = 0;
+  midiIRQCount = 0;
+  midiIRQPending = false;
+
+  // Pending events refer to the old machine state
+  Scheduler.Clear();
+  inVBlank = false;
 
   // Reset all devices
   ppc_reset();
@@ -2848,13 +2998,27 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
    *    part is a mirror of (banked) CROM0.
    *  - Sample ROM: 16MB. If <= 8MB, mirror to high 8MB.
    */
-  if (rom_set.get_rom("vrom").size <= 32*0x100000)
+  ROM vrom_image = rom_set.get_rom("vrom");
+  if (vrom_image.size == 64*0x100000 && vrom_image.patches.empty())
   {
-    rom_set.get_rom("vrom").CopyTo(&vrom[0], 32*100000);
-    rom_set.get_rom("vrom").CopyTo(&vrom[32*0x100000], 32*0x100000);
+    // VROM is never written, so a full size image is used where it is rather
+    // than copied. If it was mapped from the ROM cache, the pages are shared
+    // with other processes and only loaded as textures are fetched.
+    vromImage = vrom_image.data;
+    vrom = vromImage.get();
+    GPU.AttachVROM(vrom);
   }
   else
-    rom_set.get_rom("vrom").CopyTo(vrom, 64*0x100000);
+  {
+    memset(vrom, 0, 64*0x100000);
+    if (vrom_image.size <= 32*0x100000)
+    {
+      vrom_image.CopyTo(&vrom[0], 32*100000);
+      vrom_image.CopyTo(&vrom[32*0x100000], 32*0x100000);
+    }
+    else
+      vrom_image.CopyTo(vrom, 64*0x100000);
+  }
   if (rom_set.get_rom("banked_crom").size <= 64*0x100000)
   {
     rom_set.get_rom("banked_crom").CopyTo(&crom[8*0x100000 + 0], 64*0x100000);
@@ -2935,6 +3099,34 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   PPCFetchRegions[2].end = 0;
   PPCFetchRegions[2].ptr = NULL;
   ppc_set_fetch(PPCFetchRegions);
+  MapPPCPages();
+  ppc_set_page_table(PPCPageTable);
+  ppc_set_idle_skip(m_config["IdleSkip"].ValueAsDefault<bool>(false) || game.idle_skip);  // opt-in, or checked with this game
+
+  // Select PowerPC execution core
+  std::string ppcCore = m_config["PowerPCCore"].ValueAsDefault<std::string>("interpreter");
+  if (ppcCore == "dynarec")
+  {
+    if (!ppc_set_core(PPC_CORE_DYNAREC))
+    {
+      ErrorLog("PowerPC dynamic recompiler is not supported on this system. Using interpreter.");
+      ppc_set_core(PPC_CORE_INTERPRETER);
+    }
+  }
+  else if (ppcCore == "cached")
+  {
+    if (!ppc_set_core(PPC_CORE_CACHED))
+    {
+      ErrorLog("Insufficient memory for PowerPC cached interpreter. Using interpreter.");
+      ppc_set_core(PPC_CORE_INTERPRETER);
+    }
+  }
+  else
+  {
+    if (ppcCore != "interpreter")
+      ErrorLog("Unknown PowerPC core '%s'. Using interpreter.", ppcCore.c_str());
+    ppc_set_core(PPC_CORE_INTERPRETER);
+  }
 
   // Initialize Real3D
   int stepping = ((game.stepping[0] - '0') << 4) | (game.stepping[2] - '0');
@@ -3120,7 +3312,13 @@ bool CModel3::Init(void)
   memoryPool = new(std::nothrow) UINT8[MEM_POOL_SIZE];
   if (NULL == memoryPool)
     return ErrorLog("Insufficient memory for Model 3 object (needs %1.1f MB).", memSizeMB);
-  memset(memoryPool, 0, MEM_POOL_SIZE);
+  // VROM is cleared when it is loaded, so its pages are not touched if the
+  // ROM set's own copy ends up being used instead
+  memset(memoryPool, 0, VROM_OFFSET);
+  memset(&memoryPool[VROM_OFFSET + VROM_SIZE], 0, MEM_POOL_SIZE - (VROM_OFFSET + VROM_SIZE));
+  PPCPageTable = new(std::nothrow) PPC_PAGE_TABLE;
+  if (NULL == PPCPageTable)
+    return ErrorLog("Insufficient memory for PowerPC page table.");
 
   // Set up pointers
   ram = &memoryPool[RAM_OFFSET];
@@ -3149,6 +3347,9 @@ bool CModel3::Init(void)
     return FAIL;
   if (OKAY != GPU.Init(vrom,this,&IRQ,0x100)) // same for Real3D DMA interrupt
     return FAIL;
+  TileGen.AttachSnapshotSync(&SnapshotSync);
+  GPU.AttachSnapshotSync(&SnapshotSync);
+  GPU.AttachScheduler(&Scheduler);
   if (OKAY != SoundBoard.Init(soundROM,sampleROM))
     return FAIL;
 
@@ -3190,13 +3391,19 @@ CModel3::CModel3(Util::Config::Node &config)
   : m_config(config),
     m_multiThreaded(config["MultiThreaded"].ValueAs<bool>()),
     m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    SnapshotSync(m_multiThreaded && m_gpuMultiThreaded ? config["GPUSyncThreads"].ValueAs<unsigned>() : 0),
     TileGen(config),
     GPU(config),
     SoundBoard(config),
     m_jtag(GPU)
 {
+  inVBlank = false;
+  midiIRQCount = 0;
+  midiIRQPending = false;
+
   // Initialize pointers so dtor can know whether to free them
   memoryPool = NULL;
+  PPCPageTable = NULL;
 
   // Various uninitialized pointers
   Inputs = NULL;
@@ -3278,6 +3485,13 @@ CModel3::~CModel3(void)
   StopThreads();
 
   // Free memory
+  if (PPCPageTable != NULL)
+  {
+    ppc_set_page_table(NULL);
+    delete PPCPageTable;
+    PPCPageTable = NULL;
+  }
+
   if (memoryPool != NULL)
   {
     delete [] memoryPool;
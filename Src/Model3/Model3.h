@@ -37,6 +37,8 @@
 #include "MPC10x.h"
 #include "Real3D.h"
 #include "RTC72421.h"
+#include "Scheduler.h"
+#include "SnapshotSync.h"
 #include "SoundBoard.h"
 #include "TileGen.h"
 #include "DriveBoard/DriveBoard.h"
@@ -202,10 +204,21 @@ private:
   UINT32    ReadSecurity(unsigned reg);
   void      WriteSecurity(unsigned reg, UINT32 data);
   void      SetCROMBank(unsigned idx);
+  void      MapPPCPages(void);
+  static void WriteLowCullingRAMPage(void *context, UINT32 addr, UINT32 data);
+  static void WriteHighCullingRAMPage(void *context, UINT32 addr, UINT32 data);
+  static void WritePolygonRAMPage(void *context, UINT32 addr, UINT32 data);
+  static UINT64 PollReal3DRegisterPage(void *context, UINT32 addr);
+  static UINT64 PollSystemRegisterPage(void *context, UINT32 addr);
   UINT8     ReadSystemRegister(unsigned reg);
   void      WriteSystemRegister(unsigned reg, UINT8 data);
 
   void RunMainBoardFrame(void);                       // Runs PPC main board for a frame
+  void EndVBlank(void);                               // Asserts end of VBlank IRQs and notifies the video devices
+  static void VBlankIRQEvent(void *context);          // Scheduler callbacks for VBlank and MIDI interrupts
+  static void MIDIIRQEvent(void *context);
+  static void MIDIIRQAckEvent(void *context);
+  void MIDIIRQDone(void);                             // MIDI interrupt deasserted, schedules the next one
   void SyncGPUs(void);                                // Sync's up GPUs in preparation for rendering - must be called when PPC is not running
   bool RunSoundBoardFrame(void);                      // Runs sound board for a frame
   void RunDriveBoardFrame(void);                      // Runs drive board for a frame
@@ -250,12 +263,22 @@ private:
 
   // MIDI port
   UINT8   midiCtrlPort; // controls MIDI (SCSP) IRQ behavior
+  int     midiIRQCount; // MIDI interrupts fired this frame
+  bool    midiIRQPending; // MIDI interrupt asserted and not yet acknowledged
+
+  // Main board timing
+  CScheduler  Scheduler;
+  bool        inVBlank; // VBlank started but end of VBlank IRQs not yet asserted
+
+  // Copies dirty GPU memory into read-only snapshots (see SyncGPUs)
+  CSnapshotSync SnapshotSync;
 
   // Emulated core Model 3 memory regions
   UINT8   *memoryPool;  // single allocated region for all ROM and system RAM
   UINT8   *ram;         // 8 MB PowerPC RAM
   UINT8   *crom;        // 8+128 MB CROM (fixed CROM first, then 64MB of banked CROMs -- Daytona2 might need extra?)
   UINT8   *vrom;        // 64 MB VROM (video ROM, visible only to Real3D)
+  std::shared_ptr<UINT8> vromImage; // full size VROM used in place of the memory pool copy, if any
   UINT8   *soundROM;    // 512 KB sound ROM (68K program)
   UINT8   *sampleROM;   // 8 MB samples (68K)
   UINT8   *dsbROM;      // 128 KB DSB ROM (Z80 program)
@@ -277,6 +300,7 @@ private:
 
   // PowerPC
   PPC_FETCH_REGION  PPCFetchRegions[3];
+  PPC_PAGE_TABLE    *PPCPageTable;  // direct access map for RAM, CROM and Real3D memory
 
   // Multiple threading
   bool        gpusReady;           // True if GPUs are ready to render
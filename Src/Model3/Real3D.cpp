@@ -49,6 +49,10 @@
 #include "Util/BMPFile.h"
 #include <cstring>
 #include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REAL3D_SSE2
+#endif
 
 // Macros that divide memory regions into pages and mark them as dirty when they are written to
 #define PAGE_WIDTH 12
@@ -73,7 +77,11 @@
 #define OFFSET_98_DIRTY     (OFFSET_8E_DIRTY+DIRTY_SIZE(0x100000))
 #define OFFSET_TEXRAM_DIRTY (OFFSET_98_DIRTY+DIRTY_SIZE(0x400000))
 #define MEM_POOL_SIZE_DIRTY (DIRTY_SIZE(MEM_POOL_SIZE_RO))
-#define MEMORY_POOL_SIZE  (MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO+MEM_POOL_SIZE_DIRTY)
+#define OFFSET_8C_REPLAY      (OFFSET_8C_DIRTY+MEM_POOL_SIZE_DIRTY)   // pages to replay after a swap [double-buffered mode]
+#define OFFSET_8E_REPLAY      (OFFSET_8C_REPLAY+DIRTY_SIZE(0x400000))
+#define OFFSET_98_REPLAY      (OFFSET_8E_REPLAY+DIRTY_SIZE(0x100000))
+#define OFFSET_TEXRAM_REPLAY  (OFFSET_98_REPLAY+DIRTY_SIZE(0x400000))
+#define MEMORY_POOL_SIZE  (MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO+2*MEM_POOL_SIZE_DIRTY)
 
 static void UpdateRenderConfig(IRender3D *Render3D, uint64_t internalRenderConfig[]);
 
@@ -86,7 +94,14 @@ void CReal3D::SaveState(CBlockFile *SaveState)
 {
   SaveState->NewBlock("Real3D", __FILE__);
 
-  SaveState->Write(memoryPool, MEM_POOL_SIZE_RW); // Don't write out read-only snapshots or dirty page arrays
+  // Don't write out read-only snapshots or dirty page arrays. Regions are
+  // written one by one because they may have been swapped with the snapshots.
+  ReplaySnapshots();
+  SaveState->Write(cullingRAMLo, 0x400000);
+  SaveState->Write(cullingRAMHi, 0x100000);
+  SaveState->Write(polyRAM, 0x400000);
+  SaveState->Write(textureRAM, 0x800000);
+  SaveState->Write(textureFIFO, 0x100000);
   SaveState->Write(&fifoIdx, sizeof(fifoIdx));
   SaveState->Write(m_vromTextureFIFO, sizeof(m_vromTextureFIFO));
 
@@ -119,7 +134,11 @@ void CReal3D::LoadState(CBlockFile *SaveState)
     return;
   }
 
-  SaveState->Read(memoryPool, MEM_POOL_SIZE_RW);
+  SaveState->Read(cullingRAMLo, 0x400000);
+  SaveState->Read(cullingRAMHi, 0x100000);
+  SaveState->Read(polyRAM, 0x400000);
+  SaveState->Read(textureRAM, 0x800000);
+  SaveState->Read(textureFIFO, 0x100000);
 
   // If multi-threaded, update read-only snapshots too
   if (m_gpuMultiThreaded)
@@ -140,6 +159,7 @@ void CReal3D::LoadState(CBlockFile *SaveState)
   UpdateRenderConfig(Render3D, m_internalRenderConfig);
   SaveState->Read(&commandPortWritten);
   SaveState->Read(&m_pingPong, sizeof(m_pingPong));
+  m_statusChanged = true;   // states are saved between frames, after the status event
   for (int i = 0; i < 39; i++)
   {
     uint8_t nul;
@@ -167,8 +187,15 @@ void CReal3D::BeginVBlank(int statusCycles)
   // Calculate point at which status bit should change value.  Currently the same timing is used for both the status bit in ReadRegister
   // and in WriteDMARegister32/ReadDMARegister32, however it may be that they are completely unrelated.  It appears that step 1.x games
   // access just the former while step 2.x access the latter.  It is not known yet what this bit/these bits actually represent.
-	statusChange = ppc_total_cycles() + statusCycles;
+	statusChange = Scheduler->Now() + statusCycles;
+	m_statusChanged = false;
 	m_evenFrame = !m_evenFrame;
+	Scheduler->ScheduleAt(statusChange, StatusChangeEvent, this);
+}
+
+void CReal3D::StatusChangeEvent(void *context)
+{
+  static_cast<CReal3D *>(context)->m_statusChanged = true;
 }
 
 void CReal3D::EndVBlank(void)
@@ -190,6 +217,8 @@ uint32_t CReal3D::SyncSnapshots(void)
   queuedUploadTextures.clear();
 
   // Update read-only snapshots
+  if (m_swapSnapshots)
+    return SwapSnapshots();
   return UpdateSnapshots(false);
 }
 
@@ -203,44 +232,31 @@ uint32_t CReal3D::UpdateSnapshot(bool copyWhole, uint8_t *src, uint8_t *dst, uns
     memset(dirty, 0, dirtySize);
     return size;
   }
+  else if (SnapshotSync != NULL)
+  {
+    // Otherwise, queue the region so that only its dirty pages are copied, together with all the others
+    SnapshotSync->Queue(dst, src, size, PAGE_WIDTH, dirty);
+    return 0;
+  }
   else
   {
-    // Otherwise, loop through dirty pages array to find out what needs to be updated and copy only those parts
-    uint32_t copied = 0;
-    uint8_t *pSrc = src;
-    uint8_t *pDst = dst;
-    for (unsigned i = 0; i < dirtySize; i++)
-    {
-      uint8_t d = dirty[i];
-      if (d)
-      {
-        for (unsigned j = 0; j < 8; j++)
-        {
-          if (d&1)
-          {
-            // If not at very end of region, then copy an extra 4 bytes to allow for a possible 32-bit overlap
-            uint32_t toCopy = (i < dirtySize - 1 || j < 7 ? PAGE_SIZE + 4 : PAGE_SIZE);
-            memcpy(pDst, pSrc, toCopy);
-            copied += toCopy;
-          }
-          d >>= 1;
-          pSrc += PAGE_SIZE;
-          pDst += PAGE_SIZE;
-        }
-        dirty[i] = 0;
-      }
-      else
-      {
-        pSrc += 8 * PAGE_SIZE;
-        pDst += 8 * PAGE_SIZE;
-      }
-    }
+    uint32_t copied = CSnapshotSync::CopyDirtyPages(dst, src, size, PAGE_WIDTH, dirty, 0, dirtySize);
+    memset(dirty, 0, dirtySize);
     return copied;
   }
 }
 
 uint32_t CReal3D::UpdateSnapshots(bool copyWhole)
 {
+  // After a whole copy both sides are identical, so there is nothing left to replay
+  if (copyWhole && m_swapSnapshots)
+  {
+    memset(cullingRAMLoReplay, 0, DIRTY_SIZE(0x400000));
+    memset(cullingRAMHiReplay, 0, DIRTY_SIZE(0x100000));
+    memset(polyRAMReplay, 0, DIRTY_SIZE(0x400000));
+    memset(textureRAMReplay, 0, DIRTY_SIZE(0x800000));
+  }
+
   // Update all memory region snapshots
   uint32_t cullLoCopied  = UpdateSnapshot(copyWhole, (uint8_t*)cullingRAMLo, (uint8_t*)cullingRAMLoRO, 0x400000, cullingRAMLoDirty);
   uint32_t cullHiCopied  = UpdateSnapshot(copyWhole, (uint8_t*)cullingRAMHi, (uint8_t*)cullingRAMHiRO, 0x100000, cullingRAMHiDirty);
@@ -250,6 +266,44 @@ uint32_t CReal3D::UpdateSnapshots(bool copyWhole)
   return cullLoCopied + cullHiCopied + polyCopied + textureCopied;
 }
 
+uint32_t CReal3D::SwapSnapshots(void)
+{
+  // Normally already done at the start of the frame
+  ReplaySnapshots();
+
+  // Memory written this frame becomes the read-only snapshot. The old snapshot becomes the
+  // write side and is missing exactly the pages dirtied this frame, which are kept for replay.
+  std::swap(cullingRAMLo, cullingRAMLoRO);
+  std::swap(cullingRAMHi, cullingRAMHiRO);
+  std::swap(polyRAM, polyRAMRO);
+  std::swap(textureRAM, textureRAMRO);
+  std::swap(cullingRAMLoDirty, cullingRAMLoReplay);
+  std::swap(cullingRAMHiDirty, cullingRAMHiReplay);
+  std::swap(polyRAMDirty, polyRAMReplay);
+  std::swap(textureRAMDirty, textureRAMReplay);
+
+  if (Render3D != NULL)
+    Render3D->AttachMemory(cullingRAMLoRO, cullingRAMHiRO, polyRAMRO, vrom, textureRAMRO);
+  return 0;
+}
+
+void CReal3D::ReplaySnapshot(uint8_t *dst, const uint8_t *src, unsigned size, uint8_t *replay)
+{
+  unsigned dirtySize = DIRTY_SIZE(size);
+  CSnapshotSync::CopyDirtyPages(dst, src, size, PAGE_WIDTH, replay, 0, dirtySize);
+  memset(replay, 0, dirtySize);
+}
+
+void CReal3D::ReplaySnapshots(void)
+{
+  if (!m_swapSnapshots)
+    return;
+  ReplaySnapshot((uint8_t*)cullingRAMLo, (uint8_t*)cullingRAMLoRO, 0x400000, cullingRAMLoReplay);
+  ReplaySnapshot((uint8_t*)cullingRAMHi, (uint8_t*)cullingRAMHiRO, 0x100000, cullingRAMHiReplay);
+  ReplaySnapshot((uint8_t*)polyRAM,      (uint8_t*)polyRAMRO,      0x400000, polyRAMReplay);
+  ReplaySnapshot((uint8_t*)textureRAM,   (uint8_t*)textureRAMRO,   0x800000, textureRAMReplay);
+}
+
 void CReal3D::BeginFrame(void)
 {
   // If multi-threaded, perform now any queued texture uploads to renderer before rendering begins
@@ -338,6 +392,102 @@ static const unsigned decode8x1[8] =
   6
 };
 
+static inline const unsigned *GetTileDecodeTable(unsigned tileX)
+{
+  return tileX == 8 ? decode8x8 : (tileX == 4 ? decode8x4 : (tileX == 2 ? decode8x2 : decode8x1));
+}
+
+#ifdef REAL3D_SSE2
+/*
+ * Stores a full 8x8 tile of 16-bit texels. Each pair of rows comes from 16
+ * consecutive texels: the even row takes texels 1,0,5,4,9,8,13,12 and the
+ * odd row 3,2,7,6,11,10,15,14. Swapping the halves of every 32-bit word and
+ * then separating even and odd words produces both rows at once.
+ */
+static inline void StoreTile8x8(uint16_t *dest, const uint16_t *texData)
+{
+  for (int k = 0; k < 4; k++)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *) &texData[k * 16 + 0]);
+    __m128i b = _mm_loadu_si128((const __m128i *) &texData[k * 16 + 8]);
+    a = _mm_or_si128(_mm_slli_epi32(a, 16), _mm_srli_epi32(a, 16));
+    b = _mm_or_si128(_mm_slli_epi32(b, 16), _mm_srli_epi32(b, 16));
+    a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *) &dest[(2 * k + 0) * 2048], _mm_unpacklo_epi64(a, b));
+    _mm_storeu_si128((__m128i *) &dest[(2 * k + 1) * 2048], _mm_unpackhi_epi64(a, b));
+  }
+}
+#endif
+
+// 16-bit textures made of TileX x tileY tiles, with tileY > 1
+template <unsigned TileX>
+void CReal3D::StoreTexture16(unsigned xPos, unsigned yPos, unsigned width, unsigned height, unsigned tileY, const uint16_t *texData)
+{
+  const unsigned *decode = GetTileDecodeTable(TileX);
+
+  for (uint32_t y = yPos; y < (yPos + height); y += tileY)
+  {
+    for (uint32_t x = xPos; x < (xPos + width); x += TileX)
+    {
+      uint16_t *dest = &textureRAM[y * 2048 + x];
+#ifdef REAL3D_SSE2
+      if (TileX == 8 && tileY == 8)
+      {
+        StoreTile8x8(dest, texData);
+        texData += 64;
+        continue;
+      }
+#endif
+      for (uint32_t yy = 0; yy < tileY; yy++)
+      {
+        for (uint32_t xx = 0; xx < TileX; xx++)
+          dest[xx] = texData[decode[yy * TileX + xx]];
+        dest += 2048; // next line
+      }
+      texData += tileY * TileX; // next tile
+    }
+  }
+}
+
+// 8-bit textures made of TileX x tileY tiles, with tileY > 1. Bits set in keepMask are preserved.
+template <unsigned TileX>
+void CReal3D::StoreTexture8(unsigned xPos, unsigned yPos, unsigned width, unsigned height, unsigned tileY, const uint16_t *texData, uint16_t keepMask)
+{
+  // Source word and shift of every texel in a tile (rows of the decoding table are swapped)
+  const unsigned *decode = GetTileDecodeTable(TileX);
+  uint8_t srcWord[8 * TileX];
+  uint8_t srcShift[8 * TileX];
+  for (uint32_t yy = 0; yy < tileY; yy++)
+  {
+    for (uint32_t xx = 0; xx < TileX; xx++)
+    {
+      srcWord[yy * TileX + xx] = decode[(yy ^ 1) * TileX + (xx ^ 1)] / 2;
+      srcShift[yy * TileX + xx] = 8 * ((xx & 1) ^ 1);
+    }
+  }
+
+  for (uint32_t y = yPos; y < (yPos + height); y += tileY)
+  {
+    for (uint32_t x = xPos; x < (xPos + width); x += TileX)
+    {
+      uint16_t *dest = &textureRAM[y * 2048 + x];
+      for (uint32_t yy = 0; yy < tileY; yy++)
+      {
+        for (uint32_t xx = 0; xx < TileX; xx++)
+        {
+          const unsigned i = yy * TileX + xx;
+          uint16_t texel = (texData[srcWord[i]] >> srcShift[i]) & 0xFF;
+          texel |= texel << 8;
+          dest[xx] = (dest[xx] & keepMask) | (texel & ~keepMask);
+        }
+        dest += 2048; // next line
+      }
+      texData += (tileY * TileX) / 2; // next tile
+    }
+  }
+}
+
 void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, uint32_t &texDataOffset)
 {
   uint32_t tileX = (std::min)(8u, width);
@@ -345,7 +495,52 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
 
   texDataOffset = 0;
 
-  if (sixteenBit)  // 16-bit textures
+  if (tileX > 1 && tileY > 1)
+  {
+    // Common case: specialized decoders for each tile width
+    if (writeLSB && writeMSB && !sixteenBit)
+      DebugLog("Observed 8-bit texture with byte_select=3!");
+
+    const uint8_t byteSelect = (uint8_t)writeLSB | ((uint8_t)writeMSB << 1);
+    const uint16_t byteMask[4] = {0xFFFF, 0xFF00, 0x00FF, 0x0000};
+    bool written = true;
+    if (sixteenBit)
+    {
+      switch (tileX)
+      {
+      case 8: StoreTexture16<8>(xPos, yPos, width, height, tileY, texData); break;
+      case 4: StoreTexture16<4>(xPos, yPos, width, height, tileY, texData); break;
+      case 2: StoreTexture16<2>(xPos, yPos, width, height, tileY, texData); break;
+      }
+      texDataOffset = width * height;
+    }
+    else
+    {
+      written = byteSelect != 0;
+      if (written)
+      {
+        switch (tileX)
+        {
+        case 8: StoreTexture8<8>(xPos, yPos, width, height, tileY, texData, byteMask[byteSelect]); break;
+        case 4: StoreTexture8<4>(xPos, yPos, width, height, tileY, texData, byteMask[byteSelect]); break;
+        case 2: StoreTexture8<2>(xPos, yPos, width, height, tileY, texData, byteMask[byteSelect]); break;
+        }
+      }
+      texDataOffset = (width * height) / 2;
+    }
+
+    // Each line of texture RAM is exactly one page, so a line of the texture touches at most two
+    // pages (if it runs past the end of the line)
+    if (m_gpuMultiThreaded && written)
+    {
+      for (uint32_t y = yPos; y < (yPos + height); y++)
+      {
+        MARK_DIRTY(textureRAMDirty, (y * 2048 + xPos) * 2);
+        MARK_DIRTY(textureRAMDirty, (y * 2048 + xPos + width - 1) * 2);
+      }
+    }
+  }
+  else if (sixteenBit)  // 16-bit textures with tiles 1 texel wide or high
   {
     // Outer 2 loops: NxN tiles
     for (uint32_t y = yPos; y < (yPos + height); y += tileY)
@@ -378,7 +573,7 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
       }
     }
   }
-  else  // 8-bit textures
+  else  // 8-bit textures with tiles 1 texel wide or high
   {
     /*
      * 8-bit textures appear to be unpacked into 16-bit words in the
@@ -795,10 +990,10 @@ uint32_t CReal3D::ReadRegister(unsigned reg)
 	  uint32_t ping_pong;
 
 	  if (m_evenFrame) {
-			ping_pong = (ppc_total_cycles() >= statusChange ? 0x0 : 0x02000000);
+			ping_pong = (m_statusChanged ? 0x0 : 0x02000000);
 	  }
 	  else {
-			ping_pong = (ppc_total_cycles() >= statusChange ? 0x02000000 : 0x0);
+			ping_pong = (m_statusChanged ? 0x02000000 : 0x0);
 	  }
 
 		return 0xfdffffff | ping_pong;
@@ -820,6 +1015,13 @@ uint32_t CReal3D::ReadRegister(unsigned reg)
   return 0xffffffff;
 }
 
+uint64_t CReal3D::GetRegisterStableUntil(unsigned reg) const
+{
+  if (reg == 0)   // ping_pong bit flips once per frame at statusChange
+    return m_statusChanged ? ~uint64_t(0) : statusChange;
+  return 0;       // line of sight registers depend on the renderer
+}
+
 // TODO: This returns data in the way that the PowerPC bus expects. Other functions in CReal3D should
 // return data this way.
 uint32_t CReal3D::ReadPCIConfigSpace(unsigned device, unsigned reg, unsigned bits, unsigned offset)
@@ -870,6 +1072,7 @@ void CReal3D::Reset(void)
   error = false;
 
   m_pingPong = 0;
+  m_statusChanged = true;   // pending status event is dropped by the scheduler on reset
   commandPortWritten = false;
   commandPortWrittenRO = false;
 
@@ -915,6 +1118,16 @@ void CReal3D::AttachRenderer(IRender3D *Render3DPtr)
   DebugLog("Real3D attached a Render3D object\n");
 }
 
+void CReal3D::AttachSnapshotSync(CSnapshotSync *SnapshotSyncPtr)
+{
+  SnapshotSync = SnapshotSyncPtr;
+}
+
+void CReal3D::AttachScheduler(CScheduler *SchedulerPtr)
+{
+  Scheduler = SchedulerPtr;
+}
+
 uint32_t CReal3D::GetASICIDCode(ASIC asic) const
 {
   auto it = m_asicID.find(asic);
@@ -1010,6 +1223,10 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
     cullingRAMHiDirty = (uint8_t *) &memoryPool[OFFSET_8E_DIRTY];
     polyRAMDirty = (uint8_t *) &memoryPool[OFFSET_98_DIRTY];
     textureRAMDirty = (uint8_t *) &memoryPool[OFFSET_TEXRAM_DIRTY];
+    cullingRAMLoReplay = (uint8_t *) &memoryPool[OFFSET_8C_REPLAY];
+    cullingRAMHiReplay = (uint8_t *) &memoryPool[OFFSET_8E_REPLAY];
+    polyRAMReplay = (uint8_t *) &memoryPool[OFFSET_98_REPLAY];
+    textureRAMReplay = (uint8_t *) &memoryPool[OFFSET_TEXRAM_REPLAY];
   }
 
   // VROM pointer passed to us
@@ -1019,11 +1236,19 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
   return OKAY;
 }
 
+void CReal3D::AttachVROM(const uint8_t *vromPtr)
+{
+  vrom = (const uint32_t *) vromPtr;
+}
+
 CReal3D::CReal3D(const Util::Config::Node &config)
   : m_config(config),
-    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>())
+    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    m_swapSnapshots(m_gpuMultiThreaded && config["GPUDoubleBuffer"].ValueAs<bool>())
 {
   Render3D = NULL;
+  SnapshotSync = NULL;
+  Scheduler = NULL;
   memoryPool = NULL;
   cullingRAMLo = NULL;
   cullingRAMHi = NULL;
@@ -1049,6 +1274,8 @@ CReal3D::CReal3D(const Util::Config::Node &config)
 CReal3D::~CReal3D(void)
 {
   // Dump memory
+  if (memoryPool != NULL)
+    ReplaySnapshots();
 #if 0
   FILE  *fp;
   fp = fopen("8c000000", "wb");
@@ -1121,6 +1348,8 @@ CReal3D::~CReal3D(void)
   }
 
   Render3D = NULL;
+  SnapshotSync = NULL;
+  Scheduler = NULL;
   if (memoryPool != NULL)
   {
     delete [] memoryPool;
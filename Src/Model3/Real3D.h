@@ -31,6 +31,8 @@
 
 #include "IRQ.h"
 #include "PCI.h"
+#include "SnapshotSync.h"
+#include "Scheduler.h"
 #include "CPU/Bus.h"
 #include "Graphics/IRender3D.h"
 #include "Util/NewConfig.h"
@@ -117,9 +119,13 @@ public:
   void LoadState(CBlockFile *SaveState);
 
   /*
-   * BeginVBlank(void):
+   * BeginVBlank(statusCycles):
    *
-   * Must be called before the VBlank starts.
+   * Must be called before the VBlank starts. Schedules the status bit
+   * change.
+   *
+   * Parameters:
+   *    statusCycles  PowerPC cycles from now until the status bit changes.
    */
   void BeginVBlank(int statusCycles);
   
@@ -138,9 +144,24 @@ public:
    * end of each frame when both the render thread and the PPC thread have finished
    * their work.  If multi-threaded rendering is not enabled, then this method does
    * nothing.
+   *
+   * In double-buffered mode, the buffers written this frame are swapped with
+   * the read-only snapshots instead of being copied, and ReplaySnapshots()
+   * must then be called before any more emulation.
    */
   uint32_t SyncSnapshots(void);
 
+  /*
+   * ReplaySnapshots(void):
+   *
+   * In double-buffered mode, copies the pages that were dirtied in the
+   * previous frame forward from the read-only snapshots into the buffers now
+   * being written, so that they are up to date again. Must be called from the
+   * PPC thread before it runs a frame, and may be called concurrently with
+   * rendering. Does nothing if there is nothing to replay.
+   */
+  void ReplaySnapshots(void);
+
   /*
    * BeginFrame(void):
    *
@@ -302,6 +323,22 @@ public:
    *    The 32-bit status register.
    */
   uint32_t ReadRegister(unsigned reg);
+
+  /*
+   * GetRegisterStableUntil(reg):
+   *
+   * Used by PowerPC idle loop detection to find out how long polling a
+   * status register will keep returning the same value.
+   *
+   * Parameters:
+   *    reg   Register offset (32-bit aligned). From 0x00 to 0x3C.
+   *
+   * Returns:
+   *    PowerPC cycle count (see ppc_total_cycles()) at which the register
+   *    may next change, all bits set if it will not change until the next
+   *    VBlank, or 0 if it can change at any time.
+   */
+  uint64_t GetRegisterStableUntil(unsigned reg) const;
   
   /*
    * ReadPCIConfigSpace(device, reg, bits, offset):
@@ -358,6 +395,30 @@ public:
    *    Render3DPtr   Pointer to a 3D renderer object.
    */
   void AttachRenderer(IRender3D *Render3DPtr);
+
+  /*
+   * AttachSnapshotSync(SnapshotSyncPtr):
+   *
+   * Attaches the object used to copy dirty pages into the read-only
+   * snapshots. Regions are then queued by SyncSnapshots() and copied when
+   * the caller runs the sync object. Without one, dirty pages are copied
+   * immediately.
+   *
+   * Parameters:
+   *    SnapshotSyncPtr   Pointer to a snapshot sync object.
+   */
+  void AttachSnapshotSync(CSnapshotSync *SnapshotSyncPtr);
+
+  /*
+   * AttachScheduler(SchedulerPtr):
+   *
+   * Attaches the main board event queue, used to time the status bit. Must
+   * be called before the first VBlank.
+   *
+   * Parameters:
+   *    SchedulerPtr  Pointer to the scheduler.
+   */
+  void AttachScheduler(CScheduler *SchedulerPtr);
   
   /*
    * GetASICIDCodes(asic):
@@ -414,6 +475,18 @@ public:
    *    errors.
    */
   bool Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPtr, unsigned dmaIRQBit);
+
+  /*
+   * AttachVROM(vromPtr):
+   *
+   * Replaces the video ROM pointer passed to Init(). Must be called before
+   * AttachRenderer().
+   *
+   * Parameters:
+   *    vromPtr       A pointer to video ROM (with each 32-bit word in
+   *                  its native little endian format).
+   */
+  void AttachVROM(const uint8_t *vromPtr);
    
   /*
    * CReal3D(config):
@@ -430,19 +503,31 @@ public:
   
 private:
   // Private member functions
+  static void StatusChangeEvent(void *context);
   void      DMACopy(void);
   void      StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, uint32_t &texDataOffset);
+  template <unsigned TileX> void StoreTexture16(unsigned xPos, unsigned yPos, unsigned width, unsigned height, unsigned tileY, const uint16_t *texData);
+  template <unsigned TileX> void StoreTexture8(unsigned xPos, unsigned yPos, unsigned width, unsigned height, unsigned tileY, const uint16_t *texData, uint16_t keepMask);
 
   void      UploadTexture(uint32_t header, const uint16_t *texData);
   uint32_t  UpdateSnapshots(bool copyWhole);
   uint32_t  UpdateSnapshot(bool copyWhole, uint8_t *src, uint8_t *dst, unsigned size, uint8_t *dirty);
+  uint32_t  SwapSnapshots(void);
+  void      ReplaySnapshot(uint8_t *dst, const uint8_t *src, unsigned size, uint8_t *replay);
 
   // Config 
   const Util::Config::Node &m_config;
   const bool                m_gpuMultiThreaded;
+  const bool                m_swapSnapshots;  // double-buffered: snapshots are swapped rather than copied
 
   // Renderer attached to the Real3D
   IRender3D *Render3D;
+
+  // Dirty page sync shared with the tile generator
+  CSnapshotSync *SnapshotSync;
+
+  // Main board event queue
+  CScheduler *Scheduler;
   
   // Data passed from Model 3 object
   const uint32_t  *vrom;  // Video ROM
@@ -475,6 +560,12 @@ private:
   uint8_t   *polyRAMDirty;
   uint8_t   *textureRAMDirty;
 
+  // Pages dirtied before the last swap that are yet to be replayed (double-buffered mode only)
+  uint8_t   *cullingRAMLoReplay;
+  uint8_t   *cullingRAMHiReplay;
+  uint8_t   *polyRAMReplay;
+  uint8_t   *textureRAMReplay;
+
   // Queued texture uploads
   std::vector<QueuedUploadTextures> queuedUploadTextures;
   std::vector<QueuedUploadTextures> queuedUploadTexturesRO;  // Read-only copy of queue
@@ -501,7 +592,8 @@ private:
   
   // Status and command registers
   uint32_t m_pingPong;
-  uint64_t statusChange = 0;
+  uint64_t statusChange = 0;     // time of this frame's status bit change
+  bool m_statusChanged = true;   // set by StatusChangeEvent()
   bool m_evenFrame = false;
   
   // Internal ASIC state
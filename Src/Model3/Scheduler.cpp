@@ -0,0 +1,117 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Scheduler.cpp
+ *
+ * Main board event queue. Implementation of the CScheduler class.
+ */
+
+#include "Scheduler.h"
+
+#include "Supermodel.h"
+#include "CPU/PowerPC/ppc.h"
+#include <algorithm>
+#include <climits>
+#include <functional>
+
+
+/******************************************************************************
+ Scheduling
+******************************************************************************/
+
+void CScheduler::ScheduleAt(UINT64 time, EventHandler handler, void *context)
+{
+	Event e;
+	e.time = time;
+	e.seq = m_seq++;
+	e.handler = handler;
+	e.context = context;
+	m_events.push_back(e);
+	std::push_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+
+	// Scheduled by a device while the PowerPC is running: stop it in time
+	if (time < m_sliceEnd)
+	{
+		ppc_end_timeslice_at(time);
+		m_sliceEnd = time;
+	}
+}
+
+void CScheduler::ScheduleIn(UINT64 cycles, EventHandler handler, void *context)
+{
+	ScheduleAt(Now() + cycles, handler, context);
+}
+
+UINT64 CScheduler::Now(void) const
+{
+	return ppc_total_cycles();
+}
+
+void CScheduler::Cancel(EventHandler handler, void *context)
+{
+	auto cancelled = [handler, context](const Event &e) { return e.handler == handler && e.context == context; };
+	auto end = std::remove_if(m_events.begin(), m_events.end(), cancelled);
+	if (end == m_events.end())
+		return;
+	m_events.erase(end, m_events.end());
+	std::make_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+}
+
+void CScheduler::Clear(void)
+{
+	m_events.clear();
+}
+
+
+/******************************************************************************
+ Execution
+******************************************************************************/
+
+void CScheduler::RunUntil(UINT64 time)
+{
+	while (true)
+	{
+		// Dispatch everything that is due. Handlers may schedule more events.
+		UINT64 now = Now();
+		while (!m_events.empty() && m_events.front().time <= now)
+		{
+			std::pop_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+			Event e = m_events.back();
+			m_events.pop_back();
+			e.handler(e.context);
+		}
+
+		if (now >= time)
+			break;
+
+		// Run to the next event or the end, whichever comes first
+		UINT64 next = time;
+		if (!m_events.empty() && m_events.front().time < next)
+			next = m_events.front().time;
+		UINT64 cycles = std::min<UINT64>(next - now, INT_MAX);
+		m_sliceEnd = now + cycles;
+		int executed = ppc_execute((int) cycles);
+		m_sliceEnd = 0;
+		if (executed <= 0)
+			break;	// PowerPC halted
+	}
+}
@@ -0,0 +1,134 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Scheduler.h
+ *
+ * Header file defining the CScheduler class: main board event queue.
+ */
+
+#ifndef INCLUDED_SCHEDULER_H
+#define INCLUDED_SCHEDULER_H
+
+#include "Types.h"
+#include <vector>
+
+/*
+ * CScheduler:
+ *
+ * Timestamp-ordered queue of device callbacks. Time is measured in PowerPC
+ * cycles (see ppc_total_cycles()). The PowerPC is run exactly up to each
+ * event, so callbacks see the CPU state at the cycle they were scheduled for.
+ * Events due at the same cycle are dispatched in the order they were
+ * scheduled. Devices are handed a pointer to the scheduler by CModel3 and may
+ * schedule events while the PowerPC is running (e.g., from a register write);
+ * the current time slice is then cut short so that they are not late.
+ *
+ * Only devices that run on the PowerPC thread, in PowerPC time, can use it.
+ * The sound board is not given one: it runs a frame at a time on its own
+ * thread, only loosely synchronized with the PowerPC. The MIDI interrupts it
+ * is sent commands with are timed by CModel3 instead. The IRQ controller has
+ * no timing of its own either, since each device asserts its interrupts when
+ * they are due.
+ */
+class CScheduler
+{
+public:
+	typedef void (*EventHandler)(void *context);
+
+	/*
+	 * ScheduleAt(time, handler, context):
+	 * ScheduleIn(cycles, handler, context):
+	 *
+	 * Schedules a callback at an absolute time or relative to the current
+	 * time. Events in the past are dispatched as soon as possible. May be
+	 * called from within an event handler or by a device while the PowerPC is
+	 * running.
+	 *
+	 * Parameters:
+	 *		time		Absolute PowerPC cycle count.
+	 *		cycles		Number of PowerPC cycles from now.
+	 *		handler		Function to call.
+	 *		context		Passed to handler.
+	 */
+	void ScheduleAt(UINT64 time, EventHandler handler, void *context);
+	void ScheduleIn(UINT64 cycles, EventHandler handler, void *context);
+
+	/*
+	 * Now(void):
+	 *
+	 * Returns:
+	 *		Current time in PowerPC cycles.
+	 */
+	UINT64 Now(void) const;
+
+	/*
+	 * Cancel(handler, context):
+	 *
+	 * Removes all pending events with the given handler and context.
+	 *
+	 * Parameters:
+	 *		handler		Function the events would call.
+	 *		context		Context the events were scheduled with.
+	 */
+	void Cancel(EventHandler handler, void *context);
+
+	/*
+	 * RunUntil(time):
+	 *
+	 * Runs the PowerPC up to the given time, stopping at each pending event to
+	 * dispatch it. Events scheduled exactly at the end time are dispatched
+	 * before returning.
+	 *
+	 * Parameters:
+	 *		time	Absolute PowerPC cycle count to run to.
+	 */
+	void RunUntil(UINT64 time);
+
+	/*
+	 * Clear(void):
+	 *
+	 * Discards all pending events. Events are not saved in save states, so
+	 * this must be called on reset and when a state is loaded.
+	 */
+	void Clear(void);
+
+private:
+	struct Event
+	{
+		UINT64			time;
+		UINT64			seq;		// tie breaker: order of scheduling
+		EventHandler	handler;
+		void			*context;
+
+		bool operator>(const Event &rhs) const
+		{
+			return (time != rhs.time) ? (time > rhs.time) : (seq > rhs.seq);
+		}
+	};
+
+	std::vector<Event>	m_events;	// min-heap ordered by time, then seq
+	UINT64				m_seq = 0;
+	UINT64				m_sliceEnd = 0;	// end of the time slice the PowerPC is running, 0 when not running
+};
+
+
+#endif	// INCLUDED_SCHEDULER_H
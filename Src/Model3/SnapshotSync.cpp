@@ -0,0 +1,193 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * SnapshotSync.cpp
+ *
+ * Dirty page snapshot sync. Implementation of the CSnapshotSync class.
+ */
+
+#include "SnapshotSync.h"
+
+#include "Supermodel.h"
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SNAPSHOT_SYNC_SSE2
+#endif
+
+// Amount of region memory covered by a single job
+#define JOB_SIZE	0x80000
+
+
+/******************************************************************************
+ Dirty Page Scanning
+******************************************************************************/
+
+// Returns the index of the first non-zero byte in dirty[i..end), or end
+static unsigned FindDirty(const UINT8 *dirty, unsigned i, unsigned end)
+{
+#ifdef SNAPSHOT_SYNC_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 64 <= end; i += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) &dirty[i + 0]);
+		__m128i b = _mm_loadu_si128((const __m128i *) &dirty[i + 16]);
+		__m128i c = _mm_loadu_si128((const __m128i *) &dirty[i + 32]);
+		__m128i d = _mm_loadu_si128((const __m128i *) &dirty[i + 48]);
+		__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+			break;
+	}
+	for (; i + 16 <= end; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) &dirty[i]);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) != 0xFFFF)
+			break;
+	}
+#endif
+	for (; i + 8 <= end; i += 8)
+	{
+		UINT64 word;
+		memcpy(&word, &dirty[i], sizeof(word));
+		if (word != 0)
+			break;
+	}
+	while (i < end && dirty[i] == 0)
+		i++;
+	return i;
+}
+
+static inline bool IsPageDirty(const UINT8 *dirty, unsigned page)
+{
+	return (dirty[page >> 3] >> (page & 7)) & 1;
+}
+
+UINT32 CSnapshotSync::CopyDirtyPages(UINT8 *dst, const UINT8 *src, unsigned size, unsigned pageWidth, const UINT8 *dirty, unsigned firstByte, unsigned endByte)
+{
+	unsigned numPages = size >> pageWidth;
+	unsigned endPage = std::min(endByte * 8, numPages);
+	unsigned page = firstByte * 8;
+	UINT32 copied = 0;
+
+	while (page < endPage)
+	{
+		// Skip clean bytes in bulk
+		if ((page & 7) == 0)
+		{
+			page = FindDirty(dirty, page >> 3, endByte) * 8;
+			if (page >= endPage)
+				break;
+		}
+
+		if (!IsPageDirty(dirty, page))
+		{
+			page++;
+			continue;
+		}
+
+		// Find the end of this run of dirty pages
+		unsigned first = page;
+		while (page < endPage && IsPageDirty(dirty, page))
+			page++;
+
+		// Copy an extra 4 bytes to allow for a possible 32-bit overlap, unless
+		// at the very end of the region or the next page is copied by another job
+		UINT32 toCopy = (page - first) << pageWidth;
+		if (page < numPages && !(page == endPage && IsPageDirty(dirty, page)))
+			toCopy += 4;
+		memcpy(&dst[first << pageWidth], &src[first << pageWidth], toCopy);
+		copied += toCopy;
+	}
+
+	return copied;
+}
+
+
+/******************************************************************************
+ Job Queue
+******************************************************************************/
+
+void CSnapshotSync::Queue(UINT8 *dst, const UINT8 *src, unsigned size, unsigned pageWidth, UINT8 *dirty)
+{
+	Region region;
+	region.dst = dst;
+	region.src = src;
+	region.size = size;
+	region.pageWidth = pageWidth;
+	region.dirty = dirty;
+	region.dirtySize = 1 + (size - 1) / (8 << pageWidth);
+
+	// Split into jobs, leaving out spans with no dirty pages at all
+	unsigned jobBytes = std::max(1u, (unsigned) (JOB_SIZE >> (pageWidth + 3)));
+	unsigned i = 0;
+	while ((i = FindDirty(dirty, i, region.dirtySize)) < region.dirtySize)
+	{
+		Job job;
+		job.region = (unsigned) m_regions.size();
+		job.firstByte = i;
+		job.endByte = std::min(i + jobBytes, region.dirtySize);
+		job.copied = 0;
+		m_jobs.push_back(job);
+		i = job.endByte;
+	}
+
+	m_regions.push_back(region);
+}
+
+void CSnapshotSync::DoJob(size_t i)
+{
+	Job &job = m_jobs[i];
+	const Region &region = m_regions[job.region];
+	job.copied = CopyDirtyPages(region.dst, region.src, region.size, region.pageWidth, region.dirty, job.firstByte, job.endByte);
+}
+
+UINT32 CSnapshotSync::Run(void)
+{
+	m_workers.Run(m_jobs.size(), [this](size_t i, unsigned) { DoJob(i); });
+
+	// Dirty arrays are only read by the jobs, so clear them once all are done
+	UINT32 copied = 0;
+	for (auto &job : m_jobs)
+		copied += job.copied;
+	for (auto &region : m_regions)
+		memset(region.dirty, 0, region.dirtySize);
+	m_jobs.clear();
+	m_regions.clear();
+	return copied;
+}
+
+
+/******************************************************************************
+ Constructor and Destructor
+******************************************************************************/
+
+CSnapshotSync::CSnapshotSync(unsigned numWorkers)
+	: m_workers("SnapshotSync", numWorkers)
+{
+	DebugLog("Built snapshot sync (%u worker threads)\n", numWorkers);
+}
+
+CSnapshotSync::~CSnapshotSync(void)
+{
+	DebugLog("Destroyed snapshot sync\n");
+}
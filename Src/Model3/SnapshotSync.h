@@ -0,0 +1,130 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * SnapshotSync.h
+ *
+ * Header file defining the CSnapshotSync class: copies dirty pages of GPU
+ * memory into the read-only snapshots used by the render thread.
+ */
+
+#ifndef INCLUDED_SNAPSHOTSYNC_H
+#define INCLUDED_SNAPSHOTSYNC_H
+
+#include "Types.h"
+#include "Util/WorkerPool.h"
+#include <vector>
+
+/*
+ * CSnapshotSync:
+ *
+ * Memory regions are divided into pages of 2^pageWidth bytes with one dirty
+ * bit per page (bit n of byte i covers page i*8+n). Runs of adjacent dirty
+ * pages are coalesced into a single copy, and each run is extended by 4 bytes
+ * to allow for a 32-bit write straddling the end of the last page.
+ *
+ * Regions are queued during SyncSnapshots() and copied together by Run(),
+ * split into jobs that are shared between the calling thread and a small pool
+ * of worker threads.
+ */
+class CSnapshotSync
+{
+public:
+	/*
+	 * CopyDirtyPages(dst, src, size, pageWidth, dirty, firstByte, endByte):
+	 *
+	 * Copies the dirty pages covered by a range of the dirty array. The dirty
+	 * array is only read; the caller is responsible for clearing it.
+	 *
+	 * Parameters:
+	 *		dst			Destination (snapshot) region.
+	 *		src			Source region.
+	 *		size		Size of the whole region in bytes.
+	 *		pageWidth	Log2 of the page size.
+	 *		dirty		Dirty page array for the whole region.
+	 *		firstByte	First dirty array byte to process.
+	 *		endByte		One past the last dirty array byte to process.
+	 *
+	 * Returns:
+	 *		Number of bytes copied.
+	 */
+	static UINT32 CopyDirtyPages(UINT8 *dst, const UINT8 *src, unsigned size, unsigned pageWidth, const UINT8 *dirty, unsigned firstByte, unsigned endByte);
+
+	/*
+	 * Queue(dst, src, size, pageWidth, dirty):
+	 *
+	 * Queues a region to be synced by the next call to Run(). The region must
+	 * not be modified until then.
+	 */
+	void Queue(UINT8 *dst, const UINT8 *src, unsigned size, unsigned pageWidth, UINT8 *dirty);
+
+	/*
+	 * Run(void):
+	 *
+	 * Copies the dirty pages of all queued regions and clears their dirty
+	 * arrays. If worker threads cannot be created, everything is copied in
+	 * the calling thread.
+	 *
+	 * Returns:
+	 *		Number of bytes copied.
+	 */
+	UINT32 Run(void);
+
+	/*
+	 * CSnapshotSync(numWorkers):
+	 * ~CSnapshotSync(void):
+	 *
+	 * Parameters:
+	 *		numWorkers	Number of worker threads to help the calling thread.
+	 *					Zero does all of the work in the calling thread.
+	 *					Threads are created on first use.
+	 */
+	CSnapshotSync(unsigned numWorkers);
+	~CSnapshotSync(void);
+
+private:
+	struct Region
+	{
+		UINT8		*dst;
+		const UINT8	*src;
+		unsigned	size;
+		unsigned	pageWidth;
+		UINT8		*dirty;
+		unsigned	dirtySize;
+	};
+
+	struct Job
+	{
+		unsigned		region;		// index into m_regions
+		unsigned		firstByte;
+		unsigned		endByte;
+		UINT32			copied;
+	};
+
+	void		DoJob(size_t i);
+
+	Util::WorkerPool		m_workers;
+	std::vector<Region>		m_regions;
+	std::vector<Job>		m_jobs;
+};
+
+
+#endif	// INCLUDED_SNAPSHOTSYNC_H
@@ -30,18 +30,18 @@
  * Palettes
  * --------
  *
- * Multiple copies of the 32K-color palette data are maintained. The first is
- * the raw data as written to the VRAM. Two copies are computed, one for layers
- * A/A' and the other for layers B/B'. These pairs of layers have independent 
- * color offset registers associated with them. The renderer uses these 
- * "computed" palettes.
+ * Two copies of the 32K-color palette data are maintained. The first is the
+ * raw data as written to the VRAM. The second is "computed": each color is
+ * decoded to 32-bit RGBA. It is updated whenever the real palette is modified,
+ * a single color entry at a time.
  *
- * The computed palettes are updated whenever the real palette is modified, a
- * single color entry at a time. If the color register is modified, the entire
- * palette has to be recomputed accordingly.
+ * Layers A/A' and B/B' have independent color offset registers associated with
+ * them. These are applied by the renderer, which reads them along with the
+ * other registers, so that changing them (e.g., to fade the screen) does not
+ * require the palette to be recomputed or copied to the renderer.
  *
  * The read-only copy of the palette, which is generated for the renderer, only
- * stores the two computed palettes.
+ * stores the computed palette.
  *
  * TO-DO List:
  * -----------
@@ -52,6 +52,7 @@
 
 #include "TileGen.h"
 
+#include <algorithm>
 #include <cstring>
 #include "Supermodel.h"
 
@@ -63,21 +64,21 @@
 
 // Offsets of memory regions within TileGen memory pool
 #define OFFSET_VRAM         0x000000	// VRAM and palette data
-#define OFFSET_PAL_A        0x120000	// computed A/A' palette
-#define OFFSET_PAL_B		0x140000	// computed B/B' palette 
-#define MEM_POOL_SIZE_RW    (0x120000+0x040000)
+#define OFFSET_PAL          0x120000	// computed palette
+#define MEM_POOL_SIZE_RW    (0x120000+0x020000)
 
-#define OFFSET_VRAM_RO      0x160000   // [read-only snapshot]
-#define OFFSET_PAL_RO_A     0x280000   // [read-only snapshot]
-#define OFFSET_PAL_RO_B		0x2A0000
-#define MEM_POOL_SIZE_RO    (0x120000+0x040000)
+#define OFFSET_VRAM_RO      0x140000   // [read-only snapshot]
+#define OFFSET_PAL_RO       0x260000   // [read-only snapshot]
+#define MEM_POOL_SIZE_RO    (0x120000+0x020000)
 
-#define OFFSET_VRAM_DIRTY   0x2C0000
-#define OFFSET_PAL_A_DIRTY  (OFFSET_VRAM_DIRTY+DIRTY_SIZE(0x120000))
-#define OFFSET_PAL_B_DIRTY	(OFFSET_PAL_A_DIRTY+DIRTY_SIZE(0x20000))
-#define MEM_POOL_SIZE_DIRTY (DIRTY_SIZE(0x120000)+2*DIRTY_SIZE(0x20000))	// VRAM + 2 palette dirty buffers
+#define OFFSET_VRAM_DIRTY   0x280000
+#define OFFSET_PAL_DIRTY    (OFFSET_VRAM_DIRTY+DIRTY_SIZE(0x120000))
+#define MEM_POOL_SIZE_DIRTY (DIRTY_SIZE(0x120000)+DIRTY_SIZE(0x20000))	// VRAM + palette dirty buffers
 
-#define MEMORY_POOL_SIZE	(MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO+MEM_POOL_SIZE_DIRTY)
+#define OFFSET_VRAM_REPLAY	(OFFSET_VRAM_DIRTY+MEM_POOL_SIZE_DIRTY)	// pages to replay after a swap [double-buffered mode]
+#define OFFSET_PAL_REPLAY	(OFFSET_VRAM_REPLAY+DIRTY_SIZE(0x120000))
+
+#define MEMORY_POOL_SIZE	(MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO+2*MEM_POOL_SIZE_DIRTY)
 
 
 /******************************************************************************
@@ -87,6 +88,7 @@
 void CTileGen::SaveState(CBlockFile *SaveState)
 {
 	SaveState->NewBlock("Tile Generator", __FILE__);
+	ReplaySnapshots();
 	SaveState->Write(vram, 0x120000); // Don't write out palette, read-only snapshots or dirty page arrays, just VRAM
 	SaveState->Write(regs, sizeof(regs));
 }
@@ -109,9 +111,6 @@ void CTileGen::LoadState(CBlockFile *SaveState)
 	}	
 	SaveState->Read(regs, sizeof(regs));
 	
-	// Because regs were read after palette, must recompute
-	RecomputePalettes();
-	
 	// If multi-threaded, update read-only snapshots too
 	if (m_gpuMultiThreaded)
 		UpdateSnapshots(true);
@@ -143,38 +142,19 @@ void CTileGen::EndVBlank(void)
 	//
 }
 
-void CTileGen::RecomputePalettes(void)
-{
-	// Writing the colors forces palettes to be computed
-	if (m_gpuMultiThreaded)
-	{
-		for (unsigned colorAddr = 0; colorAddr < 32768*4; colorAddr += 4 )
-		{
-			MARK_DIRTY(palDirty[0], colorAddr);
-			MARK_DIRTY(palDirty[1], colorAddr);
-			WritePalette(colorAddr/4, *(UINT32 *) &vram[0x100000+colorAddr]);
-		}
-	}
-	else
-	{
-		for (unsigned colorAddr = 0; colorAddr < 32768*4; colorAddr += 4 )
-			WritePalette(colorAddr/4, *(UINT32 *) &vram[0x100000+colorAddr]);
-	}
-}
-
 UINT32 CTileGen::SyncSnapshots(void)
 {
-	// Good time to recompute the palettes
-	if (recomputePalettes)
-	{
-		RecomputePalettes();
-		recomputePalettes = false;
-	}
+	// Tell the renderer which pages changed, so it only redraws what depends on them
+	if (Render2D != NULL)
+		Render2D->MarkVRAMDirty(renderDirty);
+	memset(renderDirty, 0, sizeof(renderDirty));
 	
 	if (!m_gpuMultiThreaded)
 		return 0;
 	
 	// Update read-only snapshots
+	if (m_swapSnapshots)
+		return SwapSnapshots();
 	return UpdateSnapshots(false);
 }
 
@@ -188,59 +168,78 @@ UINT32 CTileGen::UpdateSnapshot(bool copyWhole, UINT8 *src, UINT8 *dst, unsigned
 		memset(dirty, 0, dirtySize);
 		return size;
 	}
+	else if (SnapshotSync != NULL)
+	{
+		// Otherwise, queue the region so that only its dirty pages are copied, together with all the others
+		SnapshotSync->Queue(dst, src, size, PAGE_WIDTH, dirty);
+		return 0;
+	}
 	else
 	{
-		// Otherwise, loop through dirty pages array to find out what needs to be updated and copy only those parts
-		UINT32 copied = 0;
-		UINT8 *pSrc = src;
-		UINT8 *pDst = dst;
-		for (unsigned i = 0; i < dirtySize; i++)
-		{
-			UINT8 d = dirty[i];
-			if (d)
-			{
-				for (unsigned j = 0; j < 8; j++)
-				{
-					if (d&1)
-					{
-						// If not at very end of region, then copy an extra 4 bytes to allow for a possible 32-bit overlap
-						UINT32 toCopy = (i < dirtySize - 1 || j < 7 ? PAGE_SIZE + 4 : PAGE_SIZE);
-						memcpy(pDst, pSrc, toCopy);
-						copied += toCopy;
-					}
-					d >>= 1;
-					pSrc += PAGE_SIZE;	
-					pDst += PAGE_SIZE;
-				}
-				dirty[i] = 0;
-			}
-			else
-			{
-				pSrc += 8 * PAGE_SIZE;	
-				pDst += 8 * PAGE_SIZE;
-			}
-		}
+		UINT32 copied = CSnapshotSync::CopyDirtyPages(dst, src, size, PAGE_WIDTH, dirty, 0, dirtySize);
+		memset(dirty, 0, dirtySize);
 		return copied;
 	}
 }
 
 UINT32 CTileGen::UpdateSnapshots(bool copyWhole)
 {
+	// After a whole copy both sides are identical, so there is nothing left to replay
+	if (copyWhole && m_swapSnapshots)
+	{
+		memset(vramReplay, 0, DIRTY_SIZE(0x120000));
+		memset(palReplay, 0, DIRTY_SIZE(0x20000));
+	}
+
 	// Update all memory region snapshots
-	UINT32 palACopied  = UpdateSnapshot(copyWhole, (UINT8*)pal[0],  (UINT8*)palRO[0],  0x020000, palDirty[0]);
-	UINT32 palBCopied  = UpdateSnapshot(copyWhole, (UINT8*)pal[1],  (UINT8*)palRO[1],  0x020000, palDirty[1]);
+	UINT32 palCopied  = UpdateSnapshot(copyWhole, (UINT8*)pal,  (UINT8*)palRO,  0x020000, palDirty);
 	UINT32 vramCopied = UpdateSnapshot(copyWhole, (UINT8*)vram, (UINT8*)vramRO, 0x120000, vramDirty);
 	memcpy(regsRO, regs, sizeof(regs)); // Always copy whole of regs buffer
-	//printf("TileGen copied - palA:%4uK, palB:%4uK, vram:%4uK, regs:%uK\n", palACopied / 1024, palBCopied / 1024, vramCopied / 1024, sizeof(regs) / 1024);
-	return palACopied + palBCopied + vramCopied + sizeof(regs);
+	//printf("TileGen copied - pal:%4uK, vram:%4uK, regs:%uK\n", palCopied / 1024, vramCopied / 1024, sizeof(regs) / 1024);
+	return palCopied + vramCopied + sizeof(regs);
+}
+
+UINT32 CTileGen::SwapSnapshots(void)
+{
+	// Normally already done at the start of the frame
+	ReplaySnapshots();
+
+	// Memory written this frame becomes the read-only snapshot. The old snapshot becomes the
+	// write side and is missing exactly the pages dirtied this frame, which are kept for replay.
+	std::swap(vram, vramRO);
+	std::swap(pal, palRO);
+	std::swap(vramDirty, vramReplay);
+	std::swap(palDirty, palReplay);
+	memcpy(regsRO, regs, sizeof(regs));
+
+	if (Render2D != NULL)
+	{
+		Render2D->AttachVRAM(vramRO);
+		Render2D->AttachPalette(palRO);
+	}
+	return sizeof(regs);
+}
+
+void CTileGen::ReplaySnapshot(UINT8 *dst, const UINT8 *src, unsigned size, UINT8 *replay)
+{
+	unsigned dirtySize = DIRTY_SIZE(size);
+	CSnapshotSync::CopyDirtyPages(dst, src, size, PAGE_WIDTH, replay, 0, dirtySize);
+	memset(replay, 0, dirtySize);
+}
+
+void CTileGen::ReplaySnapshots(void)
+{
+	if (!m_swapSnapshots)
+		return;
+	ReplaySnapshot((UINT8*)pal, (UINT8*)palRO, 0x020000, palReplay);
+	ReplaySnapshot((UINT8*)vram, (UINT8*)vramRO, 0x120000, vramReplay);
 }
 
 void CTileGen::BeginFrame(void)
 {
 	// NOTE: Render2D->WriteVRAM(addr, data) is no longer being called for RAM addresses that are written
-	// to and instead this class relies upon the fact that Render2D currently marks everything as dirty
-	// with every frame.  If this were to change in the future then code to handle marking the correct
-	// parts of the renderer as dirty would need to be added here.
+	// to. Instead, the pages that changed are collected in renderDirty and passed to Render2D by
+	// SyncSnapshots(), and Render2D keeps track of register changes itself.
 	
 	Render2D->BeginFrame();
 }
@@ -278,6 +277,8 @@ void CTileGen::WriteRAM32(unsigned addr, UINT32 data)
 {
 	if (m_gpuMultiThreaded)
 		MARK_DIRTY(vramDirty, addr);
+	if (*(UINT32 *) &vram[addr] != data)	// games often rewrite name tables with the same data
+		MARK_DIRTY(renderDirty, addr);
 	*(UINT32 *) &vram[addr] = data;
 		
 	// Update palette if required
@@ -286,14 +287,10 @@ void CTileGen::WriteRAM32(unsigned addr, UINT32 data)
 		addr -= 0x100000;
 		unsigned color = addr/4;	// color index
 		
-		// Same address in both palettes must be marked dirty
+		// Same address in computed palette must be marked dirty
 		if (m_gpuMultiThreaded)
-		{
-			MARK_DIRTY(palDirty[0], addr);
-			MARK_DIRTY(palDirty[1], addr);
-		}
+			MARK_DIRTY(palDirty, addr);
 			
-		// Both palettes will be modified simultaneously
         WritePalette(color, data);
     }
 }
@@ -336,50 +333,10 @@ void CTileGen::InitPalette(void)
 	{
 		WritePalette(i, *(UINT32 *) &vram[0x100000 + i*4]);
 		if (m_gpuMultiThreaded)
-		{
-			palRO[0][i] = pal[0][i];
-			palRO[1][i] = pal[1][i];
-		}
+			palRO[i] = pal[i];
 	}
 }
 
-static inline UINT32 AddColorOffset(UINT8 r, UINT8 g, UINT8 b, UINT8 a, UINT32 offsetReg)
-{
-	INT32	ir, ig, ib;
-	
-	/*
-	 * Color offsets are signed but I'm not sure whether or not their range is 
-	 * merely [-128,+127], which would mean adding to a 0 component would not 
-	 * result full intensity (only +127 at most). Alternatively, the signed 
-	 * value might have to be multiplied by 2. That is assumed here. In either 
-	 * case, the signed addition should be saturated.
-	 */
-
-	ib = (INT32) (INT8)((offsetReg>>16)&0xFF);
-	ig = (INT32) (INT8)((offsetReg>>8)&0xFF);
-	ir = (INT32) (INT8)((offsetReg>>0)&0xFF);
-	ib *= 2;
-	ig *= 2;
-	ir *= 2;
-	
-	// Add with saturation
-	ib += (INT32) (UINT32) b;
-	if (ib < 0)			ib = 0;
-	else if (ib > 0xFF)	ib = 0xFF;
-	ig += (INT32) (UINT32) g;
-	if (ig < 0)			ig = 0;
-	else if (ig > 0xFF)	ig = 0xFF;
-	ir += (INT32) (UINT32) r;
-	if (ir < 0)			ir = 0;
-	else if (ir > 0xFF)	ir = 0xFF;
-	
-	// Construct the final 32-bit ABGR-format color
-	r = (UINT8) ir;
-	g = (UINT8) ig;
-	b = (UINT8) ib;
-	return ((UINT32)a<<24)|((UINT32)b<<16)|((UINT32)g<<8)|(UINT32)r;
-}
-
 void CTileGen::WritePalette(unsigned color, UINT32 data)
 {
 	UINT8		r, g, b, a;
@@ -396,8 +353,8 @@ void CTileGen::WritePalette(unsigned color, UINT32 data)
 		r = ((data & 0x1F) * 255) / 31;
 	}
 
-	pal[0][color] = AddColorOffset(r, g, b, a, regs[0x40/4]);	// A/A'
-	pal[1][color] = AddColorOffset(r, g, b, a, regs[0x44/4]);	// B/B'
+	// Construct the final 32-bit ABGR-format color. Color offsets are applied by the renderer.
+	pal[color] = ((UINT32)a<<24)|((UINT32)b<<16)|((UINT32)g<<8)|(UINT32)r;
 }
 
 UINT32 CTileGen::ReadRegister(unsigned reg)
@@ -416,19 +373,13 @@ void CTileGen::WriteRegister(unsigned reg, UINT32 data)
 	case 0x08:
 	case 0x0C:
 	case 0x20:
+	case 0x40:	// layer A/A' color offset (applied by the renderer)
+	case 0x44:	// layer B/B' color offset
 	case 0x60:
 	case 0x64:
 	case 0x68:
 	case 0x6C:
 		break;
-	case 0x40:	// layer A/A' color offset
-	case 0x44:	// layer B/B' color offset
-		// We only have a mechanism to recompute both palettes simultaneously.
-		// These regs are often written together in the same frame. To avoid
-		// needlessly recomputing both palettes twice, we defer the operation.
-		if (regs[reg/4] != data)	// only if changed
-			recomputePalettes = true;
-		break;
 	case 0x10:	// IRQ acknowledge
 		IRQ->Deassert(data&0xFF);
 		// MAME believes only lower 4 bits should be cleared
@@ -450,9 +401,9 @@ void CTileGen::Reset(void)
 	memset(memoryPool, 0, memSize);
 	memset(regs, 0, sizeof(regs));
 	memset(regsRO, 0, sizeof(regsRO));
+	memset(renderDirty, 0xFF, sizeof(renderDirty));
 	
 	InitPalette();
-	recomputePalettes = false;
 
 	DebugLog("Tile Generator reset\n");
 }
@@ -470,19 +421,24 @@ void CTileGen::AttachRenderer(CRender2D *Render2DPtr)
 	if (m_gpuMultiThreaded)
 	{
 		Render2D->AttachVRAM(vramRO);
-		Render2D->AttachPalette((const UINT32 **)palRO);
+		Render2D->AttachPalette(palRO);
 		Render2D->AttachRegisters(regsRO);
 	}
 	else
 	{
 		Render2D->AttachVRAM(vram);
-		Render2D->AttachPalette((const UINT32 **)pal);
+		Render2D->AttachPalette(pal);
 		Render2D->AttachRegisters(regs);
 	}
 
 	DebugLog("Tile Generator attached a Render2D object\n");
 }
 
+void CTileGen::AttachSnapshotSync(CSnapshotSync *SnapshotSyncPtr)
+{
+	SnapshotSync = SnapshotSyncPtr;
+}
+
 
 bool CTileGen::Init(CIRQ *IRQObjectPtr)
 {
@@ -496,18 +452,17 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 	
 	// Set up main pointers
 	vram = (UINT8 *) &memoryPool[OFFSET_VRAM];
-	pal[0] = (UINT32 *) &memoryPool[OFFSET_PAL_A];
-	pal[1] = (UINT32 *) &memoryPool[OFFSET_PAL_B];
+	pal = (UINT32 *) &memoryPool[OFFSET_PAL];
 
 	// If multi-threaded, set up pointers for read-only snapshots and dirty page arrays too
 	if (m_gpuMultiThreaded)
 	{
 		vramRO = (UINT8 *) &memoryPool[OFFSET_VRAM_RO];
-		palRO[0] = (UINT32 *) &memoryPool[OFFSET_PAL_RO_A];
-		palRO[1] = (UINT32 *) &memoryPool[OFFSET_PAL_RO_B];
+		palRO = (UINT32 *) &memoryPool[OFFSET_PAL_RO];
 		vramDirty = (UINT8 *) &memoryPool[OFFSET_VRAM_DIRTY];
-		palDirty[0] = (UINT8 *) &memoryPool[OFFSET_PAL_A_DIRTY];
-		palDirty[1] = (UINT8 *) &memoryPool[OFFSET_PAL_B_DIRTY];
+		palDirty = (UINT8 *) &memoryPool[OFFSET_PAL_DIRTY];
+		vramReplay = (UINT8 *) &memoryPool[OFFSET_VRAM_REPLAY];
+		palReplay = (UINT8 *) &memoryPool[OFFSET_PAL_REPLAY];
 	}
 
 	// Hook up the IRQ controller
@@ -519,10 +474,14 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 
 CTileGen::CTileGen(const Util::Config::Node &config)
   : m_config(config),
-    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>())
+    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    m_swapSnapshots(m_gpuMultiThreaded && config["GPUDoubleBuffer"].ValueAs<bool>())
 {
 	IRQ = NULL;
+	Render2D = NULL;
+	SnapshotSync = NULL;
 	memoryPool = NULL;
+	memset(renderDirty, 0xFF, sizeof(renderDirty));
 	DebugLog("Built Tile Generator\n");
 }
 
@@ -543,6 +502,7 @@ CTileGen::~CTileGen(void)
 #endif
 		
 	IRQ = NULL;
+	SnapshotSync = NULL;
 	if (memoryPool != NULL)
 	{
 		delete [] memoryPool;
@@ -29,6 +29,7 @@
 #define INCLUDED_TILEGEN_H
 
 #include "IRQ.h"
+#include "SnapshotSync.h"
 #include "Graphics/Render2D.h"
 
 /*
@@ -82,9 +83,23 @@ public:
 	 * end of each frame when both the render thread and the PPC thread have finished
 	 * their work.  If multi-threaded rendering is not enabled, then this method does
 	 * nothing.
+	 *
+	 * In double-buffered mode, VRAM and the palette are swapped with their
+	 * snapshots instead of being copied, and ReplaySnapshots() must then be
+	 * called before any more emulation.
 	 */
 	UINT32 SyncSnapshots(void);
 
+	/*
+	 * ReplaySnapshots(void):
+	 *
+	 * In double-buffered mode, copies the pages that were dirtied in the
+	 * previous frame forward from the read-only snapshots so that VRAM and the
+	 * palette are up to date again. Must be called from the PPC thread before
+	 * it runs a frame, and may be called concurrently with rendering.
+	 */
+	void ReplaySnapshots(void);
+
 	/*
 	 * BeginFrame(void):
 	 *
@@ -222,6 +237,19 @@ public:
 	 *		Render2DPtr		Pointer to a 2D renderer object.
 	 */
 	void AttachRenderer(CRender2D *Render2DPtr);
+
+	/*
+	 * AttachSnapshotSync(SnapshotSyncPtr):
+	 *
+	 * Attaches the object used to copy dirty pages into the read-only
+	 * snapshots. Regions are then queued by SyncSnapshots() and copied when
+	 * the caller runs the sync object. Without one, dirty pages are copied
+	 * immediately.
+	 *
+	 * Parameters:
+	 *		SnapshotSyncPtr	Pointer to a snapshot sync object.
+	 */
+	void AttachSnapshotSync(CSnapshotSync *SnapshotSyncPtr);
 	
 	/*
 	 * Init(IRQObjectPtr):
@@ -254,35 +282,44 @@ public:
 	
 private:
 	// Private member functions
-	void		RecomputePalettes(void);
 	void		InitPalette(void);
 	void		WritePalette(unsigned color, UINT32 data);
 	UINT32		UpdateSnapshots(bool copyWhole);
 	UINT32		UpdateSnapshot(bool copyWhole, UINT8 *src, UINT8 *dst, unsigned size, UINT8 *dirty);
+	UINT32		SwapSnapshots(void);
+	void		ReplaySnapshot(UINT8 *dst, const UINT8 *src, unsigned size, UINT8 *replay);
 
   const Util::Config::Node &m_config;
   const bool m_gpuMultiThreaded;
+  const bool m_swapSnapshots;	// double-buffered: snapshots are swapped rather than copied
 
-	CIRQ		*IRQ;		// IRQ controller the tile generator is attached to
-	CRender2D	*Render2D;	// 2D renderer the tile generator is attached to
+	CIRQ			*IRQ;			// IRQ controller the tile generator is attached to
+	CRender2D		*Render2D;		// 2D renderer the tile generator is attached to
+	CSnapshotSync	*SnapshotSync;	// dirty page sync shared with the Real3D
 	
 	/*
-	 * Tile generator VRAM. The upper 128KB of VRAM stores the palette data.
-	 * Two palettes are computed from this based on the color offset registers:
-	 * A/A' and B/B'.
+	 * Tile generator VRAM. The upper 128KB of VRAM stores the palette data,
+	 * which is decoded into the computed palette. The color offset registers
+	 * for A/A' and B/B' are applied by the renderer.
 	 */
 	UINT8	*memoryPool;		// all memory allocated here
 	UINT8   *vram;          	// 1.125MB of VRAM
-	UINT32	*pal[2];			// 2 x 0x20000 byte (32K colors) palette
-	bool	recomputePalettes;	// whether to recompute palettes A/A' and B/B' during sync
+	UINT32	*pal;				// 0x20000 byte (32K colors) palette
 
 	// Read-only snapshots
-	UINT8   *vramRO;        // 1.125MB of VRAM                       [read-only snapshot]	
-	UINT32  *palRO[2];      // 2 x 0x20000 byte (32K colors) palette [read-only snapshot]
+	UINT8   *vramRO;        // 1.125MB of VRAM                   [read-only snapshot]	
+	UINT32  *palRO;         // 0x20000 byte (32K colors) palette [read-only snapshot]
 	
 	// Arrays to keep track of dirty pages in memory regions
 	UINT8   *vramDirty;
-	UINT8   *palDirty[2];	// one for each palette
+	UINT8   *palDirty;
+
+	// Pages dirtied before the last swap that are yet to be replayed (double-buffered mode only)
+	UINT8   *vramReplay;
+	UINT8   *palReplay;
+
+	// VRAM pages whose contents changed since they were last passed to the renderer
+	UINT8	renderDirty[0x120000/0x2000];
 
 	// Registers
 	UINT32	regs[64];
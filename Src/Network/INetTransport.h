@@ -0,0 +1,66 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef INCLUDED_INETTRANSPORT_H
+#define INCLUDED_INETTRANSPORT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Util/NewConfig.h"
+
+// Sends length-prefixed messages to the next machine in the link
+class INetSend
+{
+public:
+	virtual ~INetSend() {}
+
+	virtual bool Send(const void* data, int length) = 0;
+	virtual bool Connect() = 0;
+	virtual bool Connected() = 0;
+};
+
+// Receives messages from the previous machine in the link
+class INetReceive
+{
+public:
+	virtual ~INetReceive() {}
+
+	virtual bool CheckDataAvailable(int timeoutMS = 0) = 0;		// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
+	virtual std::vector<char>& Receive() = 0;					// empty if the connection was lost
+	virtual int Receive(void* buffer, int maxLength) = 0;		// receives straight into buffer, returns the length or -1 if the connection was lost or the message didn't fit
+	virtual bool Connected() = 0;
+	virtual void Interrupt(bool interrupt) = 0;					// while set, calls waiting for data give up as if the connection was lost, so another thread can stop one blocked on a dead link
+};
+
+// Creates the transport selected by the NetTransport setting: "tcp" (default), "udp", or "shm"
+// for instances on the same host. Shared memory links are identified by the port numbers alone.
+// dropLate lets a lossy transport skip messages that were lost on the way, which is only safe
+// when every message says where it belongs; otherwise a lost message breaks the link instead.
+namespace NetTransport
+{
+	std::unique_ptr<INetSend> CreateSend(const Util::Config::Node& config, std::string& ip, int port);
+	std::unique_ptr<INetReceive> CreateReceive(const Util::Config::Node& config, int port, bool dropLate = false);
+}
+
+#endif
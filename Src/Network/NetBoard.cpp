@@ -1161,8 +1161,8 @@ bool CNetBoard::Init(UINT8 * netRAMPtr, UINT8 *netBufferPtr)
 	port_out = m_config["PortOut"].ValueAs<unsigned>();
 	addr_out = m_config["AddressOut"].ValueAs<std::string>();
 
-	nets = std::make_unique<TCPSend>(addr_out, port_out);
-	netr = std::make_unique<TCPReceive>(port_in);
+	nets = NetTransport::CreateSend(m_config, addr_out, port_out);
+	netr = NetTransport::CreateReceive(m_config, port_in);
 
 	if (m_config["Network"].ValueAs<bool>() && m_attached) {
 		while (!nets->Connect()) {
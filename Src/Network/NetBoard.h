@@ -106,8 +106,8 @@ private:
 	UINT16 port_out = 0;
 	std::string addr_out = "";
 
-	std::unique_ptr<TCPSend> nets;
-	std::unique_ptr<TCPReceive> netr;
+	std::unique_ptr<INetSend> nets;
+	std::unique_ptr<INetReceive> netr;
 
 	//game info
 	Game Gameinfo;
@@ -0,0 +1,91 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "INetTransport.h"
+#include "TCPSend.h"
+#include "TCPReceive.h"
+#include "UDPSend.h"
+#include "UDPReceive.h"
+#include "ShmSend.h"
+#include "ShmReceive.h"
+#include "OSD/Logger.h"
+
+enum class Transport
+{
+	TCP,
+	UDP,
+	SharedMemory
+};
+
+static Transport GetTransport(const Util::Config::Node& config)
+{
+	std::string transport = config["NetTransport"].ValueAsDefault<std::string>("tcp");
+
+	if (transport == "udp")
+		return Transport::UDP;
+
+	if (transport == "shm")
+	{
+#ifdef SHM_TRANSPORT
+		return Transport::SharedMemory;
+#else
+		ErrorLog("Shared memory net transport is not supported on this platform. Using TCP instead.");
+		return Transport::TCP;
+#endif
+	}
+
+	if (transport != "tcp")
+		ErrorLog("Unknown net transport '%s'. Using TCP instead.", transport.c_str());
+
+	return Transport::TCP;
+}
+
+std::unique_ptr<INetSend> NetTransport::CreateSend(const Util::Config::Node& config, std::string& ip, int port)
+{
+	switch (GetTransport(config))
+	{
+	case Transport::UDP:
+		return std::make_unique<UDPSend>(ip, port);
+#ifdef SHM_TRANSPORT
+	case Transport::SharedMemory:
+		return std::make_unique<ShmSend>(port);
+#endif
+	default:
+		return std::make_unique<TCPSend>(ip, port);
+	}
+}
+
+std::unique_ptr<INetReceive> NetTransport::CreateReceive(const Util::Config::Node& config, int port, bool dropLate)
+{
+	switch (GetTransport(config))
+	{
+	case Transport::UDP:
+		return std::make_unique<UDPReceive>(port, dropLate);
+#ifdef SHM_TRANSPORT
+	case Transport::SharedMemory:
+		return std::make_unique<ShmReceive>(port);
+#endif
+	default:
+		return std::make_unique<TCPReceive>(port);
+	}
+}
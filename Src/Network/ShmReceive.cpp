@@ -0,0 +1,188 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ShmReceive.h"
+
+#ifdef SHM_TRANSPORT
+
+#include "OSD/Logger.h"
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+#if defined(_DEBUG)
+#include <stdio.h>
+#define DPRINTF DebugLog
+#else
+#define DPRINTF(a, ...)
+#endif
+
+ShmReceive::ShmReceive(int port) :
+	m_name(ShmRing::Name(port)),
+	m_ring(nullptr),
+	m_interrupted(false)
+{
+	// remove anything left behind by an instance that didn't exit cleanly
+	shm_unlink(m_name.c_str());
+
+	int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+	if (fd < 0) {
+		ErrorLog("Unable to create shared memory link '%s'.", m_name.c_str());
+		return;
+	}
+
+	void* mem = MAP_FAILED;
+
+	if (ftruncate(fd, sizeof(ShmRing)) == 0) {
+		mem = mmap(nullptr, sizeof(ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	if (mem == MAP_FAILED) {
+		ErrorLog("Unable to map shared memory link '%s'.", m_name.c_str());
+		shm_unlink(m_name.c_str());
+		return;
+	}
+
+	// new shared memory is zero filled, which is also the initial state of the ring
+	m_ring = (ShmRing*)mem;
+	m_ring->receiverPid = (int32_t)getpid();
+	m_ring->magic.store(ShmRing::Magic, std::memory_order_release);
+}
+
+ShmReceive::~ShmReceive()
+{
+	if (m_ring) {
+		m_ring->closed = 1;
+		munmap(m_ring, sizeof(ShmRing));
+		m_ring = nullptr;
+		shm_unlink(m_name.c_str());
+	}
+}
+
+bool ShmReceive::WaitForMessage(int timeoutMS, uint32_t& length)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto lastCheck = start;
+	uint64_t tail = m_ring->tail.load(std::memory_order_relaxed);
+
+	while (m_ring->head.load(std::memory_order_acquire) == tail) {
+
+		if (m_ring->closed || m_interrupted || timeoutMS == 0) {
+			return false;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+
+		if (timeoutMS > 0 && now - start >= std::chrono::milliseconds(timeoutMS)) {
+			return false;
+		}
+
+		// a sender that crashed never sets closed, so poll that it is still running
+		if (now - lastCheck >= 100ms) {
+			if (!ShmRing::Alive(m_ring->senderPid)) {
+				DPRINTF("Sender has gone away\n");
+				m_ring->closed = 1;
+				return false;
+			}
+			lastCheck = now;
+		}
+
+		std::this_thread::yield();
+	}
+
+	m_ring->Read(tail, &length, sizeof(length));
+
+	return true;
+}
+
+bool ShmReceive::CheckDataAvailable(int timeoutMS)
+{
+	uint32_t length;
+
+	return Connected() && WaitForMessage(timeoutMS, length);
+}
+
+std::vector<char>& ShmReceive::Receive()
+{
+	uint32_t length;
+
+	if (!Connected() || !WaitForMessage(-1, length)) {
+		DPRINTF("Can't receive because not connected.\n");
+		m_recBuffer.clear();
+		return m_recBuffer;
+	}
+
+	uint64_t tail = m_ring->tail.load(std::memory_order_relaxed);
+
+	m_recBuffer.resize(length);
+	m_ring->Read(tail + sizeof(length), m_recBuffer.data(), length);
+	m_ring->tail.store(tail + sizeof(length) + length, std::memory_order_release);
+
+	DPRINTF("Received %u bytes\n", length);
+
+	return m_recBuffer;
+}
+
+int ShmReceive::Receive(void* buffer, int maxLength)
+{
+	uint32_t length;
+
+	if (!Connected() || !WaitForMessage(-1, length)) {
+		DPRINTF("Can't receive because not connected.\n");
+		return -1;
+	}
+
+	uint64_t tail = m_ring->tail.load(std::memory_order_relaxed);
+	int result = -1;
+
+	// copied straight out of the ring into the destination
+	if (length <= (uint32_t)maxLength) {
+		m_ring->Read(tail + sizeof(length), buffer, length);
+		result = (int)length;
+	}
+
+	m_ring->tail.store(tail + sizeof(length) + length, std::memory_order_release);
+
+	DPRINTF("Received %u bytes\n", length);
+
+	return result;
+}
+
+bool ShmReceive::Connected()
+{
+	return m_ring && m_ring->attached;
+}
+
+void ShmReceive::Interrupt(bool interrupt)
+{
+	m_interrupted = interrupt;
+}
+
+#endif	// SHM_TRANSPORT
@@ -0,0 +1,57 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef _SHMRECEIVE_H_
+#define _SHMRECEIVE_H_
+
+#include "ShmRing.h"
+
+#ifdef SHM_TRANSPORT
+
+#include "INetTransport.h"
+
+class ShmReceive : public INetReceive
+{
+public:
+	ShmReceive(int port);
+	~ShmReceive();
+
+	bool CheckDataAvailable(int timeoutMS = 0);
+	std::vector<char>& Receive();
+	int Receive(void* buffer, int maxLength);
+	bool Connected();
+	void Interrupt(bool interrupt);
+
+private:
+
+	bool WaitForMessage(int timeoutMS, uint32_t& length);
+
+	std::string m_name;
+	ShmRing* m_ring;
+	std::atomic_bool m_interrupted;
+	std::vector<char> m_recBuffer;
+};
+
+#endif	// SHM_TRANSPORT
+
+#endif
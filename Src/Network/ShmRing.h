@@ -0,0 +1,93 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#if !defined(SUPERMODEL_WIN32) && !defined(_WIN32)
+#define SHM_TRANSPORT	// POSIX shared memory is available
+#endif
+
+#ifdef SHM_TRANSPORT
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <cerrno>
+#include <signal.h>
+
+// Single producer, single consumer byte ring in POSIX shared memory, used to link instances
+// on the same host. The receiving end creates it and the sending end maps it on Connect().
+// Messages are a 32-bit length followed by the data, the same framing as the TCP transport,
+// and head only moves past a message once all of it has been written. Each end also records
+// its pid so the other can tell when it has died without getting the chance to set closed.
+struct ShmRing
+{
+	static const uint32_t Magic	= 0x4B4E494C;	// "LINK"
+	static const uint32_t Size	= 0x100000;		// must be a power of two
+
+	std::atomic<uint32_t> magic;		// written last by the receiver, once the ring is ready
+	std::atomic<uint32_t> attached;		// set by the sender when it connects
+	std::atomic<uint32_t> closed;		// set by either end when it goes away
+	std::atomic<int32_t> receiverPid;	// process that created the ring
+	std::atomic<int32_t> senderPid;		// process that attached to it, 0 until then
+
+	alignas(64) std::atomic<uint64_t> head;		// bytes written, only advanced by the sender
+	alignas(64) std::atomic<uint64_t> tail;		// bytes read, only advanced by the receiver
+	alignas(64) uint8_t data[Size];
+
+	static std::string Name(int port)
+	{
+		return "/supermodel-link-" + std::to_string(port);
+	}
+
+	// true if the process is still running (EPERM means it exists but belongs to someone else)
+	static bool Alive(int32_t pid)
+	{
+		return pid > 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+	}
+
+	void Write(uint64_t pos, const void* src, uint32_t length)
+	{
+		uint32_t offset = uint32_t(pos & (Size - 1));
+		uint32_t first = std::min(length, Size - offset);
+		memcpy(&data[offset], src, first);
+		memcpy(&data[0], (const uint8_t*)src + first, length - first);
+	}
+
+	void Read(uint64_t pos, void* dst, uint32_t length) const
+	{
+		uint32_t offset = uint32_t(pos & (Size - 1));
+		uint32_t first = std::min(length, Size - offset);
+		memcpy(dst, &data[offset], first);
+		memcpy((uint8_t*)dst + first, &data[0], length - first);
+	}
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory ring needs address-free 64-bit atomics");
+
+#endif	// SHM_TRANSPORT
+
+#endif
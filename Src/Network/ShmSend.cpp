@@ -0,0 +1,165 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ShmSend.h"
+
+#ifdef SHM_TRANSPORT
+
+#include "OSD/Logger.h"
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+#if defined(_DEBUG)
+#include <stdio.h>
+#define DPRINTF DebugLog
+#else
+#define DPRINTF(a, ...)
+#endif
+
+ShmSend::ShmSend(int port) :
+	m_name(ShmRing::Name(port)),
+	m_ring(nullptr)
+{
+}
+
+ShmSend::~ShmSend()
+{
+	if (m_ring) {
+		m_ring->closed = 1;
+	}
+
+	Disconnect();
+}
+
+bool ShmSend::Send(const void* data, int length)
+{
+	if (!Connected()) {
+		DPRINTF("Not connected\n");
+		return false;
+	}
+
+	if (m_ring->closed) {
+		DPRINTF("Receiver has closed the link\n");
+		Disconnect();
+		return false;
+	}
+
+	uint32_t size = length;
+	uint32_t total = sizeof(size) + size;
+
+	if (total > ShmRing::Size) {
+		DPRINTF("Message of %i bytes is too big\n", length);
+		return false;
+	}
+
+	// wait for the receiver to make room
+	uint64_t head = m_ring->head.load(std::memory_order_relaxed);
+	auto lastCheck = std::chrono::steady_clock::now();
+
+	while (ShmRing::Size - (head - m_ring->tail.load(std::memory_order_acquire)) < total) {
+		if (m_ring->closed) {
+			Disconnect();
+			return false;
+		}
+
+		// a receiver that crashed never sets closed, so poll that it is still running
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastCheck >= 100ms) {
+			if (!ShmRing::Alive(m_ring->receiverPid)) {
+				DPRINTF("Receiver has gone away\n");
+				m_ring->closed = 1;
+				Disconnect();
+				return false;
+			}
+			lastCheck = now;
+		}
+
+		std::this_thread::yield();
+	}
+
+	DPRINTF("Sending %i bytes\n", length);
+
+	m_ring->Write(head, &size, sizeof(size));		// pack the length at the start of transmission
+	m_ring->Write(head + sizeof(size), data, size);
+	m_ring->head.store(head + total, std::memory_order_release);
+
+	return true;
+}
+
+bool ShmSend::Connected()
+{
+	return m_ring != nullptr;
+}
+
+bool ShmSend::Connect()
+{
+	if (m_ring) {
+		return true;
+	}
+
+	void* mem = MAP_FAILED;
+	int fd = shm_open(m_name.c_str(), O_RDWR, 0);
+
+	if (fd >= 0) {
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ShmRing)) {
+			mem = mmap(nullptr, sizeof(ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+	}
+
+	if (mem == MAP_FAILED) {
+		std::this_thread::sleep_for(1ms);	// receiver isn't up yet
+		return false;
+	}
+
+	ShmRing* ring = (ShmRing*)mem;
+
+	if (ring->magic.load(std::memory_order_acquire) != ShmRing::Magic || ring->closed) {
+		munmap(mem, sizeof(ShmRing));
+		std::this_thread::sleep_for(1ms);
+		return false;
+	}
+
+	ring->senderPid = (int32_t)getpid();
+	ring->attached = 1;
+	m_ring = ring;
+
+	return true;
+}
+
+void ShmSend::Disconnect()
+{
+	if (m_ring) {
+		munmap(m_ring, sizeof(ShmRing));
+		m_ring = nullptr;
+	}
+}
+
+#endif	// SHM_TRANSPORT
@@ -0,0 +1,53 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#ifndef _SHMSEND_H_
+#define _SHMSEND_H_
+
+#include "ShmRing.h"
+
+#ifdef SHM_TRANSPORT
+
+#include "INetTransport.h"
+
+class ShmSend : public INetSend
+{
+public:
+	ShmSend(int port);
+	~ShmSend();
+
+	bool Send(const void* data, int length);
+	bool Connect();
+	bool Connected();
+private:
+
+	void Disconnect();
+
+	std::string	m_name;
+	ShmRing*	m_ring;
+
+};
+
+#endif	// SHM_TRANSPORT
+
+#endif
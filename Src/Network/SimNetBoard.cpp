@@ -31,6 +31,9 @@
 
 static const uint64_t netGUID = 0x5bf177da34872;
 
+// number of frames the pipelined link can buffer in each direction (power of two)
+static const unsigned pipelineDepth = 8;
+
 inline bool CSimNetBoard::IsGame(const char* gameName)
 {
 	return (m_gameInfo.name == gameName) || (m_gameInfo.parent == gameName);
@@ -46,6 +49,8 @@ CSimNetBoard::~CSimNetBoard(void)
 
 	if (m_connectThread.joinable())
 		m_connectThread.join();
+
+	StopIOThread();
 }
 
 void CSimNetBoard::SaveState(CBlockFile* SaveState)
@@ -85,9 +90,10 @@ bool CSimNetBoard::Init(uint8_t* netRAMPtr, uint8_t* netBufferPtr)
 	port_in = m_config["PortIn"].ValueAs<unsigned>();
 	port_out = m_config["PortOut"].ValueAs<unsigned>();
 	addr_out = m_config["AddressOut"].ValueAs<std::string>();
+	m_pipelined = m_config["NetPipeline"].ValueAsDefault<bool>(false);
 
-	nets = std::make_unique<TCPSend>(addr_out, port_out);
-	netr = std::make_unique<TCPReceive>(port_in);
+	nets = NetTransport::CreateSend(m_config, addr_out, port_out);
+	netr = NetTransport::CreateReceive(m_config, port_in, m_pipelined);	// only pipelined packets carry the slot they go in
 
 	return 0;
 }
@@ -457,13 +463,47 @@ void CSimNetBoard::RunFrame(void)
 		m_counter++;
 		CommRAM16[0x6] = FLIPENDIAN16(m_counter);
 		
+		if (m_pipelined)
+		{
+			if (!m_ioThread.joinable())
+				StartIOThread();
+
+			if (m_linkBroken)
+			{
+				StopIOThread();
+				m_state = State::error;
+				if (m_gameType == GameType::one)
+					m_status1 = 0x40;				// send "link broken" message to mainboard
+			}
+
+			// hand our segment to the I/O thread (if it has fallen a whole ring behind, this frame's is dropped)
+			uint8_t* segment = m_sendRing.BeginWrite();
+			if (segment)
+			{
+				memcpy(segment, CommRAM + 0x100, m_segmentSize);
+				m_sendRing.EndWrite();
+			}
+
+			// pick up the newest complete set of segments without waiting for one
+			const uint8_t* segments;
+			while ((segments = m_recvRing.BeginRead()) != nullptr)
+			{
+				memcpy(m_lastSegments.data(), segments, m_lastSegments.size());
+				m_recvRing.EndRead();
+				m_haveSegments = true;
+			}
+
+			// both banks need them, so they are copied in every frame
+			if (m_haveSegments)
+				memcpy(CommRAM + 0x100 + m_segmentSize, m_lastSegments.data(), m_lastSegments.size());
+		}
+
 		// we only send what we need to; helps cut down on bandwidth
 		// each machine has to receive back its own data (TODO: copy this data manually?)
-		for (int i = 0; i < m_numMachines; i++)
+		for (int i = 0; i < m_numMachines && !m_pipelined; i++)
 		{
 			nets->Send(CommRAM + 0x100 + i * m_segmentSize, m_segmentSize);
-			auto& recv_data = netr->Receive();
-			if (recv_data.size() == 0)
+			if (netr->Receive(CommRAM + 0x100 + (i + 1) * m_segmentSize, m_segmentSize) <= 0)
 			{
 				// link broken - send an "empty" packet to alert other machines
 				nets->Send(nullptr, 0);
@@ -472,7 +512,6 @@ void CSimNetBoard::RunFrame(void)
 					m_status1 = 0x40;			// send "link broken" message to mainboard
 				break;
 			}
-			memcpy(CommRAM + 0x100 + (i + 1) * m_segmentSize, recv_data.data(), recv_data.size());
 		}
 
 		// swap CommRAM banks
@@ -499,6 +538,8 @@ void CSimNetBoard::RunFrame(void)
 
 void CSimNetBoard::Reset(void)
 {
+	StopIOThread();
+
 	// if netboard was active, send an "empty" packet so the other machines don't get stuck waiting for data
 	if (m_state == State::ready)
 	{
@@ -554,6 +595,96 @@ void CSimNetBoard::ConnectProc(void)
 	m_connected = true;
 }
 
+void CSimNetBoard::StartIOThread(void)
+{
+	size_t segmentsSize = size_t(m_numMachines) * m_segmentSize;
+
+	m_sendRing.Init(m_segmentSize, pipelineDepth);
+	m_recvRing.Init(segmentsSize, pipelineDepth);
+	m_ioSegments.assign(segmentsSize, 0);
+	m_lastSegments.assign(segmentsSize, 0);
+	m_haveSegments = false;
+
+	m_ioQuit = false;
+	m_linkBroken = false;
+	m_ioThread = std::thread(&CSimNetBoard::IOProc, this);
+}
+
+void CSimNetBoard::StopIOThread(void)
+{
+	m_ioQuit = true;
+
+	if (m_ioThread.joinable())
+	{
+		// it may be waiting for the rest of a packet from a machine that has gone away
+		netr->Interrupt(true);
+		m_ioThread.join();
+		netr->Interrupt(false);
+	}
+}
+
+// Forwards segments around the ring as soon as they arrive. Each packet carries the number of hops
+// it will have made when received, which is also the slot it goes in (slot 0 being our own segment).
+// This way a segment is one hop behind on each machine, rather than waiting for a whole lap per frame.
+// The second byte is a tag from the machine that sent it, so it knows how many of its own are still
+// going around. Only pipelineDepth are allowed at once, which keeps everything in flight small enough
+// for the transport to buffer: a send can't block on a machine that has stopped reading.
+void CSimNetBoard::IOProc(void)
+{
+	std::vector<uint8_t> packet(2 + m_segmentSize);
+	std::vector<uint8_t> incoming(packet.size());
+	uint8_t sent = 0;			// tag of our next segment
+	uint8_t returned = 0;		// tag following the last of ours to come back around
+
+	while (!m_ioQuit)
+	{
+		// send our own segment for any new frames
+		const uint8_t* segment;
+		while (uint8_t(sent - returned) < pipelineDepth && (segment = m_sendRing.BeginRead()) != nullptr)
+		{
+			packet[0] = 1;
+			packet[1] = sent++;
+			memcpy(&packet[2], segment, m_segmentSize);
+			m_sendRing.EndRead();
+			nets->Send(packet.data(), (int)packet.size());
+		}
+
+		if (netr->Connected() && !netr->CheckDataAvailable(1))
+			continue;
+
+		int received = netr->Receive(incoming.data(), (int)incoming.size());
+		uint8_t hops = received == (int)incoming.size() ? incoming[0] : 0;
+		if (hops == 0 || hops > m_numMachines)
+		{
+			// link broken - send an "empty" packet to alert other machines
+			nets->Send(nullptr, 0);
+			m_linkBroken = true;
+			return;
+		}
+
+		memcpy(&m_ioSegments[(hops - 1) * m_segmentSize], &incoming[2], m_segmentSize);
+
+		if (hops < m_numMachines)
+		{
+			incoming[0] = hops + 1;
+			nets->Send(incoming.data(), (int)incoming.size());
+		}
+		else
+		{
+			// any of ours sent before this one were lost on the way
+			returned = incoming[1] + 1;
+
+			// our own segment is back, so everything else received is at least as new: publish it
+			uint8_t* segments = m_recvRing.BeginWrite();
+			if (segments)
+			{
+				memcpy(segments, m_ioSegments.data(), m_ioSegments.size());
+				m_recvRing.EndWrite();
+			}
+		}
+	}
+}
+
 uint8_t CSimNetBoard::ReadCommRAM8(unsigned addr)
 {
 	return externalCommRAM[addr];
@@ -24,8 +24,10 @@
 #define INCLUDED_SIMNETBOARD_H
 
 #include <cstdint>
-#include "TCPSend.h"
-#include "TCPReceive.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "INetTransport.h"
 #include "INetBoard.h"
 
 enum class State
@@ -90,8 +92,8 @@ private:
 	std::atomic_bool m_quit = false;
 	std::atomic_bool m_connected = false;
 
-	std::unique_ptr<TCPSend> nets = nullptr;
-	std::unique_ptr<TCPReceive> netr = nullptr;
+	std::unique_ptr<INetSend> nets = nullptr;
+	std::unique_ptr<INetReceive> netr = nullptr;
 
 	Game m_gameInfo;
 	GameType m_gameType = GameType::unknown;
@@ -112,6 +114,69 @@ private:
 
 	inline bool IsGame(const char* gameName);
 	void ConnectProc(void);
+
+	// Lock-free ring of fixed size packets with one producer and one consumer thread.
+	// The number of packets must be a power of two.
+	class PacketRing
+	{
+	public:
+		void Init(size_t packetSize, unsigned numPackets)
+		{
+			m_data.assign(packetSize * numPackets, 0);
+			m_packetSize = packetSize;
+			m_numPackets = numPackets;
+			m_head = 0;
+			m_tail = 0;
+		}
+
+		uint8_t* BeginWrite(void)		// returns nullptr if full
+		{
+			unsigned head = m_head.load(std::memory_order_relaxed);
+			if (head - m_tail.load(std::memory_order_acquire) == m_numPackets)
+				return nullptr;
+			return &m_data[(head & (m_numPackets - 1)) * m_packetSize];
+		}
+
+		void EndWrite(void)
+		{
+			m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		const uint8_t* BeginRead(void)	// returns nullptr if empty
+		{
+			unsigned tail = m_tail.load(std::memory_order_relaxed);
+			if (m_head.load(std::memory_order_acquire) == tail)
+				return nullptr;
+			return &m_data[(tail & (m_numPackets - 1)) * m_packetSize];
+		}
+
+		void EndRead(void)
+		{
+			m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+	private:
+		std::vector<uint8_t> m_data;
+		size_t m_packetSize = 0;
+		unsigned m_numPackets = 0;
+		std::atomic<unsigned> m_head = 0;
+		std::atomic<unsigned> m_tail = 0;
+	};
+
+	// pipelined link: segments are forwarded around the ring by an I/O thread instead of RunFrame
+	bool m_pipelined = false;
+	std::thread m_ioThread;
+	std::atomic_bool m_ioQuit = false;
+	std::atomic_bool m_linkBroken = false;
+	PacketRing m_sendRing;							// our own segment for each frame
+	PacketRing m_recvRing;							// segments of every machine, published each time ours comes back around
+	std::vector<uint8_t> m_ioSegments;				// segments collected so far by the I/O thread
+	std::vector<uint8_t> m_lastSegments;			// latest segments picked up by RunFrame
+	bool m_haveSegments = false;
+
+	void StartIOThread(void);
+	void StopIOThread(void);
+	void IOProc(void);
 };
 
 #endif
\ No newline at end of file
@@ -36,7 +36,9 @@ using namespace std::chrono_literals;
 TCPReceive::TCPReceive(int port) :
 	m_listenSocket(nullptr),
 	m_receiveSocket(nullptr),
-	m_socketSet(nullptr)
+	m_socketSet(nullptr),
+	m_running(false),
+	m_interrupted(false)
 {
 	SDLNet_Init();
 
@@ -82,7 +84,7 @@ TCPReceive::~TCPReceive()
 
 bool TCPReceive::CheckDataAvailable(int timeoutMS)
 {
-	if (!m_receiveSocket) {
+	if (!m_receiveSocket || m_interrupted) {
 		return false;
 	}
 
@@ -98,32 +100,69 @@ std::vector<char>& TCPReceive::Receive()
 	}
 
 	int size = 0;
-	int result = 0;
 
-	result = SDLNet_TCP_Recv(m_receiveSocket, &size, sizeof(int));
-	DPRINTF("Received %i bytes\n", result);
-	if (result <= 0) {
-		SDLNet_TCP_Close(m_receiveSocket);
-		m_receiveSocket = nullptr;
+	if (!ReceiveData((char*)&size, sizeof(int))) {
+		m_recBuffer.clear();
+		return m_recBuffer;
 	}
 
 	// reserve our space
 	m_recBuffer.resize(size);
 
+	if (!ReceiveData(m_recBuffer.data(), size)) {
+		m_recBuffer.clear();
+	}
+
+	return m_recBuffer;
+}
+
+int TCPReceive::Receive(void* buffer, int maxLength)
+{
+	if (!m_receiveSocket) {
+		DPRINTF("Can't receive because no socket.\n");
+		return -1;
+	}
+
+	int size = 0;
+
+	if (!ReceiveData((char*)&size, sizeof(int))) {
+		return -1;
+	}
+
+	// too big for the destination, read it anyway to stay in step with the stream
+	if (size > maxLength) {
+		m_recBuffer.resize(size);
+		ReceiveData(m_recBuffer.data(), size);
+		return -1;
+	}
+
+	return ReceiveData((char*)buffer, size) ? size : -1;
+}
+
+bool TCPReceive::ReceiveData(char* buffer, int size)
+{
 	while (size) {
 
-		result = SDLNet_TCP_Recv(m_receiveSocket, m_recBuffer.data() + (m_recBuffer.size() - size), size);
+		// wait in short steps so that Interrupt() can stop a message that never finishes arriving
+		while (SDLNet_CheckSockets(m_socketSet, 16) == 0) {
+			if (m_interrupted) {
+				CloseReceiveSocket();		// part of the message may have been read, the stream can't be picked up again
+				return false;
+			}
+		}
+
+		int result = SDLNet_TCP_Recv(m_receiveSocket, buffer, size);
 		DPRINTF("Received %i bytes\n", result);
 		if (result <= 0) {
-			SDLNet_TCP_Close(m_receiveSocket);
-			m_receiveSocket = nullptr;
-			break;
+			CloseReceiveSocket();
+			return false;
 		}
 
+		buffer += result;
 		size -= result;
 	}
 
-	return m_recBuffer;
+	return true;
 }
 
 void TCPReceive::ListenFunc()
@@ -153,7 +192,19 @@ void TCPReceive::ListenFunc()
 	}
 }
 
+void TCPReceive::CloseReceiveSocket()
+{
+	SDLNet_DelSocket(m_socketSet, (SDLNet_GenericSocket)m_receiveSocket.load());
+	SDLNet_TCP_Close(m_receiveSocket);
+	m_receiveSocket = nullptr;
+}
+
 bool TCPReceive::Connected()
 {
 	return (m_receiveSocket != 0);
+}
+
+void TCPReceive::Interrupt(bool interrupt)
+{
+	m_interrupted = interrupt;
 }
\ No newline at end of file
@@ -27,8 +27,9 @@
 #include <atomic>
 #include <vector>
 #include "SDLIncludes.h"
+#include "INetTransport.h"
 
-class TCPReceive
+class TCPReceive : public INetReceive
 {
 public:
 	TCPReceive(int port);
@@ -36,17 +37,22 @@ public:
 
 	bool CheckDataAvailable(int timeoutMS = 0);		// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
 	std::vector<char>& Receive();
+	int Receive(void* buffer, int maxLength);
 	bool Connected();
+	void Interrupt(bool interrupt);
 
 private:
 
 	void ListenFunc();
+	bool ReceiveData(char* buffer, int size);
+	void CloseReceiveSocket();
 
 	TCPsocket m_listenSocket;
 	std::atomic<TCPsocket> m_receiveSocket;
 	SDLNet_SocketSet m_socketSet;
 	std::thread m_listenThread;
 	std::atomic_bool m_running;
+	std::atomic_bool m_interrupted;
 	std::vector<char> m_recBuffer;
 };
 
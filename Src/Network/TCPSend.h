@@ -25,8 +25,9 @@
 
 #include <string>
 #include "SDLIncludes.h"
+#include "INetTransport.h"
 
-class TCPSend
+class TCPSend : public INetSend
 {
 public:
 	TCPSend(std::string& ip, int port);
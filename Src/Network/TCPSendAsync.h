@@ -31,8 +31,9 @@
 #include <memory>
 #include <thread>
 #include "SDLIncludes.h"
+#include "INetTransport.h"
 
-class TCPSendAsync
+class TCPSendAsync : public INetSend
 {
 public:
 	TCPSendAsync(std::string& ip, int port);
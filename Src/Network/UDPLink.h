@@ -0,0 +1,64 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#ifndef _UDPLINK_H_
+#define _UDPLINK_H_
+
+#include <cstdint>
+
+// Datagram framing shared by UDPSend and UDPReceive. Every message gets the next sequence
+// number and is split into fragments of at most Payload bytes, each sent in its own
+// datagram behind this header. The whole message is sent Redundancy times in a row so a
+// single lost datagram doesn't stall the link, and duplicates are dropped by the receiver.
+struct UDPHeader
+{
+	enum Type : uint16_t
+	{
+		Data,
+		Hello,		// sent by UDPSend::Connect() to start a new session
+		Ack			// reply to Hello from the receiver
+	};
+
+	static const uint32_t Magic			= 0x4B4E494C;	// "LINK"
+	static const int Payload			= 1024;			// fragment size, stays under a typical MTU
+	static const int MaxFragments		= 128;
+	static const int MaxMessage			= Payload * MaxFragments;
+	static const int MaxDatagram		= 16 + Payload;	// header + payload
+	static const int Redundancy			= 2;
+
+	uint32_t magic;
+	uint32_t seq;			// message sequence number, the first message of a session is 1
+	uint32_t length;		// length of the whole message
+	uint16_t fragment;		// index of this fragment
+	uint16_t type;
+
+	static int Fragments(uint32_t length)
+	{
+		return length ? int((length + Payload - 1) / Payload) : 1;
+	}
+};
+
+static_assert(sizeof(UDPHeader) == 16, "UDPHeader::MaxDatagram assumes a 16 byte header");
+
+#endif
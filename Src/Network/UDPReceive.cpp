@@ -0,0 +1,345 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "UDPReceive.h"
+#include "OSD/Logger.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std::chrono_literals;
+
+#if defined(_DEBUG)
+#include <stdio.h>
+#define DPRINTF DebugLog
+#else
+#define DPRINTF(a, ...)
+#endif
+
+static const auto LINK_TIMEOUT = 5s;		// silence after which the previous machine is assumed gone
+
+UDPReceive::UDPReceive(int port, bool dropLate) :
+	m_socket(nullptr),
+	m_socketSet(nullptr),
+	m_packet(nullptr),
+	m_running(false),
+	m_interrupted(false),
+	m_nextSeq(1),
+	m_dropLate(dropLate),
+	m_connected(false)
+{
+	SDLNet_Init();
+
+	for (auto& message : m_messages) {
+		message.data.reset(new char[UDPHeader::MaxMessage]);
+	}
+
+	m_socket = SDLNet_UDP_Open(port);
+	m_packet = SDLNet_AllocPacket(UDPHeader::MaxDatagram);
+	m_socketSet = SDLNet_AllocSocketSet(1);
+
+	if (m_socket && m_packet && m_socketSet) {
+		SDLNet_UDP_AddSocket(m_socketSet, m_socket);
+		m_running = true;
+		m_receiveThread = std::thread(&UDPReceive::ReceiveFunc, this);
+	}
+	else {
+		ErrorLog("Unable to open UDP port %i.", port);
+	}
+}
+
+UDPReceive::~UDPReceive()
+{
+	m_running = false;
+	m_cv.notify_all();
+
+	if (m_receiveThread.joinable()) {
+		m_receiveThread.join();
+	}
+
+	if (m_socketSet) {
+		SDLNet_FreeSocketSet(m_socketSet);
+		m_socketSet = nullptr;
+	}
+
+	if (m_socket) {
+		SDLNet_UDP_Close(m_socket);
+		m_socket = nullptr;
+	}
+
+	if (m_packet) {
+		SDLNet_FreePacket(m_packet);
+		m_packet = nullptr;
+	}
+
+	SDLNet_Quit();
+}
+
+void UDPReceive::ReceiveFunc()
+{
+	while (m_running) {
+
+		// the timeout is only there to notice when we have to exit
+		int ready = SDLNet_CheckSockets(m_socketSet, 16);
+
+		if (ready < 0) {
+			std::this_thread::sleep_for(16ms);
+			continue;
+		}
+
+		while (ready > 0 && SDLNet_UDP_Recv(m_socket, m_packet) > 0) {
+			HandlePacket();
+		}
+	}
+}
+
+void UDPReceive::HandlePacket()
+{
+	UDPHeader header;
+
+	if (m_packet->len < (int)sizeof(header)) {
+		return;
+	}
+
+	memcpy(&header, m_packet->data, sizeof(header));
+
+	if (header.magic != UDPHeader::Magic) {
+		return;
+	}
+
+	if (header.type == UDPHeader::Hello) {
+
+		// new session, sequence numbers start again
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& message : m_messages) {
+				message.seq = 0;
+				message.ready = false;
+			}
+			m_nextSeq = 1;
+			m_connected = true;
+			m_lastPacket = std::chrono::steady_clock::now();
+		}
+
+		m_cv.notify_all();
+
+		// answer on the same packet, which already holds the sender's address
+		header.type = UDPHeader::Ack;
+		memcpy(m_packet->data, &header, sizeof(header));
+		m_packet->len = sizeof(header);
+		SDLNet_UDP_Send(m_socket, -1, m_packet);
+
+		DPRINTF("Accepted connection.\n");
+		return;
+	}
+
+	if (header.type != UDPHeader::Data) {
+		return;
+	}
+
+	// drop anything malformed
+	int size = m_packet->len - (int)sizeof(header);
+	int offset = header.fragment * UDPHeader::Payload;
+
+	if (header.length > (uint32_t)UDPHeader::MaxMessage || header.fragment >= UDPHeader::Fragments(header.length) ||
+		size != std::min((int)header.length - offset, UDPHeader::Payload)) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_connected) {
+		return;			// data from before the last hello
+	}
+
+	m_lastPacket = std::chrono::steady_clock::now();
+
+	if (header.seq < m_nextSeq) {
+		return;			// duplicate, or too late to be of any use
+	}
+
+	Message& message = m_messages[header.seq % Slots];
+
+	if (message.seq != header.seq) {
+
+		if (message.seq > header.seq) {
+			return;		// slot already taken by a newer message
+		}
+
+		message.seq = header.seq;
+		message.length = header.length;
+		message.received = 0;
+		message.fragments.reset();
+		message.ready = false;
+	}
+
+	if (message.ready || message.fragments[header.fragment] || message.length != header.length) {
+		return;
+	}
+
+	memcpy(message.data.get() + offset, m_packet->data + sizeof(header), size);
+	message.fragments.set(header.fragment);
+
+	if (++message.received == UDPHeader::Fragments(message.length)) {
+		message.ready = true;
+		m_cv.notify_all();
+	}
+}
+
+UDPReceive::Message* UDPReceive::NextMessage()
+{
+	Message* next = &m_messages[m_nextSeq % Slots];
+
+	if (next->ready && next->seq == m_nextSeq) {
+		return next;
+	}
+
+	// Lockstep messages say nothing about which slot they fill, so handing out the next one
+	// in place of a lost one would shift every slot after it for good. Keep waiting instead;
+	// if it never turns up the link times out and is reported as broken.
+	if (!m_dropLate) {
+		return nullptr;
+	}
+
+	// Late drop: once a newer message is complete, whatever is still missing before it
+	// has been lost on the way and waiting for it would only stall the link.
+	Message* oldest = nullptr;
+
+	for (auto& message : m_messages) {
+		if (message.ready && message.seq > m_nextSeq && (!oldest || message.seq < oldest->seq)) {
+			oldest = &message;
+		}
+	}
+
+	if (oldest) {
+		DPRINTF("Dropped %u lost messages\n", oldest->seq - m_nextSeq);
+		m_nextSeq = oldest->seq;
+	}
+
+	return oldest;
+}
+
+UDPReceive::Message* UDPReceive::WaitForMessage(std::unique_lock<std::mutex>& lock, int timeoutMS)
+{
+	auto start = std::chrono::steady_clock::now();
+	Message* message;
+
+	while (!(message = NextMessage())) {
+
+		auto now = std::chrono::steady_clock::now();
+
+		if (!m_connected || !m_running || m_interrupted || timeoutMS == 0) {
+			return nullptr;
+		}
+
+		if (now - m_lastPacket >= LINK_TIMEOUT) {
+			ErrorLog("Lost the link to the previous machine.");
+			m_connected = false;
+			return nullptr;
+		}
+
+		if (timeoutMS > 0 && now - start >= std::chrono::milliseconds(timeoutMS)) {
+			return nullptr;
+		}
+
+		m_cv.wait_for(lock, timeoutMS > 0 ? std::min<std::chrono::milliseconds>(std::chrono::milliseconds(timeoutMS), 100ms) : 100ms);
+	}
+
+	return message;
+}
+
+void UDPReceive::Release(Message* message)
+{
+	message->ready = false;
+	m_nextSeq = message->seq + 1;
+}
+
+bool UDPReceive::CheckDataAvailable(int timeoutMS)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	return WaitForMessage(lock, timeoutMS) != nullptr;
+}
+
+std::vector<char>& UDPReceive::Receive()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	Message* message = WaitForMessage(lock, -1);
+
+	if (!message) {
+		DPRINTF("Can't receive because not connected.\n");
+		m_recBuffer.clear();
+		return m_recBuffer;
+	}
+
+	m_recBuffer.assign(message->data.get(), message->data.get() + message->length);
+	Release(message);
+
+	DPRINTF("Received %zu bytes\n", m_recBuffer.size());
+
+	return m_recBuffer;
+}
+
+int UDPReceive::Receive(void* buffer, int maxLength)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	Message* message = WaitForMessage(lock, -1);
+
+	if (!message) {
+		DPRINTF("Can't receive because not connected.\n");
+		return -1;
+	}
+
+	// copied straight out of the reassembly buffer into the destination
+	int result = -1;
+
+	if (message->length <= (uint32_t)maxLength) {
+		memcpy(buffer, message->data.get(), message->length);
+		result = (int)message->length;
+	}
+
+	Release(message);
+
+	DPRINTF("Received %i bytes\n", result);
+
+	return result;
+}
+
+bool UDPReceive::Connected()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_connected;
+}
+
+void UDPReceive::Interrupt(bool interrupt)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_interrupted = interrupt;
+	}
+
+	m_cv.notify_all();
+}
@@ -0,0 +1,92 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#ifndef _UDPRECEIVE_H_
+#define _UDPRECEIVE_H_
+
+#include <thread>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "SDLIncludes.h"
+#include "INetTransport.h"
+#include "UDPLink.h"
+
+class UDPReceive : public INetReceive
+{
+public:
+	UDPReceive(int port, bool dropLate = false);
+	~UDPReceive();
+
+	bool CheckDataAvailable(int timeoutMS = 0);		// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
+	std::vector<char>& Receive();
+	int Receive(void* buffer, int maxLength);
+	bool Connected();
+	void Interrupt(bool interrupt);
+
+private:
+
+	// A message being reassembled, or a complete one waiting to be received. Slots are
+	// picked by sequence number, so a newer message can only replace an older one.
+	struct Message
+	{
+		uint32_t seq = 0;
+		uint32_t length = 0;
+		int received = 0;
+		std::bitset<UDPHeader::MaxFragments> fragments;
+		bool ready = false;
+		std::unique_ptr<char[]> data;
+	};
+
+	static const int Slots = 4;
+
+	void ReceiveFunc();
+	void HandlePacket();
+	Message* NextMessage();
+	Message* WaitForMessage(std::unique_lock<std::mutex>& lock, int timeoutMS);
+	void Release(Message* message);
+
+	UDPsocket m_socket;
+	SDLNet_SocketSet m_socketSet;
+	UDPpacket* m_packet;		// only used by the receive thread
+	std::thread m_receiveThread;
+	std::atomic_bool m_running;
+	std::atomic_bool m_interrupted;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	Message m_messages[Slots];
+	uint32_t m_nextSeq;			// next message to hand out, anything older is dropped
+	bool m_dropLate;			// skip over lost messages instead of waiting for them
+	bool m_connected;
+	std::chrono::steady_clock::time_point m_lastPacket;
+
+	std::vector<char> m_recBuffer;
+};
+
+#endif
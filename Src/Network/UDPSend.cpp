@@ -0,0 +1,176 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "UDPSend.h"
+#include "UDPLink.h"
+#include "OSD/Logger.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(_DEBUG)
+#include <stdio.h>
+#define DPRINTF DebugLog
+#else
+#define DPRINTF(a, ...)
+#endif
+
+static const int CONNECT_TIMEOUT_MS = 100;		// how long to wait for the receiver to answer a hello
+
+UDPSend::UDPSend(std::string& ip, int port) :
+	m_ip(ip),
+	m_port(port),
+	m_socket(nullptr),
+	m_socketSet(nullptr),
+	m_packet(nullptr),
+	m_seq(0),
+	m_connected(false)
+{
+	SDLNet_Init();
+
+	m_socket = SDLNet_UDP_Open(0);
+	m_packet = SDLNet_AllocPacket(UDPHeader::MaxDatagram);
+	m_socketSet = SDLNet_AllocSocketSet(1);
+
+	if (m_socket && m_socketSet) {
+		SDLNet_UDP_AddSocket(m_socketSet, m_socket);
+	}
+}
+
+UDPSend::~UDPSend()
+{
+	if (m_socketSet) {
+		SDLNet_FreeSocketSet(m_socketSet);
+		m_socketSet = nullptr;
+	}
+
+	if (m_socket) {
+		SDLNet_UDP_Close(m_socket);
+		m_socket = nullptr;
+	}
+
+	if (m_packet) {
+		SDLNet_FreePacket(m_packet);
+		m_packet = nullptr;
+	}
+
+	SDLNet_Quit();	// unload lib (winsock dll for windows)
+}
+
+bool UDPSend::SendPacket(uint16_t type, uint16_t fragment, uint32_t length, const void* data, int size)
+{
+	UDPHeader header;
+	header.magic	= UDPHeader::Magic;
+	header.seq		= m_seq;
+	header.length	= length;
+	header.fragment	= fragment;
+	header.type		= type;
+
+	memcpy(m_packet->data, &header, sizeof(header));
+	if (size) {
+		memcpy(m_packet->data + sizeof(header), data, size);
+	}
+
+	m_packet->len = int(sizeof(header)) + size;
+	m_packet->address = m_address;
+
+	return SDLNet_UDP_Send(m_socket, -1, m_packet) != 0;
+}
+
+bool UDPSend::Send(const void* data, int length)
+{
+	if (!Connected()) {
+		DPRINTF("Not connected\n");
+		return false;
+	}
+
+	if (length > UDPHeader::MaxMessage) {
+		ErrorLog("Net message of %i bytes is too big for the UDP transport.", length);
+		return false;
+	}
+
+	DPRINTF("Sending %i bytes\n", length);
+
+	m_seq++;
+
+	const char* src = (const char*)data;
+	int fragments = UDPHeader::Fragments(length);
+
+	for (int copy = 0; copy < UDPHeader::Redundancy; copy++) {
+		for (int i = 0; i < fragments; i++) {
+			int offset = i * UDPHeader::Payload;
+			int size = std::min(length - offset, UDPHeader::Payload);
+			if (!SendPacket(UDPHeader::Data, uint16_t(i), uint32_t(length), src + offset, size)) {
+				DPRINTF("Failed to send datagram\n");
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool UDPSend::Connected()
+{
+	return m_connected;
+}
+
+bool UDPSend::Connect()
+{
+	if (!m_socket || !m_socketSet || !m_packet) {
+		return false;
+	}
+
+	if (SDLNet_ResolveHost(&m_address, m_ip.c_str(), m_port) != 0) {
+		return false;
+	}
+
+	// a hello starts a new session, so sequence numbers start again from the beginning
+	m_seq = 0;
+	m_connected = false;
+
+	if (!SendPacket(UDPHeader::Hello, 0, 0, nullptr, 0)) {
+		return false;
+	}
+
+	// wait for the receiver to answer, ignoring anything left over from an earlier attempt
+	while (SDLNet_CheckSockets(m_socketSet, CONNECT_TIMEOUT_MS) > 0) {
+		while (SDLNet_UDP_Recv(m_socket, m_packet) > 0) {
+
+			UDPHeader header;
+
+			if (m_packet->len >= (int)sizeof(header)) {
+				memcpy(&header, m_packet->data, sizeof(header));
+				if (header.magic == UDPHeader::Magic && header.type == UDPHeader::Ack) {
+					m_connected = true;
+				}
+			}
+		}
+
+		if (m_connected) {
+			return true;
+		}
+	}
+
+	return false;
+}
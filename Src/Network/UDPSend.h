@@ -0,0 +1,55 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#ifndef _UDPSEND_H_
+#define _UDPSEND_H_
+
+#include <string>
+#include "SDLIncludes.h"
+#include "INetTransport.h"
+
+class UDPSend : public INetSend
+{
+public:
+	UDPSend(std::string& ip, int port);
+	~UDPSend();
+
+	bool Send(const void* data, int length);
+	bool Connect();
+	bool Connected();
+private:
+
+	bool SendPacket(uint16_t type, uint16_t fragment, uint32_t length, const void* data, int size);
+
+	std::string			m_ip;
+	int					m_port;
+	IPaddress			m_address;
+	UDPsocket			m_socket;		// sdl socket, bound to any free port so the receiver can reply
+	SDLNet_SocketSet	m_socketSet;
+	UDPpacket*			m_packet;		// allocated once, reused for every datagram
+	uint32_t			m_seq;
+	bool				m_connected;
+};
+
+#endif
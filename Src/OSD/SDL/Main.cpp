@@ -892,6 +892,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   // Initialize and load ROMs
   if (OKAY != Model3->Init())
     return 1;
+  uint32_t vromKey = rom_set->get_rom("vrom").key;   // lets the New3D mesh cache be checked without reading VROM
   if (Model3->LoadGame(game, *rom_set))
     return 1;
   *rom_set = ROMSet();  // free up this memory we won't need anymore
@@ -945,7 +946,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
   // Initialize the renderers
   CRender2D *Render2D = new CRender2D(s_runtime_config);
-  IRender3D *Render3D = s_runtime_config["New3DEngine"].ValueAs<bool>() ? ((IRender3D *) new New3D::CNew3D(s_runtime_config, Model3->GetGame().name)) : ((IRender3D *) new Legacy3D::CLegacy3D(s_runtime_config));
+  IRender3D *Render3D = s_runtime_config["New3DEngine"].ValueAs<bool>() ? ((IRender3D *) new New3D::CNew3D(s_runtime_config, Model3->GetGame().name, vromKey)) : ((IRender3D *) new Legacy3D::CLegacy3D(s_runtime_config));
   if (OKAY != Render2D->Init(xOffset, yOffset, xRes, yRes, totalXRes, totalYRes))
     goto QuitError;
   if (OKAY != Render3D->Init(xOffset, yOffset, xRes, yRes, totalXRes, totalYRes))
@@ -1091,7 +1092,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
       // Recreate renderers and attach to the emulator
       Render2D = new CRender2D(s_runtime_config);
-      Render3D = s_runtime_config["New3DEngine"].ValueAs<bool>() ? ((IRender3D *) new New3D::CNew3D(s_runtime_config, Model3->GetGame().name)) : ((IRender3D *) new Legacy3D::CLegacy3D(s_runtime_config));
+      Render3D = s_runtime_config["New3DEngine"].ValueAs<bool>() ? ((IRender3D *) new New3D::CNew3D(s_runtime_config, Model3->GetGame().name, vromKey)) : ((IRender3D *) new Legacy3D::CLegacy3D(s_runtime_config));
       if (OKAY != Render2D->Init(xOffset, yOffset, xRes, yRes, totalXRes, totalYRes))
         goto QuitError;
       if (OKAY != Render3D->Init(xOffset, yOffset, xRes, yRes, totalXRes, totalYRes))
@@ -1414,7 +1415,12 @@ static Util::Config::Node DefaultConfig()
   // CModel3
   config.Set("MultiThreaded", true);
   config.Set("GPUMultiThreaded", true);
+  config.Set("GPUSyncThreads", "2");
+  config.Set("GPUDoubleBuffer", false);
+  config.Set("ROMCache", false);
   config.Set("PowerPCFrequency", "50");
+  config.Set("PowerPCCore", "interpreter");
+  config.Set("IdleSkip", false);
   // 2D and 3D graphics engines
   config.Set("MultiTexture", false);
   config.Set("VertexShader", "");
@@ -1441,12 +1447,17 @@ static Util::Config::Node DefaultConfig()
   // Platform-specific/UI
   config.Set("New3DEngine", true);
   config.Set("QuadRendering", false);
+  config.Set("MeshCache", false);
+  config.Set("New3DThreads", "0");
+  config.Set("New3DBatching", false);
+  config.Set("GPUTextures", false);
   config.Set("XResolution", "496");
   config.Set("YResolution", "384");
   config.Set("FullScreen", false);
   config.Set("WideScreen", false);
   config.Set("Stretch", false);
   config.Set("WideBackground", false);
+  config.Set("GPUTilemaps", false);
   config.Set("VSync", true);
   config.Set("Throttle", true);
   config.Set("RefreshRate", 60.0f);
@@ -1479,6 +1490,8 @@ static Util::Config::Node DefaultConfig()
   config.Set("PortIn", unsigned(1970));
   config.Set("PortOut", unsigned(1971));
   config.Set("AddressOut", "127.0.0.1");
+  config.Set("NetPipeline", false);
+  config.Set("NetTransport", "tcp");
 #endif
 #else
   config.Set("InputSystem", "sdl");
@@ -1516,9 +1529,17 @@ static void Help(void)
   puts("");
   puts("Core Options:");
   printf("  -ppc-frequency=<freq>   PowerPC frequency in MHz [Default: %d]\n", defaultConfig["PowerPCFrequency"].ValueAs<unsigned>());
+  printf("  -ppc-core=<core>        PowerPC core: interpreter, cached or dynarec [Default: %s]\n", defaultConfig["PowerPCCore"].ValueAs<std::string>().c_str());
+  puts("  -idle-skip              Fast-forward through PowerPC idle polling loops");
+  puts("  -no-idle-skip           Only skip idle loops in games known to work [Default]");
   puts("  -no-threads             Disable multi-threading entirely");
   puts("  -gpu-multi-threaded     Run graphics rendering in separate thread [Default]");
   puts("  -no-gpu-thread          Run graphics rendering in main thread");
+  printf("  -gpu-sync-threads=<n>   Extra threads for copying GPU memory to renderer [Default: %d]\n", defaultConfig["GPUSyncThreads"].ValueAs<unsigned>());
+  puts("  -gpu-double-buffer      Swap GPU memory with renderer instead of copying it");
+  puts("  -no-gpu-double-buffer   Copy modified GPU memory to renderer [Default]");
+  puts("  -rom-cache              Keep loaded ROM regions on disk and map them at startup");
+  puts("  -no-rom-cache           Load ROMs from the zip file every run [Default]");
   puts("  -load-state=<file>      Load save state after starting");
   puts("");
   puts("Video Options:");
@@ -1528,6 +1549,8 @@ static void Help(void)
   puts("  -wide-screen            Expand 3D field of view to screen width");
   puts("  -wide-bg                When wide-screen mode is enabled, also expand the 2D");
   puts("                          background layer to screen width");
+  puts("  -gpu-tilemaps           Draw 2D layers with a shader (requires OpenGL 3.0)");
+  puts("  -no-gpu-tilemaps        Draw 2D layers on the CPU [Default]");
   puts("  -stretch                Fit viewport to resolution, ignoring aspect ratio");
   puts("  -no-throttle            Disable frame rate lock");
   puts("  -vsync                  Lock to vertical refresh rate [Default]");
@@ -1538,6 +1561,15 @@ static void Help(void)
   puts("                          0=none [Default], 1=P1 only, 2=P2 only, 3=P1 & P2");
   puts("  -new3d                  New 3D engine by Ian Curtis [Default]");
   puts("  -quad-rendering         Enable proper quad rendering");
+  puts("  -mesh-cache             Keep built 3D models on disk between runs (new engine)");
+  puts("  -no-mesh-cache          Build 3D models from scratch every run [Default]");
+  printf("  -new3d-threads=<n>      Extra threads for building 3D models [Default: %d]\n", defaultConfig["New3DThreads"].ValueAs<unsigned>());
+  puts("  -new3d-batching         Submit 3D meshes in batches (new engine, requires");
+  puts("                          OpenGL 4.3)");
+  puts("  -no-new3d-batching      Submit 3D meshes one at a time [Default]");
+  puts("  -gpu-textures           Decode 3D textures on the graphics card (new engine,");
+  puts("                          requires OpenGL 3.2)");
+  puts("  -no-gpu-textures        Decode 3D textures on the CPU [Default]");
   puts("  -legacy3d               Legacy 3D engine (faster but less accurate)");
   puts("  -multi-texture          Use 8 texture maps for decoding (legacy engine)");
   puts("  -no-multi-texture       Decode to single texture (legacy engine) [Default]");
@@ -1567,6 +1599,12 @@ static void Help(void)
   puts("  -net                    Enable net board");
   puts("  -simulate-netboard      Simulate the net board [Default]");
   puts("  -emulate-netboard       Emulate the net board (requires -no-threads)");
+  puts("  -net-pipeline           Forward link data on a separate thread without");
+  puts("                          waiting for it every frame (simulated net board)");
+  puts("  -no-net-pipeline        Exchange link data in lockstep every frame [Default]");
+  puts("  -net-transport=<t>      Link transport: tcp [Default], udp, or shm for");
+  puts("                          instances on the same host (ports name the shared");
+  puts("                          memory)");
   puts("");
 #endif
   puts("Input Options:");
@@ -1620,7 +1658,13 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-game-xml-file",         "GameXMLFile"             },
     { "-load-state",            "InitStateFile"           },
     { "-ppc-frequency",         "PowerPCFrequency"        },
+    { "-ppc-core",              "PowerPCCore"             },
+    { "-gpu-sync-threads",      "GPUSyncThreads"          },
     { "-crosshairs",            "Crosshairs"              },
+    { "-new3d-threads",         "New3DThreads"            },
+#ifdef NET_BOARD
+    { "-net-transport",         "NetTransport"            },
+#endif
     { "-vert-shader",           "VertexShader"            },
     { "-frag-shader",           "FragmentShader"          },
     { "-vert-shader-fog",       "VertexShaderFog"         },
@@ -1639,10 +1683,16 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
   };
   const std::map<std::string, std::pair<std::string, bool>> bool_options
   { // -option
+    { "-idle-skip",           { "IdleSkip",         true } },
+    { "-no-idle-skip",        { "IdleSkip",         false } },
     { "-threads",             { "MultiThreaded",    true } },
     { "-no-threads",          { "MultiThreaded",    false } },
     { "-gpu-multi-threaded",  { "GPUMultiThreaded", true } },
     { "-no-gpu-thread",       { "GPUMultiThreaded", false } },
+    { "-gpu-double-buffer",   { "GPUDoubleBuffer",  true } },
+    { "-no-gpu-double-buffer", { "GPUDoubleBuffer", false } },
+    { "-rom-cache",           { "ROMCache",         true } },
+    { "-no-rom-cache",        { "ROMCache",         false } },
     { "-window",              { "FullScreen",       false } },
     { "-fullscreen",          { "FullScreen",       true } },
     { "-no-wide-screen",      { "WideScreen",       false } },
@@ -1651,6 +1701,8 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-no-stretch",          { "Stretch",          false } },
     { "-wide-bg",             { "WideBackground",   true } },
     { "-no-wide-bg",          { "WideBackground",   false } },
+    { "-gpu-tilemaps",        { "GPUTilemaps",      true } },
+    { "-no-gpu-tilemaps",     { "GPUTilemaps",      false } },
     { "-no-multi-texture",    { "MultiTexture",     false } },
     { "-multi-texture",       { "MultiTexture",     true } },
     { "-throttle",            { "Throttle",         true } },
@@ -1661,6 +1713,12 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-no-fps",              { "ShowFrameRate",    false } },
     { "-new3d",               { "New3DEngine",      true } },
     { "-quad-rendering",      { "QuadRendering",    true } },
+    { "-mesh-cache",          { "MeshCache",        true } },
+    { "-no-mesh-cache",       { "MeshCache",        false } },
+    { "-new3d-batching",      { "New3DBatching",    true } },
+    { "-no-new3d-batching",   { "New3DBatching",    false } },
+    { "-gpu-textures",        { "GPUTextures",      true } },
+    { "-no-gpu-textures",     { "GPUTextures",      false } },
     { "-legacy3d",            { "New3DEngine",      false } },
     { "-no-flip-stereo",      { "FlipStereo",       false } },
     { "-flip-stereo",         { "FlipStereo",       true } },
@@ -1675,6 +1733,8 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-no-net",              { "Network",       false } },
     { "-simulate-netboard",   { "SimulateNet",   true } },
     { "-emulate-netboard",    { "SimulateNet",   false } },
+    { "-net-pipeline",        { "NetPipeline",   true } },
+    { "-no-net-pipeline",     { "NetPipeline",   false } },
 #endif
     { "-no-force-feedback",   { "ForceFeedback",    false } },
     { "-force-feedback",      { "ForceFeedback",    true } },
@@ -1871,6 +1931,8 @@ int main(int argc, char **argv)
         PrintGameList(xml_file, loader.GetGames());
         return 0;
       }
+      if (config3["ROMCache"].ValueAs<bool>())
+        loader.EnableROMCache("ROMCache");
       if (loader.Load(&game, &rom_set, *cmd_line.rom_files.begin()))
         return 1;
       Util::Config::MergeINISections(&config4, config3, fileConfig[game.name]);   // apply game-specific config
@@ -0,0 +1,154 @@
+#include "ROMCache.h"
+#include "OSD/Logger.h"
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint32_t ROM_CACHE_MAGIC   = 0x43524D53; // 'SMRC'
+static const uint32_t ROM_CACHE_VERSION = 1;
+
+// Region data starts one page into the file so that the mapping is aligned
+static const size_t ROM_CACHE_HEADER_SIZE = 4096;
+
+struct ROMCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t key;
+  uint32_t reserved;
+  uint64_t size;
+};
+
+static bool IsValidHeader(const ROMCacheHeader &header, uint32_t key, size_t size)
+{
+  return header.magic == ROM_CACHE_MAGIC && header.version == ROM_CACHE_VERSION && header.key == key && header.size == size;
+}
+
+// Maps an entire file read-only, returning its base address or nullptr
+static uint8_t *MapFile(const std::string &path, size_t *length)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return nullptr;
+  LARGE_INTEGER file_size;
+  void *base = nullptr;
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+  {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL)
+    {
+      base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping); // view keeps the mapping alive
+    }
+    *length = size_t(file_size.QuadPart);
+  }
+  CloseHandle(file);
+  return (uint8_t *) base;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    base = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    *length = size_t(st.st_size);
+  }
+  close(fd);  // mapping stays valid
+  return base == MAP_FAILED ? nullptr : (uint8_t *) base;
+#endif
+}
+
+static void UnmapFile(uint8_t *base, size_t length)
+{
+#ifdef _WIN32
+  (void) length;
+  UnmapViewOfFile(base);
+#else
+  munmap(base, length);
+#endif
+}
+
+std::string ROMCache::GetPath(const std::string &game_name, const std::string &region_name) const
+{
+  return m_directory + "/" + game_name + "." + region_name + ".bin";
+}
+
+bool ROMCache::Map(ROM *rom, const std::string &game_name, const std::string &region_name, uint32_t key, size_t size) const
+{
+  std::string path = GetPath(game_name, region_name);
+  size_t length = 0;
+  uint8_t *base = MapFile(path, &length);
+  if (!base)
+    return false;   // nothing cached yet
+
+  ROMCacheHeader header;
+  bool valid = length == ROM_CACHE_HEADER_SIZE + size;
+  if (valid)
+  {
+    memcpy(&header, base, sizeof(header));
+    valid = IsValidHeader(header, key, size);
+  }
+  if (!valid)
+  {
+    InfoLog("ROM cache '%s' does not match this ROM set and will be rebuilt.", path.c_str());
+    UnmapFile(base, length);
+    return false;
+  }
+
+  // Share ownership of the whole mapping but point at the region data
+  std::shared_ptr<uint8_t> mapping(base, [length](uint8_t *p) { UnmapFile(p, length); });
+  rom->data = std::shared_ptr<uint8_t>(mapping, base + ROM_CACHE_HEADER_SIZE);
+  rom->size = size;
+  return true;
+}
+
+void ROMCache::Save(const ROM &rom, const std::string &game_name, const std::string &region_name, uint32_t key) const
+{
+  // Written under a temporary name so other instances never map a partial file
+  std::string path = GetPath(game_name, region_name);
+  std::string temp_path = path + ".tmp";
+  FILE *fp = fopen(temp_path.c_str(), "wb");
+  if (!fp)
+  {
+    ErrorLog("Unable to write ROM cache to '%s'.", path.c_str());
+    return;
+  }
+
+  uint8_t header_page[ROM_CACHE_HEADER_SIZE] = {};
+  ROMCacheHeader header;
+  header.magic = ROM_CACHE_MAGIC;
+  header.version = ROM_CACHE_VERSION;
+  header.key = key;
+  header.reserved = 0;
+  header.size = rom.size;
+  memcpy(header_page, &header, sizeof(header));
+
+  bool ok = fwrite(header_page, sizeof(header_page), 1, fp) == 1;
+  ok = ok && fwrite(rom.data.get(), 1, rom.size, fp) == rom.size;
+  ok = (fclose(fp) == 0) && ok;
+  if (ok)
+  {
+    remove(path.c_str()); // rename() does not replace existing files on Windows
+    ok = rename(temp_path.c_str(), path.c_str()) == 0;
+  }
+  if (!ok)
+  {
+    remove(temp_path.c_str());
+    ErrorLog("Unable to write ROM cache to '%s'.", path.c_str());
+  }
+}
+
+ROMCache::ROMCache(const std::string &directory)
+  : m_directory(directory)
+{
+}
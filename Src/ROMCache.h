@@ -0,0 +1,36 @@
+#ifndef INCLUDED_ROMCACHE_H
+#define INCLUDED_ROMCACHE_H
+
+#include "ROMSet.h"
+#include <cstdint>
+#include <string>
+
+/*
+ * Cache of loaded ROM regions on disk. Each region is stored exactly as
+ * GameLoader builds it (interleaved and byte swapped, patches not applied) in
+ * its own file, and is memory mapped read-only when the game is next run.
+ * Mapped regions are shared between all processes running the same game and
+ * are only paged in as they are used.
+ *
+ * The key identifies the region's layout and the CRCs of the files it is
+ * built from; a cached region with a different key is ignored and rebuilt.
+ */
+class ROMCache
+{
+public:
+  ROMCache(const std::string &directory);
+
+  // Maps a cached region into rom, returning false if it is not cached or
+  // is stale. The mapped data must not be written to.
+  bool Map(ROM *rom, const std::string &game_name, const std::string &region_name, uint32_t key, size_t size) const;
+
+  // Writes a region to the cache, replacing any previous copy
+  void Save(const ROM &rom, const std::string &game_name, const std::string &region_name, uint32_t key) const;
+
+private:
+  std::string GetPath(const std::string &game_name, const std::string &region_name) const;
+
+  std::string m_directory;
+};
+
+#endif  // INCLUDED_ROMCACHE_H
@@ -26,6 +26,7 @@ struct ROM
   std::shared_ptr<uint8_t> data;
   std::vector<BigEndianPatch> patches;
   size_t size = 0;
+  uint32_t key = 0;   // identifies the contents without reading them: region layout, file CRCs and patches
   
   void CopyTo(uint8_t *dest, size_t dest_size, bool apply_patches = true) const;
 };
@@ -0,0 +1,247 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * NetLinkTest.cpp
+ *
+ * Loopback test of the pipelined net board link. Built and run by the
+ * 'net-link-test' make target.
+ *
+ * A machine linked to itself, then a ring of several, each a CSimNetBoard on
+ * its own thread connected over 127.0.0.1, go through the link handshake and
+ * run frames with NetPipeline enabled. Every machine puts its index and frame
+ * number in its segment. The segments each machine gets back must be in the
+ * slot given by their hop count, never go back to an older frame, and all
+ * reach the last frame once the machines stop changing them. Finally the
+ * boards are destroyed while their I/O threads are still running.
+ *
+ * Usage: net-link-test [transport [port]]
+ */
+
+#include "Network/SimNetBoard.h"
+#include "Util/NewConfig.h"
+#include "Supermodel.h"
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/******************************************************************************
+ Logging
+******************************************************************************/
+
+void DebugLog(const char *fmt, ...)
+{
+}
+
+void InfoLog(const char *fmt, ...)
+{
+}
+
+bool ErrorLog(const char *fmt, ...)
+{
+	va_list vl;
+	va_start(vl, fmt);
+	vprintf(fmt, vl);
+	va_end(vl);
+	printf("\n");
+	return FAIL;
+}
+
+
+/******************************************************************************
+ Test Machine
+******************************************************************************/
+
+#define SEGMENT_SIZE	0x40
+#define NUM_FRAMES		300
+#define MAX_WAIT_FRAMES	5000	// for the handshake, and for the last frame to get around
+
+static std::string			transport = "tcp";
+static unsigned				basePort = 15370;
+static std::atomic<int>		failures;
+static std::atomic<int>		finished;		// machines that have seen every segment reach the last frame
+
+static void Fail(const char *fmt, ...)
+{
+	if (failures++ < 10)
+	{
+		va_list vl;
+		va_start(vl, fmt);
+		vprintf(fmt, vl);
+		va_end(vl);
+		printf("\n");
+	}
+}
+
+static void NextFrame(CSimNetBoard &board)
+{
+	board.RunFrame();
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+/*
+ * Runs one machine of a ring of numMachines. Machine 0 is the master, the
+ * others are slaves. Returns once every machine has finished.
+ */
+static void RunMachine(int index, int numMachines)
+{
+	Util::Config::Node config("Global");
+	config.Set("Network", true);
+	config.Set("NetPipeline", true);
+	config.Set("NetTransport", transport);
+	config.Set("PortIn", basePort + index);
+	config.Set("PortOut", basePort + (index + 1) % numMachines);
+	config.Set("AddressOut", std::string("127.0.0.1"));
+
+	Game game;
+	game.name = "daytona2";
+	game.netboard_present = true;
+
+	std::vector<uint8_t> ram(0x10000), buffer(0x20000);
+	*(uint16_t *) &ram[0x400] = index == 0 ? 0 : 1;	// master or slave
+	*(uint16_t *) &ram[0x402] = 0x800;
+	*(uint16_t *) &ram[0x404] = SEGMENT_SIZE;
+
+	CSimNetBoard board(config);
+	board.GetGame(game);
+	board.Init(ram.data(), buffer.data());
+
+	// the main board's side of the initialization
+	board.WriteIORegister(0xc0, 1);
+	board.RunFrame();
+	board.WriteIORegister(0x88, 0xf000);
+	board.RunFrame();
+
+	int wait = 0;
+	while (board.ReadIORegister(0x8a) == 0)
+	{
+		if (++wait > MAX_WAIT_FRAMES)
+		{
+			Fail("machine %d: link handshake didn't finish", index);
+			finished++;
+			return;
+		}
+		NextFrame(board);
+	}
+
+	std::vector<int> lastFrame(numMachines, 0);
+	bool done = false;
+
+	for (int frame = 1; !done || finished < numMachines; frame++)
+	{
+		if (frame > NUM_FRAMES + MAX_WAIT_FRAMES)
+		{
+			Fail("machine %d: the last frame didn't get around the ring", index);
+			finished++;
+			break;
+		}
+
+		// what the game would write into its segment, unchanged after the last frame
+		int value = frame < NUM_FRAMES ? frame : NUM_FRAMES;
+		board.WriteCommRAM8(0x100 + 0, uint8_t(index + 1));
+		board.WriteCommRAM8(0x100 + 1, uint8_t(value));
+		board.WriteCommRAM8(0x100 + 2, uint8_t(value >> 8));
+
+		NextFrame(board);
+
+		if (board.ReadIORegister(0x8a) == 0x40)
+		{
+			Fail("machine %d: link broken at frame %d", index, frame);
+			finished++;
+			break;
+		}
+
+		// the segment in slot n has made n hops to get here, the last one is our own
+		bool complete = true;
+		for (int slot = 1; slot <= numMachines; slot++)
+		{
+			unsigned addr = 0x100 + slot * SEGMENT_SIZE;
+			int source = board.ReadCommRAM8(addr + 0);
+			int sourceFrame = board.ReadCommRAM8(addr + 1) | (board.ReadCommRAM8(addr + 2) << 8);
+
+			if (source == 0)	// nothing published yet
+			{
+				complete = false;
+				continue;
+			}
+
+			int expected = (index - slot + numMachines) % numMachines;
+			if (source != expected + 1)
+				Fail("machine %d: slot %d has the segment of machine %d, expected %d", index, slot, source - 1, expected);
+			if (sourceFrame < lastFrame[slot - 1])
+				Fail("machine %d: slot %d went back from frame %d to %d", index, slot, lastFrame[slot - 1], sourceFrame);
+
+			lastFrame[slot - 1] = sourceFrame;
+			complete = complete && sourceFrame == NUM_FRAMES;
+		}
+
+		if (complete && !done)
+		{
+			done = true;
+			finished++;
+		}
+	}
+
+	// the board is destroyed with its I/O thread running, possibly after the next machine has gone
+}
+
+static bool RunRing(int numMachines)
+{
+	int before = failures;
+	finished = 0;
+
+	std::vector<std::thread> machines;
+	for (int i = 0; i < numMachines; i++)
+		machines.emplace_back(RunMachine, i, numMachines);
+	for (auto &machine: machines)
+		machine.join();
+
+	bool ok = failures == before;
+	printf("%d machine%s over %s: %s\n", numMachines, numMachines == 1 ? " linked to itself" : "s", transport.c_str(), ok ? "ok" : "FAILED");
+	basePort += numMachines;
+	return ok;
+}
+
+
+/******************************************************************************
+ Main Program
+******************************************************************************/
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		transport = argv[1];
+	if (argc > 2)
+		basePort = atoi(argv[2]);
+
+	bool ok = RunRing(1);
+	ok = RunRing(2) && ok;
+	ok = RunRing(4) && ok;
+
+	return !ok;
+}
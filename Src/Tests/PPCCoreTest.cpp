@@ -0,0 +1,431 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PPCCoreTest.cpp
+ *
+ * Differential test of the PowerPC execution cores. Built and run by the
+ * 'ppc-core-test' make target.
+ *
+ * Randomly generated programs (integer arithmetic, loads and stores, loops,
+ * conditional branches, self-modifying stores and decrementer interrupts) are
+ * run for a number of frames, each made of time slices of random length. At
+ * the end of every frame, a few instructions and data words are rewritten
+ * through the bus the way DMA does. Registers, cycle counts and RAM must match
+ * the interpreter after every frame.
+ *
+ * Usage: ppc-core-test [seeds [frames]]
+ */
+
+#include "CPU/PowerPC/ppc.h"
+#include "CPU/Bus.h"
+#include "Supermodel.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+/******************************************************************************
+ Logging
+******************************************************************************/
+
+void DebugLog(const char *fmt, ...)
+{
+}
+
+void InfoLog(const char *fmt, ...)
+{
+}
+
+bool ErrorLog(const char *fmt, ...)
+{
+	va_list vl;
+	va_start(vl, fmt);
+	vprintf(fmt, vl);
+	va_end(vl);
+	printf("\n");
+	return FAIL;
+}
+
+
+/******************************************************************************
+ Test Machine
+******************************************************************************/
+
+#define RAM_SIZE	0x800000
+#define CODE_BASE	0x2000		// generated program
+#define DATA_BASE	0x100000	// loads and stores (r31)
+#define DATA_SIZE	0x4000
+#define CHECK_SIZE	(DATA_BASE + DATA_SIZE)	// RAM compared after each frame
+
+static UINT8 *ram;
+
+/*
+ * RAM only. Writes that get here rather than going through the page table
+ * invalidate code like CModel3 does for DMA.
+ */
+class CTestBus: public IBus
+{
+public:
+	UINT8 Read8(UINT32 addr) { return addr < RAM_SIZE ? ram[addr^3] : 0xFF; }
+	UINT16 Read16(UINT32 addr) { return addr < RAM_SIZE ? *(UINT16 *) &ram[addr^2] : 0xFFFF; }
+	UINT32 Read32(UINT32 addr) { return addr < RAM_SIZE ? *(UINT32 *) &ram[addr] : 0xFFFFFFFF; }
+	UINT64 Read64(UINT32 addr) { return ((UINT64) Read32(addr) << 32) | Read32(addr + 4); }
+
+	void Write8(UINT32 addr, UINT8 data)
+	{
+		if (addr < RAM_SIZE)
+		{
+			ram[addr^3] = data;
+			ppc_invalidate_code(addr, 1);
+		}
+	}
+
+	void Write16(UINT32 addr, UINT16 data)
+	{
+		if (addr < RAM_SIZE)
+		{
+			*(UINT16 *) &ram[addr^2] = data;
+			ppc_invalidate_code(addr, 2);
+		}
+	}
+
+	void Write32(UINT32 addr, UINT32 data)
+	{
+		if (addr < RAM_SIZE)
+		{
+			*(UINT32 *) &ram[addr] = data;
+			ppc_invalidate_code(addr, 4);
+		}
+	}
+
+	void Write64(UINT32 addr, UINT64 data)
+	{
+		Write32(addr + 0, (UINT32) (data >> 32));
+		Write32(addr + 4, (UINT32) data);
+	}
+};
+
+static CTestBus				Bus;
+static PPC_FETCH_REGION		FetchRegions[3];
+static PPC_PAGE_TABLE		PageTable;
+
+
+/******************************************************************************
+ Program Generator
+******************************************************************************/
+
+static std::vector<UINT32>	Program;
+static std::mt19937			Rand;
+
+static int R(int n) { return Rand() % n; }
+static int Dst(void) { return 1 + R(20); }	// r1-r20 are scratch, r21 and up are reserved
+static int Src(void) { return R(21); }
+
+static UINT32 D(int op, int rt, int ra, int imm) { return (op << 26) | (rt << 21) | (ra << 16) | (imm & 0xFFFF); }
+static UINT32 X(int rt, int ra, int rb, int xo, int rc = 0) { return (31 << 26) | (rt << 21) | (ra << 16) | (rb << 11) | (xo << 1) | rc; }
+static UINT32 M(int op, int rs, int ra, int sh, int mb, int me, int rc) { return (op << 26) | (rs << 21) | (ra << 16) | (sh << 11) | (mb << 6) | (me << 1) | rc; }
+static UINT32 SPR(int rt, int spr, int xo) { return (31 << 26) | (rt << 21) | ((spr & 0x1F) << 16) | ((spr >> 5) << 11) | (xo << 1); }
+static UINT32 BC(int bo, int bi, int disp) { return (16 << 26) | (bo << 21) | (bi << 16) | (disp & 0xFFFC); }
+static UINT32 B(int disp) { return (18 << 26) | (disp & 0x3FFFFFC); }
+
+static void GenerateInstruction(void)
+{
+	static const int xoArith[] = { 266, 40, 235, 10, 138, 8, 136 };	// add, subf, mullw, addc, adde, subfc, subfe
+	static const int xoLogic[] = { 28, 444, 316, 24, 536, 792, 60, 476, 124 };	// and, or, xor, slw, srw, sraw, andc, nand, nor
+
+	switch (R(24))
+	{
+	case 0:		Program.push_back(D(14, Dst(), Src(), R(65536))); break;	// addi
+	case 1:		Program.push_back(D(15, Dst(), Src(), R(65536))); break;	// addis
+	case 2:		Program.push_back(D(24 + R(4), Src(), Dst(), R(65536))); break;	// ori, oris, xori, xoris
+	case 3:		Program.push_back(M(21, Src(), Dst(), R(32), R(32), R(32), R(2))); break;	// rlwinm
+	case 4:		Program.push_back(M(20, Src(), Dst(), R(32), R(32), R(32), R(2))); break;	// rlwimi
+	case 5:		Program.push_back(X(Dst(), Src(), Src(), xoArith[R(7)], R(2))); break;
+	case 6:		Program.push_back(X(Src(), Dst(), Src(), xoLogic[R(9)], R(2))); break;
+	case 7:		Program.push_back(X(Src(), Dst(), R(32), 824, R(2))); break;	// srawi
+	case 8:		Program.push_back(X(Src(), Dst(), 0, R(2) ? 26 : 954, R(2))); break;	// cntlzw, extsb
+	case 9:		Program.push_back(D(11, R(8) << 2, Src(), R(65536))); break;	// cmpi
+	case 10:	Program.push_back(D(10, R(8) << 2, Src(), R(65536))); break;	// cmpli
+	case 11:	Program.push_back(X(R(8) << 2, Src(), Src(), R(2) ? 0 : 32)); break;	// cmp, cmpl
+	case 12:	Program.push_back(D(32, Dst(), 31, R(DATA_SIZE / 4) * 4)); break;	// lwz
+	case 13:	Program.push_back(D(34, Dst(), 31, R(DATA_SIZE))); break;	// lbz
+	case 14:	Program.push_back(D(40, Dst(), 31, R(DATA_SIZE / 2) * 2)); break;	// lhz
+	case 15:	Program.push_back(D(36, Src(), 31, R(DATA_SIZE / 4) * 4)); break;	// stw
+	case 16:	Program.push_back(D(38, Src(), 31, R(DATA_SIZE))); break;	// stb
+	case 17:	Program.push_back(D(44, Src(), 31, R(DATA_SIZE / 2) * 2)); break;	// sth
+	case 18:	Program.push_back(SPR(Dst(), 268, 371)); break;	// mftb
+	case 19:	Program.push_back(X(Dst(), 0, 0, 19)); break;	// mfcr
+	case 20:	Program.push_back((31 << 26) | (Src() << 21) | (R(256) << 12) | (144 << 1)); break;	// mtcrf
+	case 21:	Program.push_back(D(12 + R(2), Dst(), Src(), R(65536))); break;	// addic, addic.
+	case 22:	Program.push_back(D(7, Dst(), Src(), R(65536))); break;	// mulli
+	case 23:	Program.push_back(SPR(Dst(), 22, 339)); break;	// mfdec
+	}
+}
+
+/*
+ * Loop of random blocks. r31 points to the data area, r29 is the decrementer
+ * reload value, r30 counts decrementer interrupts and r22-r26 are used by the
+ * self-modifying blocks.
+ */
+static void GenerateProgram(unsigned seed)
+{
+	Rand.seed(seed);
+	Program.clear();
+
+	Program.push_back(D(15, 31, 0, DATA_BASE >> 16));	// lis r31,data
+	Program.push_back(D(14, 29, 0, 300 + R(3000)));		// li r29,reload
+	Program.push_back(SPR(29, 22, 467));				// mtdec r29
+	Program.push_back(D(14, 28, 0, 0));					// li r28,0
+	Program.push_back(D(24, 28, 28, 0x8000));			// ori r28,r28,0x8000 (EE)
+	Program.push_back((31 << 26) | (28 << 21) | (146 << 1));	// mtmsr r28
+	Program.push_back(D(14, 22, 0, 0));					// li r22,0
+
+	size_t loopTop = Program.size();
+	for (int block = 0; block < 40; block++)
+	{
+		switch (R(6))
+		{
+		case 0:	// counted loop
+		{
+			int n = 1 + R(10);
+			Program.push_back(D(14, 27, 0, 1 + R(20)));	// li r27,count
+			Program.push_back(SPR(27, 9, 467));			// mtctr r27
+			for (int i = 0; i < n; i++)
+				GenerateInstruction();
+			Program.push_back(BC(16, 0, -4 * n));		// bdnz
+			break;
+		}
+		case 1:	// forward conditional branch
+		{
+			int n = 1 + R(6);
+			Program.push_back(D(11, 0, Src(), R(65536)));	// cmpi
+			Program.push_back(BC(R(2) ? 12 : 4, R(3), 4 * (n + 1)));
+			for (int i = 0; i < n; i++)
+				GenerateInstruction();
+			break;
+		}
+		case 2:	// self-modifying: patch an "addi r26,r26,imm", sometimes in the same basic block
+		{
+			Program.push_back(D(14, 24, 24, 1));			// addi r24,r24,1
+			Program.push_back(M(21, 24, 23, 0, 16, 31, 0));	// clrlwi r23,r24,16
+			Program.push_back(D(25, 23, 23, 0x3B5A));		// oris r23,r23,0x3B5A (addi r26,r26,0)
+			size_t store = Program.size();
+			Program.push_back(0);
+			if (R(2))
+				Program.push_back(B(4));					// b next
+			size_t target = Program.size();
+			Program.push_back(D(14, 26, 26, 0));
+			Program[store] = D(36, 23, 22, CODE_BASE + target * 4);	// stw r23,target(r22)
+			break;
+		}
+		default:
+		{
+			int n = 1 + R(12);
+			for (int i = 0; i < n; i++)
+				GenerateInstruction();
+			break;
+		}
+		}
+	}
+	Program.push_back(B(-4 * (int) (Program.size() - loopTop)));
+}
+
+
+/******************************************************************************
+ Differential Run
+******************************************************************************/
+
+struct FrameState
+{
+	UINT32	gpr[32];
+	UINT8	cr[8];
+	UINT32	lr, ctr, xer, msr, pc;
+	UINT64	cycles;
+	UINT32	ramHash;
+};
+
+static bool operator==(const FrameState &a, const FrameState &b)
+{
+	return memcmp(a.gpr, b.gpr, sizeof(a.gpr)) == 0 && memcmp(a.cr, b.cr, sizeof(a.cr)) == 0 &&
+		a.lr == b.lr && a.ctr == b.ctr && a.xer == b.xer && a.msr == b.msr && a.pc == b.pc &&
+		a.cycles == b.cycles && a.ramHash == b.ramHash;
+}
+
+static UINT32 HashRAM(void)
+{
+	UINT32 h = 2166136261u;	// FNV-1a
+	for (UINT32 i = 0; i < CHECK_SIZE; i++)
+		h = (h ^ ram[i]) * 16777619u;
+	return h;
+}
+
+static FrameState Capture(void)
+{
+	FrameState s;
+	for (int i = 0; i < 32; i++)
+		s.gpr[i] = ppc_get_gpr(i);
+	for (int i = 0; i < 8; i++)
+		s.cr[i] = ppc_get_cr(i);
+	s.lr = ppc_get_lr();
+	s.ctr = ppc_read_spr(9);
+	s.xer = ppc_read_spr(1);
+	s.msr = ppc_read_msr();
+	s.pc = ppc_get_pc();
+	s.cycles = ppc_total_cycles();
+	s.ramHash = HashRAM();
+	return s;
+}
+
+static void Setup(unsigned seed, PPC_CORE core, bool usePageTable)
+{
+	memset(ram, 0, RAM_SIZE);
+	GenerateProgram(seed);
+	for (size_t i = 0; i < Program.size(); i++)
+		*(UINT32 *) &ram[CODE_BASE + i * 4] = Program[i];
+	*(UINT32 *) &ram[0x900] = D(14, 30, 30, 1);		// decrementer: addi r30,r30,1
+	*(UINT32 *) &ram[0x904] = SPR(29, 22, 467);		// mtdec r29
+	*(UINT32 *) &ram[0x908] = (19 << 26) | (50 << 1);	// rfi
+	for (UINT32 i = 0; i < DATA_SIZE; i += 4)
+		*(UINT32 *) &ram[DATA_BASE + i] = i * 2654435761u;
+
+	FetchRegions[0].start = 0;
+	FetchRegions[0].end = RAM_SIZE - 1;
+	FetchRegions[0].ptr = (UINT32 *) ram;
+	FetchRegions[1].start = 0xFFF00000;	// exception vectors (MSR[IP] is set on reset) mirror RAM
+	FetchRegions[1].end = 0xFFFFFFFF;
+	FetchRegions[1].ptr = (UINT32 *) ram;
+	FetchRegions[2].start = 0;
+	FetchRegions[2].end = 0;
+	FetchRegions[2].ptr = NULL;
+
+	memset(&PageTable, 0, sizeof(PageTable));
+	for (UINT32 i = 0; i < (RAM_SIZE >> PPC_PAGE_SHIFT); i++)
+		PageTable.read[i] = PageTable.write[i] = &ram[i << PPC_PAGE_SHIFT];
+
+	PPC_CONFIG config = { PPC_MODEL_603R, 0x25, BUS_FREQUENCY_66MHZ };
+	ppc_init(&config);
+	ppc_attach_bus(&Bus);
+	ppc_set_fetch(FetchRegions);
+	ppc_set_page_table(usePageTable ? &PageTable : NULL);
+	ppc_set_core(core);
+	ppc_reset();
+	ppc_set_pc(CODE_BASE - 4);	// one slot before the program so the first fetch is sequential
+}
+
+/*
+ * Runs a frame as slices of random length, then rewrites a few instructions
+ * and data words through the bus.
+ */
+static void RunFrame(std::mt19937 &frameRand)
+{
+	for (int slice = 0; slice < 20; slice++)
+		ppc_execute(1 + frameRand() % 5000);
+
+	for (int i = 0; i < 4; i++)
+	{
+		UINT32 addr = CODE_BASE + (frameRand() % Program.size()) * 4;
+		UINT32 op = Bus.Read32(addr);
+		UINT32 imm = frameRand() & 0x7FFF;
+		if ((op >> 26) == 14)	// addi: new immediate
+			Bus.Write32(addr, (op & 0xFFFF0000) | imm);
+		Bus.Write32(DATA_BASE + (frameRand() % (DATA_SIZE / 4)) * 4, frameRand());
+	}
+}
+
+static std::vector<FrameState> Run(unsigned seed, int numFrames, PPC_CORE core, bool usePageTable)
+{
+	std::vector<FrameState> states;
+	std::mt19937 frameRand(seed * 7919);
+	Setup(seed, core, usePageTable);
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		RunFrame(frameRand);
+		states.push_back(Capture());
+	}
+	return states;
+}
+
+static void PrintMismatch(unsigned seed, int frame, const FrameState &ref, const FrameState &s)
+{
+	printf("  seed %u frame %d: pc %08X/%08X cycles %llu/%llu ram %08X/%08X\n", seed, frame, ref.pc, s.pc,
+		(unsigned long long) ref.cycles, (unsigned long long) s.cycles, ref.ramHash, s.ramHash);
+	for (int i = 0; i < 32; i++)
+	{
+		if (ref.gpr[i] != s.gpr[i])
+			printf("    r%d %08X/%08X\n", i, ref.gpr[i], s.gpr[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned numSeeds = argc > 1 ? atoi(argv[1]) : 100;
+	int numFrames = argc > 2 ? atoi(argv[2]) : 20;
+
+	static const struct { PPC_CORE core; const char *name; } cores[] =
+	{
+		{ PPC_CORE_CACHED,	"cached" },
+		{ PPC_CORE_DYNAREC,	"dynarec" }
+	};
+
+	ram = (UINT8 *) calloc(1, RAM_SIZE);
+	Setup(1, PPC_CORE_INTERPRETER, false);
+	int failures = 0;
+
+	for (auto &c: cores)
+	{
+		if (!ppc_set_core(c.core))
+		{
+			printf("%-8s not available on this host\n", c.name);
+			continue;
+		}
+		ppc_set_core(PPC_CORE_INTERPRETER);
+
+		unsigned mismatches = 0;
+		for (unsigned seed = 1; seed <= numSeeds; seed++)
+		{
+			bool usePageTable = (seed & 1) != 0;
+			std::vector<FrameState> ref = Run(seed, numFrames, PPC_CORE_INTERPRETER, usePageTable);
+			std::vector<FrameState> test = Run(seed, numFrames, c.core, usePageTable);
+			for (int frame = 0; frame < numFrames; frame++)
+			{
+				if (!(ref[frame] == test[frame]))
+				{
+					if (mismatches < 5)
+						PrintMismatch(seed, frame, ref[frame], test[frame]);
+					mismatches++;
+					break;
+				}
+			}
+		}
+
+		printf("%-8s %u/%u programs match the interpreter over %d frames\n", c.name, numSeeds - mismatches, numSeeds, numFrames);
+		if (mismatches != 0)
+			failures++;
+	}
+
+	ppc_set_core(PPC_CORE_INTERPRETER);
+	free(ram);
+	return failures != 0;
+}
@@ -0,0 +1,117 @@
+#include "Util/WorkerPool.h"
+#include "Supermodel.h"
+#include "OSD/Thread.h"
+#include <algorithm>
+
+namespace Util
+{
+  void WorkerPool::Run(size_t numJobs, const std::function<void(size_t, unsigned)> &job)
+  {
+    m_job = &job;
+    m_numJobs = numJobs;
+    m_nextJob = 0;
+
+    // Only wake the workers if there is enough work to share
+    unsigned numWakened = 0;
+    if (numJobs > 1 && StartWorkers())
+    {
+      numWakened = (unsigned) std::min<size_t>(numJobs - 1, m_workers.size());
+      for (unsigned i = 0; i < numWakened; i++)
+        m_workSync->Post();
+    }
+
+    DoJobs(0);
+
+    for (unsigned i = 0; i < numWakened; i++)
+      m_doneSync->Wait();
+
+    m_job = nullptr;
+  }
+
+  void WorkerPool::DoJobs(unsigned slot)
+  {
+    size_t i;
+    while ((i = m_nextJob++) < m_numJobs)
+      (*m_job)(i, slot);
+  }
+
+  int WorkerPool::StartWorker(void *data)
+  {
+    WorkerPool *pool = (WorkerPool *) data;
+    return pool->RunWorker(++pool->m_workerSlots);
+  }
+
+  int WorkerPool::RunWorker(unsigned slot)
+  {
+    while (true)
+    {
+      if (!m_workSync->Wait())
+        return 1;
+      if (m_stopWorkers)
+        return 0;
+      DoJobs(slot);
+      m_doneSync->Post();
+    }
+  }
+
+  bool WorkerPool::StartWorkers()
+  {
+    if (m_startedWorkers)
+      return !m_workers.empty();
+    m_startedWorkers = true;
+    if (m_numWorkers == 0)
+      return false;
+
+    m_stopWorkers = false;
+    m_workerSlots = 0;
+    m_workSync = CThread::CreateSemaphore(0);
+    m_doneSync = CThread::CreateSemaphore(0);
+    if (m_workSync && m_doneSync)
+    {
+      for (unsigned i = 0; i < m_numWorkers; i++)
+      {
+        CThread *thread = CThread::CreateThread(m_name, StartWorker, this);
+        if (!thread)
+          break;
+        m_workers.push_back(thread);
+      }
+      if (m_workers.size() == m_numWorkers)
+        return true;
+    }
+
+    ErrorLog("Unable to create %s threads: %s\nRunning its work in the calling thread instead.\n", m_name.c_str(), CThread::GetLastError());
+    StopWorkers();
+    return false;
+  }
+
+  void WorkerPool::StopWorkers()
+  {
+    m_stopWorkers = true;
+    for (size_t i = 0; i < m_workers.size(); i++)
+      m_workSync->Post();
+    for (auto thread : m_workers)
+    {
+      thread->Wait();
+      delete thread;
+    }
+    m_workers.clear();
+
+    delete m_workSync;
+    delete m_doneSync;
+    m_workSync = nullptr;
+    m_doneSync = nullptr;
+  }
+
+  WorkerPool::WorkerPool(const std::string &name, unsigned numWorkers)
+    : m_name(name),
+      m_numWorkers(numWorkers),
+      m_workerSlots(0),
+      m_nextJob(0)
+  {
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    StopWorkers();
+  }
+} // Util
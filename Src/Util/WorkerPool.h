@@ -0,0 +1,58 @@
+#ifndef INCLUDED_UTIL_WORKERPOOL_H
+#define INCLUDED_UTIL_WORKERPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+class CThread;
+class CSemaphore;
+
+namespace Util
+{
+  /*
+   * Shares batches of independent jobs between the calling thread and a small
+   * pool of worker threads. The threads are created on first use, and if that
+   * fails every job is run in the calling thread instead.
+   */
+  class WorkerPool
+  {
+  public:
+    // Runs job(index, slot) for every index in [0, numJobs) and returns once
+    // all are done. Slot is 0 in the calling thread and 1..NumWorkers() in the
+    // workers, so jobs can keep per-thread results.
+    void Run(size_t numJobs, const std::function<void(size_t, unsigned)> &job);
+
+    unsigned NumWorkers() const
+    {
+      return m_numWorkers;
+    }
+
+    WorkerPool(const std::string &name, unsigned numWorkers);
+    ~WorkerPool();
+
+  private:
+    bool StartWorkers();
+    void StopWorkers();
+    void DoJobs(unsigned slot);
+    static int StartWorker(void *data);
+    int RunWorker(unsigned slot);
+
+    const std::string m_name;
+    const unsigned m_numWorkers;
+    bool m_startedWorkers = false;
+    bool m_stopWorkers = false;
+    std::vector<CThread *> m_workers;
+    CSemaphore *m_workSync = nullptr;   // posted once per worker to start a batch
+    CSemaphore *m_doneSync = nullptr;   // posted by each worker when the batch is done
+    std::atomic<unsigned> m_workerSlots;
+
+    const std::function<void(size_t, unsigned)> *m_job = nullptr;
+    size_t m_numJobs = 0;
+    std::atomic<size_t> m_nextJob;
+  };
+} // Util
+
+#endif  // INCLUDED_UTIL_WORKERPOOL_H